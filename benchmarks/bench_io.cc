@@ -0,0 +1,350 @@
+#include <algorithm>
+#include <arpa/inet.h>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <unistd.h>
+
+#include "application.h"
+#include "config.h"
+#include "fd_manager.h"
+#include "io_manager.h"
+#include "io_uring.h"
+#include "module/log.h"
+
+using namespace meha;
+
+// 一次回环echo测试的结果
+struct EchoResult
+{
+    double requestsPerSec = 0;
+    double syscallsPerRequest = 0;
+    double epollCtlsPerRequest = 0;
+};
+
+/**
+ * @brief 回环echo乒乓：conns 个连接，每个连接往返 rounds 次
+ * @param backend io.backend 的取值
+ * @param provided 服务端是否用provided buffer接收
+ */
+static EchoResult EchoPingPong(size_t pool_size, const std::string &backend, size_t conns, size_t rounds, bool provided = false)
+{
+    auto io_backend = Config::Lookup<std::string>("io.backend");
+    auto multi_reactor = Config::Lookup<bool>("io.multi_reactor");
+    io_backend->setValue(backend);
+    multi_reactor->setValue(true);
+
+    EchoResult result;
+    std::chrono::duration<double> elapsed{};
+    IOManager::IOStats stats;
+    {
+        IOManager iom(pool_size, false);
+        iom.start();
+        std::atomic_int port{0};
+        iom.schedule([&]() {
+            int listen_fd = ::socket(AF_INET, SOCK_STREAM, 0);
+            sockaddr_in addr{};
+            addr.sin_family = AF_INET;
+            addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+            socklen_t len = sizeof(addr);
+            ::bind(listen_fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr));
+            ::listen(listen_fd, static_cast<int>(conns));
+            ::getsockname(listen_fd, reinterpret_cast<sockaddr *>(&addr), &len);
+            port = ntohs(addr.sin_port);
+            for (size_t i = 0; i < conns; i++) {
+                int fd = ::accept(listen_fd, nullptr, nullptr);
+                if (fd < 0) {
+                    break;
+                }
+                iom.schedule([&iom, fd, provided]() {
+                    char buf[64];
+                    while (true) {
+                        if (provided) {
+                            IOManager::ProvidedBuffer buffer;
+                            ssize_t n = iom.recvProvided(fd, buffer);
+                            if (n <= 0 || ::send(fd, buffer.data(), n, 0) != n) {
+                                break;
+                            }
+                        } else {
+                            ssize_t n = ::recv(fd, buf, sizeof(buf), 0);
+                            if (n <= 0 || ::send(fd, buf, n, 0) != n) {
+                                break;
+                            }
+                        }
+                    }
+                    ::close(fd);
+                });
+            }
+            ::close(listen_fd);
+        });
+        while (port == 0) {
+            ::usleep(1000);
+        }
+
+        const auto before = iom.getIOStats();
+        auto begin = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < conns; i++) {
+            iom.schedule([&, rounds]() {
+                int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+                sockaddr_in addr{};
+                addr.sin_family = AF_INET;
+                addr.sin_port = htons(port);
+                addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+                if (::connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) == 0) {
+                    const char msg[] = "ping";
+                    char buf[64];
+                    for (size_t r = 0; r < rounds; r++) {
+                        if (::send(fd, msg, sizeof(msg), 0) != sizeof(msg) || ::recv(fd, buf, sizeof(buf), 0) <= 0) {
+                            break;
+                        }
+                    }
+                }
+                ::close(fd);
+            });
+        }
+        iom.stop();
+        elapsed = std::chrono::steady_clock::now() - begin;
+        stats = iom.getIOStats();
+        stats.epollWaits -= before.epollWaits;
+        stats.epollCtls -= before.epollCtls;
+        stats.wakeups -= before.wakeups;
+        stats.ioCalls -= before.ioCalls;
+        stats.uringEnters -= before.uringEnters;
+    }
+    io_backend->setValue("auto");
+    multi_reactor->setValue(false);
+
+    const double requests = static_cast<double>(conns * rounds);
+    result.requestsPerSec = requests / elapsed.count();
+    result.syscallsPerRequest = stats.syscalls() / requests;
+    result.epollCtlsPerRequest = stats.epollCtls / requests;
+    return result;
+}
+
+// 对比epoll与io_uring后端在回环echo上的吞吐以及每个请求的系统调用次数
+static void BenchBackend(size_t pool_size, size_t conns, size_t rounds)
+{
+    auto epoll = EchoPingPong(pool_size, "epoll", conns, rounds);
+    LOG_FMT_INFO(root, "[backend/epoll] threads=%lu conns=%lu: %.0f req/s, %.2f syscalls/req (epoll_ctl %.3f/req)", pool_size, conns, epoll.requestsPerSec, epoll.syscallsPerRequest, epoll.epollCtlsPerRequest);
+    if (!IOUring::IsSupported()) {
+        LOG_INFO(root, "[backend/io_uring] 内核不支持io_uring，跳过");
+        return;
+    }
+    auto uring = EchoPingPong(pool_size, "io_uring", conns, rounds);
+    LOG_FMT_INFO(root, "[backend/io_uring] threads=%lu conns=%lu: %.0f req/s, %.2f syscalls/req", pool_size, conns, uring.requestsPerSec, uring.syscallsPerRequest);
+    auto provided = EchoPingPong(pool_size, "io_uring", conns, rounds, true);
+    LOG_FMT_INFO(root, "[backend/io_uring+provided] threads=%lu conns=%lu: %.0f req/s, %.2f syscalls/req", pool_size, conns, provided.requestsPerSec, provided.syscallsPerRequest);
+}
+
+/**
+ * @brief 从外部线程陆续调度 n 个空任务（每 burst 个一组，组间稍作停顿让工作线程回到epoll_wait）
+ * @param[out] elapsed_ms 从开始调度到全部执行完的耗时
+ * @return 每个任务平均的唤醒系统调用次数
+ */
+static double WakeupsPerTask(size_t pool_size, bool multi_reactor, size_t n, size_t burst, double &elapsed_ms)
+{
+    auto multi_reactor_config = Config::Lookup<bool>("io.multi_reactor");
+    multi_reactor_config->setValue(multi_reactor);
+    IOManager::IOStats before, after;
+    {
+        IOManager iom(pool_size, false);
+        iom.start();
+        ::usleep(10 * 1000);
+        before = iom.getIOStats();
+        std::atomic_size_t done{0};
+        auto begin = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < n; i++) {
+            iom.schedule([&done]() { ++done; });
+            if ((i + 1) % burst == 0) {
+                ::usleep(100);
+            }
+        }
+        while (done < n) {
+            ::usleep(100);
+        }
+        elapsed_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+        after = iom.getIOStats();
+        iom.stop();
+    }
+    multi_reactor_config->setValue(false);
+    return static_cast<double>(after.wakeups - before.wakeups) / n;
+}
+
+// 调度任务时唤醒空闲工作线程的开销
+static void BenchWakeups(size_t pool_size, size_t n)
+{
+    for (size_t burst : {1, 16}) {
+        double single_ms = 0, multi_ms = 0;
+        double single = WakeupsPerTask(pool_size, false, n, burst, single_ms);
+        double multi = WakeupsPerTask(pool_size, true, n, burst, multi_ms);
+        LOG_FMT_INFO(root, "[wakeup] threads=%lu tasks=%lu burst=%lu: 单reactor %.2f wakeups/task (%.0f ms), 多reactor %.2f wakeups/task (%.0f ms)", pool_size, n, burst, single, single_ms, multi, multi_ms);
+    }
+}
+
+/**
+ * @brief 单连接回环echo乒乓，逐次测量往返延迟
+ * @param busy_poll_us 忙轮询时间，0表示空闲时直接阻塞在epoll_wait上
+ * @return 排好序的往返延迟（us）
+ */
+static std::vector<double> PingPongLatency(size_t pool_size, uint64_t busy_poll_us, size_t rounds)
+{
+    auto io_backend = Config::Lookup<std::string>("io.backend");
+    auto multi_reactor = Config::Lookup<bool>("io.multi_reactor");
+    io_backend->setValue("epoll");
+    multi_reactor->setValue(true);
+
+    std::vector<double> latencies;
+    latencies.reserve(rounds);
+    {
+        IOManager iom(pool_size, false);
+        IOManager::BusyPollOptions options;
+        options.budgetUs = busy_poll_us;
+        options.socketBusyPollUs = busy_poll_us > 0 ? 50 : 0;
+        options.preferBusyPoll = busy_poll_us > 0;
+        iom.setBusyPoll(options);
+        iom.start();
+        std::atomic_int port{0};
+        iom.schedule([&]() {
+            int listen_fd = ::socket(AF_INET, SOCK_STREAM, 0);
+            sockaddr_in addr{};
+            addr.sin_family = AF_INET;
+            addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+            socklen_t len = sizeof(addr);
+            ::bind(listen_fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr));
+            ::listen(listen_fd, 1);
+            ::getsockname(listen_fd, reinterpret_cast<sockaddr *>(&addr), &len);
+            port = ntohs(addr.sin_port);
+            int fd = ::accept(listen_fd, nullptr, nullptr);
+            ::close(listen_fd);
+            char buf[64];
+            while (fd >= 0) {
+                ssize_t n = ::recv(fd, buf, sizeof(buf), 0);
+                if (n <= 0 || ::send(fd, buf, n, 0) != n) {
+                    break;
+                }
+            }
+            ::close(fd);
+        });
+        while (port == 0) {
+            ::usleep(1000);
+        }
+        iom.schedule([&]() {
+            int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+            sockaddr_in addr{};
+            addr.sin_family = AF_INET;
+            addr.sin_port = htons(port);
+            addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+            if (::connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) == 0) {
+                const char msg[] = "ping";
+                char buf[64];
+                for (size_t r = 0; r < rounds; r++) {
+                    auto begin = std::chrono::steady_clock::now();
+                    if (::send(fd, msg, sizeof(msg), 0) != sizeof(msg) || ::recv(fd, buf, sizeof(buf), 0) <= 0) {
+                        break;
+                    }
+                    latencies.push_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - begin).count());
+                }
+            }
+            ::close(fd);
+        });
+        iom.stop();
+    }
+    io_backend->setValue("auto");
+    multi_reactor->setValue(false);
+    std::sort(latencies.begin(), latencies.end());
+    return latencies;
+}
+
+// 对比空闲时阻塞在epoll_wait上与忙轮询两种模式下的往返延迟分布
+static void BenchBusyPoll(size_t pool_size, size_t rounds)
+{
+    auto percentile = [](const std::vector<double> &sorted, double p) {
+        return sorted.empty() ? 0.0 : sorted[std::min(sorted.size() - 1, static_cast<size_t>(p * sorted.size()))];
+    };
+    for (uint64_t busy_poll_us : {0, 200}) {
+        auto latencies = PingPongLatency(pool_size, busy_poll_us, rounds);
+        LOG_FMT_INFO(root, "[latency/%s] threads=%lu rounds=%lu: p50 %.1fus, p99 %.1fus, p999 %.1fus", busy_poll_us > 0 ? "busy_poll" : "blocking", pool_size, latencies.size(),
+                     percentile(latencies, 0.5), percentile(latencies, 0.99), percentile(latencies, 0.999));
+    }
+}
+
+/**
+ * @brief 大量空闲连接上带读超时的recv：conns 个连接上从不来数据，每个连接的协程循环recv，超时后立即再recv
+ * @details 各连接错开开始，读超时均匀地分布在每一毫秒上
+ * @param slack_us 定时器默认的宽限
+ * @param[out] timeouts_per_sec 每秒超时的次数
+ * @return 每秒epoll_wait的次数
+ */
+static double IdleTimeoutWakeups(size_t conns, uint64_t timeout_ms, uint64_t slack_us, double &timeouts_per_sec)
+{
+    auto io_backend = Config::Lookup<std::string>("io.backend");
+    io_backend->setValue("epoll");
+    const double seconds = 2;
+    double wakeups = 0;
+    {
+        IOManager iom(1, false);
+        iom.setTimerSlack(std::chrono::microseconds(slack_us));
+        iom.start();
+        std::vector<int> peers;
+        std::atomic_uint64_t timeouts{0};
+        for (size_t i = 0; i < conns; i++) {
+            int pair[2];
+            ::socketpair(AF_UNIX, SOCK_STREAM, 0, pair);
+            FileDescriptorManager::Instance()->fetch(pair[0], false);
+            peers.push_back(pair[1]);
+            iom.schedule([fd = pair[0], delay = i * timeout_ms * 1000 / conns, timeout_ms, &timeouts]() {
+                ::usleep(delay);
+                timeval tv{static_cast<time_t>(timeout_ms / 1000), static_cast<suseconds_t>(timeout_ms % 1000 * 1000)};
+                ::setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+                char c;
+                // 对端关闭后recv返回0
+                while (::recv(fd, &c, 1, 0) == -1 && errno == ETIMEDOUT) {
+                    ++timeouts;
+                }
+                ::close(fd);
+            });
+        }
+        // 等所有连接都进入稳定的超时循环
+        ::usleep(timeout_ms * 2 * 1000);
+        const auto before = iom.getIOStats();
+        const uint64_t timeouts_before = timeouts;
+        ::usleep(static_cast<useconds_t>(seconds * 1000 * 1000));
+        wakeups = (iom.getIOStats().epollWaits - before.epollWaits) / seconds;
+        timeouts_per_sec = (timeouts - timeouts_before) / seconds;
+        for (int peer : peers) {
+            ::close(peer);
+        }
+        iom.stop();
+    }
+    io_backend->setValue("auto");
+    return wakeups;
+}
+
+// 定时器按宽限合并前后，空闲长连接的读超时引起的reactor唤醒次数
+static void BenchTimerSlack(size_t conns, uint64_t timeout_ms)
+{
+    for (uint64_t slack_us : {0, 1000, 10000}) {
+        double timeouts = 0;
+        const double wakeups = IdleTimeoutWakeups(conns, timeout_ms, slack_us, timeouts);
+        LOG_FMT_INFO(root, "[timer_slack] conns=%lu timeout=%lums slack=%luus: %.0f epoll_wait/s, %.0f timeouts/s, %.1f timeouts/wakeup", conns, timeout_ms, slack_us, wakeups, timeouts, timeouts / wakeups);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    Application app;
+    return app.boot(BootArgs{
+        .argc = argc,
+        .argv = argv,
+        .configFile = "/home/will/Workspace/Devs/projects/server-framework/benchmarks/bench_config.yml",
+        .mainFunc = [](int, char **) -> int {
+            BenchBackend(1, 16, 2000);
+            BenchBackend(2, 64, 500);
+            BenchWakeups(4, 20000);
+            BenchBusyPoll(1, 20000);
+            BenchBusyPoll(2, 20000);
+            BenchTimerSlack(1000, 1000);
+            return 0;
+        }});
+}
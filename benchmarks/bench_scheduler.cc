@@ -0,0 +1,216 @@
+#include <algorithm>
+#include <chrono>
+#include <ctime>
+#include <unistd.h>
+#include <vector>
+
+#include "application.h"
+#include "config.h"
+#include "module/log.h"
+#include "scheduler.h"
+
+using namespace meha;
+
+// 调度 n 个空任务并等待全部执行完，返回每秒执行的任务数
+static double ScheduleEmptyTasks(size_t pool_size, size_t n, Scheduler::TaskKind kind = Scheduler::Coroutine, Scheduler::Strategy strategy = Scheduler::WorkStealing)
+{
+    auto begin = std::chrono::steady_clock::now();
+    {
+        Scheduler sc(pool_size, true, strategy);
+        sc.start();
+        for (size_t i = 0; i < n; i++) {
+            sc.schedule([]() {}, kind);
+        }
+        sc.stop();
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - begin;
+    return n / elapsed.count();
+}
+
+// 对比开启/关闭调度器的协程缓存时，可调用对象任务的吞吐
+static void BenchFiberCache(size_t pool_size, size_t n)
+{
+    auto fiber_cache = Config::Lookup<uint64_t>("scheduler.fiber_cache");
+    const uint64_t cache_size = fiber_cache->getValue();
+    fiber_cache->setValue(0);
+    double without_cache = ScheduleEmptyTasks(pool_size, n);
+    fiber_cache->setValue(cache_size);
+    double with_cache = ScheduleEmptyTasks(pool_size, n);
+    LOG_FMT_INFO(root, "[fiber_cache] threads=%lu tasks=%lu: 不缓存 %.0f tasks/s, 缓存(%lu) %.0f tasks/s", pool_size, n, without_cache, cache_size, with_cache);
+}
+
+// 对比协程任务与内联任务的吞吐
+static void BenchInlineTask(size_t pool_size, size_t n)
+{
+    double coroutine = ScheduleEmptyTasks(pool_size, n, Scheduler::Coroutine);
+    double inlined = ScheduleEmptyTasks(pool_size, n, Scheduler::Inline);
+    LOG_FMT_INFO(root, "[inline_task] threads=%lu tasks=%lu: 协程任务 %.0f tasks/s, 内联任务 %.0f tasks/s", pool_size, n, coroutine, inlined);
+}
+
+// 由 roots 个根任务各自派生 n / roots 个子任务，返回每秒执行的任务数（子任务由工作线程提交）
+static double ScheduleFanOutTasks(size_t pool_size, size_t n, Scheduler::Strategy strategy)
+{
+    constexpr size_t roots = 64;
+    auto begin = std::chrono::steady_clock::now();
+    {
+        Scheduler sc(pool_size, true, strategy);
+        sc.start();
+        for (size_t i = 0; i < roots; i++) {
+            sc.schedule([&sc, n]() {
+                for (size_t j = 0; j < n / roots; j++) {
+                    sc.schedule([]() {});
+                }
+            });
+        }
+        sc.stop();
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - begin;
+    return n / elapsed.count();
+}
+
+// 对比不同调度策略在不同工作线程数量下的吞吐
+static void BenchStrategy(size_t pool_size, size_t n)
+{
+    double fcfs = ScheduleEmptyTasks(pool_size, n, Scheduler::Coroutine, Scheduler::FCFS);
+    double stealing = ScheduleEmptyTasks(pool_size, n, Scheduler::Coroutine, Scheduler::WorkStealing);
+    LOG_FMT_INFO(root, "[strategy/external] threads=%lu tasks=%lu: FCFS %.0f tasks/s, WorkStealing %.0f tasks/s", pool_size, n, fcfs, stealing);
+    fcfs = ScheduleFanOutTasks(pool_size, n, Scheduler::FCFS);
+    stealing = ScheduleFanOutTasks(pool_size, n, Scheduler::WorkStealing);
+    LOG_FMT_INFO(root, "[strategy/fan_out] threads=%lu tasks=%lu: FCFS %.0f tasks/s, WorkStealing %.0f tasks/s", pool_size, n, fcfs, stealing);
+}
+
+// 在后台任务的压力下每隔1ms提交一个前台任务，返回前台任务从提交到开始执行的p99延迟（us）
+static double ForegroundLatencyP99(size_t pool_size, size_t background, size_t foreground, Scheduler::Strategy strategy)
+{
+    using Clock = std::chrono::steady_clock;
+    std::vector<int64_t> latencies(foreground);
+    {
+        Scheduler sc(pool_size, true, strategy);
+        sc.start();
+        const uint32_t lowest = static_cast<uint32_t>(std::max<size_t>(sc.priorityLevels(), 1) - 1);
+        // 后台任务：每个占用CPU约20us
+        for (size_t i = 0; i < background; i++) {
+            sc.schedule(
+                []() {
+                    auto until = Clock::now() + std::chrono::microseconds(20);
+                    while (Clock::now() < until)
+                        ;
+                },
+                Scheduler::Priority{lowest});
+        }
+        for (size_t i = 0; i < foreground; i++) {
+            auto submit = Clock::now();
+            sc.schedule(
+                [&latencies, i, submit]() {
+                    latencies[i] = std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - submit).count();
+                },
+                Scheduler::Priority{0});
+            ::usleep(1000);
+        }
+        sc.stop();
+    }
+    std::sort(latencies.begin(), latencies.end());
+    return latencies[latencies.size() * 99 / 100];
+}
+
+// 对比FCFS与PSA下前台任务的尾延迟
+static void BenchPriority(size_t pool_size, size_t background, size_t foreground)
+{
+    double fcfs = ForegroundLatencyP99(pool_size, background, foreground, Scheduler::FCFS);
+    double psa = ForegroundLatencyP99(pool_size, background, foreground, Scheduler::PSA);
+    LOG_FMT_INFO(root, "[priority] threads=%lu background=%lu foreground=%lu: 前台任务p99延迟 FCFS %.0f us, PSA %.0f us", pool_size, background, foreground, fcfs, psa);
+}
+
+// 外部线程以每批 batch_size 个任务提交 n 个空任务，batch_size 为0时逐个提交，返回每秒执行的任务数，submit_ns 返回提交每个任务的平均耗时
+static double ScheduleTaskBatches(size_t pool_size, size_t n, size_t batch_size, double &submit_ns)
+{
+    auto begin = std::chrono::steady_clock::now();
+    {
+        Scheduler sc(pool_size, false);
+        sc.start();
+        auto submit_begin = std::chrono::steady_clock::now();
+        if (batch_size == 0) {
+            for (size_t i = 0; i < n; i++) {
+                sc.schedule([]() {});
+            }
+        } else {
+            for (size_t i = 0; i < n; i += batch_size) {
+                Scheduler::TaskBatch batch;
+                for (size_t j = 0; j < batch_size; j++) {
+                    batch.add([]() {});
+                }
+                sc.schedule(std::move(batch));
+            }
+        }
+        std::chrono::duration<double, std::nano> submit = std::chrono::steady_clock::now() - submit_begin;
+        submit_ns = submit.count() / n;
+        sc.stop();
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - begin;
+    return n / elapsed.count();
+}
+
+// 对比逐个提交与批量提交的吞吐
+static void BenchTaskBatch(size_t pool_size, size_t n)
+{
+    double single_ns = 0, batched_ns = 0;
+    double single = ScheduleTaskBatches(pool_size, n, 0, single_ns);
+    double batched = ScheduleTaskBatches(pool_size, n, 10000, batched_ns);
+    LOG_FMT_INFO(root, "[task_batch] threads=%lu tasks=%lu: 逐个提交 %.0f tasks/s (提交 %.0f ns/task), 每批10000个 %.0f tasks/s (提交 %.0f ns/task)", pool_size, n, single, single_ns, batched, batched_ns);
+}
+
+// 进程消耗的CPU时间（ms）
+static double ProcessCPUTime()
+{
+    timespec ts;
+    ::clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+// 调度器空闲一段时间，统计这段时间消耗的CPU；再每隔1ms提交一个任务，统计任务从提交到开始执行的延迟
+static void BenchIdleWorkers(size_t pool_size, size_t tasks)
+{
+    using Clock = std::chrono::steady_clock;
+    std::vector<int64_t> latencies(tasks);
+    double idle_cpu = 0;
+    {
+        Scheduler sc(pool_size, false);
+        sc.start();
+        ::usleep(100 * 1000); // 等待工作线程都进入空闲状态
+        double begin = ProcessCPUTime();
+        ::usleep(1000 * 1000);
+        idle_cpu = ProcessCPUTime() - begin;
+        for (size_t i = 0; i < tasks; i++) {
+            auto submit = Clock::now();
+            sc.schedule([&latencies, i, submit]() {
+                latencies[i] = std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - submit).count();
+            });
+            ::usleep(1000);
+        }
+        sc.stop();
+    }
+    std::sort(latencies.begin(), latencies.end());
+    LOG_FMT_INFO(root, "[idle] threads=%lu: 空闲1s消耗CPU %.1f ms, 任务延迟 p50 %ld us, p99 %ld us", pool_size, idle_cpu, latencies[tasks / 2], latencies[tasks * 99 / 100]);
+}
+
+int main(int argc, char *argv[])
+{
+    Application app;
+    return app.boot(BootArgs{
+        .argc = argc,
+        .argv = argv,
+        .configFile = "/home/will/Workspace/Devs/projects/server-framework/benchmarks/bench_config.yml",
+        .mainFunc = [](int, char **) -> int {
+            BenchFiberCache(1, 200000);
+            BenchFiberCache(4, 200000);
+            BenchInlineTask(1, 200000);
+            BenchInlineTask(4, 200000);
+            for (size_t threads : {1, 2, 4, 8}) {
+                BenchStrategy(threads, 200000);
+            }
+            BenchPriority(4, 20000, 200);
+            BenchIdleWorkers(4, 500);
+            BenchTaskBatch(4, 200000);
+            return 0;
+        }});
+}
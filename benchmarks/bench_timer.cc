@@ -0,0 +1,189 @@
+#include <chrono>
+#include <random>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "application.h"
+#include "module/log.h"
+#include "timer.h"
+#include "utils/clock.h"
+
+using namespace meha;
+
+// 只测量定时器本身的开销，不需要唤醒任何人
+class BenchTimerManager : public TimerManager
+{
+public:
+    explicit BenchTimerManager(size_t queues = 1)
+        : TimerManager(queues)
+    {
+    }
+
+    // 当前线程使用的定时器队列，-1表示共享队列
+    static thread_local int s_queue;
+
+protected:
+    void onTimerInsertedAtFront(size_t) override {}
+    size_t currentTimerQueue() const override
+    {
+        return s_queue < 0 ? sharedTimerQueue() : s_queue;
+    }
+};
+
+thread_local int BenchTimerManager::s_queue = -1;
+
+// 每次操作的平均耗时（ns）
+template<typename Func>
+static double NanosPerOp(size_t n, Func &&func)
+{
+    auto begin = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < n; i++) {
+        func(i);
+    }
+    std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - begin;
+    return elapsed.count() / n;
+}
+
+/**
+ * @brief 在 active 个活跃定时器（100~200s后到期，测量期间不会到期）的背景下测量定时器的各种操作
+ * @details 添加+取消模拟带超时的hook IO：每次IO添加一个超时定时器，IO完成后取消
+ */
+static void BenchTimerChurn(size_t active, size_t ops)
+{
+    BenchTimerManager manager;
+    std::mt19937_64 rng(42);
+    auto random_delay = [&rng]() {
+        return std::chrono::seconds(100 + rng() % 100);
+    };
+    std::vector<Timer::sptr> timers;
+    timers.reserve(active);
+    const double add = NanosPerOp(active, [&](size_t) {
+        timers.push_back(manager.addTimer(random_delay(), []() {}));
+    });
+    const double churn = NanosPerOp(ops, [&](size_t) {
+        manager.addTimer(5000, []() {})->cancel();
+    });
+    // 同样的添加+取消，用调用者分配的一次性超时（hook IO现在的做法）
+    Timeout timeout([](void *) {}, nullptr);
+    const double timeout_churn = NanosPerOp(ops, [&](size_t) {
+        manager.addTimeout(timeout, std::chrono::milliseconds(5));
+        manager.cancelTimeout(timeout);
+    });
+    const double reset = NanosPerOp(ops, [&](size_t) {
+        timers[rng() % active]->reset(random_delay(), true);
+    });
+    // 一批同时到期的定时器
+    for (size_t i = 0; i < ops; i++) {
+        manager.addTimer(std::chrono::microseconds(500), []() {});
+    }
+    ::usleep(2000);
+    std::vector<Timer::TimeOutFunc> fns;
+    const double expire = NanosPerOp(1, [&](size_t) {
+        manager.listExpiredCallback(fns);
+    }) / ops;
+    const double cancel = NanosPerOp(active, [&](size_t i) {
+        timers[i]->cancel();
+    });
+    LOG_FMT_INFO(root, "[timer] active=%lu: 添加 %.0f ns/op, 添加+取消 %.0f ns/op（一次性超时 %.0f ns/op）, 重设 %.0f ns/op, 批量到期 %.0f ns/timer（%lu个）, 取消 %.0f ns/op",
+                 active, add, churn, timeout_churn, reset, expire, fns.size(), cancel);
+}
+
+/**
+ * @brief threads 个线程同时添加+取消定时器（模拟各工作线程上带超时的hook IO）
+ * @param per_thread 每个线程使用自己的定时器队列，否则都使用同一个共享队列
+ */
+static double ThreadedChurn(size_t threads, size_t ops, bool per_thread)
+{
+    BenchTimerManager manager(per_thread ? threads + 1 : 1);
+    std::vector<std::thread> workers;
+    auto begin = std::chrono::steady_clock::now();
+    for (size_t t = 0; t < threads; t++) {
+        workers.emplace_back([&manager, ops, per_thread, t]() {
+            BenchTimerManager::s_queue = per_thread ? static_cast<int>(t) : -1;
+            for (size_t i = 0; i < ops; i++) {
+                manager.addTimer(5000, []() {})->cancel();
+            }
+        });
+    }
+    for (auto &worker : workers) {
+        worker.join();
+    }
+    std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - begin;
+    return elapsed.count() / (threads * ops);
+}
+
+static void BenchTimerThreads(size_t threads, size_t ops)
+{
+    const double shared = ThreadedChurn(threads, ops, false);
+    const double per_thread = ThreadedChurn(threads, ops, true);
+    LOG_FMT_INFO(root, "[timer] threads=%lu 添加+取消: 共享队列 %.0f ns/op, 每线程队列 %.0f ns/op", threads, shared, per_thread);
+}
+
+/**
+ * @brief 对比读取精确时间与读取缓存的时间，以及它们在定时器、日志热路径上的开销
+ * @details 缓存时间的一方模拟IO工作线程：每轮事件循环刷新一次，一轮处理 batch 次操作
+ */
+static void BenchClock(size_t ops, size_t batch)
+{
+    const double precise = NanosPerOp(ops, [](size_t) {
+        volatile auto now = utils::PreciseMonotonicUS().count();
+        (void)now;
+    });
+    const double system = NanosPerOp(ops, [](size_t) {
+        volatile auto now = utils::PreciseSystemTime().time_since_epoch().count();
+        (void)now;
+    });
+    utils::StartCoarseClock();
+    const double coarse = NanosPerOp(ops, [batch](size_t i) {
+        if (i % batch == 0) {
+            utils::RefreshCoarseClock();
+        }
+        volatile auto now = utils::CoarseMonotonicUS().count();
+        (void)now;
+    });
+    utils::StopCoarseClock();
+    LOG_FMT_INFO(root, "[clock] 精确单调时间 %.1f ns/op, 精确系统时间 %.1f ns/op, 缓存的时间（每%lu次刷新一次）%.1f ns/op", precise, system, batch, coarse);
+
+    // 定时器：添加+取消，以及日志消息的创建（不输出）
+    auto churn = [ops, batch](bool cached) {
+        BenchTimerManager manager;
+        double timer = 0, log = 0;
+        if (cached) {
+            utils::StartCoarseClock();
+        }
+        timer = NanosPerOp(ops, [&](size_t i) {
+            if (i % batch == 0) {
+                utils::RefreshCoarseClock();
+            }
+            manager.addTimer(5000, []() {})->cancel();
+        });
+        log = NanosPerOp(ops, [&](size_t i) {
+            if (i % batch == 0) {
+                utils::RefreshCoarseClock();
+            }
+            LogMessage msg(__FILE__, __LINE__, "", 0, 0, "root");
+        });
+        utils::StopCoarseClock();
+        return std::make_pair(timer, log);
+    };
+    auto [precise_timer, precise_log] = churn(false);
+    auto [coarse_timer, coarse_log] = churn(true);
+    LOG_FMT_INFO(root, "[clock] 添加+取消定时器 %.0f -> %.0f ns/op, 创建日志消息 %.0f -> %.0f ns/op", precise_timer, coarse_timer, precise_log, coarse_log);
+}
+
+int main(int argc, char *argv[])
+{
+    Application app;
+    return app.boot(BootArgs{
+        .argc = argc,
+        .argv = argv,
+        .configFile = "/home/will/Workspace/Devs/projects/server-framework/benchmarks/bench_config.yml",
+        .mainFunc = [](int, char **) -> int {
+            BenchTimerChurn(10000, 1000000);
+            BenchTimerChurn(1000000, 1000000);
+            BenchTimerThreads(4, 1000000);
+            BenchClock(1000000, 64);
+            return 0;
+        }});
+}
@@ -1,3 +1,5 @@
+#include <algorithm>
+#include <atomic>
 #include <sys/stat.h>
 #include <sys/types.h>
 
@@ -7,9 +9,13 @@
 namespace meha
 {
 
+// 下一个包装对象的代数，0 表示没有包装对象
+static std::atomic_uint64_t s_next_generation{1};
+
 FileDescriptor::FileDescriptor(int fd)
-    : m_state{false, false, false, false}
+    : m_state{false, false, false, false, false}
     , m_fd(fd)
+    , m_generation(s_next_generation.fetch_add(1, std::memory_order_relaxed))
     , m_recvTimeout(-1)
     , m_sendTimeout(-1)
     , m_iom(nullptr)
@@ -22,8 +28,10 @@ void FileDescriptor::init()
     struct stat fd_stat;
     if (fstat(m_fd, &fd_stat) == -1) {
         m_state.isSocket = false;
+        m_state.isRegularFile = false;
     } else {
         m_state.isSocket = S_ISSOCK(fd_stat.st_mode);
+        m_state.isRegularFile = S_ISREG(fd_stat.st_mode);
     }
 
     if (isSocket()) {
@@ -81,23 +89,58 @@ FileDescriptor::sptr FileDescriptorManagerImpl::fetch(int fd, bool only_if_exist
         }
     }
     rlock.unLock();
+    return create(fd);
+}
 
-    WriteScopedLock wlock(&m_lock);
-    if (m_fdPool.size() <= fd) {
-        m_fdPool.resize(fd << 1);
+FileDescriptor::sptr FileDescriptorManagerImpl::create(int fd)
+{
+    if (fd < 0) {
+        return nullptr;
     }
     auto fdp = std::make_shared<FileDescriptor>(fd);
+    WriteScopedLock wlock(&m_lock);
+    if (m_fdPool.size() <= static_cast<size_t>(fd)) {
+        m_fdPool.resize(static_cast<size_t>(fd) << 1);
+    }
     m_fdPool[fd] = fdp;
     return fdp;
 }
 
-void FileDescriptorManagerImpl::remove(int fd)
+uint64_t FileDescriptorManagerImpl::generation(int fd)
 {
-    WriteScopedLock lock(&m_lock);
-    if (m_fdPool.size() <= static_cast<size_t>(fd)) {
+    ReadScopedLock lock(&m_lock);
+    if (fd < 0 || m_fdPool.size() <= static_cast<size_t>(fd) || !m_fdPool[fd]) {
+        return 0;
+    }
+    return m_fdPool[fd]->generation();
+}
+
+void FileDescriptorManagerImpl::attach(int fd)
+{
+    if (fd < 0) {
         return;
     }
-    m_fdPool[fd].reset();
+    WriteScopedLock lock(&m_lock);
+    if (m_attached.size() <= static_cast<size_t>(fd)) {
+        m_attached.resize(std::max(m_attached.size() << 1, static_cast<size_t>(fd) + 1));
+    }
+    m_attached[fd] = true;
+}
+
+bool FileDescriptorManagerImpl::remove(int fd)
+{
+    if (fd < 0) {
+        return false;
+    }
+    WriteScopedLock lock(&m_lock);
+    if (m_fdPool.size() > static_cast<size_t>(fd)) {
+        m_fdPool[fd].reset();
+    }
+    if (m_attached.size() <= static_cast<size_t>(fd) || !m_attached[fd]) {
+        return false;
+    }
+    m_attached[fd] = false;
+    return true;
 }
 
 } // namespace meha
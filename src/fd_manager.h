@@ -25,10 +25,23 @@ public:
     {
         return m_state.isSocket;
     };
+    // 是否是普通文件（普通文件的IO无法通过epoll异步化）
+    bool isRegularFile() const
+    {
+        return m_state.isRegularFile;
+    };
     bool isClosed() const
     {
         return m_state.isClosed;
     };
+    /**
+     * @brief 包装对象的代数，每创建一个包装对象加一
+     * @details 同一个fd号被关闭后又被复用时代数不同，IOManager据此发现fd绕过hook的close被关闭、又被复用了（见 IOManager::subscribeEvent）
+     */
+    uint64_t generation() const
+    {
+        return m_generation;
+    }
     // 标记用户手动设置了O_NONBLOCK
     void setUserNonBlock(bool v)
     {
@@ -64,12 +77,14 @@ private:
 
     bool m_isInited;
     int m_fd;
+    uint64_t m_generation;
     struct State
     {
         bool isSocket : 1;
         bool sysNONBLOCK : 1;
         bool userNONBLOCK : 1;
         bool isClosed : 1;
+        bool isRegularFile : 1;
     } m_state;
 
     uint64_t m_recvTimeout;
@@ -91,16 +106,32 @@ public:
      * @return 返回指定的文件描述符的包装对象；当指定的文件描述符不存在时，返回 nullptr，如果指定 only_if_exists 为 false，则为这个文件描述符创建新的包装对象并返回。
      */
     FileDescriptor::sptr fetch(int fd, bool only_if_exists = true);
+    /**
+     * @brief 为内核刚分配的 fd（socket、accept、open 的返回值）创建新的包装对象，替换池中同号的旧对象
+     * @details fd绕过hook的close被关闭（比如close_f）时，池中会留下同号的旧对象，不能再沿用它的状态
+     * @return fd 小于 0 时返回 nullptr
+     */
+    FileDescriptor::sptr create(int fd);
+    // 获取 fd 当前的包装对象的代数，没有包装对象时返回 0 thread-safe
+    uint64_t generation(int fd);
+
+    /**
+     * @brief 登记有IOManager持有 fd 的状态（加入了epoll或者提交了io_uring操作） thread-safe
+     * @details 每个IOManager只在第一次持有某个fd的状态时登记（见 IOManager::attachFd），与包装对象无关（没有经过hook创建的fd也可以监听事件）
+     */
+    void attach(int fd);
 
     /**
      * @brief 将一个文件描述符从管理类中删除
+     * @return 是否有IOManager持有该fd的状态（见 attach），为true时要通知IOManager释放它（见 IOManager::ReleaseFd）
      * //TODO 这里不需要用引用计数管理吗？
      */
-    void remove(int fd);
+    bool remove(int fd);
 
 private:
     RWMutex m_lock{};
     std::vector<FileDescriptor::sptr> m_fdPool; // 文件描述符池
+    std::vector<bool> m_attached; // 有IOManager持有状态的fd
 };
 
 using FileDescriptorManager = SingletonPtr<FileDescriptorManagerImpl>;
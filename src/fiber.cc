@@ -1,15 +1,22 @@
 #include <cstddef>
+#include <cstring>
 #include <fmt/format.h>
 #include <memory>
+#include <mutex>
 #include <optional>
+#include <signal.h>
 #include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
 
 #include "config.h"
 #include "fiber.h"
+#include "fiber_stack.h"
 #include "module/log.h"
 #include "scheduler.h"
 #include "utils/exception.h"
 #include "utils/sem.h"
+#include "utils/utils.h"
 
 namespace meha
 {
@@ -29,36 +36,133 @@ static thread_local Fiber::sptr t_master_fiber{nullptr};
 static ConfigItem<uint64_t>::sptr g_fiber_stack_size{Config::Lookup<uint64_t>("fiber.stack_size", 128 * 1024, "单位:B")};
 
 /**
- * @brief 对 malloc/free 简单封装的内存分配器接口
- * @details 封装一个通用的内存分配器的目的是用于以后的测试性能工作
- * NOTE 这里没用多态是因为static方法不属于类的成员，而virtual只能用于成员方法
+ * @brief 协程栈溢出检测
+ * @details 协程栈低地址端的保护页被访问时会触发 SIGSEGV。由于此时溢出的协程栈已经无法再压栈，
+ * 信号处理函数必须运行在每个线程各自的备用信号栈（sigaltstack）上
  */
-struct HeapStackAllocator
+struct StackGuard
 {
-    static void *Alloc(uint64_t size)
+    // 线程的备用信号栈，随线程退出而释放
+    struct AltStack
     {
-        return malloc(size);
-    }
-    static void Dealloc(void *ptr, uint64_t size)
+        void *memory = nullptr;
+        size_t size = 0;
+
+        AltStack()
+        {
+            stack_t old_ss{};
+            // 已经有人为当前线程设置过备用信号栈了，沿用即可
+            if (::sigaltstack(nullptr, &old_ss) == 0 && !(old_ss.ss_flags & SS_DISABLE)) {
+                return;
+            }
+            size = std::max<size_t>(SIGSTKSZ, 64 * 1024);
+            memory = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (memory == MAP_FAILED) {
+                memory = nullptr;
+                return;
+            }
+            stack_t ss{};
+            ss.ss_sp = memory;
+            ss.ss_size = size;
+            if (::sigaltstack(&ss, nullptr) == -1) {
+                ::munmap(memory, size);
+                memory = nullptr;
+            }
+        }
+
+        ~AltStack()
+        {
+            if (memory) {
+                stack_t ss{};
+                ss.ss_flags = SS_DISABLE;
+                ::sigaltstack(&ss, nullptr);
+                ::munmap(memory, size);
+            }
+        }
+    };
+
+    // 在信号处理函数中格式化输出用的缓冲区（只做内存写入，异步信号安全）
+    struct SignalSafeWriter
     {
-        free(ptr);
-    }
-};
+        char buf[256];
+        size_t len = 0;
 
-struct ShmStackAllocator
-{
-    static void *Alloc(uint64_t size)
+        SignalSafeWriter &str(const char *s)
+        {
+            while (*s && len < sizeof(buf)) {
+                buf[len++] = *s++;
+            }
+            return *this;
+        }
+        SignalSafeWriter &dec(uint64_t v)
+        {
+            char digits[20];
+            int n = 0;
+            do {
+                digits[n++] = static_cast<char>('0' + v % 10);
+                v /= 10;
+            } while (v);
+            while (n > 0 && len < sizeof(buf)) {
+                buf[len++] = digits[--n];
+            }
+            return *this;
+        }
+        SignalSafeWriter &hex(uint64_t v)
+        {
+            str("0x");
+            char digits[16];
+            int n = 0;
+            do {
+                digits[n++] = "0123456789abcdef"[v & 0xf];
+                v >>= 4;
+            } while (v);
+            while (n > 0 && len < sizeof(buf)) {
+                buf[len++] = digits[--n];
+            }
+            return *this;
+        }
+    };
+
+    // 为当前线程开启栈溢出检测
+    // NOTE 这里不能查询栈分配器是否带保护页：底层分配器在第一次分配栈时才按配置确定，而线程初始化协程时应用可能还没有加载配置。
+    // 不带保护页时（heap）处理函数不会匹配任何协程栈，只是多了一个备用信号栈
+    static void Install()
     {
-        return mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        static thread_local AltStack t_alt_stack;
+        static std::once_flag s_once;
+        std::call_once(s_once, []() {
+            struct sigaction sa{};
+            sa.sa_sigaction = &StackGuard::OnSegmentFault;
+            sa.sa_flags = SA_SIGINFO | SA_ONSTACK;
+            sigemptyset(&sa.sa_mask);
+            ::sigaction(SIGSEGV, &sa, &s_old_action);
+        });
     }
-    static void Dealloc(void *ptr, uint64_t size)
+
+    // NOTE 信号处理函数中只能调用异步信号安全的函数，因此不能打日志，直接写stderr
+    static void OnSegmentFault(int, siginfo_t *info, void *)
     {
-        munmap(ptr, size);
+        Fiber *fiber = t_fiber;
+        const auto addr = reinterpret_cast<uintptr_t>(info->si_addr);
+        // 协程有栈时底层分配器已经确定，GuardSize 不会在这里读取配置
+        if (fiber && fiber->m_stack) {
+            const auto stack_low = reinterpret_cast<uintptr_t>(fiber->m_stack);
+            if (addr < stack_low && addr >= stack_low - StackAllocator::GuardSize()) {
+                // snprintf不是异步信号安全的，手动格式化
+                SignalSafeWriter out;
+                out.str("协程[").dec(fiber->m_fid).str("]栈溢出：栈空间[").hex(stack_low).str(", ").hex(stack_low + fiber->m_stack_size);
+                out.str(")，大小 ").dec(fiber->m_stack_size).str(" B，越界访问地址 ").hex(addr).str("\n");
+                ::syscall(SYS_write, STDERR_FILENO, out.buf, out.len);
+            }
+        }
+        // 恢复原有的处理方式后返回，出错的指令会被重新执行，再由原处理方式处理（默认是终止进程并生成core）
+        ::sigaction(SIGSEGV, &s_old_action, nullptr);
     }
+
+    static struct sigaction s_old_action;
 };
 
-// 协程栈空间分配器。起别名的作用是以后栈空间分配器换了别的，只需要更换这里的类型就行
-using StackAllocator = HeapStackAllocator;
+struct sigaction StackGuard::s_old_action{};
 
 Fiber::Fiber()
     : m_fid(0)
@@ -69,8 +173,7 @@ Fiber::Fiber()
     , m_callback(nullptr)
 {
     // 这里创建的是主协程，主协程直接就是开跑的，且不使用我们创建的内存空间来做协程栈，且不存在协程函数
-    // 获取上下文对象的副本
-    ASSERT_FMT(getcontext(&m_ctx) == 0, "获取主协程上下文失败");
+    // 主协程的上下文在第一次被换出时才会保存下来，因此这里无需获取
     SetCurrent(this);
     // 总协程数量增加
     ++s_fiber_count;
@@ -78,25 +181,29 @@ Fiber::Fiber()
     LOG_TRACE(core, "创建主协程[0]"); // 注意这里不要调用LOG，因为此时还没有初始化好协程，LOG里面会调用Fiber的函数造成无限递归
 }
 
-Fiber::Fiber(FiberFunc callback, bool scheduled, size_t stack_size)
+Fiber::Fiber(FiberFunc callback, bool scheduled, size_t stack_size, StackMode stack_mode)
     : m_fid(++s_fiber_id)
     , m_status(Initialized)
     , m_ctx()
     , m_stack(nullptr)
     , m_callback(std::move(callback))
     , m_scheduled(scheduled)
+    , m_stack_mode(stack_mode)
 {
     // 注意这里创建的是子协程
+    if (m_stack_mode == Shared) {
+        // 共享栈协程在第一次换入时才绑定共享栈并构造上下文
+        m_stack_size = 0;
+        ++s_fiber_count;
+        LOG_FMT_TRACE(core, "创建共享栈子协程[%lu]", m_fid);
+        return;
+    }
     m_stack_size = stack_size == 0 ? g_fiber_stack_size->getValue() : stack_size;
-    ASSERT_FMT(getcontext(&m_ctx) == 0, "获取子协程上下文失败");
     // 给上下文对象分配分配新的栈空间内存
     m_stack = StackAllocator::Alloc(m_stack_size);
     ASSERT_FMT(m_stack, "fiber stack alloc failed");
-    m_ctx.uc_link = nullptr;
-    m_ctx.uc_stack.ss_sp = m_stack;
-    m_ctx.uc_stack.ss_size = m_stack_size;
-    // 给新的上下文绑定入口函数
-    makecontext(&m_ctx, &Fiber::Run, 0);
+    // 在新栈上构造上下文并绑定入口函数
+    m_ctx.make(m_stack, m_stack_size, &Fiber::Run);
 
     ++s_fiber_count;
     LOG_FMT_TRACE(core, "创建子协程[%lu]", m_fid);
@@ -111,14 +218,25 @@ Fiber::Fiber(Fiber &&rhs) noexcept
     m_ctx = rhs.m_ctx;
     m_stack = rhs.m_stack;
     m_scheduled = rhs.m_scheduled;
+    m_stack_mode = rhs.m_stack_mode;
+    m_shared_stack = rhs.m_shared_stack;
+    m_saved_stack = rhs.m_saved_stack;
+    m_saved_size = rhs.m_saved_size;
+    m_saved_capacity = rhs.m_saved_capacity;
+    if (m_shared_stack && m_shared_stack->occupant == &rhs) {
+        m_shared_stack->occupant = this;
+    }
     // REVIEW 这里用swap比用move能处理callback中存在智能指针的问题？？
     m_callback.swap(rhs.m_callback);
-    makecontext(&m_ctx, &Fiber::Run, 0);
+    if (m_status == Initialized && m_stack) {
+        m_ctx.make(m_stack, m_stack_size, &Fiber::Run);
+    }
     rhs.m_stack = nullptr;
     rhs.m_stack_size = 0;
-    rhs.m_ctx.uc_link = nullptr;
-    rhs.m_ctx.uc_stack.ss_sp = nullptr;
-    rhs.m_ctx.uc_stack.ss_size = 0;
+    rhs.m_ctx = FiberContext();
+    rhs.m_shared_stack = nullptr;
+    rhs.m_saved_stack = nullptr;
+    rhs.m_saved_size = rhs.m_saved_capacity = 0;
     LOG_FMT_TRACE(core, "移动子协程[%lu]", m_fid);
 }
 
@@ -126,21 +244,36 @@ Fiber &Fiber::operator=(Fiber &&rhs) noexcept
 {
     // 移动赋值运算符不需要考虑自赋值问题
     if (&rhs != this) {
-        StackAllocator::Dealloc(m_stack, m_stack_size);
+        if (m_stack_mode == Shared) {
+            releaseSharedStack();
+        } else {
+            StackAllocator::Dealloc(m_stack, m_stack_size);
+        }
         m_fid = rhs.m_fid;
         m_stack_size = rhs.m_stack_size;
         m_status = rhs.m_status;
         m_ctx = rhs.m_ctx;
         m_stack = rhs.m_stack;
         m_scheduled = rhs.m_scheduled;
+        m_stack_mode = rhs.m_stack_mode;
+        m_shared_stack = rhs.m_shared_stack;
+        m_saved_stack = rhs.m_saved_stack;
+        m_saved_size = rhs.m_saved_size;
+        m_saved_capacity = rhs.m_saved_capacity;
+        if (m_shared_stack && m_shared_stack->occupant == &rhs) {
+            m_shared_stack->occupant = this;
+        }
         // REVIEW 这里用swap比用move能处理callback中存在智能指针的问题？？
         m_callback.swap(rhs.m_callback);
-        makecontext(&m_ctx, &Fiber::Run, 0);
+        if (m_status == Initialized && m_stack) {
+            m_ctx.make(m_stack, m_stack_size, &Fiber::Run);
+        }
         rhs.m_stack = nullptr;
         rhs.m_stack_size = 0;
-        rhs.m_ctx.uc_link = nullptr;
-        rhs.m_ctx.uc_stack.ss_sp = nullptr;
-        rhs.m_ctx.uc_stack.ss_size = 0;
+        rhs.m_ctx = FiberContext();
+        rhs.m_shared_stack = nullptr;
+        rhs.m_saved_stack = nullptr;
+        rhs.m_saved_size = rhs.m_saved_capacity = 0;
     }
     LOG_FMT_TRACE(core, "移动子协程[%lu]", m_fid);
     return *this;
@@ -149,7 +282,10 @@ Fiber &Fiber::operator=(Fiber &&rhs) noexcept
 Fiber::~Fiber()
 {
     LOG_FMT_TRACE(core, "析构协程[%lu]", m_fid);
-    if (m_stack) { // 存在栈，说明是子协程，释放申请的协程栈空间
+    if (m_stack_mode == Shared) { // 共享栈子协程，只需释放保存栈内容的内存
+        ASSERT(m_status == Initialized || m_status == Terminated);
+        releaseSharedStack();
+    } else if (m_stack) { // 存在栈，说明是子协程，释放申请的协程栈空间
         ASSERT(m_status == Initialized || m_status == Terminated);
         StackAllocator::Dealloc(m_stack, m_stack_size);
     } else { // 否则是主协程
@@ -164,23 +300,28 @@ Fiber::~Fiber()
 
 void Fiber::reset(FiberFunc &&callback) noexcept
 {
-    ASSERT(m_stack);
+    ASSERT(m_stack || m_stack_mode == Shared);
     ASSERT(m_status == Initialized || m_status == Terminated);
     m_callback = std::move(callback);
-    // 获取当前的协程上下文
-    ASSERT(getcontext(&m_ctx) == 0);
-    // 修改当前协程上下文
-    m_ctx.uc_link = nullptr;
-    m_ctx.uc_stack.ss_sp = m_stack;
-    m_ctx.uc_stack.ss_size = m_stack_size;
-    makecontext(&m_ctx, &Fiber::Run, 0);
+    // 在原有的栈上重新构造协程上下文（共享栈协程结束时已经解除了绑定，下次换入时再构造）
+    if (m_stack_mode == Dedicated) {
+        m_ctx.make(m_stack, m_stack_size, &Fiber::Run);
+    }
     m_status = Initialized;
 }
 
+int32_t Fiber::boundThread() const noexcept
+{
+    return m_shared_stack ? m_shared_stack->tid : -1;
+}
+
 void Fiber::resume()
 {
     // 当前执行的是主协程
     ASSERT(m_status == Initialized || m_status == Ready);
+    if (m_stack_mode == Shared) {
+        switchInSharedStack();
+    }
     SwapFromTo(m_scheduled ? Scheduler::GetSchedulerFiber().get() : t_master_fiber.get(), this);
 }
 
@@ -188,13 +329,77 @@ void Fiber::yield()
 {
     // 当前执行的是子协程
     ASSERT(m_status == Running || m_status == Terminated);
+    ASSERT_FMT(!Scheduler::IsRunningInline(), "内联任务运行在调度协程上，不能yield（需要挂起的任务应以 Scheduler::Coroutine 类型调度）");
     // 协程运行完之后会自动yield一次，用于回到主协程，此时状态已为TERM状态，不应该改为READY
     if (m_status != Terminated) {
         m_status = Ready; // 准备好下次被换入
+    } else if (m_stack_mode == Shared) {
+        // 已经结束的共享栈协程不再需要保存栈内容，让出共享栈
+        releaseSharedStack();
     }
     SwapFromTo(this, m_scheduled ? Scheduler::GetSchedulerFiber().get() : t_master_fiber.get());
 }
 
+void Fiber::switchInSharedStack()
+{
+    if (!m_shared_stack) {
+        // 第一次换入，绑定当前线程的一个共享栈
+        m_shared_stack = SharedStack::Acquire();
+        ASSERT_FMT(m_shared_stack->memory, "shared fiber stack alloc failed");
+        ++m_shared_stack->bound;
+        m_stack = m_shared_stack->memory;
+        m_stack_size = m_shared_stack->size;
+    }
+    ASSERT_FMT(m_shared_stack->tid == static_cast<int32_t>(utils::GetThreadID()), "共享栈协程[%lu]只能在绑定的线程[%d]上恢复执行", m_fid, m_shared_stack->tid);
+    // 换入的协程与当前协程共用一个栈时，拷贝会踩坏当前协程正在使用的栈
+    ASSERT_FMT(!t_fiber || t_fiber->m_shared_stack != m_shared_stack, "协程[%lu]与当前协程共用一个共享栈，不能在当前协程中换入", m_fid);
+    Fiber *occupant = m_shared_stack->occupant;
+    if (occupant == this) {
+        return;
+    }
+    if (occupant) {
+        occupant->saveSharedStack();
+    }
+    if (m_status == Initialized) {
+        m_ctx.make(m_stack, m_stack_size, &Fiber::Run);
+    } else {
+        std::memcpy(static_cast<char *>(m_stack) + m_stack_size - m_saved_size, m_saved_stack, m_saved_size);
+    }
+    m_shared_stack->occupant = this;
+}
+
+void Fiber::saveSharedStack()
+{
+    auto *sp = static_cast<char *>(m_ctx.stackPointer());
+    auto *top = static_cast<char *>(m_stack) + m_stack_size;
+    ASSERT_FMT(sp && sp >= m_stack && sp <= top, "协程[%lu]的栈顶指针不在共享栈内", m_fid);
+    m_saved_size = top - sp;
+    // 保存区只增不减，避免协程反复换入换出时频繁申请内存
+    if (m_saved_capacity < m_saved_size) {
+        free(m_saved_stack);
+        m_saved_stack = malloc(m_saved_size);
+        ASSERT_FMT(m_saved_stack, "fiber saved stack alloc failed");
+        m_saved_capacity = m_saved_size;
+    }
+    std::memcpy(m_saved_stack, sp, m_saved_size);
+}
+
+void Fiber::releaseSharedStack()
+{
+    if (m_shared_stack) {
+        if (m_shared_stack->occupant == this) {
+            m_shared_stack->occupant = nullptr;
+        }
+        --m_shared_stack->bound;
+    }
+    m_shared_stack = nullptr;
+    m_stack = nullptr;
+    m_stack_size = 0;
+    free(m_saved_stack);
+    m_saved_stack = nullptr;
+    m_saved_size = m_saved_capacity = 0;
+}
+
 void Fiber::SwapFromTo(Fiber *from, Fiber *to)
 {
     if (from == to) {
@@ -204,7 +409,7 @@ void Fiber::SwapFromTo(Fiber *from, Fiber *to)
     ASSERT(from);
     ASSERT(to);
     SetCurrent(to);
-    if (swapcontext(&(from->m_ctx), &(to->m_ctx))) {
+    if (!FiberContext::Swap(&(from->m_ctx), &(to->m_ctx))) {
         throw SystemError(fmt::format("swap from fiber[{}] to fiber[{}] failed", from->m_fid, to->m_fid));
     }
 }
@@ -212,6 +417,8 @@ void Fiber::SwapFromTo(Fiber *from, Fiber *to)
 void Fiber::Init()
 {
     if (t_master_fiber == nullptr) {
+        // 线程第一次使用协程时开启栈溢出检测
+        StackGuard::Install();
         t_master_fiber.reset(new Fiber());
         // 为了确保主协程只创建一次，这里不能为t_master_fiber赋值，应该在Init()中做
         // SetCurrent(t_master_fiber);
@@ -3,10 +3,8 @@
 #include <functional>
 #include <memory>
 #include <optional>
-extern "C" {
-#include <ucontext.h>
-}
 
+#include "fiber_context.h"
 #include "macro.h"
 #include "utils/noncopyable.h"
 
@@ -14,6 +12,7 @@ namespace meha
 {
 
 class Scheduler;
+struct SharedStack;
 
 /**
  * @brief 协程类（不可拷贝但可移动）
@@ -23,6 +22,7 @@ class Scheduler;
 class Fiber : public utils::NonCopyable, public std::enable_shared_from_this<Fiber>
 {
     friend class Scheduler;
+    friend struct StackGuard;
 
 public:
     MEHA_PTR_INSIDE_CLASS(Fiber)
@@ -36,13 +36,21 @@ public:
         Terminated, // 结束（运行结束）
     };
 
+    // 协程栈模式
+    enum StackMode {
+        Dedicated, // 独占栈：每个协程单独分配一块栈空间
+        Shared, // 共享栈：在线程的共享栈上运行，换出时只把栈上存活的部分拷贝到堆上保存，适合大量空闲的协程
+    };
+
     /**
      * @brief 创建新子协程
      * @param callback 协程执行函数
      * @param scheduled 是否参与协程调度器调度
-     * @param stack_size 协程栈大小，如果传 0，使用配置项 "fiber.stack_size" 的值
+     * @param stack_size 协程栈大小，如果传 0，使用配置项 "fiber.stack_size" 的值；共享栈模式下忽略，栈大小由配置项 "fiber.shared_stack.size" 决定
+     * @param stack_mode 协程栈模式
+     * @note 共享栈模式的协程第一次被换入后就绑定在当前线程上，之后只能在该线程上恢复执行（调度器会自动把它固定到该线程）
      * */
-    explicit Fiber(FiberFunc callback, bool scheduled, size_t stack_size = 0);
+    explicit Fiber(FiberFunc callback, bool scheduled, size_t stack_size = 0, StackMode stack_mode = Dedicated);
 
     // TODO 三五法则
     Fiber(Fiber &&rhs) noexcept;
@@ -91,6 +99,12 @@ public:
     {
         return m_scheduled;
     }
+    StackMode stackMode() const noexcept
+    {
+        return m_stack_mode;
+    }
+    // 协程绑定的线程，只有已经开始运行的共享栈协程才会绑定线程，否则返回 -1
+    int32_t boundThread() const noexcept;
 
 private:
     // 无参构造用于创建 master fiber，设置为私有的即不允许用户创建master fiber
@@ -103,8 +117,14 @@ private:
     static void SwapFromTo(Fiber *from, Fiber *to);
     // 设置当前执行的协程
     static void SetCurrent(Fiber *fiber);
-    // 协程入口函数（makecontext的第二个参数）
+    // 协程入口函数（FiberContext::make的入口参数）
     static void Run();
+    // 共享栈协程换入前的准备：绑定共享栈，保存原占用者的栈内容，恢复自己的栈内容
+    void switchInSharedStack();
+    // 把栈上存活的部分拷贝到 m_saved_stack 中
+    void saveSharedStack();
+    // 解除与共享栈的绑定
+    void releaseSharedStack();
 
 public:
     // 在当前线程上创建主协程。线程如果要创建协程就要先执行这个函数
@@ -124,10 +144,15 @@ private:
     uint64_t m_fid; // 协程 id
     uint64_t m_stack_size; // 协程栈大小
     Status m_status; // 协程状态
-    ucontext_t m_ctx; // 当前协程上下文
+    FiberContext m_ctx; // 当前协程上下文
     void *m_stack; // 协程栈空间指针
     FiberFunc m_callback; // 协程执行函数
     bool m_scheduled; // 是否参与协程调度器调度
+    StackMode m_stack_mode{Dedicated}; // 协程栈模式
+    SharedStack *m_shared_stack{nullptr}; // 绑定的共享栈（仅共享栈模式）
+    void *m_saved_stack{nullptr}; // 换出时保存的栈内容（仅共享栈模式）
+    uint64_t m_saved_size{0}; // 保存的栈内容大小
+    uint64_t m_saved_capacity{0}; // m_saved_stack 的容量
 };
 
 } // namespace meha
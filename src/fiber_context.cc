@@ -0,0 +1,203 @@
+#include <cstdint>
+#include <cstring>
+
+#include "fiber_context.h"
+
+#ifndef MEHA_FIBER_USE_UCONTEXT
+extern "C" {
+// 保存当前的callee-saved寄存器到当前栈上，并把栈顶写入 *from_sp，然后切换到 to_sp 栈上恢复寄存器并返回
+void meha_fiber_context_swap(void **from_sp, void *to_sp);
+// 新上下文第一次被换入时的落脚点，负责调用入口函数（入口函数由make时压入栈中的寄存器槽位传入）
+void meha_fiber_context_trampoline();
+}
+
+// NOTE 这里用文件作用域的汇编而不是单独的 .S 文件，是为了继续沿用 src/CMakeLists.txt 中对 *.cc 的收集规则
+#if defined(__x86_64__)
+/**
+ * 栈布局（高地址 -> 低地址），swap 返回时按此顺序弹出：
+ *   [返回地址] [rbp] [rbx] [r12] [r13] [r14] [r15] [mxcsr | x87 控制字]  <- sp
+ */
+__asm__(
+    ".text\n"
+    ".globl meha_fiber_context_swap\n"
+    ".hidden meha_fiber_context_swap\n"
+    ".type meha_fiber_context_swap, @function\n"
+    ".align 16\n"
+    "meha_fiber_context_swap:\n"
+    "    .cfi_startproc\n"
+    "    pushq %rbp\n"
+    "    pushq %rbx\n"
+    "    pushq %r12\n"
+    "    pushq %r13\n"
+    "    pushq %r14\n"
+    "    pushq %r15\n"
+    "    subq $8, %rsp\n"
+    "    stmxcsr (%rsp)\n"
+    "    fnstcw 4(%rsp)\n"
+    "    movq %rsp, (%rdi)\n"
+    "    movq %rsi, %rsp\n"
+    "    ldmxcsr (%rsp)\n"
+    "    fldcw 4(%rsp)\n"
+    "    addq $8, %rsp\n"
+    "    popq %r15\n"
+    "    popq %r14\n"
+    "    popq %r13\n"
+    "    popq %r12\n"
+    "    popq %rbx\n"
+    "    popq %rbp\n"
+    "    ret\n"
+    "    .cfi_endproc\n"
+    ".size meha_fiber_context_swap, .-meha_fiber_context_swap\n"
+
+    ".globl meha_fiber_context_trampoline\n"
+    ".hidden meha_fiber_context_trampoline\n"
+    ".type meha_fiber_context_trampoline, @function\n"
+    ".align 16\n"
+    "meha_fiber_context_trampoline:\n"
+    "    .cfi_startproc\n"
+    "    .cfi_undefined rip\n" // 标记为调用栈的最外层，backtrace到这里就停止
+    "    callq *%rbx\n"
+    "    ud2\n" // 入口函数不允许返回
+    "    .cfi_endproc\n"
+    ".size meha_fiber_context_trampoline, .-meha_fiber_context_trampoline\n");
+#elif defined(__aarch64__)
+/**
+ * 栈帧布局（0xb0字节，sp 为帧底）：
+ *   0x00 d8-d15 | 0x40 x19-x28 | 0x90 x29 x30 | 0xa0 fpcr
+ */
+__asm__(
+    ".text\n"
+    ".globl meha_fiber_context_swap\n"
+    ".hidden meha_fiber_context_swap\n"
+    ".type meha_fiber_context_swap, %function\n"
+    ".align 4\n"
+    "meha_fiber_context_swap:\n"
+    "    .cfi_startproc\n"
+    "    sub sp, sp, #0xb0\n"
+    "    stp d8, d9, [sp, #0x00]\n"
+    "    stp d10, d11, [sp, #0x10]\n"
+    "    stp d12, d13, [sp, #0x20]\n"
+    "    stp d14, d15, [sp, #0x30]\n"
+    "    stp x19, x20, [sp, #0x40]\n"
+    "    stp x21, x22, [sp, #0x50]\n"
+    "    stp x23, x24, [sp, #0x60]\n"
+    "    stp x25, x26, [sp, #0x70]\n"
+    "    stp x27, x28, [sp, #0x80]\n"
+    "    stp x29, x30, [sp, #0x90]\n"
+    "    mrs x9, fpcr\n"
+    "    str x9, [sp, #0xa0]\n"
+    "    mov x9, sp\n"
+    "    str x9, [x0]\n"
+    "    mov sp, x1\n"
+    "    ldr x9, [sp, #0xa0]\n"
+    "    msr fpcr, x9\n"
+    "    ldp d8, d9, [sp, #0x00]\n"
+    "    ldp d10, d11, [sp, #0x10]\n"
+    "    ldp d12, d13, [sp, #0x20]\n"
+    "    ldp d14, d15, [sp, #0x30]\n"
+    "    ldp x19, x20, [sp, #0x40]\n"
+    "    ldp x21, x22, [sp, #0x50]\n"
+    "    ldp x23, x24, [sp, #0x60]\n"
+    "    ldp x25, x26, [sp, #0x70]\n"
+    "    ldp x27, x28, [sp, #0x80]\n"
+    "    ldp x29, x30, [sp, #0x90]\n"
+    "    add sp, sp, #0xb0\n"
+    "    ret\n"
+    "    .cfi_endproc\n"
+    ".size meha_fiber_context_swap, .-meha_fiber_context_swap\n"
+
+    ".globl meha_fiber_context_trampoline\n"
+    ".hidden meha_fiber_context_trampoline\n"
+    ".type meha_fiber_context_trampoline, %function\n"
+    ".align 4\n"
+    "meha_fiber_context_trampoline:\n"
+    "    .cfi_startproc\n"
+    "    .cfi_undefined x30\n"
+    "    blr x19\n"
+    "    brk #0\n"
+    "    .cfi_endproc\n"
+    ".size meha_fiber_context_trampoline, .-meha_fiber_context_trampoline\n");
+#endif
+#endif
+
+namespace meha
+{
+
+#ifdef MEHA_FIBER_USE_UCONTEXT
+
+void FiberContext::make(void *stack, size_t size, EntryFunc entry)
+{
+    getcontext(&m_ctx);
+    m_ctx.uc_link = nullptr;
+    m_ctx.uc_stack.ss_sp = stack;
+    m_ctx.uc_stack.ss_size = size;
+    makecontext(&m_ctx, entry, 0);
+}
+
+bool FiberContext::Swap(FiberContext *from, FiberContext *to)
+{
+    return swapcontext(&from->m_ctx, &to->m_ctx) == 0;
+}
+
+void *FiberContext::stackPointer() const
+{
+#if defined(__x86_64__)
+    return reinterpret_cast<void *>(m_ctx.uc_mcontext.gregs[REG_RSP]);
+#elif defined(__aarch64__)
+    return reinterpret_cast<void *>(m_ctx.uc_mcontext.sp);
+#else
+    return nullptr;
+#endif
+}
+
+const char *FiberContext::Backend()
+{
+    return "ucontext";
+}
+
+#else
+
+void FiberContext::make(void *stack, size_t size, EntryFunc entry)
+{
+    // 栈从高地址向低地址增长，栈底按16字节对齐
+    auto top = (reinterpret_cast<uintptr_t>(stack) + size) & ~static_cast<uintptr_t>(15);
+    auto *slots = reinterpret_cast<uint64_t *>(top);
+#if defined(__x86_64__)
+    constexpr size_t kSlots = 8;
+    std::memset(slots - kSlots, 0, kSlots * sizeof(uint64_t));
+    slots[-1] = reinterpret_cast<uint64_t>(&meha_fiber_context_trampoline); // 返回地址
+    slots[-3] = reinterpret_cast<uint64_t>(entry); // rbx
+    slots[-8] = 0x1F80ull | (0x037Full << 32); // mxcsr 与 x87 控制字的默认值
+#elif defined(__aarch64__)
+    constexpr size_t kSlots = 0xb0 / sizeof(uint64_t);
+    std::memset(slots - kSlots, 0, kSlots * sizeof(uint64_t));
+    uint64_t *frame = slots - kSlots;
+    frame[0x40 / 8] = reinterpret_cast<uint64_t>(entry); // x19
+    frame[0x98 / 8] = reinterpret_cast<uint64_t>(&meha_fiber_context_trampoline); // x30
+#endif
+    m_sp = slots - kSlots;
+}
+
+bool FiberContext::Swap(FiberContext *from, FiberContext *to)
+{
+    meha_fiber_context_swap(&from->m_sp, to->m_sp);
+    return true;
+}
+
+void *FiberContext::stackPointer() const
+{
+    return m_sp;
+}
+
+const char *FiberContext::Backend()
+{
+#if defined(__x86_64__)
+    return "asm(x86_64)";
+#else
+    return "asm(aarch64)";
+#endif
+}
+
+#endif
+
+} // namespace meha
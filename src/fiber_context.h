@@ -0,0 +1,61 @@
+#pragma once
+
+#include <cstddef>
+#if !defined(MEHA_FIBER_USE_UCONTEXT) && !defined(__x86_64__) && !defined(__aarch64__)
+// 没有手写汇编实现的平台，回退到ucontext后端
+#define MEHA_FIBER_USE_UCONTEXT
+#endif
+#ifdef MEHA_FIBER_USE_UCONTEXT
+extern "C" {
+#include <ucontext.h>
+}
+#endif
+
+namespace meha
+{
+
+/**
+ * @brief 协程上下文（上下文切换后端的封装）
+ * @details 默认使用手写汇编实现的切换，只保存callee-saved寄存器和栈指针，不涉及信号掩码，因此切换时不会陷入内核；
+ * 编译时定义 MEHA_FIBER_USE_UCONTEXT（cmake选项 FIBER_USE_UCONTEXT）则回退到glibc的ucontext实现。
+ * @note 默认构造的上下文不绑定栈，仅用于保存主协程/调度协程这类“借用线程栈”的执行流
+ */
+class FiberContext
+{
+public:
+    using EntryFunc = void (*)();
+
+    FiberContext() = default;
+
+    /**
+     * @brief 在给定的栈空间上构造一个新的上下文，第一次换入时从 entry 开始执行
+     * @param stack 栈空间起始地址（低地址）
+     * @param size 栈空间大小
+     * @param entry 入口函数，不允许返回
+     */
+    void make(void *stack, size_t size, EntryFunc entry);
+
+    /**
+     * @brief 保存当前执行流到 from，换入 to
+     * @return 是否切换成功
+     */
+    static bool Swap(FiberContext *from, FiberContext *to);
+
+    /**
+     * @brief 上下文换出时的栈顶指针，栈上 [stackPointer(), 栈底) 之间的内容就是换出时仍存活的部分
+     * @return 当前后端/平台无法获取时返回 nullptr
+     */
+    void *stackPointer() const;
+
+    // 当前编译使用的后端名称
+    static const char *Backend();
+
+private:
+#ifdef MEHA_FIBER_USE_UCONTEXT
+    ucontext_t m_ctx{};
+#else
+    void *m_sp = nullptr; // 换出时保存的栈顶指针，callee-saved寄存器都压在这个栈上
+#endif
+};
+
+} // namespace meha
@@ -0,0 +1,413 @@
+#include <atomic>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <unordered_set>
+#include <vector>
+
+#include "config.h"
+#include "fiber_stack.h"
+#include "module/log.h"
+#include "utils/mutex.h"
+#include "utils/utils.h"
+
+namespace meha
+{
+
+// 线程缓存中每个尺寸级别最多保留的栈数量
+static ConfigItem<uint64_t>::sptr g_stack_pool_thread_cache{Config::Lookup<uint64_t>("fiber.stack_pool.thread_cache", 16, "每个线程每个尺寸级别最多缓存的协程栈数量，0表示不缓存")};
+// 全局池中每个尺寸级别最多保留的栈数量
+static ConfigItem<uint64_t>::sptr g_stack_pool_global_cache{Config::Lookup<uint64_t>("fiber.stack_pool.global_cache", 256, "全局池每个尺寸级别最多缓存的协程栈数量，0表示不缓存")};
+
+// 每个线程的共享栈数量与大小
+static ConfigItem<uint64_t>::sptr g_shared_stack_count{Config::Lookup<uint64_t>("fiber.shared_stack.count", 4, "每个线程的共享栈数量")};
+static ConfigItem<uint64_t>::sptr g_shared_stack_size{Config::Lookup<uint64_t>("fiber.shared_stack.size", 1024 * 1024, "共享栈大小，单位:B")};
+
+// 池的底层分配器
+static ConfigItem<std::string>::sptr g_stack_backend{Config::Lookup<std::string>("fiber.stack_backend", "mmap", "协程栈的底层分配方式：mmap（带保护页，按需分配物理页）或 heap（malloc），仅在第一次分配栈时读取")};
+
+// 热路径上不走 ConfigItem::getValue（会加读锁），而是读取由变更回调同步过来的副本
+static std::atomic_uint64_t s_thread_cache_limit{g_stack_pool_thread_cache->getValue()};
+static std::atomic_uint64_t s_global_cache_limit{g_stack_pool_global_cache->getValue()};
+
+struct _StackPoolIniter
+{
+    _StackPoolIniter()
+    {
+        g_stack_pool_thread_cache->addListener([](const uint64_t &, const uint64_t &new_value) {
+            s_thread_cache_limit = new_value;
+        });
+        g_stack_pool_global_cache->addListener([](const uint64_t &, const uint64_t &new_value) {
+            s_global_cache_limit = new_value;
+        });
+    }
+};
+static _StackPoolIniter s_stack_pool_initer;
+
+/* --------------------------- HeapStackAllocator --------------------------- */
+
+void *HeapStackAllocator::Alloc(uint64_t size)
+{
+    return malloc(size);
+}
+
+void HeapStackAllocator::Dealloc(void *ptr, uint64_t size)
+{
+    free(ptr);
+}
+
+/* --------------------------- MmapStackAllocator --------------------------- */
+
+uint64_t MmapStackAllocator::GuardSize()
+{
+    static const uint64_t page_size = ::sysconf(_SC_PAGESIZE);
+    return page_size;
+}
+
+// 映射失败时退回到堆上分配的栈（见 MmapStackAllocator::Alloc），释放时要还给堆
+static SpinLock s_fallback_mutex;
+static std::unordered_set<void *> s_fallback_stacks;
+static std::atomic_size_t s_fallback_count{0};
+
+// 第一次退回到没有保护页的栈时打印一次警告
+static void WarnUnguardedOnce(int error)
+{
+    static std::atomic_bool warned{false};
+    if (!warned.exchange(true)) {
+        LOG_FMT_WARN(core, "带保护页的协程栈分配失败: %s(%d)，此后分配失败的栈不带保护页（检查 vm.max_map_count，每个带保护页的栈占用2个内存映射）", ::strerror(error), error);
+    }
+}
+
+void *MmapStackAllocator::Alloc(uint64_t size)
+{
+    const uint64_t guard = GuardSize();
+    // MAP_NORESERVE：不预留交换空间，物理页在第一次访问时才分配
+    void *base = ::mmap(nullptr, size + guard, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (base == MAP_FAILED) {
+        // 通常是内存映射的数量达到了 vm.max_map_count，退回到堆上分配
+        WarnUnguardedOnce(errno);
+        void *stack = HeapStackAllocator::Alloc(size);
+        if (stack) {
+            SpinScopedLock lock(&s_fallback_mutex);
+            s_fallback_stacks.insert(stack);
+            ++s_fallback_count;
+        }
+        return stack;
+    }
+    // 栈向低地址增长，因此保护页放在最低端。设置失败（拆分映射同样受 vm.max_map_count 限制）时不带保护页，释放方式不变
+    if (::mprotect(base, guard, PROT_NONE) == -1) {
+        WarnUnguardedOnce(errno);
+    }
+    return static_cast<char *>(base) + guard;
+}
+
+void MmapStackAllocator::Dealloc(void *ptr, uint64_t size)
+{
+    if (s_fallback_count.load(std::memory_order_relaxed) > 0) {
+        SpinScopedLock lock(&s_fallback_mutex);
+        if (s_fallback_stacks.erase(ptr)) {
+            --s_fallback_count;
+            lock.unLock();
+            HeapStackAllocator::Dealloc(ptr, size);
+            return;
+        }
+    }
+    const uint64_t guard = GuardSize();
+    ::munmap(static_cast<char *>(ptr) - guard, size + guard);
+}
+
+/* -------------------------- PooledStackAllocator -------------------------- */
+
+// 底层分配器在第一次分配栈时确定，此后不再改变
+static bool UseMmapBackend()
+{
+    static const bool use_mmap = g_stack_backend->getValue() != "heap";
+    return use_mmap;
+}
+
+static void *BackendAlloc(uint64_t size)
+{
+    return UseMmapBackend() ? MmapStackAllocator::Alloc(size) : HeapStackAllocator::Alloc(size);
+}
+
+static void BackendDealloc(void *ptr, uint64_t size)
+{
+    if (UseMmapBackend()) {
+        MmapStackAllocator::Dealloc(ptr, size);
+    } else {
+        HeapStackAllocator::Dealloc(ptr, size);
+    }
+}
+
+// 最小尺寸级别为 4KB，最大为 8MB
+static constexpr uint64_t kMinClassShift = 12;
+static constexpr uint64_t kMaxClassShift = 23;
+static constexpr size_t kClassCount = kMaxClassShift - kMinClassShift + 1;
+
+// 获取栈尺寸对应的级别，超出最大级别时返回 -1
+static int SizeClass(uint64_t size)
+{
+    if (size > (1ull << kMaxClassShift)) {
+        return -1;
+    }
+    uint64_t shift = kMinClassShift;
+    while ((1ull << shift) < size) {
+        ++shift;
+    }
+    return static_cast<int>(shift - kMinClassShift);
+}
+
+static uint64_t ClassSize(int cls)
+{
+    return 1ull << (cls + kMinClassShift);
+}
+
+// 空闲的栈本身就用来存放链表指针，因此池不需要额外的内存
+struct FreeStack
+{
+    FreeStack *next;
+};
+
+// 一条带计数的空闲链表
+struct FreeList
+{
+    FreeStack *head = nullptr;
+    std::atomic_uint64_t count{0}; // 仅由持有者修改，原子类型只是为了让GetStats跨线程读
+
+    void push(void *ptr)
+    {
+        auto node = static_cast<FreeStack *>(ptr);
+        node->next = head;
+        head = node;
+        count.store(count.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+    void *pop()
+    {
+        FreeStack *node = head;
+        head = node->next;
+        count.store(count.load(std::memory_order_relaxed) - 1, std::memory_order_relaxed);
+        return node;
+    }
+    bool empty() const
+    {
+        return head == nullptr;
+    }
+};
+
+struct ThreadStackCache;
+
+// 全局池（所有线程共享）
+struct GlobalStackPool
+{
+    Mutex mutex;
+    FreeList lists[kClassCount];
+    std::vector<ThreadStackCache *> caches; // 存活的线程缓存，用于汇总统计
+    uint64_t retiredHits = 0; // 已退出线程的统计
+    uint64_t retiredMisses = 0;
+};
+
+// NOTE 全局池故意不析构：进程退出时仍可能有线程在归还栈，而这部分内存在进程退出时自然会被回收
+static GlobalStackPool &GetGlobalPool()
+{
+    static auto *pool = new GlobalStackPool();
+    return *pool;
+}
+
+// 线程缓存
+struct ThreadStackCache
+{
+    FreeList lists[kClassCount];
+    std::atomic_uint64_t hits{0};
+    std::atomic_uint64_t misses{0};
+
+    ThreadStackCache()
+    {
+        auto &pool = GetGlobalPool();
+        ScopedLock lock(&pool.mutex);
+        pool.caches.push_back(this);
+    }
+
+    ~ThreadStackCache()
+    {
+        // 线程退出时把缓存的栈全部还给全局池
+        for (size_t cls = 0; cls < kClassCount; cls++) {
+            release(static_cast<int>(cls), lists[cls].count);
+        }
+        auto &pool = GetGlobalPool();
+        ScopedLock lock(&pool.mutex);
+        pool.retiredHits += hits;
+        pool.retiredMisses += misses;
+        for (auto it = pool.caches.begin(); it != pool.caches.end(); ++it) {
+            if (*it == this) {
+                pool.caches.erase(it);
+                break;
+            }
+        }
+    }
+
+    static void increase(std::atomic_uint64_t &counter)
+    {
+        counter.store(counter.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+
+    // 从全局池批量取回栈，返回是否取到
+    bool refill(int cls)
+    {
+        uint64_t batch = std::max<uint64_t>(s_thread_cache_limit / 2, 1);
+        auto &pool = GetGlobalPool();
+        ScopedLock lock(&pool.mutex);
+        FreeList &global = pool.lists[cls];
+        while (batch-- > 0 && !global.empty()) {
+            lists[cls].push(global.pop());
+        }
+        return !lists[cls].empty();
+    }
+
+    // 将本线程缓存的 n 个栈归还全局池，全局池满了就直接释放
+    void release(int cls, uint64_t n)
+    {
+        if (n == 0) {
+            return;
+        }
+        std::vector<void *> overflow;
+        {
+            auto &pool = GetGlobalPool();
+            ScopedLock lock(&pool.mutex);
+            FreeList &global = pool.lists[cls];
+            const uint64_t limit = s_global_cache_limit;
+            while (n-- > 0 && !lists[cls].empty()) {
+                void *ptr = lists[cls].pop();
+                if (global.count < limit) {
+                    global.push(ptr);
+                } else {
+                    overflow.push_back(ptr);
+                }
+            }
+        }
+        // 锁外释放内存
+        for (void *ptr : overflow) {
+            BackendDealloc(ptr, ClassSize(cls));
+        }
+    }
+};
+
+static thread_local ThreadStackCache t_stack_cache;
+
+void *PooledStackAllocator::Alloc(uint64_t size)
+{
+    const int cls = SizeClass(size);
+    if (cls < 0) {
+        ThreadStackCache::increase(t_stack_cache.misses);
+        return BackendAlloc(size);
+    }
+    FreeList &local = t_stack_cache.lists[cls];
+    if (!local.empty() || t_stack_cache.refill(cls)) {
+        ThreadStackCache::increase(t_stack_cache.hits);
+        return local.pop();
+    }
+    ThreadStackCache::increase(t_stack_cache.misses);
+    return BackendAlloc(ClassSize(cls));
+}
+
+void PooledStackAllocator::Dealloc(void *ptr, uint64_t size)
+{
+    if (!ptr) {
+        return;
+    }
+    const int cls = SizeClass(size);
+    if (cls < 0) {
+        BackendDealloc(ptr, size);
+        return;
+    }
+    FreeList &local = t_stack_cache.lists[cls];
+    local.push(ptr);
+    const uint64_t limit = s_thread_cache_limit;
+    if (local.count > limit) {
+        // 超过线程缓存上限，归还多出的部分以及一半的缓存，避免在上限附近反复与全局池交互
+        t_stack_cache.release(cls, local.count - limit / 2);
+    }
+}
+
+uint64_t PooledStackAllocator::GuardSize()
+{
+    return UseMmapBackend() ? MmapStackAllocator::GuardSize() : 0;
+}
+
+PooledStackAllocator::Stats PooledStackAllocator::GetStats()
+{
+    Stats stats;
+    auto &pool = GetGlobalPool();
+    ScopedLock lock(&pool.mutex);
+    stats.hits = pool.retiredHits;
+    stats.misses = pool.retiredMisses;
+    for (auto &list : pool.lists) {
+        stats.cached += list.count;
+    }
+    for (auto cache : pool.caches) {
+        stats.hits += cache->hits.load(std::memory_order_relaxed);
+        stats.misses += cache->misses.load(std::memory_order_relaxed);
+        for (auto &list : cache->lists) {
+            stats.cached += list.count.load(std::memory_order_relaxed);
+        }
+    }
+    return stats;
+}
+
+/* ------------------------------- SharedStack ------------------------------ */
+
+// 线程的共享栈，随线程退出而释放
+struct ThreadSharedStacks
+{
+    std::unique_ptr<SharedStack[]> stacks; // SharedStack 含有原子变量，不能放在需要移动元素的容器中
+    size_t count = 0;
+    size_t next = 0;
+
+    // NOTE 不能还给线程缓存：t_shared_stacks 可能先于 t_stack_cache 构造，线程退出时线程缓存已经析构，因此直接交给底层分配器释放
+    ~ThreadSharedStacks()
+    {
+        for (size_t i = 0; i < count; i++) {
+            if (stacks[i].memory) {
+                const int cls = SizeClass(stacks[i].size);
+                BackendDealloc(stacks[i].memory, cls < 0 ? stacks[i].size : ClassSize(cls));
+            }
+        }
+    }
+};
+
+static thread_local ThreadSharedStacks t_shared_stacks;
+
+SharedStack *SharedStack::Acquire()
+{
+    auto &shared = t_shared_stacks;
+    if (shared.count == 0) {
+        const uint64_t count = std::max<uint64_t>(g_shared_stack_count->getValue(), 1);
+        const uint64_t size = g_shared_stack_size->getValue();
+        shared.stacks = std::make_unique<SharedStack[]>(count);
+        shared.count = count;
+        for (size_t i = 0; i < count; i++) {
+            shared.stacks[i].memory = StackAllocator::Alloc(size);
+            shared.stacks[i].size = size;
+            shared.stacks[i].tid = utils::GetThreadID();
+        }
+    }
+    SharedStack *stack = &shared.stacks[shared.next];
+    shared.next = (shared.next + 1) % shared.count;
+    return stack;
+}
+
+bool SharedStack::HasBoundFibers()
+{
+    auto &shared = t_shared_stacks;
+    for (size_t i = 0; i < shared.count; i++) {
+        if (shared.stacks[i].bound > 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+} // namespace meha
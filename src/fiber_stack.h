@@ -0,0 +1,91 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+namespace meha
+{
+
+/**
+ * @brief 对 malloc/free 简单封装的内存分配器接口
+ * @details 封装一个通用的内存分配器的目的是用于以后的测试性能工作
+ * NOTE 这里没用多态是因为static方法不属于类的成员，而virtual只能用于成员方法
+ */
+struct HeapStackAllocator
+{
+    static void *Alloc(uint64_t size);
+    static void Dealloc(void *ptr, uint64_t size);
+};
+
+/**
+ * @brief 基于 mmap 的栈分配器
+ * @details 在栈的低地址端额外映射一个 PROT_NONE 的保护页，协程栈溢出时会立即触发 SIGSEGV，而不是悄悄踩坏相邻的内存；
+ * 映射使用 MAP_NORESERVE，物理页在第一次访问时才分配，因此栈的名义大小再大，实际占用的也只有用到的那部分。
+ * 每个栈占用2个内存映射，映射数量达到 vm.max_map_count 后，新的栈退回到不带保护页的分配（打印一次警告），而不是失败
+ * @note 返回的地址是保护页之上的可用栈空间的起始地址
+ */
+struct MmapStackAllocator
+{
+    static void *Alloc(uint64_t size);
+    static void Dealloc(void *ptr, uint64_t size);
+    // 保护页的大小（一个内存页）
+    static uint64_t GuardSize();
+};
+
+/**
+ * @brief 池化的协程栈分配器
+ * @details 栈按尺寸向上取整到2的幂划分为若干尺寸级别，每个线程为每个级别维护一条空闲链表，
+ * 热路径上的分配/释放只操作本线程的链表，不加锁也不调用底层分配器；
+ * 线程缓存超过上限时，多出的一半栈批量归还到全局池，本线程缓存为空时再从全局池批量取回；
+ * 全局池也超过上限时，才真正释放内存。
+ * 超过最大尺寸级别的栈不走池，直接使用底层分配器。
+ * 底层分配器由配置项 fiber.stack_backend 决定："mmap"（默认，带保护页的 MmapStackAllocator）或 "heap"（HeapStackAllocator），
+ * 该配置项只在第一次分配栈时读取一次，之后修改不生效（池中已有的栈必须用同一种方式释放）。
+ * 相关配置项：fiber.stack_pool.thread_cache、fiber.stack_pool.global_cache
+ */
+struct PooledStackAllocator
+{
+    struct Stats
+    {
+        uint64_t hits = 0; // 从池中取到栈的次数
+        uint64_t misses = 0; // 池中没有可用的栈，需要调用底层分配器的次数
+        uint64_t cached = 0; // 当前缓存在池中（包括各线程缓存与全局池）的栈数量
+    };
+
+    static void *Alloc(uint64_t size);
+    static void Dealloc(void *ptr, uint64_t size);
+    // 获取池的命中统计
+    static Stats GetStats();
+    // 栈空间低地址端的保护页大小，底层分配器不带保护页时返回 0
+    static uint64_t GuardSize();
+};
+
+// 协程栈空间分配器。起别名的作用是以后栈空间分配器换了别的，只需要更换这里的类型就行
+using StackAllocator = PooledStackAllocator;
+
+class Fiber;
+
+/**
+ * @brief 共享栈（copy-on-switch）
+ * @details 每个线程持有若干个共享栈（配置项 fiber.shared_stack.count、fiber.shared_stack.size），
+ * 共享栈模式的协程第一次换入时绑定到当前线程的某个共享栈上运行；
+ * 同一时刻一个共享栈上只保留一个协程（occupant）的栈内容，其他绑定到该栈的协程被换入前，
+ * 需要先把 occupant 的栈上存活的部分拷贝到它自己的堆内存中，再把要换入的协程保存的内容拷贝回来。
+ * @note 由于栈内容里可能有指向栈内的指针，协程只能在绑定的共享栈（也就是绑定的线程）上恢复执行
+ */
+struct SharedStack
+{
+    void *memory = nullptr; // 栈空间起始地址（低地址）
+    uint64_t size = 0; // 栈空间大小
+    int32_t tid = -1; // 所属线程
+    Fiber *occupant = nullptr; // 当前栈上保存着其栈内容的协程
+    std::atomic_uint32_t bound{0}; // 绑定到该栈上还没有结束的协程数量
+
+    // 轮流选取当前线程的一个共享栈（线程第一次调用时创建）
+    static SharedStack *Acquire();
+    // 当前线程的共享栈上是否还绑定着没有结束的协程（此时线程不能退出，否则这些协程再也无法恢复执行）
+    static bool HasBoundFibers();
+};
+
+} // namespace meha
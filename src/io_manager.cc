@@ -1,16 +1,23 @@
+#include <algorithm>
+#include <chrono>
 #include <cstring>
-#include <fcntl.h>
 #include <string>
+#include <type_traits>
 extern "C" {
 #include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
 #include <unistd.h>
 }
 
 #include "config.h"
+#include "fd_manager.h"
 #include "fiber.h"
 #include "io_manager.h"
+#include "module/hook.h"
 #include "module/log.h"
 
+#include "utils/clock.h"
 #include "utils/exception.h"
 
 namespace meha
@@ -18,53 +25,75 @@ namespace meha
 
 /* -------------------------------- FDContext ------------------------------- */
 
+FdContext::EventTimeout::EventTimeout(int fd, FdEvent event)
+    : fd(fd)
+    , event(event)
+    , timeout(&EventTimeout::OnTimeout, this)
+{
+}
+
+void FdContext::EventTimeout::OnTimeout(void *arg)
+{
+    auto self = static_cast<EventTimeout *>(arg);
+    self->timedOut = true;
+    self->iom->triggerEvent(self->fd, self->event);
+}
+
 FdContext::FdContext(int fd, FdEvent ev)
     : m_fd(fd)
     , m_events(ev)
+    , m_readTimeout(fd, FdEvent::Read)
+    , m_writeTimeout(fd, FdEvent::Write)
 {
 }
 
-FdContext::EpollOp FdContext::addEvent(FdEvent event, Fiber::FiberFunc callback)
+void FdContext::addEvent(FdEvent event, Fiber::FiberFunc callback, Scheduler::TaskKind kind)
 {
-    FdContext::EpollOp op = EpollOp::Err;
-    if (m_events == FdEvent::None) {
-        op = EpollOp::Add;
-    } else {
-        op = EpollOp::Mod;
-    }
     m_events = static_cast<FdEvent>(m_events | event);
-    setHandler(event, Scheduler::GetCurrent(), callback);
-    return op;
+    setHandler(event, Scheduler::GetCurrent(), std::move(callback), kind);
 }
 
-FdContext::EpollOp FdContext::delEvent(FdEvent event)
+void FdContext::delEvent(FdEvent event)
 {
-    FdContext::EpollOp op = EpollOp::Err;
-    if (m_events == FdEvent::Read || m_events == FdEvent::Write) {
-        op = EpollOp::Del;
-    } else {
-        op = EpollOp::Mod;
-    }
     m_events = static_cast<FdEvent>(m_events & ~event);
-    setHandler(event, nullptr, nullptr);
-    return op;
+    // 不能用setHandler，回调为空时它会把当前协程设为处理器
+    getHandler(event).reset(nullptr, std::monostate{});
 }
 
-void FdContext::emitEvent(FdEvent event)
+void FdContext::emitEvent(FdEvent event, Scheduler::TaskBatch *batch)
 {
     ASSERT(m_events & event);
     auto &handler = getHandler(event);
     if (!handler.isEmpty()) {
         ASSERT(handler.scheduler);
-        if (auto fp = std::get_if<Fiber::sptr>(&handler.handle)) {
-            handler.scheduler->schedule(*fp);
+        if (batch && handler.scheduler == Scheduler::GetCurrent()) {
+            if (auto fp = std::get_if<Fiber::sptr>(&handler.handle)) {
+                batch->add(std::move(*fp));
+            } else if (auto fc = std::get_if<Fiber::FiberFunc>(&handler.handle)) {
+                batch->add(std::move(*fc), handler.kind);
+            }
+        } else if (auto fp = std::get_if<Fiber::sptr>(&handler.handle)) {
+            handler.scheduler->schedule(std::move(*fp));
         } else if (auto fc = std::get_if<Fiber::FiberFunc>(&handler.handle)) {
-            handler.scheduler->schedule(*fc);
+            handler.scheduler->schedule(std::move(*fc), handler.kind);
         }
     }
     delEvent(event); // 清除触发状态
 }
 
+bool FdContext::prepareIO(FdEvent event)
+{
+    const bool was_ready = m_ready.fetch_and(~event) & event;
+    return was_ready || !(m_drained & event);
+}
+
+bool FdContext::markNotReady(FdEvent event)
+{
+    m_drained.fetch_or(event);
+    // IO执行期间到达的就绪通知已经锁存在m_ready中（通知同时会清除m_drained）
+    return !(m_ready & event);
+}
+
 FdContext::EventHandler &FdContext::getHandler(FdEvent event)
 {
     switch (event) {
@@ -77,15 +106,24 @@ FdContext::EventHandler &FdContext::getHandler(FdEvent event)
     }
 }
 
-void FdContext::setHandler(FdEvent event, Scheduler *scheduler, const Fiber::FiberFunc &callback)
+void FdContext::setHandler(FdEvent event, Scheduler *scheduler, Fiber::FiberFunc callback, Scheduler::TaskKind kind)
 {
     if (callback) {
-        getHandler(event).reset(scheduler, callback);
+        getHandler(event).reset(scheduler, std::move(callback), kind);
     } else {
         getHandler(event).reset(scheduler, Fiber::GetCurrent());
     }
 }
 
+FdContext::EventTimeout *FdContext::claimTimeout(FdEvent event)
+{
+    EventTimeout &timeout = event == FdEvent::Read ? m_readTimeout : m_writeTimeout;
+    if (timeout.claimed.exchange(true, std::memory_order_acquire)) {
+        return nullptr;
+    }
+    return &timeout;
+}
+
 /* -------------------------------- IOManager ------------------------------- */
 
 #define FIND_EVENT_LISTEN(fd, event)                      \
@@ -102,50 +140,348 @@ void FdContext::setHandler(FdEvent event, Scheduler *scheduler, const Fiber::Fib
         return false;                                     \
     }
 
-#define EVENT_LISTEN_ACTION(fd_ctx, action)                             \
-    ::epoll_event epevent{};                                            \
-    epevent.events = EPOLLET | fd_ctx->m_events;                        \
-    epevent.data.ptr = fd_ctx;                                          \
-    if (::epoll_ctl(m_epollFd, action, fd_ctx->m_fd, &epevent) == -1) { \
-        return false;                                                   \
-    }
-
 // IO最大超时时间配置项（默认1s一次）
 static ConfigItem<uint64_t>::sptr g_max_timeout{Config::Lookup<uint64_t>("io.max_timeout", 5000, "单位:ms")};
+// 多reactor
+static ConfigItem<bool>::sptr g_multi_reactor{Config::Lookup<bool>("io.multi_reactor", false, "是否每个工作线程使用自己的epoll（多reactor），仅在创建IOManager时读取")};
+static ConfigItem<std::string>::sptr g_reactor_policy{Config::Lookup<std::string>("io.reactor_policy", "round_robin", "多reactor模式下fd分配给工作线程的策略：round_robin（轮流分配）或 least_loaded（分配给fd最少的工作线程），仅在创建IOManager时读取")};
+// io_uring
+static ConfigItem<std::string>::sptr g_io_backend{Config::Lookup<std::string>("io.backend", "auto", "套接字IO的后端：auto（内核支持时使用io_uring，否则使用epoll），epoll 或 io_uring，仅在创建IOManager时读取")};
+static ConfigItem<uint64_t>::sptr g_uring_entries{Config::Lookup<uint64_t>("io.uring.entries", 256, "每个io_uring实例的SQ大小")};
+static ConfigItem<uint64_t>::sptr g_uring_buffers{Config::Lookup<uint64_t>("io.uring.buffers", 256, "每个io_uring实例的provided buffer数量（2的幂，0表示不使用provided buffer ring）")};
+static ConfigItem<uint64_t>::sptr g_uring_buffer_size{Config::Lookup<uint64_t>("io.uring.buffer_size", 4096, "每个provided buffer的大小")};
+// 忙轮询
+static ConfigItem<uint64_t>::sptr g_busy_poll_budget{Config::Lookup<uint64_t>("io.busy_poll.budget_us", 0, "空闲的工作线程阻塞在epoll_wait之前先忙轮询多久，单位:us，0表示不轮询，仅在创建IOManager时读取")};
+static ConfigItem<uint64_t>::sptr g_busy_poll_workers{Config::Lookup<uint64_t>("io.busy_poll.workers", 0, "只有序号小于该值的工作线程忙轮询，0表示所有工作线程，仅在创建IOManager时读取")};
+static ConfigItem<int>::sptr g_busy_poll_socket{Config::Lookup<int>("io.busy_poll.socket_us", 0, "接受的连接上设置的SO_BUSY_POLL，单位:us，0表示不设置，仅在创建IOManager时读取")};
+static ConfigItem<bool>::sptr g_busy_poll_prefer{Config::Lookup<bool>("io.busy_poll.prefer", false, "接受的连接上是否设置SO_PREFER_BUSY_POLL，仅在创建IOManager时读取")};
+// 定时器合并
+static ConfigItem<uint64_t>::sptr g_timer_slack{Config::Lookup<uint64_t>("io.timer_slack_us", 0, "定时器默认的宽限，单位:us，宽限内到期的定时器合并为一次唤醒，0表示准时到期，仅在创建IOManager时读取（之后可以用setTimerSlack修改）")};
+
+// 所有存活的IOManager（见ReleaseFd）。其他静态对象析构时仍可能关闭fd，所以不释放
+struct IOManagerInstances
+{
+    RWMutex mutex;
+    std::vector<IOManager *> list;
+};
+
+static IOManagerInstances &AllInstances()
+{
+    static auto instances = new IOManagerInstances;
+    return *instances;
+}
+
+/**
+ * @brief 等待epoll事件，超时精确到微秒
+ * @details epoll_wait的超时只能精确到ms，亚毫秒的定时器要么提前醒来空转，要么多等；epoll_pwait2（5.11）的超时是timespec。
+ * 不通过glibc调用（2.35才有封装），内核不支持时退回epoll_wait，超时向上取整到ms
+ */
+static int EpollWait(int epfd, epoll_event *events, int max_events, std::chrono::microseconds timeout)
+{
+    static std::atomic_bool s_pwait2_supported{true};
+    if (timeout.count() > 0 && s_pwait2_supported.load(std::memory_order_relaxed)) {
+        __kernel_timespec ts{};
+        ts.tv_sec = timeout.count() / 1000000;
+        ts.tv_nsec = timeout.count() % 1000000 * 1000;
+        const int result = static_cast<int>(::syscall(__NR_epoll_pwait2, epfd, events, max_events, &ts, nullptr, 0));
+        if (result >= 0 || errno != ENOSYS) {
+            return result;
+        }
+        s_pwait2_supported = false;
+    }
+    return ::epoll_wait(epfd, events, max_events, static_cast<int>(std::chrono::ceil<std::chrono::milliseconds>(timeout).count()));
+}
+
+// io_uring的CQE的user_data指向UringCompletion，链接超时的CQE的user_data最低位置1，为0的（取消操作）不需要处理
+struct IOManager::UringCompletion
+{
+    virtual ~UringCompletion() = default;
+    // 处理一个CQE，is_timeout表示是链接超时的CQE
+    virtual void complete(int32_t res, uint32_t flags, bool is_timeout) = 0;
+};
+
+// 等待一次io_uring操作的协程，位于该协程的栈上
+struct IOManager::UringWaiter : UringCompletion
+{
+    void complete(int32_t res, uint32_t flags, bool is_timeout) override
+    {
+        if (is_timeout) {
+            timedOut = res == -ETIME;
+        } else {
+            result.res = res;
+            result.flags = flags;
+        }
+        // 带超时的操作有两个CQE，都收到之后才能恢复协程，协程恢复后这个对象就失效了
+        if (pending.fetch_sub(1) == 1) {
+            --*inflight;
+            --fdCtx->m_uringOps;
+            auto resume_func = std::move(resume);
+            resume_func();
+        }
+    }
+
+    UringResult result;
+    std::atomic_int pending{1};
+    bool timedOut = false;
+    FdContext *fdCtx = nullptr;
+    std::atomic_size_t *inflight = nullptr; // 提交该操作的工作线程槽位的计数
+    ResumeFunc resume;
+};
+
+// 监听套接字的multishot accept：一次提交，每来一个连接产生一个CQE，直到出错或被取消（CQE没有IORING_CQE_F_MORE标记）
+struct IOManager::AcceptQueue : UringCompletion
+{
+    // 等待连接的协程，位于该协程的栈上
+    struct Waiter
+    {
+        int32_t res = 0;
+        ResumeFunc resume;
+    };
+
+    void complete(int32_t res, uint32_t flags, bool) override
+    {
+        std::vector<ResumeFunc> resumes;
+        bool destroy = false;
+        {
+            ScopedLock lock(&iom->m_acceptMutex);
+            auto wake = [&](int32_t result) {
+                Waiter *waiter = waiters.front();
+                waiters.pop_front();
+                waiter->res = result;
+                resumes.push_back(std::move(waiter->resume));
+            };
+            if (res >= 0) {
+                if (closed) {
+                    close_f(res);
+                } else if (!waiters.empty()) {
+                    wake(res);
+                } else {
+                    ready.push_back(res);
+                }
+            } else if (closed || res == -ECANCELED) {
+                // 监听套接字被关闭了
+                while (!waiters.empty()) {
+                    wake(-EBADF);
+                }
+            } else if (!waiters.empty()) {
+                wake(res);
+            }
+            if (!(flags & IORING_CQE_F_MORE)) {
+                armed = false;
+                --*inflight;
+                --fdCtx->m_uringOps;
+                if (closed) {
+                    destroy = true;
+                } else if (!waiters.empty()) {
+                    // 还有协程在等待，重新提交
+                    const int ret = iom->armAccept(this);
+                    while (ret < 0 && !waiters.empty()) {
+                        wake(ret);
+                    }
+                }
+            }
+        }
+        for (auto &resume : resumes) {
+            resume();
+        }
+        if (destroy) {
+            IOManager *manager = iom;
+            ScopedLock lock(&manager->m_acceptMutex);
+            auto &closing = manager->m_closingAccepts;
+            closing.erase(std::find_if(closing.begin(), closing.end(), [this](const std::unique_ptr<AcceptQueue> &queue) {
+                return queue.get() == this;
+            }));
+        }
+    }
+
+    IOManager *iom = nullptr;
+    int fd = -1;
+    FdContext *fdCtx = nullptr;
+    std::deque<int> ready; // 已经接受、还没有被取走的连接
+    std::deque<Waiter *> waiters;
+    bool armed = false;
+    bool closed = false; // 监听套接字已经关闭，收到最后一个CQE后销毁
+    std::atomic_size_t *inflight = nullptr; // 提交multishot accept的工作线程槽位的计数
+};
+
+// io_uring操作的结果转换为系统调用的返回值
+static ssize_t UringReturn(int32_t res)
+{
+    if (res < 0) {
+        errno = -res;
+        return -1;
+    }
+    return res;
+}
 
 IOManager *IOManager::GetCurrent()
 {
     return dynamic_cast<IOManager *>(Scheduler::GetCurrent());
 }
 
-IOManager::IOManager(size_t pool_size, bool use_caller)
-    : Scheduler(pool_size, use_caller)
-{
-    // 创建 epoll fd
-    m_epollFd = ::epoll_create(0xffff);
-    ASSERT(m_epollFd > 0);
-    // 创建管道，并加入 epoll 监听（统一事件源）
-    ASSERT(::pipe(m_ticklePipe) != -1);
-    // 最初需要创建监听管道的读端作为最初的监听对象
-    ::epoll_event event{};
-    event.data.fd = m_ticklePipe[0];
-    // 1. 设置监听读就绪，边缘触发模式
-    event.events = EPOLLIN | EPOLLET;
-    // 2. 将管道读取端设置为非阻塞模式
-    ASSERT(::fcntl(m_ticklePipe[0], F_SETFL, O_NONBLOCK) != -1);
-    // 3. 将管道读端加入 epoll 监听
-    ASSERT(::epoll_ctl(m_epollFd, EPOLL_CTL_ADD, m_ticklePipe[0], &event) != -1);
+IOManager::IOManager(size_t pool_size, bool use_caller, Strategy strategy)
+    : Scheduler(pool_size, use_caller, strategy)
+    // 多reactor模式下每个工作线程槽位一个定时器队列，外加一个共享队列
+    , TimerManager(g_multi_reactor->getValue() ? workerSlots() + 1 : 1)
+{
+    m_multiReactor = timerQueueCount() > 1;
+    const std::string policy = g_reactor_policy->getValue();
+    if (policy == "least_loaded") {
+        m_reactorPolicy = LeastLoaded;
+    } else if (policy != "round_robin") {
+        LOG_FMT_WARN(core, "未知的 io.reactor_policy: %s，使用 round_robin", policy.c_str());
+    }
+    // 多reactor模式下每个工作线程槽位一个reactor（包括弹性线程池扩容的槽位）
+    const size_t reactors = m_multiReactor ? workerSlots() : 1;
+    for (size_t i = 0; i < reactors; i++) {
+        auto reactor = std::make_unique<Reactor>();
+        // 创建 epoll fd
+        reactor->epollFd = ::epoll_create(0xffff);
+        ASSERT(reactor->epollFd > 0);
+        // 创建eventfd，并加入 epoll 监听（统一事件源）
+        // 非阻塞、边沿触发：每次写都会产生一次就绪通知，醒来后读一次就把计数清零，不必像管道那样逐字节读干净
+        reactor->eventFd = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        ASSERT(reactor->eventFd >= 0);
+        // 其他fd的data.ptr是FdContext，这里用Reactor自身的地址区分
+        ::epoll_event event{};
+        event.data.ptr = reactor.get();
+        event.events = EPOLLIN | EPOLLET;
+        ASSERT(::epoll_ctl(reactor->epollFd, EPOLL_CTL_ADD, reactor->eventFd, &event) != -1);
+        m_reactors.push_back(std::move(reactor));
+    }
+    m_uringInflight = std::make_unique<std::atomic_size_t[]>(workerSlots());
+    const std::string backend = g_io_backend->getValue();
+    if (backend == "io_uring" || backend == "auto") {
+        if (IOUring::IsSupported()) {
+            m_backend = Uring;
+        } else if (backend == "io_uring") {
+            LOG_WARN(core, "内核不支持io_uring，使用epoll");
+        }
+    } else if (backend != "epoll") {
+        LOG_FMT_WARN(core, "未知的 io.backend: %s，使用epoll", backend.c_str());
+    }
+    if (m_backend == Uring) {
+        // 每个reactor一个io_uring实例，ring的fd在CQ中有完成事件时可读，由该reactor的epoll一起等待（水平触发，收割完CQ就不再可读）
+        // 带超时的操作要在一次提交中放下两个链接在一起的SQE
+        const auto entries = static_cast<uint32_t>(std::max<uint64_t>(g_uring_entries->getValue(), 2));
+        for (auto &reactor : m_reactors) {
+            reactor->ring = std::make_unique<IOUring>(entries);
+            if (!reactor->ring->valid()) {
+                LOG_WARN(core, "创建io_uring实例失败，使用epoll");
+                m_backend = Epoll;
+                break;
+            }
+            const uint64_t buffers = g_uring_buffers->getValue();
+            if (buffers > 0 && !reactor->ring->setupBufferRing(static_cast<uint32_t>(buffers), static_cast<uint32_t>(g_uring_buffer_size->getValue()))) {
+                LOG_FMT_WARN(core, "注册provided buffer ring失败（io.uring.buffers: %lu）", buffers);
+            }
+            ::epoll_event event{};
+            event.data.ptr = reactor->ring.get();
+            event.events = EPOLLIN;
+            ASSERT(::epoll_ctl(reactor->epollFd, EPOLL_CTL_ADD, reactor->ring->fd(), &event) != -1);
+        }
+        if (m_backend == Epoll) {
+            for (auto &reactor : m_reactors) {
+                reactor->ring.reset();
+            }
+        }
+    }
+    m_busyPoll.budgetUs = g_busy_poll_budget->getValue();
+    m_busyPoll.workers = g_busy_poll_workers->getValue();
+    m_busyPoll.socketBusyPollUs = g_busy_poll_socket->getValue();
+    m_busyPoll.preferBusyPoll = g_busy_poll_prefer->getValue();
+    setTimerSlack(std::chrono::microseconds(g_timer_slack->getValue()));
     // 初始化 m_fdCtxs 池大小为256
     contextListResize(256);
+    auto &instances = AllInstances();
+    WriteScopedLock lock(&instances.mutex);
+    instances.list.push_back(this);
 }
 
 IOManager::~IOManager()
 {
     ASSERT_FMT(isStoped(), "IOManager销毁时，要求必须消费完里面的任务");
+    {
+        auto &instances = AllInstances();
+        WriteScopedLock lock(&instances.mutex);
+        instances.list.erase(std::find(instances.list.begin(), instances.list.end(), this));
+    }
+    // 已经接受、还没有被取走的连接
+    for (auto &[fd, queue] : m_acceptQueues) {
+        for (int client : queue->ready) {
+            close_f(client);
+        }
+    }
     // 关闭打开的文件标识符
-    ::close(m_epollFd);
-    ::close(m_ticklePipe[0]);
-    ::close(m_ticklePipe[1]);
+    for (auto &reactor : m_reactors) {
+        ::close(reactor->epollFd);
+        ::close(reactor->eventFd);
+    }
+}
+
+IOManager::Reactor &IOManager::currentReactor()
+{
+    const int index = GetWorkerIndex();
+    if (!m_multiReactor || index < 0) {
+        return *m_reactors[0];
+    }
+    return *m_reactors[index];
+}
+
+IOManager::Reactor &IOManager::assignReactor(FdContext *fd_ctx)
+{
+    if (fd_ctx->m_reactor >= 0) {
+        return *m_reactors[fd_ctx->m_reactor];
+    }
+    size_t index = 0;
+    if (m_multiReactor) {
+        // 只分配给有工作线程的reactor；读锁与工作线程退出互斥（见idle）
+        ReadScopedLock lock(&m_mutex);
+        const size_t count = m_reactors.size();
+        const size_t start = m_reactorPolicy == RoundRobin ? m_nextReactor++ : 0;
+        bool found = false;
+        // caller线程要到stop时才开始调度，只有没有其他工作线程时才分配给它
+        for (int pass = 0; pass < 2 && !found; pass++) {
+            for (size_t i = 0; i < count; i++) {
+                const size_t candidate = (start + i) % count;
+                const pid_t tid = workerThread(candidate);
+                if (tid == -1 || (pass == 0 && tid == callerThread())) {
+                    continue;
+                }
+                if (!found || (m_reactorPolicy == LeastLoaded && m_reactors[candidate]->fds < m_reactors[index]->fds)) {
+                    index = candidate;
+                    found = true;
+                }
+                if (m_reactorPolicy == RoundRobin) {
+                    break;
+                }
+            }
+        }
+    }
+    fd_ctx->m_reactor = static_cast<int>(index);
+    ++m_reactors[index]->fds;
+    return *m_reactors[index];
+}
+
+void IOManager::releaseReactor(FdContext *fd_ctx)
+{
+    if (fd_ctx->m_reactor < 0) {
+        return;
+    }
+    --m_reactors[fd_ctx->m_reactor]->fds;
+    fd_ctx->m_reactor = -1;
+}
+
+int IOManager::reactorOf(int fd) const
+{
+    ReadScopedLock lock(&m_mutex);
+    if (m_fdCtxs.size() <= static_cast<size_t>(fd)) {
+        return -1;
+    }
+    FdContext *fd_ctx = m_fdCtxs[fd].get();
+    lock.unLock();
+    ScopedLock lock2(&fd_ctx->m_mutex);
+    return fd_ctx->m_reactor;
 }
 
 void IOManager::contextListResize(size_t size)
@@ -158,38 +494,71 @@ void IOManager::contextListResize(size_t size)
     }
 }
 
-bool IOManager::subscribeEvent(int fd, FDEvent event, Fiber::FiberFunc callback)
+FdContext *IOManager::fetchFdContext(int fd)
 {
-    FdContext *fd_ctx = nullptr;
     ReadScopedLock lock(&m_mutex);
     // 从 FDContext 池中拿对象
     if (m_fdCtxs.size() > static_cast<size_t>(fd)) { // 对象池足够大
-        fd_ctx = m_fdCtxs[fd].get();
-        lock.unLock();
-    } else { // 对象池太小，扩容
-        lock.unLock();
-        WriteScopedLock lock2(&m_mutex);
-        contextListResize(m_fdCtxs.size() << 1);
-        fd_ctx = m_fdCtxs[fd].get();
+        return m_fdCtxs[fd].get();
     }
-    ScopedLock lock3(&fd_ctx->m_mutex);
-    // 如果要监听的事件已经存在，则覆盖它
-    if (fd_ctx->m_events & event) {
-        triggerEvent(fd, event);
+    // 对象池太小，扩容
+    lock.unLock();
+    WriteScopedLock lock2(&m_mutex);
+    if (m_fdCtxs.size() <= static_cast<size_t>(fd)) {
+        contextListResize(std::max(m_fdCtxs.size() << 1, static_cast<size_t>(fd) + 1));
     }
+    return m_fdCtxs[fd].get();
+}
 
-    EVENT_LISTEN_ACTION(fd_ctx, fd_ctx->addEvent(event, callback));
+bool IOManager::subscribeEvent(int fd, FDEvent event, Fiber::FiberFunc callback, Scheduler::TaskKind kind)
+{
+    FdContext *fd_ctx = fetchFdContext(fd);
+    const uint64_t generation = FileDescriptorManager::Instance()->generation(fd);
+    ScopedLock lock(&fd_ctx->m_mutex);
+    if (fd_ctx->m_registered && fd_ctx->m_generation != generation) {
+        // fd绕过hook的close被关闭后fd号又被复用了，原来的注册随旧的文件一起失效，按新的fd重新加入
+        LOG_FMT_DEBUG(core, "fd %d 被关闭后复用，重新加入epoll", fd);
+        detachFdContext(fd, fd_ctx);
+    }
+    // fd第一次监听事件时加入epoll，边沿触发地同时监听读写，此后监听、触发事件都不再需要epoll_ctl，直到fd关闭
+    if (!fd_ctx->m_registered) {
+        ::epoll_event epevent{};
+        epevent.events = EPOLLIN | EPOLLOUT | EPOLLET;
+        epevent.data.ptr = fd_ctx;
+        const int epoll_fd = assignReactor(fd_ctx).epollFd;
+        m_epollCtls.fetch_add(1, std::memory_order_relaxed);
+        if (::epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &epevent) == -1) {
+            // fd被关闭（没有经过triggerAllEvents）后，epoll中可能还留着复制出来的fd
+            if (errno != EEXIST || ::epoll_ctl(epoll_fd, EPOLL_CTL_MOD, fd, &epevent) == -1) {
+                return false;
+            }
+        }
+        fd_ctx->m_registered = true;
+        fd_ctx->m_generation = generation;
+        attachFd(fd, fd_ctx);
+    }
+    // 如果要监听的事件已经存在，则先触发原来的
+    if (fd_ctx->m_events & event) {
+        fd_ctx->emitEvent(event);
+        --m_pendingEvents;
+    }
+    fd_ctx->addEvent(event, std::move(callback), kind);
     ++m_pendingEvents;
+    // 就绪通知在没有等待者时就已经到达（锁存），边沿触发不会再通知一次，立即触发
+    // 消费锁存的通知时也要清除未就绪标记，否则被唤醒的IO会跳过系统调用，等待不会再来的通知
+    if (fd_ctx->m_ready.fetch_and(~event) & event) {
+        fd_ctx->m_drained.fetch_and(~event);
+        fd_ctx->emitEvent(event);
+        --m_pendingEvents;
+    }
     return true;
 }
 
 bool IOManager::unsubscribeEvent(int fd, FDEvent event)
 {
     FIND_EVENT_LISTEN(fd, event);
-    // 从对应的 fd_ctx 中删除该事件
-    EVENT_LISTEN_ACTION(fd_ctx, fd_ctx->delEvent(event));
-    // 如果该fd没有其他在监听的事件了，要从epoll对象中移除对该fd的监听
-    fd_ctx->getHandler(event).reset(nullptr, std::monostate{});
+    // fd仍然留在epoll中，之后的就绪通知会被锁存
+    fd_ctx->delEvent(event);
     --m_pendingEvents;
     return true;
 }
@@ -197,7 +566,6 @@ bool IOManager::unsubscribeEvent(int fd, FDEvent event)
 bool IOManager::triggerEvent(int fd, FDEvent event)
 {
     FIND_EVENT_LISTEN(fd, event);
-    EVENT_LISTEN_ACTION(fd_ctx, fd_ctx->delEvent(event));
     fd_ctx->emitEvent(event);
     --m_pendingEvents;
     return true;
@@ -214,15 +582,38 @@ bool IOManager::triggerAllEvents(int fd)
         fd_ctx = m_fdCtxs[fd].get();
     }
     ScopedLock lock(&(fd_ctx->m_mutex));
-    if (!fd_ctx->m_events) {
-        return true;
+    detachFdContext(fd, fd_ctx);
+    return true;
+}
+
+void IOManager::ReleaseFd(int fd)
+{
+    if (fd < 0) {
+        return;
     }
-    ::epoll_event epevent;
-    epevent.events = 0;
-    epevent.data.ptr = fd_ctx;
-    if (::epoll_ctl(m_epollFd, EPOLL_CTL_DEL, fd, &epevent) == -1) {
-        return false;
+    auto &instances = AllInstances();
+    ReadScopedLock lock(&instances.mutex);
+    for (IOManager *iom : instances.list) {
+        iom->triggerAllEvents(fd);
+        iom->uringCancel(fd);
+    }
+}
+
+void IOManager::detachFdContext(int fd, FdContext *fd_ctx)
+{
+    // fd即将被关闭，从epoll中移除，不再属于任何reactor，就绪状态也不再有效
+    if (fd_ctx->m_registered) {
+        ::epoll_event epevent{};
+        m_epollCtls.fetch_add(1, std::memory_order_relaxed);
+        if (::epoll_ctl(assignReactor(fd_ctx).epollFd, EPOLL_CTL_DEL, fd, &epevent) == -1) {
+            LOG_FMT_DEBUG(core, "epoll_ctl(DEL, %d): %s(%d)", fd, ::strerror(errno), errno);
+        }
+        fd_ctx->m_registered = false;
     }
+    releaseReactor(fd_ctx);
+    fd_ctx->m_attached.store(false, std::memory_order_relaxed);
+    fd_ctx->m_ready = 0;
+    fd_ctx->m_drained = 0;
     if (fd_ctx->m_events & FDEvent::Read) {
         fd_ctx->emitEvent(FDEvent::Read);
         --m_pendingEvents;
@@ -232,22 +623,417 @@ bool IOManager::triggerAllEvents(int fd)
         --m_pendingEvents;
     }
     fd_ctx->m_events = FDEvent::None;
+}
+
+void IOManager::attachFd(int fd, FdContext *fd_ctx)
+{
+    // 只有第一次需要登记，此后每次IO只是一次原子读
+    if (!fd_ctx->m_attached.load(std::memory_order_relaxed) && !fd_ctx->m_attached.exchange(true, std::memory_order_relaxed)) {
+        FileDescriptorManager::Instance()->attach(fd);
+    }
+}
+
+bool IOManager::wakeReactor(Reactor &reactor)
+{
+    // 没有线程阻塞在epoll_wait上时不必唤醒，它们回到epoll_wait之前会再检查一次任务队列（见idle）
+    // 已经写过eventfd、等待的线程还没有醒来处理时也不必再写，它醒来后会取走所有的任务
+    if (reactor.waiting == 0 || reactor.notified.exchange(1) == 1) {
+        return false;
+    }
+    m_wakeups.fetch_add(1, std::memory_order_relaxed);
+    const uint64_t one = 1;
+    if (::write(reactor.eventFd, &one, sizeof(one)) != sizeof(one)) {
+        throw meha::SystemError("写eventfd唤醒工作线程失败");
+    }
     return true;
 }
 
 void IOManager::tickle()
 {
-    if (hasIdler()) { // tickle动作本身是对idle协程起作用的，因此必须有idle协程
+    if (!m_multiReactor) {
+        wakeReactor(*m_reactors[0]);
         return;
     }
-    if (::write(m_ticklePipe[1], "T", 1) == -1) {
-        throw meha::SystemError("向子协程发送消息失败");
+    // 唤醒一个阻塞在epoll_wait上的工作线程，从轮转的位置开始找，避免总是唤醒同一个
+    const size_t count = m_reactors.size();
+    const size_t start = m_nextTickle++;
+    for (size_t i = 0; i < count; i++) {
+        if (wakeReactor(*m_reactors[(start + i) % count])) {
+            return;
+        }
     }
 }
 
+void IOManager::tickleThread(pid_t thread_id)
+{
+    for (size_t i = 0; i < workerSlots(); i++) {
+        if (workerThread(i) == thread_id) {
+            wake(i);
+            return;
+        }
+    }
+}
+
+void IOManager::wake(size_t worker)
+{
+    wakeReactor(m_multiReactor ? *m_reactors[worker] : *m_reactors[0]);
+}
+
+void IOManager::setupAcceptedSocket(int fd)
+{
+    if (m_busyPoll.socketBusyPollUs > 0 && setsockopt_f(fd, SOL_SOCKET, SO_BUSY_POLL, &m_busyPoll.socketBusyPollUs, sizeof(int)) == -1) {
+        // 超过 net.core.busy_read 需要 CAP_NET_ADMIN
+        LOG_FMT_DEBUG(core, "设置SO_BUSY_POLL失败: %s(%d)", ::strerror(errno), errno);
+    }
+    const int prefer = 1;
+    if (m_busyPoll.preferBusyPoll && setsockopt_f(fd, SOL_SOCKET, SO_PREFER_BUSY_POLL, &prefer, sizeof(prefer)) == -1) {
+        LOG_FMT_DEBUG(core, "设置SO_PREFER_BUSY_POLL失败: %s(%d)", ::strerror(errno), errno);
+    }
+}
+
+int IOManager::busyPoll(Reactor &reactor, epoll_event *events, int max_events)
+{
+    const auto deadline = utils::RefreshCoarseClock() + std::chrono::microseconds(m_busyPoll.budgetUs);
+    do {
+        // 轮询期间不计入waiting，tickle不会写eventfd，新任务由这里自己发现
+        if (hasRunnableTask() || isStoped() || getNextTimer().count() == 0) {
+            return 0;
+        }
+        m_epollWaits.fetch_add(1, std::memory_order_relaxed);
+        const int result = ::epoll_wait(reactor.epollFd, events, max_events, 0);
+        if (result > 0) {
+            return result;
+        }
+        // 每次轮询刷新一次缓存的时间，getNextTimer据此判断定时器是否到期
+    } while (utils::RefreshCoarseClock() < deadline);
+    return -1;
+}
+
 bool IOManager::isStoped() const
 {
-    return getNextTimer() == ~0ull && m_pendingEvents == 0 && Scheduler::isStoped();
+    return !hasTimer() && m_pendingEvents == 0 && Scheduler::isStoped();
+}
+
+IOManager::IOStats IOManager::getIOStats() const
+{
+    IOStats stats;
+    stats.epollWaits = m_epollWaits.load(std::memory_order_relaxed);
+    stats.epollCtls = m_epollCtls.load(std::memory_order_relaxed);
+    stats.wakeups = m_wakeups.load(std::memory_order_relaxed);
+    stats.ioCalls = m_ioCalls.load(std::memory_order_relaxed);
+    stats.uringOps = m_uringOps.load(std::memory_order_relaxed);
+    for (auto &reactor : m_reactors) {
+        if (reactor->ring) {
+            stats.uringEnters += reactor->ring->enterCount();
+        }
+    }
+    return stats;
+}
+
+bool IOManager::uringUsable() const
+{
+    if (m_backend != Uring || Scheduler::GetCurrent() != this || GetWorkerIndex() < 0 || IsRunningInline()) {
+        return false;
+    }
+    auto fiber = Fiber::GetCurrent();
+    return fiber && fiber->isScheduled() && fiber->boundThread() == -1;
+}
+
+template<typename Prep>
+IOManager::UringResult IOManager::uringWait(int fd, Prep &&prep, uint64_t timeout_ms)
+{
+    // SQ一直腾不出空位时最多重试的次数，每次重试前协程都换出一次
+    constexpr int kSubmitRetries = 16;
+    // 挂起动作只捕获一个指针，放得进std::function内部的缓冲区，不需要分配内存
+    struct
+    {
+        IOManager *iom;
+        std::remove_reference_t<Prep> *prep;
+        uint64_t timeoutMs;
+        bool submitted;
+        __kernel_timespec ts;
+        UringWaiter waiter;
+    } wait{this, &prep, timeout_ms, false, {}, {}};
+    wait.waiter.fdCtx = fetchFdContext(fd);
+    attachFd(fd, wait.waiter.fdCtx);
+    for (int attempt = 0; !wait.submitted; ++attempt) {
+        if (attempt > kSubmitRetries) {
+            LOG_FMT_WARN(core, "io_uring的SQ一直没有空位，放弃提交(fd=%d)", fd);
+            wait.waiter.result.res = -EAGAIN;
+            return wait.waiter.result;
+        }
+        // 协程换出之后才提交，否则操作完成时协程可能还没有换出
+        const bool suspended = suspend([&wait](ResumeFunc resume) {
+            IOManager *iom = wait.iom;
+            UringWaiter &waiter = wait.waiter;
+            waiter.resume = std::move(resume);
+            const int index = GetWorkerIndex();
+            Reactor &reactor = iom->currentReactor();
+            const bool has_timeout = wait.timeoutMs != static_cast<uint64_t>(-1);
+            const uint32_t count = has_timeout ? 2 : 1;
+            SpinScopedLock lock(&reactor.ringMutex);
+            IOUring &ring = *reactor.ring;
+            if (!ring.reserve(count)) {
+                // 内核拒绝提交（比如CQ溢出），先收割已完成的操作腾出CQ再试一次
+                lock.unLock();
+                iom->reapCompletions(reactor);
+                lock.lock();
+                if (!ring.reserve(count)) {
+                    // 什么都没有提交，恢复协程稍后重试
+                    lock.unLock();
+                    auto resume_func = std::move(waiter.resume);
+                    resume_func();
+                    return;
+                }
+            }
+            // 预留成功后取SQE不会失败；提交之后协程随时可能恢复，不能再访问它栈上的 wait
+            wait.submitted = true;
+            waiter.result.reactor = iom->m_multiReactor ? static_cast<size_t>(index) : 0;
+            waiter.inflight = &iom->m_uringInflight[index];
+            ++*waiter.inflight;
+            ++waiter.fdCtx->m_uringOps;
+            iom->m_uringOps.fetch_add(1, std::memory_order_relaxed);
+            io_uring_sqe *sqe = ring.getSqe();
+            ASSERT(sqe);
+            (*wait.prep)(sqe);
+            sqe->user_data = reinterpret_cast<uint64_t>(static_cast<UringCompletion *>(&waiter));
+            if (has_timeout) {
+                wait.ts.tv_sec = static_cast<int64_t>(wait.timeoutMs / 1000);
+                wait.ts.tv_nsec = static_cast<int64_t>(wait.timeoutMs % 1000 * 1000 * 1000);
+                sqe->flags |= IOSQE_IO_LINK;
+                io_uring_sqe *timeout_sqe = ring.getSqe();
+                ASSERT(timeout_sqe);
+                IOUring::PrepLinkTimeout(timeout_sqe, &wait.ts);
+                timeout_sqe->user_data = sqe->user_data | 1;
+                waiter.pending = 2;
+            }
+            const int ret = ring.submit();
+            lock.unLock();
+            if (ret < 0) {
+                // SQE留在SQ中，随下一次提交一起提交
+                LOG_FMT_WARN(core, "io_uring_enter失败: %s(%d)", ::strerror(-ret), -ret);
+            }
+            // 已经就绪的套接字IO在提交时就完成了，直接收割，不必等epoll唤醒
+            iom->reapCompletions(reactor);
+        });
+        ASSERT_FMT(suspended, "只能在本调度器的协程中通过io_uring执行IO（见uringUsable）");
+    }
+    if (wait.waiter.result.res == -ECANCELED) {
+        // 被链接超时取消，或者fd被关闭时取消
+        wait.waiter.result.res = wait.waiter.timedOut ? -ETIMEDOUT : -EBADF;
+    }
+    return wait.waiter.result;
+}
+
+void IOManager::reapCompletions(Reactor &reactor)
+{
+    struct Cqe
+    {
+        uint64_t userData;
+        int32_t res;
+        uint32_t flags;
+    };
+    if (!reactor.ring->hasCompletions()) {
+        return;
+    }
+    // 先取出所有CQE再处理，处理时不持有ring的锁（可能要重新提交）。
+    // 缓冲区按线程复用，稳定状态下不分配内存；单reactor模式下多个工作线程会同时收割同一个ring，按线程分开不需要再加锁
+    static thread_local std::vector<Cqe> t_cqes;
+    std::vector<Cqe> &cqes = t_cqes;
+    cqes.clear();
+    {
+        SpinScopedLock lock(&reactor.ringMutex);
+        reactor.ring->reap([&cqes](uint64_t user_data, int32_t res, uint32_t flags) {
+            cqes.push_back(Cqe{user_data, res, flags});
+        });
+    }
+    for (const Cqe &cqe : cqes) {
+        if (cqe.userData == 0) {
+            continue;
+        }
+        auto completion = reinterpret_cast<UringCompletion *>(cqe.userData & ~1ull);
+        completion->complete(cqe.res, cqe.flags, cqe.userData & 1);
+    }
+}
+
+ssize_t IOManager::uringRecv(int fd, void *buf, size_t len, int flags, uint64_t timeout_ms)
+{
+    return UringReturn(uringWait(
+                           fd, [=](io_uring_sqe *sqe) { IOUring::PrepRecv(sqe, fd, buf, len, flags); }, timeout_ms)
+                           .res);
+}
+
+ssize_t IOManager::uringSend(int fd, const void *buf, size_t len, int flags, uint64_t timeout_ms)
+{
+    return UringReturn(uringWait(
+                           fd, [=](io_uring_sqe *sqe) { IOUring::PrepSend(sqe, fd, buf, len, flags); }, timeout_ms)
+                           .res);
+}
+
+int IOManager::uringConnect(int fd, const sockaddr *addr, socklen_t addrlen, uint64_t timeout_ms)
+{
+    return static_cast<int>(UringReturn(uringWait(
+                                            fd, [=](io_uring_sqe *sqe) { IOUring::PrepConnect(sqe, fd, addr, addrlen); }, timeout_ms)
+                                            .res));
+}
+
+int IOManager::armAccept(AcceptQueue *queue)
+{
+    const int index = GetWorkerIndex();
+    Reactor &reactor = currentReactor();
+    int ret = 0;
+    {
+        SpinScopedLock lock(&reactor.ringMutex);
+        io_uring_sqe *sqe = reactor.ring->getSqe();
+        if (!sqe) {
+            return -EBUSY;
+        }
+        IOUring::PrepAccept(sqe, queue->fd, nullptr, nullptr, true);
+        sqe->user_data = reinterpret_cast<uint64_t>(static_cast<UringCompletion *>(queue));
+        ret = reactor.ring->submit();
+    }
+    if (ret < 0) {
+        LOG_FMT_WARN(core, "io_uring_enter失败: %s(%d)", ::strerror(-ret), -ret);
+    }
+    // 提交失败时SQE也已经在SQ中了，随下一次提交一起提交；CQE要拿到m_acceptMutex才能处理，此时还不会来
+    queue->armed = true;
+    queue->inflight = &m_uringInflight[index];
+    ++*queue->inflight;
+    ++queue->fdCtx->m_uringOps;
+    m_uringOps.fetch_add(1, std::memory_order_relaxed);
+    return 0;
+}
+
+int IOManager::uringAccept(int fd, sockaddr *addr, socklen_t *addrlen, uint64_t timeout_ms)
+{
+    int client = -1;
+    if (timeout_ms != static_cast<uint64_t>(-1)) {
+        // 带超时的accept提交单次accept和链接超时
+        client = static_cast<int>(uringWait(
+                                      fd, [=](io_uring_sqe *sqe) { IOUring::PrepAccept(sqe, fd, addr, addrlen, false); }, timeout_ms)
+                                      .res);
+        return static_cast<int>(UringReturn(client));
+    }
+    FdContext *fd_ctx = fetchFdContext(fd);
+    attachFd(fd, fd_ctx);
+    // 从就绪队列中取出一个连接，取不到时返回-1
+    auto take = [this, fd, fd_ctx]() -> int {
+        auto &queue = m_acceptQueues[fd];
+        if (!queue) {
+            queue = std::make_unique<AcceptQueue>();
+            queue->iom = this;
+            queue->fd = fd;
+            queue->fdCtx = fd_ctx;
+        }
+        if (queue->ready.empty()) {
+            return -1;
+        }
+        const int ready = queue->ready.front();
+        queue->ready.pop_front();
+        return ready;
+    };
+    {
+        ScopedLock lock(&m_acceptMutex);
+        client = take();
+    }
+    if (client < 0) {
+        AcceptQueue::Waiter waiter;
+        const bool suspended = suspend([&](ResumeFunc resume) {
+            {
+                ScopedLock lock(&m_acceptMutex);
+                // 挂起期间可能已经来了连接，也可能监听套接字已经被关闭（此时会重新创建就绪队列，accept关闭的fd得到EBADF）
+                waiter.res = take();
+                if (waiter.res < 0) {
+                    AcceptQueue *queue = m_acceptQueues[fd].get();
+                    const int ret = queue->armed ? 0 : armAccept(queue);
+                    if (ret == 0) {
+                        waiter.resume = std::move(resume);
+                        queue->waiters.push_back(&waiter);
+                        return;
+                    }
+                    waiter.res = ret;
+                }
+            }
+            resume();
+        });
+        ASSERT_FMT(suspended, "只能在本调度器的协程中通过io_uring执行IO（见uringUsable）");
+        client = waiter.res;
+    }
+    if (client < 0) {
+        return static_cast<int>(UringReturn(client));
+    }
+    // multishot accept不返回对端地址
+    if (addr && addrlen) {
+        m_ioCalls.fetch_add(1, std::memory_order_relaxed);
+        ::getpeername(client, addr, addrlen);
+    }
+    return client;
+}
+
+ssize_t IOManager::recvProvided(int fd, ProvidedBuffer &buffer, int flags, uint64_t timeout_ms)
+{
+    buffer.release();
+    if (!uringUsable() || !currentReactor().ring->hasBufferRing()) {
+        errno = ENOTSUP;
+        return -1;
+    }
+    const UringResult result = uringWait(
+        fd, [=](io_uring_sqe *sqe) { IOUring::PrepRecvProvided(sqe, fd, flags); }, timeout_ms);
+    // 对端关闭时也可能占用了一个缓冲区，同样要归还
+    if (result.flags & IORING_CQE_F_BUFFER) {
+        const auto bid = static_cast<uint16_t>(result.flags >> IORING_CQE_BUFFER_SHIFT);
+        buffer.m_iom = this;
+        buffer.m_reactor = result.reactor;
+        buffer.m_bid = bid;
+        buffer.m_data = m_reactors[result.reactor]->ring->bufferData(bid);
+        buffer.m_size = result.res > 0 ? static_cast<size_t>(result.res) : 0;
+    }
+    return UringReturn(result.res);
+}
+
+void IOManager::recycleBuffer(size_t reactor, uint16_t bid)
+{
+    SpinScopedLock lock(&m_reactors[reactor]->ringMutex);
+    m_reactors[reactor]->ring->recycleBuffer(bid);
+}
+
+void IOManager::uringCancel(int fd)
+{
+    if (m_backend != Uring) {
+        return;
+    }
+    {
+        ScopedLock lock(&m_acceptMutex);
+        auto iter = m_acceptQueues.find(fd);
+        if (iter != m_acceptQueues.end()) {
+            std::unique_ptr<AcceptQueue> queue = std::move(iter->second);
+            m_acceptQueues.erase(iter);
+            for (int client : queue->ready) {
+                close_f(client);
+            }
+            queue->ready.clear();
+            // multishot accept被取消后还有最后一个CQE，收到之后再销毁（等待的协程在那时以EBADF返回）
+            if (queue->armed) {
+                queue->closed = true;
+                m_closingAccepts.push_back(std::move(queue));
+            }
+        }
+    }
+    {
+        ReadScopedLock lock(&m_mutex);
+        if (m_fdCtxs.size() <= static_cast<size_t>(fd) || m_fdCtxs[fd]->m_uringOps == 0) {
+            return;
+        }
+    }
+    // 操作可能是在任意一个reactor上提交的，取消只对同一个ring中的操作有效
+    for (auto &reactor : m_reactors) {
+        SpinScopedLock lock(&reactor->ringMutex);
+        io_uring_sqe *sqe = reactor->ring->getSqe();
+        if (sqe) {
+            IOUring::PrepCancelFd(sqe, fd);
+            reactor->ring->submit();
+        }
+    }
 }
 
 void IOManager::idle()
@@ -255,18 +1041,56 @@ void IOManager::idle()
     // 一次epoll_wait最多检测256个就绪事件，如果就绪事件超过了这个数，那么会在下轮epoll_wati继续处理
     const uint64_t MAX_EVNETS = 256;
     auto event_list = std::make_unique<epoll_event[]>(MAX_EVNETS);
+    // 单reactor模式下所有工作线程等待同一个epoll，多reactor模式下只等待自己的
+    Reactor &reactor = currentReactor();
+    // 超时的定时器回调，在循环外创建以复用内存
+    std::vector<Fiber::FiberFunc> fns;
+    std::vector<Fiber::FiberFunc> inline_fns;
+    // 当前线程开始缓存时间，每轮循环刷新，定时器和日志读取缓存的时间
+    utils::StartCoarseClock();
+    auto stop_clock = utils::GenScopeGuard([]() {
+        utils::StopCoarseClock();
+    });
+    // 最近一次有事件或者新任务的时间，用于弹性线程池的空闲退出
+    uint64_t last_active_ms = utils::CoarseMonotonicUS().count() / 1000;
+    // 当前工作线程是否忙轮询
+    const bool busy_poll = m_busyPoll.budgetUs > 0 && (m_busyPoll.workers == 0 || static_cast<size_t>(GetWorkerIndex()) < m_busyPoll.workers);
 
     while (true) {
+        // 执行任务期间时间不会刷新
+        utils::RefreshCoarseClock();
         if (isStoped()) {
+            // 停止条件可能是由其他线程上最后一个任务的结束达成的，发现的线程负责唤醒仍阻塞在epoll_wait上的线程，不必等到超时
+            if (m_multiReactor) {
+                for (auto &other : m_reactors) {
+                    wakeReactor(*other);
+                }
+            } else {
+                wakeReactor(reactor);
+            }
             break;
         }
 
-        int result = 0;
-        while (true) {
+        // 忙轮询用完了轮询时间才阻塞在epoll_wait上
+        int result = busy_poll ? busyPoll(reactor, event_list.get(), MAX_EVNETS) : -1;
+        while (result < 0) {
             // 默认超时时间5秒，如果下一个定时器的超时时间大于5秒，仍以5秒来计算超时，避免定时器超时时间太大时，epoll_wait一直阻塞
-            uint64_t next_timeout_ms = std::min(getNextTimer(), g_max_timeout->getValue());
+            // 定时器的等待时间精确到微秒，亚毫秒的定时器不会因为取整成0而空转
+            std::chrono::microseconds next_timeout = std::min<std::chrono::microseconds>(getNextTimer(), std::chrono::milliseconds(g_max_timeout->getValue()));
+            // 线程池会缩容时，最多等到空闲超时就要醒来检查一次
+            if (m_idleTimeout > 0) {
+                next_timeout = std::min<std::chrono::microseconds>(next_timeout, std::chrono::milliseconds(m_idleTimeout));
+            }
+            // 先声明自己要阻塞在epoll_wait上，再检查一次有没有任务（以及是否要停止），与入队（停止）后tickle的顺序相反，保证不会错过唤醒
+            ++reactor.waiting;
+            if (hasRunnableTask() || isStoped()) {
+                next_timeout = std::chrono::microseconds(0);
+            }
             // 阻塞等待 epoll 返回结果
-            result = ::epoll_wait(m_epollFd, event_list.get(), MAX_EVNETS, static_cast<int>(next_timeout_ms));
+            m_epollWaits.fetch_add(1, std::memory_order_relaxed);
+            result = EpollWait(reactor.epollFd, event_list.get(), MAX_EVNETS, next_timeout);
+            --reactor.waiting;
+            utils::RefreshCoarseClock();
 
             if (result < 0 && errno != EINTR) {
                 LOG_FMT_WARN(core, "调度器@%p epoll_wait异常: %s(%d)", this, ::strerror(errno), errno);
@@ -279,21 +1103,36 @@ void IOManager::idle()
         }
 
         // FIXME 收集所有已超时的定时器，调度执行超时回调函数 这里的超时事件不精确吧？只有在跳出循环外才会走到并处理
-        std::vector<Fiber::FiberFunc> fns;
-        listExpiredCallback(fns);
-        if (!fns.empty()) {
-            schedule(fns.begin(), fns.end());
+        // 内部的定时器回调（只是重新调度某个协程）作为内联任务执行，无需为每个回调创建协程；用户的定时器回调可能做IO、挂起，仍在协程中执行
+        // 超时的定时器回调与就绪事件的回调放在同一批任务中，最后只提交一次
+        TaskBatch batch;
+        fns.clear();
+        inline_fns.clear();
+        listExpiredCallback(fns, &inline_fns);
+        for (auto &fn : inline_fns) {
+            batch.add(std::move(fn), Inline);
+        }
+        for (auto &fn : fns) {
+            batch.add(std::move(fn));
         }
+        bool active = !batch.empty();
 
         // 遍历 event_list 处理被触发事件的 fd
         for (int i = 0; i < result; i++) {
             ::epoll_event &ev = event_list[i];
-            // 处理来自主线程的消息
-            if (ev.data.fd == m_ticklePipe[0]) {
-                char dummy;
-                // 将来自主线程的tickle数据读取干净（读不出东西了或者读到来异常）
-                while (::read(ev.data.fd, &dummy, 1) > 0)
-                    ;
+            // 被tickle唤醒：读一次把eventfd的计数清零，此后的tickle才需要再写eventfd
+            if (ev.data.ptr == &reactor) {
+                uint64_t count;
+                m_wakeups.fetch_add(1, std::memory_order_relaxed);
+                (void)::read(reactor.eventFd, &count, sizeof(count));
+                reactor.notified = 0;
+                active = true;
+                continue;
+            }
+            // io_uring中有完成的操作，恢复等待的协程
+            if (reactor.ring && ev.data.ptr == reactor.ring.get()) {
+                reapCompletions(reactor);
+                active = true;
                 continue;
             }
             // 处理非主线程的消息
@@ -307,40 +1146,53 @@ void IOManager::idle()
             if (ev.events & (EPOLLERR | EPOLLHUP)) {
                 ev.events |= EPOLLIN | EPOLLOUT;
             }
-            auto real_events = FDEvent::None;
+            uint32_t real_events = FDEvent::None;
             if (ev.events & EPOLLIN) {
-                real_events = static_cast<FDEvent>(real_events | FDEvent::Read);
+                real_events |= FDEvent::Read;
             }
             if (ev.events & EPOLLOUT) {
-                real_events = static_cast<FDEvent>(real_events | FDEvent::Write);
+                real_events |= FDEvent::Write;
             }
-            // fd_ctx 中指定监听的事件都已经被触发并处理
-            if ((fd_ctx->m_events & real_events) == FDEvent::None) {
-                continue;
+            // 没有等待者的事件锁存起来，留给下一次IO或者监听
+            const uint32_t latched = real_events & ~fd_ctx->m_events;
+            if (latched) {
+                fd_ctx->m_ready.fetch_or(latched);
             }
-            // 下面是处理该 fd 上的就绪事件
-            // 从 epoll 中移除这个 fd 的被触发的事件的监听
-
-            // fd_ctx->delEvent(real_events);
-            // EVENT_LISTEN_ACTION(fd_ctx, EPOLL_CTL_DEL);
-
-            uint32_t left_events = (fd_ctx->m_events & ~real_events);
-            int op = left_events == 0 ? EPOLL_CTL_DEL : EPOLL_CTL_MOD;
-            ev.events = EPOLLET | left_events;
-            int ret = ::epoll_ctl(m_epollFd, op, fd_ctx->m_fd, &ev);
-            // epoll 事件修改失败，打印一条 ERROR 日志，不做任何处理
-            if (ret == -1) {
-                LOG_FMT_ERROR(core, "epoll_ctl(%d, %d, %d, %ul): return %d, errno %s(%d)", m_epollFd, op, fd_ctx->m_fd, ev.events, ret, ::strerror(errno), errno);
+            // fd一直留在epoll中（边沿触发），这里不需要epoll_ctl。有新的就绪通知，之前的EAGAIN不再说明未就绪
+            // 必须先锁存再清除：markNotReady不持有fd_ctx->m_mutex，在两步之间标记未就绪的IO要能看到锁存的通知
+            fd_ctx->m_drained.fetch_and(~real_events);
+            real_events &= fd_ctx->m_events;
+            if (real_events == FDEvent::None) {
+                continue;
             }
             // 触发该 fd 对应的事件的处理器
             if (real_events & FDEvent::Read) {
-                fd_ctx->emitEvent(FDEvent::Read);
+                fd_ctx->emitEvent(FDEvent::Read, &batch);
                 --m_pendingEvents;
             }
             if (real_events & FDEvent::Write) {
-                fd_ctx->emitEvent(FDEvent::Write);
+                fd_ctx->emitEvent(FDEvent::Write, &batch);
                 --m_pendingEvents;
             }
+            active = true;
+        }
+        // 多reactor模式下事件回调留在当前工作线程上执行（它刚刚访问过这些fd），忙不过来时才会被其他工作线程窃取
+        if (m_multiReactor) {
+            scheduleLocal(std::move(batch));
+        } else {
+            schedule(std::move(batch));
+        }
+        // 空闲太久（一直没有就绪事件、超时的定时器和新任务）的工作线程退出线程池
+        const uint64_t now_ms = utils::CoarseMonotonicUS().count() / 1000;
+        if (active) {
+            last_active_ms = now_ms;
+        } else if (m_idleTimeout > 0 && now_ms - last_active_ms >= m_idleTimeout) {
+            // 多reactor模式下自己的reactor上还有fd、自己的队列中还有定时器时不能退出；持有写锁，避免检查之后又有fd分配过来
+            // 线程退出时内核会取消它提交的io_uring操作，因此还有未完成的操作时也不能退出
+            WriteScopedLock lock(&m_mutex);
+            if ((!m_multiReactor || (reactor.fds == 0 && timerCount(GetWorkerIndex()) == 0)) && m_uringInflight[GetWorkerIndex()] == 0 && tryRetireWorker()) {
+                break;
+            }
         }
         // 让出当前线程的执行权，给调度器执行其他排队等待的协程（IO协程调度器的好处）
         Fiber::sptr current_fiber = Fiber::GetCurrent();
@@ -350,9 +1202,66 @@ void IOManager::idle()
     }
 }
 
-void IOManager::onTimerInsertedAtFront()
+void IOManager::onTimerInsertedAtFront(size_t queue)
+{
+    if (queue == sharedTimerQueue()) {
+        // 共享队列由所有工作线程处理，唤醒任意一个
+        tickle();
+    } else if (queue != currentTimerQueue()) {
+        // 其他线程重设了该工作线程的定时器
+        wake(queue);
+    }
+}
+
+size_t IOManager::currentTimerQueue() const
 {
-    tickle();
+    const int index = GetWorkerIndex();
+    if (!m_multiReactor || index < 0 || Scheduler::GetCurrent() != this) {
+        return sharedTimerQueue();
+    }
+    return static_cast<size_t>(index);
+}
+
+/* ----------------------------- ProvidedBuffer ----------------------------- */
+
+IOManager::ProvidedBuffer::ProvidedBuffer(ProvidedBuffer &&other) noexcept
+    : m_iom(other.m_iom)
+    , m_reactor(other.m_reactor)
+    , m_bid(other.m_bid)
+    , m_data(other.m_data)
+    , m_size(other.m_size)
+{
+    other.m_iom = nullptr;
+    other.m_data = nullptr;
+    other.m_size = 0;
+}
+
+IOManager::ProvidedBuffer &IOManager::ProvidedBuffer::operator=(ProvidedBuffer &&other) noexcept
+{
+    if (this != &other) {
+        release();
+        std::swap(m_iom, other.m_iom);
+        m_reactor = other.m_reactor;
+        m_bid = other.m_bid;
+        m_data = std::exchange(other.m_data, nullptr);
+        m_size = std::exchange(other.m_size, 0);
+    }
+    return *this;
+}
+
+IOManager::ProvidedBuffer::~ProvidedBuffer()
+{
+    release();
+}
+
+void IOManager::ProvidedBuffer::release()
+{
+    if (m_iom) {
+        m_iom->recycleBuffer(m_reactor, m_bid);
+        m_iom = nullptr;
+    }
+    m_data = nullptr;
+    m_size = 0;
 }
 
 #undef FIND_EVENT_LISTEN
@@ -3,14 +3,18 @@
 #include <atomic>
 #include <memory>
 #include <sys/epoll.h>
+#include <unordered_map>
 #include <variant>
 
+#include "io_uring.h"
 #include "scheduler.h"
 #include "timer.h"
 
 namespace meha
 {
 
+class IOManager;
+
 /**
  * @brief fd就绪事件上下文
  * @details <fd, event, callback>
@@ -23,54 +27,101 @@ public:
     enum FdEvent { None = 0x0,
                    Read = 0x1,
                    Write = 0x4 };
-    enum EpollOp {
-        Err = 0,
-        Add = EPOLL_CTL_ADD,
-        Mod = EPOLL_CTL_MOD,
-        Del = EPOLL_CTL_DEL,
-    };
     struct EventHandler
     {
         Scheduler *scheduler = nullptr; // 指定处理该事件的调度器
         std::variant<std::monostate, Fiber::sptr, Fiber::FiberFunc> handle = std::monostate{}; // 处理该事件的回调句柄
+        Scheduler::TaskKind kind = Scheduler::Coroutine; // 回调是可调用对象时以何种任务执行
         bool isEmpty() const
         {
             return std::holds_alternative<std::monostate>(handle);
         }
         // 重设当前EventHandler
-        void reset(Scheduler *sche, const decltype(handle) &cb)
+        void reset(Scheduler *sche, decltype(handle) cb, Scheduler::TaskKind task_kind = Scheduler::Coroutine)
         {
             scheduler = sche;
-            handle = cb;
+            handle = std::move(cb);
+            kind = task_kind;
         }
     };
+    /**
+     * @brief 等待事件的超时（见hook的doIO），随FdContext一起分配，每次等待不需要再分配内存
+     * @details 超时后标记timedOut并提前触发事件，等待的协程醒来、取消超时之后据此以ETIMEDOUT返回；
+     * 同一个事件同时只有一个等待的协程能占用它（见claimTimeout），其他的自己分配
+     * @note 不能放在协程栈上：共享栈协程挂起后栈会被换出
+     */
+    struct EventTimeout
+    {
+        EventTimeout(int fd, FdEvent event);
+        // 超时回调，arg是EventTimeout
+        static void OnTimeout(void *arg);
+
+        IOManager *iom = nullptr; // 添加超时的IOManager
+        const int fd;
+        const FdEvent event;
+        bool timedOut = false; // 是否已经超时，取消超时之后才能读取
+        std::atomic_bool claimed{false}; // 是否被等待的协程占用
+        std::atomic_bool armed{false}; // 监听事件之后是否已经加入了超时，等待的协程恢复后要等它为true才能取消超时
+        Timeout timeout;
+    };
 
 public:
     explicit FdContext(int fd, FdEvent ev = FdEvent::None);
 
     // 添加监听指定的事件
-    EpollOp addEvent(FdEvent event, Fiber::FiberFunc callback);
+    void addEvent(FdEvent event, Fiber::FiberFunc callback, Scheduler::TaskKind kind = Scheduler::Coroutine);
     // 取消监听指定的事件
-    EpollOp delEvent(FdEvent event);
-    // 触发事件，然后删除该事件相关的信息
-    void emitEvent(FdEvent event);
+    void delEvent(FdEvent event);
+    /**
+     * @brief 触发事件，然后删除该事件相关的信息
+     * @param batch 不为空时，由当前调度器处理的事件回调加入该批量任务，而不是逐个提交
+     */
+    void emitEvent(FdEvent event, Scheduler::TaskBatch *batch = nullptr);
 
     // 获取指定事件的处理器
     EventHandler &getHandler(FdEvent event);
     // 设置指定事件的处理器
-    void setHandler(FdEvent event, Scheduler *scheduler, const Fiber::FiberFunc &callback);
+    void setHandler(FdEvent event, Scheduler *scheduler, Fiber::FiberFunc callback, Scheduler::TaskKind kind = Scheduler::Coroutine);
+    /**
+     * @brief 占用指定事件的超时 thread-safe
+     * @return 已经被其他等待的协程占用时返回nullptr，不再使用时将claimed置为false
+     */
+    EventTimeout *claimTimeout(FdEvent event);
+
+    /**
+     * @brief 执行IO之前调用，消费锁存的就绪事件 thread-safe
+     * @return 为false时该事件已知未就绪（上次IO返回EAGAIN之后还没有新的就绪通知），不必执行IO，直接等待
+     */
+    bool prepareIO(FdEvent event);
+    /**
+     * @brief IO返回EAGAIN之后调用，标记该事件未就绪 thread-safe
+     * @return 为false时执行IO之后又收到了就绪通知，应该立即重试而不是等待
+     */
+    bool markNotReady(FdEvent event);
 
 private:
     mutable Mutex m_mutex;
     int m_fd; // 要监听的文件描述符
-    FdEvent m_events = FdEvent::None; // 要监听的事件掩码集
+    FdEvent m_events = FdEvent::None; // 有等待者的事件掩码集
     EventHandler m_readHandler; // 读就绪事件处理器
     EventHandler m_writeHandler; // 写就绪事件处理器
+    EventTimeout m_readTimeout; // 等待读就绪的超时
+    EventTimeout m_writeTimeout; // 等待写就绪的超时
+    int m_reactor = -1; // 该fd所属的reactor（见IOManager::Reactor），第一次监听事件时分配，fd关闭时释放
+    bool m_registered = false; // 是否已经加入epoll：第一次监听事件时以 EPOLLIN|EPOLLOUT|EPOLLET 加入，此后不再修改，fd关闭时才移除
+    uint64_t m_generation = 0; // 加入epoll时fd的包装对象的代数（见FileDescriptor::generation），与当前的不同说明fd绕过hook的close被关闭后又被复用了
+    std::atomic_uint32_t m_ready{0}; // 锁存的就绪事件：epoll通知就绪时没有等待者的事件，下一次IO或者监听时消费
+    std::atomic_uint32_t m_drained{0}; // 已知未就绪的事件：IO返回了EAGAIN，此后还没有新的就绪通知
+    std::atomic_uint32_t m_uringOps{0}; // 该fd上未完成的io_uring操作数量，fd关闭时不为0就要取消这些操作
+    std::atomic_bool m_attached{false}; // 是否已经在FileDescriptorManager中登记（见 IOManager::attachFd），fd关闭时清除
 };
 
 /**
  * @brief IO协程调度
- * @details 用于监听套接字
+ * @details 用于监听套接字。默认所有工作线程共用一个epoll（单reactor）；开启 io.multi_reactor 后每个工作线程有自己的epoll（多reactor），
+ * fd第一次监听事件时按 io.reactor_policy 分配给一个工作线程，此后该fd的事件只由这个工作线程等待，事件回调也优先在这个工作线程上执行。
+ * io.backend 为 io_uring 时每个reactor还有一个io_uring实例，hook的套接字IO直接作为SQE提交，协程挂起直到拿到CQE的结果。
+ * 多reactor模式下定时器也按工作线程分开：工作线程创建的定时器只由它自己等待和处理，计算epoll_wait的超时不需要访问其他线程的定时器
  */
 class IOManager final : public Scheduler, public TimerManager
 {
@@ -78,12 +129,87 @@ public:
     using sptr = std::shared_ptr<IOManager>;
     using FDEvent = FdContext::FdEvent;
 
+    // 多reactor模式下把fd分配给reactor的策略
+    enum ReactorPolicy {
+        RoundRobin, // 轮流分配
+        LeastLoaded, // 分配给fd最少的reactor
+    };
+    // 套接字IO的后端
+    enum Backend {
+        Epoll, // 尝试系统调用，EAGAIN时监听就绪事件，就绪后再重试
+        Uring, // 直接把IO操作提交给io_uring，完成后带着结果恢复协程
+    };
+
+    /**
+     * @brief IO相关的系统调用统计（用于对比不同后端的开销）
+     */
+    struct IOStats
+    {
+        uint64_t epollWaits = 0; // epoll_wait的次数
+        uint64_t epollCtls = 0; // epoll_ctl的次数
+        uint64_t wakeups = 0; // 唤醒工作线程时读写eventfd的次数
+        uint64_t ioCalls = 0; // hook直接发起的IO系统调用次数
+        uint64_t uringEnters = 0; // io_uring_enter的次数
+        uint64_t uringOps = 0; // 提交给io_uring的IO操作数量
+        // 以上系统调用的总数
+        uint64_t syscalls() const
+        {
+            return epollWaits + epollCtls + wakeups + ioCalls + uringEnters;
+        }
+    };
+
+    /**
+     * @brief 忙轮询设置：用CPU换延迟，默认值来自 io.busy_poll.*
+     */
+    struct BusyPollOptions
+    {
+        uint64_t budgetUs = 0; // 空闲的工作线程阻塞在epoll_wait之前，先用不阻塞的epoll_wait轮询多久（us），0表示不轮询
+        size_t workers = 0; // 只有序号小于该值的工作线程轮询，0表示所有工作线程
+        int socketBusyPollUs = 0; // 接受的连接上设置的SO_BUSY_POLL（us，让内核在recv时轮询网卡队列），0表示不设置
+        bool preferBusyPoll = false; // 接受的连接上是否设置SO_PREFER_BUSY_POLL
+    };
+
+    /**
+     * @brief 从io_uring的provided buffer ring中取得的接收缓冲区，析构时还给内核
+     * @note 不能在IOManager销毁之后析构
+     */
+    class ProvidedBuffer
+    {
+        friend class IOManager;
+
+    public:
+        ProvidedBuffer() = default;
+        ProvidedBuffer(ProvidedBuffer &&other) noexcept;
+        ProvidedBuffer &operator=(ProvidedBuffer &&other) noexcept;
+        ~ProvidedBuffer();
+        const char *data() const
+        {
+            return m_data;
+        }
+        size_t size() const
+        {
+            return m_size;
+        }
+        // 提前归还缓冲区
+        void release();
+
+    private:
+        IOManager *m_iom = nullptr;
+        size_t m_reactor = 0; // 缓冲区所属的reactor
+        uint16_t m_bid = 0;
+        const char *m_data = nullptr;
+        size_t m_size = 0;
+    };
+
 public:
-    explicit IOManager(size_t pool_size, bool use_caller = true);
+    explicit IOManager(size_t pool_size, bool use_caller = true, Strategy strategy = FCFS);
     ~IOManager() override;
 
-    // thread-safe 给指定的 fd 增加事件监听，当 callback 是 nullptr 时，将当前上下文转换为协程，并作为事件回调使用
-    bool subscribeEvent(int fd, FDEvent event, Fiber::FiberFunc callback = nullptr);
+    /**
+     * @brief thread-safe 给指定的 fd 增加事件监听，当 callback 是 nullptr 时，将当前上下文转换为协程，并作为事件回调使用
+     * @param kind callback 以何种任务执行：只是唤醒挂起协程的回调（见 Scheduler::suspend）应以 Inline 执行，省去一个协程
+     */
+    bool subscribeEvent(int fd, FDEvent event, Fiber::FiberFunc callback = nullptr, Scheduler::TaskKind kind = Scheduler::Coroutine);
     // thread-safe 给指定的 fd 移除指定的事件监听
     bool unsubscribeEvent(int fd, FDEvent event);
     // thread-safe 立即触发指定 fd 的指定的事件回调，然后移除该事件
@@ -92,20 +218,191 @@ public:
     bool triggerAllEvents(int fd);
 
     static IOManager *GetCurrent();
+    /**
+     * @brief fd关闭之前调用 thread-safe
+     * @details 在所有存活的IOManager中触发该fd上等待的事件、把它移出epoll、取消它上面的io_uring操作，不要求在工作线程上调用。
+     * hook的close不论是否开启hook，只要有IOManager持有该fd的状态（见 FileDescriptorManagerImpl::remove）就会调用它；
+     * 绕过hook关闭的fd（close_f、dup2等）由subscribeEvent按FileDescriptor的代数发现
+     */
+    static void ReleaseFd(int fd);
+
+    // 是否是多reactor模式
+    bool isMultiReactor() const
+    {
+        return m_multiReactor;
+    }
+    ReactorPolicy reactorPolicy() const
+    {
+        return m_reactorPolicy;
+    }
+    // reactor的数量（多reactor模式下等于工作线程槽位的数量）
+    size_t reactorCount() const
+    {
+        return m_reactors.size();
+    }
+    // 分配到指定reactor上的fd数量
+    size_t reactorLoad(size_t index) const
+    {
+        return m_reactors[index]->fds;
+    }
+    // fd所属的reactor，还没有分配时返回-1 thread-safe
+    int reactorOf(int fd) const;
+    // 获取fd的上下文，对象池不够大时扩容（上下文对象一直有效，fd关闭后被复用）thread-safe
+    FdContext *fetchFdContext(int fd);
+
+    Backend backend() const
+    {
+        return m_backend;
+    }
+    // 修改本实例的忙轮询设置，要在start之前调用
+    void setBusyPoll(const BusyPollOptions &options)
+    {
+        m_busyPoll = options;
+    }
+    const BusyPollOptions &busyPoll() const
+    {
+        return m_busyPoll;
+    }
+    // 给新接受的连接设置忙轮询相关的套接字选项（由hook的accept调用），设置失败只记录日志
+    void setupAcceptedSocket(int fd);
+    // 获取IO系统调用统计 thread-safe
+    IOStats getIOStats() const;
+    // hook直接发起了一次IO系统调用（统计用）
+    void countIOCall()
+    {
+        m_ioCalls.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief 当前协程能否通过io_uring执行IO
+     * @details 需要io_uring后端，并且当前协程是本调度器调度的独立栈协程（共享栈协程挂起后栈内容会被换出，而IO缓冲区通常就在栈上）
+     */
+    bool uringUsable() const;
+    /**
+     * @brief 通过io_uring执行套接字IO，当前协程挂起直到操作完成（需要 uringUsable()）
+     * @param timeout_ms 超时时间（ms），-1表示不超时
+     * @return 与对应的系统调用相同，失败时返回-1并设置errno（超时为ETIMEDOUT，fd被关闭为EBADF）
+     */
+    ssize_t uringRecv(int fd, void *buf, size_t len, int flags, uint64_t timeout_ms);
+    ssize_t uringSend(int fd, const void *buf, size_t len, int flags, uint64_t timeout_ms);
+    int uringConnect(int fd, const sockaddr *addr, socklen_t addrlen, uint64_t timeout_ms);
+    /**
+     * @brief 通过io_uring接受连接
+     * @details 没有超时时使用multishot accept：监听套接字上只提交一次accept，此后每来一个连接内核都产生一个CQE，
+     * 连接先放入该监听套接字的就绪队列，后续的accept直接从队列中取出，不再有系统调用
+     */
+    int uringAccept(int fd, sockaddr *addr, socklen_t *addrlen, uint64_t timeout_ms);
+    /**
+     * @brief 用provided buffer ring接收数据：缓冲区由内核在数据到达时才从池中挑选，大量空闲连接不必各自占用接收缓冲区
+     * @param[out] buffer 接收到的数据，用完后析构或release
+     * @return 接收到的字节数，失败时返回-1并设置errno（不是io_uring后端时为ENOTSUP，缓冲区用完时为ENOBUFS）
+     */
+    ssize_t recvProvided(int fd, ProvidedBuffer &buffer, int flags = 0, uint64_t timeout_ms = -1);
+    // fd关闭前取消它上面所有未完成的io_uring操作（等待这些操作的协程以EBADF返回）thread-safe
+    void uringCancel(int fd);
 
 protected:
+    // 唤醒一个阻塞在epoll_wait上的工作线程；所有工作线程都醒着时什么也不做，它们回到epoll_wait之前会检查任务队列
     void tickle() override;
+    void tickleThread(pid_t thread_id) override;
+    /**
+     * @brief 唤醒指定的工作线程，它已经醒着或者已经被通知过时什么也不做
+     * @param worker 工作线程的序号
+     * @note 单reactor模式下所有工作线程共用一个epoll，无法只唤醒指定的线程，只能唤醒任意一个
+     */
+    void wake(size_t worker);
     void idle() override;
     bool isStoped() const override;
     void contextListResize(size_t size);
 
-    void onTimerInsertedAtFront() override;
+    // 只唤醒处理该定时器队列的工作线程，当前线程自己的队列不需要唤醒（它回到idle时会重新计算超时）
+    void onTimerInsertedAtFront(size_t queue) override;
+    // 多reactor模式下每个工作线程有自己的定时器队列（下标就是工作线程的序号），其他线程创建的定时器放入共享队列
+    size_t currentTimerQueue() const override;
+
+private:
+    /**
+     * @brief 事件循环：一个epoll以及唤醒它的eventfd
+     * @details 单reactor模式下只有一个，所有工作线程共用；多reactor模式下每个工作线程槽位一个，下标就是工作线程的序号
+     */
+    struct Reactor
+    {
+        int epollFd = -1;
+        int eventFd = -1; // 唤醒阻塞在epoll_wait上的工作线程，边沿触发，醒来后读一次就清零
+        std::atomic_uint32_t waiting{0}; // 阻塞在该epoll_wait上的工作线程数量
+        std::atomic_uint32_t notified{0}; // 已经写了eventfd、等待的线程还没有醒来处理，此时再次唤醒是多余的
+        std::atomic_size_t fds{0}; // 分配到该reactor上的fd数量
+        std::unique_ptr<IOUring> ring; // io_uring后端：提交到该reactor的IO操作，ring的fd也由该epoll等待
+        SpinLock ringMutex; // 单reactor模式下所有工作线程共用一个ring
+    };
+    // 一个io_uring操作的完成处理（CQE的user_data），定义见io_manager.cc
+    struct UringCompletion;
+    struct UringWaiter;
+    // 监听套接字的multishot accept状态
+    struct AcceptQueue;
+    // 一次io_uring操作的结果
+    struct UringResult
+    {
+        int32_t res = 0;
+        uint32_t flags = 0;
+        size_t reactor = 0; // 提交到的reactor
+    };
+
+    // 当前工作线程等待的reactor
+    Reactor &currentReactor();
+    // fd所属的reactor，还没有分配时按策略分配一个（需要持有fd_ctx->m_mutex）
+    Reactor &assignReactor(FdContext *fd_ctx);
+    // fd关闭时释放它所属的reactor（需要持有fd_ctx->m_mutex）
+    void releaseReactor(FdContext *fd_ctx);
+    // fd关闭时把它移出epoll、释放所属的reactor、清空就绪状态并触发等待的事件（需要持有fd_ctx->m_mutex）
+    void detachFdContext(int fd, FdContext *fd_ctx);
+    // 第一次持有fd的状态（加入epoll、提交io_uring操作）时在FileDescriptorManager中登记，关闭fd时才会通知当前IOManager释放它
+    static void attachFd(int fd, FdContext *fd_ctx);
+    /**
+     * @brief 写eventfd唤醒阻塞在该reactor上的工作线程
+     * @return 没有线程阻塞在epoll_wait上，或者已经通知过、还没有醒来时不再通知，返回false
+     */
+    bool wakeReactor(Reactor &reactor);
+    /**
+     * @brief 在当前工作线程的reactor上提交一个io_uring操作，当前协程挂起直到完成
+     * @param prep 填写SQE
+     */
+    template<typename Prep>
+    UringResult uringWait(int fd, Prep &&prep, uint64_t timeout_ms);
+    // 收割reactor上已完成的io_uring操作，恢复等待的协程
+    void reapCompletions(Reactor &reactor);
+    /**
+     * @brief 忙轮询：用不阻塞的epoll_wait轮询reactor，直到有就绪事件、有可执行的任务、定时器到期、调度器停止或者用完轮询时间
+     * @return 就绪事件的数量，有任务、定时器到期或者调度器停止时为0，用完轮询时间时为-1（此后应该阻塞在epoll_wait上）
+     */
+    int busyPoll(Reactor &reactor, epoll_event *events, int max_events);
+    // 提交监听套接字的multishot accept（需要持有m_acceptMutex），返回0或-errno
+    int armAccept(AcceptQueue *queue);
+    // 归还provided buffer
+    void recycleBuffer(size_t reactor, uint16_t bid);
 
 private:
-    int m_epollFd = 0;
-    int m_ticklePipe[2]{0, 0}; // 主协程给子协程发消息用的管道（0读1写）
+    bool m_multiReactor = false;
+    ReactorPolicy m_reactorPolicy = RoundRobin;
+    Backend m_backend = Epoll;
+    BusyPollOptions m_busyPoll;
+    std::vector<std::unique_ptr<Reactor>> m_reactors;
+    std::atomic_size_t m_nextReactor{0}; // RoundRobin：下一个分配的reactor
+    std::atomic_size_t m_nextTickle{0}; // 多reactor模式下tickle开始查找的位置
     std::atomic_size_t m_pendingEvents{0}; // 等待执行的IO事件的数量
     std::vector<std::unique_ptr<FdContext>> m_fdCtxs{}; // FDContext 的对象池，下标对应 fd id。这个用map会不会更好，为啥需要像select那样准备一大串fd呢？或者说这里有必要池化吗？
     mutable RWMutex m_mutex;
+    // 各工作线程槽位提交的、还没有完成的io_uring操作数量（线程退出时内核会取消它提交的操作，因此不为0时不能退出线程池）
+    std::unique_ptr<std::atomic_size_t[]> m_uringInflight;
+    // 各监听套接字的multishot accept状态，以及fd已经关闭、还在等待最后一个CQE的，由m_acceptMutex保护
+    std::unordered_map<int, std::unique_ptr<AcceptQueue>> m_acceptQueues;
+    std::vector<std::unique_ptr<AcceptQueue>> m_closingAccepts;
+    Mutex m_acceptMutex;
+    // 系统调用统计
+    std::atomic_uint64_t m_epollWaits{0};
+    std::atomic_uint64_t m_epollCtls{0};
+    std::atomic_uint64_t m_wakeups{0};
+    std::atomic_uint64_t m_ioCalls{0};
+    std::atomic_uint64_t m_uringOps{0};
 };
 } // namespace meha
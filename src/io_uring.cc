@@ -0,0 +1,265 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "io_uring.h"
+#include "module/log.h"
+
+namespace meha
+{
+
+static int IOUringSetup(uint32_t entries, io_uring_params *params)
+{
+    return static_cast<int>(::syscall(__NR_io_uring_setup, entries, params));
+}
+
+static int IOUringEnter(int ring_fd, uint32_t to_submit, uint32_t min_complete, uint32_t flags)
+{
+    return static_cast<int>(::syscall(__NR_io_uring_enter, ring_fd, to_submit, min_complete, flags, nullptr, 0));
+}
+
+static int IOUringRegister(int ring_fd, uint32_t opcode, const void *arg, uint32_t nr_args)
+{
+    return static_cast<int>(::syscall(__NR_io_uring_register, ring_fd, opcode, arg, nr_args));
+}
+
+bool IOUring::IsSupported()
+{
+    static const bool supported = []() {
+        IOUring ring(2);
+        if (!ring.valid()) {
+            return false;
+        }
+        // 探测用到的操作码
+        alignas(io_uring_probe) char buffer[sizeof(io_uring_probe) + IORING_OP_LAST * sizeof(io_uring_probe_op)]{};
+        auto probe = reinterpret_cast<io_uring_probe *>(buffer);
+        if (IOUringRegister(ring.fd(), IORING_REGISTER_PROBE, probe, IORING_OP_LAST) < 0) {
+            return false;
+        }
+        for (auto op : {IORING_OP_RECV, IORING_OP_SEND, IORING_OP_ACCEPT, IORING_OP_CONNECT, IORING_OP_LINK_TIMEOUT, IORING_OP_ASYNC_CANCEL}) {
+            if (op > probe->last_op || !(probe->ops[op].flags & IO_URING_OP_SUPPORTED)) {
+                return false;
+            }
+        }
+        // provided buffer ring（5.19）与 multishot accept 同时引入，能注册就认为都支持；按fd取消（5.19）没有单独的探测方式
+        return ring.setupBufferRing(1, 64);
+    }();
+    return supported;
+}
+
+IOUring::IOUring(uint32_t entries)
+{
+    io_uring_params params{};
+    // CQ开大一些，multishot操作一次提交会产生多个完成事件；某个SQE出错时继续提交后面的
+    params.flags = IORING_SETUP_CQSIZE | IORING_SETUP_SUBMIT_ALL;
+    params.cq_entries = entries * 4;
+    int fd = IOUringSetup(entries, &params);
+    if (fd < 0) {
+        LOG_FMT_DEBUG(core, "io_uring_setup失败: %s(%d)", ::strerror(errno), errno);
+        return;
+    }
+    // 只支持SQ和CQ共用一块映射的内核（5.4）
+    if (!(params.features & IORING_FEAT_SINGLE_MMAP) || !(params.features & IORING_FEAT_NODROP)) {
+        ::close(fd);
+        return;
+    }
+    m_ringSize = std::max(params.sq_off.array + params.sq_entries * sizeof(uint32_t), params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe));
+    m_ringPtr = ::mmap(nullptr, m_ringSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (m_ringPtr == MAP_FAILED) {
+        m_ringPtr = nullptr;
+        ::close(fd);
+        return;
+    }
+    m_sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+    void *sqes = ::mmap(nullptr, m_sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED) {
+        ::munmap(m_ringPtr, m_ringSize);
+        m_ringPtr = nullptr;
+        ::close(fd);
+        return;
+    }
+    m_sqes = static_cast<io_uring_sqe *>(sqes);
+    auto base = static_cast<char *>(m_ringPtr);
+    m_sqHead = reinterpret_cast<uint32_t *>(base + params.sq_off.head);
+    m_sqTail = reinterpret_cast<uint32_t *>(base + params.sq_off.tail);
+    m_sqMask = *reinterpret_cast<uint32_t *>(base + params.sq_off.ring_mask);
+    m_sqEntries = params.sq_entries;
+    // SQ的下标数组固定为恒等映射，第i个SQE就是sqes[i & mask]
+    auto array = reinterpret_cast<uint32_t *>(base + params.sq_off.array);
+    for (uint32_t i = 0; i < m_sqEntries; i++) {
+        array[i] = i;
+    }
+    m_sqeTail = *m_sqTail;
+    m_cqHead = reinterpret_cast<uint32_t *>(base + params.cq_off.head);
+    m_cqTail = reinterpret_cast<uint32_t *>(base + params.cq_off.tail);
+    m_cqMask = *reinterpret_cast<uint32_t *>(base + params.cq_off.ring_mask);
+    m_cqes = reinterpret_cast<io_uring_cqe *>(base + params.cq_off.cqes);
+    m_ringFd = fd;
+}
+
+IOUring::~IOUring()
+{
+    if (m_bufRing) {
+        io_uring_buf_reg reg{};
+        reg.bgid = 0;
+        IOUringRegister(m_ringFd, IORING_UNREGISTER_PBUF_RING, &reg, 1);
+        ::munmap(m_bufRing, m_bufRingSize);
+        ::munmap(m_bufData, static_cast<size_t>(m_bufCount) * m_bufSize);
+    }
+    if (m_sqes) {
+        ::munmap(m_sqes, m_sqesSize);
+    }
+    if (m_ringPtr) {
+        ::munmap(m_ringPtr, m_ringSize);
+    }
+    if (m_ringFd >= 0) {
+        ::close(m_ringFd);
+    }
+}
+
+bool IOUring::reserve(uint32_t n)
+{
+    // SQ空位不够就先提交，非SQPOLL模式下内核在io_uring_enter返回前就已经取走了提交的SQE
+    if (m_sqEntries - (m_sqeTail - __atomic_load_n(m_sqHead, __ATOMIC_ACQUIRE)) >= n) {
+        return true;
+    }
+    submit();
+    return m_sqEntries - (m_sqeTail - __atomic_load_n(m_sqHead, __ATOMIC_ACQUIRE)) >= n;
+}
+
+io_uring_sqe *IOUring::getSqe()
+{
+    if (!reserve(1)) {
+        return nullptr;
+    }
+    io_uring_sqe *sqe = &m_sqes[m_sqeTail & m_sqMask];
+    ++m_sqeTail;
+    std::memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+}
+
+int IOUring::submit()
+{
+    // 包括之前提交失败留在SQ中的
+    const uint32_t to_submit = m_sqeTail - __atomic_load_n(m_sqHead, __ATOMIC_ACQUIRE);
+    if (to_submit == 0) {
+        return 0;
+    }
+    __atomic_store_n(m_sqTail, m_sqeTail, __ATOMIC_RELEASE);
+    int ret;
+    do {
+        m_enterCount.fetch_add(1, std::memory_order_relaxed);
+        ret = IOUringEnter(m_ringFd, to_submit, 0, 0);
+    } while (ret < 0 && errno == EINTR);
+    return ret < 0 ? -errno : ret;
+}
+
+bool IOUring::setupBufferRing(uint32_t count, uint32_t size)
+{
+    if (m_bufRing || count == 0 || (count & (count - 1)) != 0 || count > 32768) {
+        return false;
+    }
+    m_bufRingSize = count * sizeof(io_uring_buf);
+    void *ring = ::mmap(nullptr, m_bufRingSize, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+    if (ring == MAP_FAILED) {
+        return false;
+    }
+    void *data = ::mmap(nullptr, static_cast<size_t>(count) * size, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+    if (data == MAP_FAILED) {
+        ::munmap(ring, m_bufRingSize);
+        return false;
+    }
+    io_uring_buf_reg reg{};
+    reg.ring_addr = reinterpret_cast<uint64_t>(ring);
+    reg.ring_entries = count;
+    reg.bgid = 0;
+    if (IOUringRegister(m_ringFd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+        ::munmap(data, static_cast<size_t>(count) * size);
+        ::munmap(ring, m_bufRingSize);
+        return false;
+    }
+    m_bufRing = static_cast<io_uring_buf_ring *>(ring);
+    m_bufCount = count;
+    m_bufSize = size;
+    m_bufData = static_cast<char *>(data);
+    for (uint32_t bid = 0; bid < count; bid++) {
+        recycleBuffer(static_cast<uint16_t>(bid));
+    }
+    return true;
+}
+
+void IOUring::recycleBuffer(uint16_t bid)
+{
+    // tail与第0个缓冲区描述的resv字段重叠，只有生产者（这里）会写它
+    // NOTE 不能用 m_bufRing->bufs：C++中 __DECLARE_FLEX_ARRAY 里的空结构体占1字节，bufs的偏移是8而不是0
+    const uint16_t tail = m_bufRing->tail;
+    io_uring_buf &buf = reinterpret_cast<io_uring_buf *>(m_bufRing)[tail & (m_bufCount - 1)];
+    buf.addr = reinterpret_cast<uint64_t>(bufferData(bid));
+    buf.len = m_bufSize;
+    buf.bid = bid;
+    __atomic_store_n(&m_bufRing->tail, static_cast<uint16_t>(tail + 1), __ATOMIC_RELEASE);
+}
+
+void IOUring::PrepRecv(io_uring_sqe *sqe, int fd, void *buf, size_t len, int flags)
+{
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = fd;
+    sqe->addr = reinterpret_cast<uint64_t>(buf);
+    sqe->len = static_cast<uint32_t>(len);
+    sqe->msg_flags = static_cast<uint32_t>(flags);
+}
+
+void IOUring::PrepSend(io_uring_sqe *sqe, int fd, const void *buf, size_t len, int flags)
+{
+    sqe->opcode = IORING_OP_SEND;
+    sqe->fd = fd;
+    sqe->addr = reinterpret_cast<uint64_t>(buf);
+    sqe->len = static_cast<uint32_t>(len);
+    sqe->msg_flags = static_cast<uint32_t>(flags);
+}
+
+void IOUring::PrepAccept(io_uring_sqe *sqe, int fd, sockaddr *addr, socklen_t *addrlen, bool multishot)
+{
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = fd;
+    sqe->addr = reinterpret_cast<uint64_t>(addr);
+    sqe->addr2 = reinterpret_cast<uint64_t>(addrlen);
+    if (multishot) {
+        sqe->ioprio |= IORING_ACCEPT_MULTISHOT;
+    }
+}
+
+void IOUring::PrepConnect(io_uring_sqe *sqe, int fd, const sockaddr *addr, socklen_t addrlen)
+{
+    sqe->opcode = IORING_OP_CONNECT;
+    sqe->fd = fd;
+    sqe->addr = reinterpret_cast<uint64_t>(addr);
+    sqe->off = addrlen;
+}
+
+void IOUring::PrepRecvProvided(io_uring_sqe *sqe, int fd, int flags)
+{
+    PrepRecv(sqe, fd, nullptr, 0, flags);
+    sqe->flags |= IOSQE_BUFFER_SELECT;
+    sqe->buf_group = 0;
+}
+
+void IOUring::PrepLinkTimeout(io_uring_sqe *sqe, __kernel_timespec *ts)
+{
+    sqe->opcode = IORING_OP_LINK_TIMEOUT;
+    sqe->fd = -1;
+    sqe->addr = reinterpret_cast<uint64_t>(ts);
+    sqe->len = 1;
+}
+
+void IOUring::PrepCancelFd(io_uring_sqe *sqe, int fd)
+{
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = fd;
+    sqe->cancel_flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL;
+}
+
+} // namespace meha
@@ -0,0 +1,151 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <linux/io_uring.h>
+#include <sys/socket.h>
+
+#include "utils/noncopyable.h"
+
+namespace meha
+{
+
+/**
+ * @brief io_uring 实例
+ * @details 不依赖liburing，直接通过系统调用建立SQ/CQ环形队列，只提供IOManager用到的功能：取SQE、提交、收割CQE、provided buffer ring。
+ * 不是线程安全的，多个线程共用时由调用者加锁
+ */
+class IOUring : public utils::NonCopyable
+{
+public:
+    // 当前内核是否支持IOManager用到的io_uring功能（套接字操作、链接超时、按fd取消、multishot accept、provided buffer ring），结果会缓存
+    static bool IsSupported();
+
+    /**
+     * @brief 创建io_uring实例
+     * @param entries SQ的大小（内核会向上取整到2的幂）
+     * @note 创建失败时 valid() 为false
+     */
+    explicit IOUring(uint32_t entries);
+    ~IOUring();
+
+    bool valid() const
+    {
+        return m_ringFd >= 0;
+    }
+    // io_uring实例的fd，CQ中有完成事件时可读，可以加入epoll监听
+    int fd() const
+    {
+        return m_ringFd;
+    }
+
+    /**
+     * @brief 取一个已清零的SQE
+     * @details SQ满时先把已填好的SQE提交给内核再取
+     * @return 提交失败时返回nullptr
+     */
+    io_uring_sqe *getSqe();
+    // 保证SQ中至少还有n个空位（不够时先提交），链接在一起的SQE要在同一次提交中，取之前先预留
+    bool reserve(uint32_t n);
+    /**
+     * @brief 把已填好、还没有被内核取走的SQE提交给内核（一次io_uring_enter）
+     * @return 提交的SQE数量，出错时返回-errno（SQE留在SQ中，随下一次提交一起提交）
+     */
+    int submit();
+    // CQ中是否有完成事件（不加锁的快速检查）
+    bool hasCompletions() const
+    {
+        return *m_cqHead != __atomic_load_n(m_cqTail, __ATOMIC_ACQUIRE);
+    }
+
+    /**
+     * @brief 收割所有已完成的CQE
+     * @param func 对每个CQE调用 func(user_data, res, flags)
+     * @return 收割的CQE数量
+     */
+    template<typename Func>
+    size_t reap(Func &&func)
+    {
+        uint32_t head = *m_cqHead;
+        const uint32_t tail = __atomic_load_n(m_cqTail, __ATOMIC_ACQUIRE);
+        size_t count = 0;
+        for (; head != tail; head++, count++) {
+            const io_uring_cqe &cqe = m_cqes[head & m_cqMask];
+            func(cqe.user_data, cqe.res, cqe.flags);
+        }
+        if (count > 0) {
+            __atomic_store_n(m_cqHead, head, __ATOMIC_RELEASE);
+        }
+        return count;
+    }
+
+    /**
+     * @brief 注册provided buffer ring（buffer group 0），recv时由内核从中挑选缓冲区
+     * @param count 缓冲区数量（2的幂，不超过32768）
+     * @param size 每个缓冲区的大小
+     * @return 是否注册成功
+     */
+    bool setupBufferRing(uint32_t count, uint32_t size);
+    // 是否注册了provided buffer ring
+    bool hasBufferRing() const
+    {
+        return m_bufRing != nullptr;
+    }
+    uint32_t bufferSize() const
+    {
+        return m_bufSize;
+    }
+    // 缓冲区的数据地址
+    char *bufferData(uint16_t bid) const
+    {
+        return m_bufData + static_cast<size_t>(bid) * m_bufSize;
+    }
+    // 把用完的缓冲区还给内核
+    void recycleBuffer(uint16_t bid);
+
+    // 调用io_uring_enter的次数
+    uint64_t enterCount() const
+    {
+        return m_enterCount.load(std::memory_order_relaxed);
+    }
+
+    // 填写常用操作的SQE
+    static void PrepRecv(io_uring_sqe *sqe, int fd, void *buf, size_t len, int flags);
+    static void PrepSend(io_uring_sqe *sqe, int fd, const void *buf, size_t len, int flags);
+    static void PrepAccept(io_uring_sqe *sqe, int fd, sockaddr *addr, socklen_t *addrlen, bool multishot);
+    static void PrepConnect(io_uring_sqe *sqe, int fd, const sockaddr *addr, socklen_t addrlen);
+    // 从provided buffer ring中挑选缓冲区接收
+    static void PrepRecvProvided(io_uring_sqe *sqe, int fd, int flags);
+    // 作为前一个SQE的链接超时（前一个SQE要设置IOSQE_IO_LINK），ts在完成之前必须有效
+    static void PrepLinkTimeout(io_uring_sqe *sqe, __kernel_timespec *ts);
+    // 取消fd上所有未完成的操作
+    static void PrepCancelFd(io_uring_sqe *sqe, int fd);
+
+private:
+    int m_ringFd = -1;
+    // SQ/CQ环形队列的映射（IORING_FEAT_SINGLE_MMAP时SQ和CQ共用一块映射）
+    void *m_ringPtr = nullptr;
+    size_t m_ringSize = 0;
+    io_uring_sqe *m_sqes = nullptr;
+    size_t m_sqesSize = 0;
+    uint32_t *m_sqHead = nullptr;
+    uint32_t *m_sqTail = nullptr;
+    uint32_t m_sqMask = 0;
+    uint32_t m_sqEntries = 0;
+    // 已取出的SQE的尾部，提交时才写入内核可见的SQ尾部
+    uint32_t m_sqeTail = 0;
+    uint32_t *m_cqHead = nullptr;
+    uint32_t *m_cqTail = nullptr;
+    uint32_t m_cqMask = 0;
+    io_uring_cqe *m_cqes = nullptr;
+    // provided buffer ring
+    io_uring_buf_ring *m_bufRing = nullptr;
+    size_t m_bufRingSize = 0;
+    uint32_t m_bufCount = 0;
+    uint32_t m_bufSize = 0;
+    char *m_bufData = nullptr;
+    std::atomic_uint64_t m_enterCount{0};
+};
+
+} // namespace meha
@@ -1,4 +1,9 @@
+#include <algorithm>
+#include <chrono>
+#include <climits>
 #include <cstdarg>
+#include <poll.h>
+#include <thread>
 
 #include "config.h"
 #include "fd_manager.h"
@@ -10,6 +15,7 @@ namespace meha
 {
 
 static meha::ConfigItem<int>::sptr g_tcp_connect_timeout = meha::Config::Lookup("tcp.connect.timeout", 5000);
+static meha::ConfigItem<bool>::sptr g_hook_offload_file_io = meha::Config::Lookup("hook.offload_file_io", false, "是否把普通文件的open/read/write等交给阻塞调用线程池执行（见Scheduler::offload），避免阻塞工作线程");
 
 namespace hook
 {
@@ -82,11 +88,190 @@ void SetHookEnable(bool flag)
     t_hook_enabled = flag;
 }
 
-// 用于跟踪定时器的状态
-struct TimerInfo
+// @brief 报告内联任务中本来会挂起协程的调用
+// @details 内联任务运行在调度协程上，不能挂起（见 Scheduler::Inline），执行期间hook是关闭的，
+// 这类调用会阻塞整个工作线程，需要挂起的任务应以 Scheduler::Coroutine 类型调度
+static void ReportInlineBlocking(const char *func_name)
 {
-    int timeouted = 0; // 表示定时器是否已经超时
-};
+    LOG_FMT_ERROR(core, "内联任务中调用了会挂起协程的 %s，阻塞工作线程直到完成", func_name);
+}
+
+// @brief 内联任务中的套接字IO是否本来会挂起协程
+// @details 在框架设置为非阻塞的套接字上返回EAGAIN（connect返回EINPROGRESS），hook开启时会挂起协程等待就绪
+// @return 需要阻塞等待时返回fd的包装对象，否则返回nullptr；不会修改errno
+static meha::FileDescriptor::sptr InlineBlockingSocket(int fd, const char *func_name)
+{
+    if (!meha::Scheduler::IsRunningInline()) {
+        return nullptr;
+    }
+    const int error = errno;
+    auto fdp = meha::FileDescriptorManager::Instance()->fetch(fd);
+    errno = error;
+    if (!fdp || !fdp->isSocket() || fdp->userNonBlock()) {
+        return nullptr;
+    }
+    ReportInlineBlocking(func_name);
+    return fdp;
+}
+
+// @brief 阻塞工作线程，直到fd上的事件就绪
+// @details 内联任务不能挂起协程，用poll代替事件监听，保持用户看到的阻塞套接字语义
+// @param timeout_ms 超时时间，-1表示不超时
+// @return 是否就绪；超时时errno为ETIMEDOUT
+static bool WaitInlineIO(int fd, meha::FdContext::FdEvent event, uint64_t timeout_ms)
+{
+    pollfd pfd{fd, static_cast<short>(event == meha::FdContext::FdEvent::Read ? POLLIN : POLLOUT), 0};
+    const int timeout = timeout_ms == static_cast<uint64_t>(-1) ? -1 : static_cast<int>(std::min<uint64_t>(timeout_ms, INT_MAX));
+    int ret;
+    do {
+        ret = ::poll(&pfd, 1, timeout);
+    } while (ret == -1 && errno == EINTR);
+    if (ret == 0) {
+        errno = ETIMEDOUT;
+    }
+    return ret > 0;
+}
+
+// @brief 普通文件IO的代理函数
+// @details 普通文件的IO无法通过epoll异步化，开启 hook.offload_file_io 时交给阻塞调用线程池执行，当前协程挂起等待结果
+// @note 共享栈协程挂起后栈内容会被换出，而IO的缓冲区通常就在协程栈上，因此共享栈协程直接执行
+template<typename OriginFunc, typename... Args>
+static auto doFileIO(OriginFunc func, Args &&...args) -> decltype(func(std::forward<Args>(args)...))
+{
+    auto scheduler = meha::Scheduler::GetCurrent();
+    if (!meha::hook::t_hook_enabled || !scheduler || !g_hook_offload_file_io->getValue() || meha::Fiber::GetCurrent()->boundThread() != -1) {
+        return func(std::forward<Args>(args)...);
+    }
+    // errno是线程局部的，要从执行IO的线程带回来
+    int error = 0;
+    auto n = scheduler->offload([&]() {
+        auto ret = func(std::forward<Args>(args)...);
+        error = errno;
+        return ret;
+    });
+    errno = error;
+    return n;
+}
+
+// @brief 能否通过io_uring执行fd上的IO
+// @details 与doIO相同，只有框架设置了非阻塞的套接字才会异步化；此外要求io_uring后端，并且当前是独立栈协程
+// @param[out] fdp fd的包装对象
+// @return 可以时返回当前的IOManager，否则返回nullptr
+static meha::IOManager *UringTarget(int fd, meha::FileDescriptor::sptr &fdp)
+{
+    auto iom = meha::IOManager::GetCurrent();
+    if (!meha::hook::t_hook_enabled || !iom || !iom->uringUsable()) {
+        return nullptr;
+    }
+    fdp = meha::FileDescriptorManager::Instance()->fetch(fd);
+    if (!fdp || fdp->isClosed() || !fdp->isSocket() || fdp->userNonBlock()) {
+        return nullptr;
+    }
+    return iom;
+}
+
+// @brief 挂起当前协程，直到fd上的事件就绪（或者被triggerEvent提前触发）
+// @param timeout 不为空时，监听事件成功之后加入该超时，delay 之后提前触发事件；加入之后才会设置 timeout->armed
+// @return 是否成功监听了事件
+static bool WaitEvent(meha::IOManager *iom, int fd, meha::FdContext::FdEvent event,
+                      meha::FdContext::EventTimeout *timeout = nullptr, std::chrono::milliseconds delay = {})
+{
+    // 挂起动作只捕获一个指针，放得进std::function内部的缓冲区，不需要分配内存
+    struct
+    {
+        meha::IOManager *iom;
+        int fd;
+        meha::FdContext::FdEvent event;
+        meha::FdContext::EventTimeout *timeout;
+        std::chrono::milliseconds delay;
+        bool ok;
+    } wait{iom, fd, event, timeout, delay, true};
+    // 协程完全换出之后再监听事件，事件不会在协程换出之前就把它放回任务队列；
+    // 超时在监听成功之后才加入，否则超时可能先于监听到期，提前触发落空，协程再也不会被唤醒
+    bool suspended = iom->suspend([&wait](meha::Scheduler::ResumeFunc resume) {
+        // 监听成功之后协程随时可能在其他线程上恢复，wait 随之失效，不能再访问
+        meha::IOManager *iom = wait.iom;
+        meha::FdContext::EventTimeout *timeout = wait.timeout;
+        const std::chrono::milliseconds delay = wait.delay;
+        // 唤醒只是把协程放回任务队列，以内联任务执行，不需要为它再创建一个协程
+        if (!iom->subscribeEvent(wait.fd, wait.event, resume, meha::Scheduler::Inline)) {
+            wait.ok = false;
+            resume();
+            return;
+        }
+        if (timeout) {
+            iom->addTimeout(timeout->timeout, delay);
+            timeout->armed.store(true, std::memory_order_release);
+        }
+    });
+    if (!suspended) {
+        // 不是调度器调度的协程，以当前协程作为事件回调
+        wait.ok = iom->subscribeEvent(fd, event);
+        if (wait.ok) {
+            if (timeout) {
+                iom->addTimeout(timeout->timeout, delay);
+                timeout->armed.store(true, std::memory_order_release);
+            }
+            meha::Fiber::Yield();
+        }
+    }
+    return wait.ok;
+}
+
+// @brief 挂起当前协程，直到fd上的事件就绪，或者超时
+// @param timeout_ms 超时时间，-1表示不超时
+// @return 0表示事件就绪，ETIMEDOUT表示超时，-1表示监听事件失败
+static int WaitEventFor(meha::IOManager *iom, int fd, meha::FdContext::FdEvent event, uint64_t timeout_ms)
+{
+    if (timeout_ms == static_cast<uint64_t>(-1)) {
+        return WaitEvent(iom, fd, event) ? 0 : -1;
+    }
+    // 超时结点在FdContext中，不需要分配内存；同一个事件同时有多个协程等待时（很少见），后来的自己分配
+    std::unique_ptr<meha::FdContext::EventTimeout> owned;
+    meha::FdContext::EventTimeout *timeout = iom->fetchFdContext(fd)->claimTimeout(event);
+    if (!timeout) {
+        owned = std::make_unique<meha::FdContext::EventTimeout>(fd, event);
+        timeout = owned.get();
+    }
+    timeout->iom = iom;
+    timeout->timedOut = false;
+    timeout->armed.store(false, std::memory_order_relaxed);
+    // 超时后提前触发该 fd 的事件，结束等待
+    const bool ok = WaitEvent(iom, fd, event, timeout, std::chrono::milliseconds(timeout_ms));
+    if (ok) {
+        // 事件可能在监听之后、加入超时之前就绪，协程已经在其他线程上恢复，等超时加入之后才能取消
+        while (!timeout->armed.load(std::memory_order_acquire)) {
+            std::this_thread::yield();
+        }
+    }
+    // 取消之后超时回调不会再执行，才能交给下一个等待的协程
+    iom->cancelTimeout(timeout->timeout);
+    const bool timed_out = timeout->timedOut;
+    timeout->claimed.store(false, std::memory_order_release);
+    if (!ok) {
+        return -1;
+    }
+    return timed_out ? ETIMEDOUT : 0;
+}
+
+// 当前协程挂起 duration 后恢复
+static void SleepFor(meha::IOManager *iom, std::chrono::microseconds duration)
+{
+    // 协程完全换出之后再添加定时器，亚毫秒的定时器不会在协程换出之前就到期把它放回任务队列
+    bool suspended = iom->suspend([&](meha::Scheduler::ResumeFunc resume) {
+        iom->addTimer(duration, std::move(resume), false, meha::TimerManager::kDefaultSlack, true);
+    });
+    if (!suspended) {
+        // 不是调度器调度的协程
+        meha::Fiber::sptr fiber = meha::Fiber::GetCurrent();
+        iom->addTimer(
+            duration, [iom, fiber]() {
+                iom->schedule(fiber);
+            },
+            false, meha::TimerManager::kDefaultSlack, true);
+        fiber->yield();
+    }
+}
 
 // @brief 执行hook逻辑的代理函数
 // @param fd 执行IO操作的fd
@@ -102,7 +287,17 @@ static ssize_t doIO(int fd, OriginFunc func, const char *func_name,
     auto iom = meha::IOManager::GetCurrent();
     // 如果没有启用 hook，则直接调用系统函数
     if (!meha::hook::t_hook_enabled || !iom) {
-        return func(fd, std::forward<Args>(args)...);
+        ssize_t n = func(fd, std::forward<Args>(args)...);
+        if (n == -1 && errno == EAGAIN) {
+            // 内联任务中阻塞等待就绪之后重试，与hook开启时的行为一致
+            if (auto fdp = InlineBlockingSocket(fd, func_name)) {
+                const uint64_t timeout_ms = fdp->timeout(fd_timeout_type);
+                while (n == -1 && errno == EAGAIN && WaitInlineIO(fd, event, timeout_ms)) {
+                    n = func(fd, std::forward<Args>(args)...);
+                }
+            }
+        }
+        return n;
     }
 
     if (func_name) {
@@ -118,6 +313,9 @@ static ssize_t doIO(int fd, OriginFunc func, const char *func_name,
         errno = EBADF;
         return -1;
     }
+    if (fdp->isRegularFile()) {
+        return doFileIO(func, fd, std::forward<Args>(args)...);
+    }
     // 如果不是socket fd，或者是用户设置了非阻塞的fd，则不允许被hook（后者是因为给libc设置O_NONBLOCK会在内部异步化，这里就不需要协程了）
     if (!fdp->isSocket() || fdp->userNonBlock()) {
         return func(fd, std::forward<Args>(args)...);
@@ -126,60 +324,46 @@ static ssize_t doIO(int fd, OriginFunc func, const char *func_name,
     // 执行到此，说明需要执行hook后协程化的版本
 
     uint64_t timeout_ms = fdp->timeout(fd_timeout_type); // 获取fd上设置的超时
-    auto timer_info = std::make_shared<TimerInfo>(); // 生成一个监控超时的对象备用
+    auto fd_ctx = iom->fetchFdContext(fd); // fd的就绪状态
 retry:
-    // 执行IO操作
-    ssize_t n = func(fd, std::forward<Args>(args)...); // NOTE 可见实现函数的功能还是需要调用原本的API来实现
-    // 出现错误 EINTR，是因为系统 API 在阻塞等待状态下被其他的系统信号中断执行
-    // 此处的解决办法就是重新调用这次系统 API
-    while (n == -1 && errno == EINTR) {
-        n = func(fd, std::forward<Args>(args)...);
+    ssize_t n = -1;
+    if (fd_ctx->prepareIO(event)) {
+        // 执行IO操作
+        iom->countIOCall();
+        n = func(fd, std::forward<Args>(args)...); // NOTE 可见实现函数的功能还是需要调用原本的API来实现
+        // 出现错误 EINTR，是因为系统 API 在阻塞等待状态下被其他的系统信号中断执行
+        // 此处的解决办法就是重新调用这次系统 API
+        while (n == -1 && errno == EINTR) {
+            iom->countIOCall();
+            n = func(fd, std::forward<Args>(args)...);
+        }
+    } else {
+        // 上次返回EAGAIN之后还没有新的就绪通知，这次系统调用也必然返回EAGAIN，省掉它
+        errno = EAGAIN;
     }
     // 出现错误 EAGAIN，是因为长时间未读到数据或者无法写入数据（即资源未就绪，注意这里是sysNONBLOCK的）
     // 需要把这个 fd 丢到当前 IOManager 里监听对应事件，等待事件触发后再返回执行
     if (n == -1 && errno == EAGAIN) {
+        // IO执行期间已经有新的就绪通知到达，直接重试
+        if (!fd_ctx->markNotReady(event)) {
+            goto retry;
+        }
         if (func_name) {
             LOG_FMT_DEBUG(core, "doIO(%s): 开始异步等待", func_name);
         }
 
-        meha::Timer::sptr timer;
-        std::weak_ptr<TimerInfo> timer_info_wp(timer_info);
-        // 如果设置了超时时间，在指定时间后取消掉该 fd 的事件监听
-        if (timeout_ms != static_cast<uint64_t>(-1)) {
-            timer = iom->addConditionalTimer(
-                timeout_ms,
-                [timer_info_wp, fd, iom, event]() {
-                    auto t = timer_info_wp.lock();
-                    if (!t || t->timeouted) {
-                        return;
-                    }
-                    t->timeouted = ETIMEDOUT;
-                    iom->triggerEvent(fd, event);
-                },
-                timer_info_wp);
-        }
-        uint64_t now = 0;
-
-        int rt = iom->subscribeEvent(fd, event);
-        if (!rt) {
+        // 监听事件并让出执行权，如果设置了超时时间，超时后结束等待
+        const int result = WaitEventFor(iom, fd, event, timeout_ms);
+        if (result == -1) {
             if (func_name) {
                 LOG_FMT_ERROR(core, "%s 添加事件监听失败(%d, %u)", func_name, fd, event);
             }
-            if (timer) {
-                timer->cancel();
-            }
             return -1;
         }
 
-        // 注册完事件回调后，立即yield让出执行权
-        meha::Fiber::Yield();
-
         // 获得执行权说明事件已就绪
-        if (timer) {
-            timer->cancel();
-        }
-        if (timer_info->timeouted) {
-            errno = timer_info->timeouted;
+        if (result == ETIMEDOUT) {
+            errno = ETIMEDOUT;
             return -1;
         }
         goto retry; // 继续执行下一次IO
@@ -192,7 +376,24 @@ int ConnectWithTimeout(int sockfd, const struct sockaddr *addr,
 {
     auto iom = meha::IOManager::GetCurrent();
     if (!meha::hook::t_hook_enabled || !iom) {
-        return connect_f(sockfd, addr, addrlen);
+        const int n = connect_f(sockfd, addr, addrlen);
+        if (n == -1 && errno == EINPROGRESS && InlineBlockingSocket(sockfd, "connect")) {
+            // 内联任务中阻塞等待连接完成，再取出连接的结果
+            if (!WaitInlineIO(sockfd, meha::FdContext::FdEvent::Write, timeout_ms)) {
+                return -1;
+            }
+            int error = 0;
+            socklen_t len = sizeof(int);
+            if (getsockopt(sockfd, SOL_SOCKET, SO_ERROR, &error, &len) == -1) {
+                return -1;
+            }
+            if (error) {
+                errno = error;
+                return -1;
+            }
+            return 0;
+        }
+        return n;
     }
     auto fdp = meha::FileDescriptorManager::Instance()->fetch(sockfd);
     if (!fdp || fdp->isClosed()) {
@@ -202,6 +403,9 @@ int ConnectWithTimeout(int sockfd, const struct sockaddr *addr,
     if (!fdp->isSocket() || fdp->userNonBlock()) {
         return connect_f(sockfd, addr, addrlen);
     }
+    // 之前锁存的可写状态与这次连接无关
+    iom->fetchFdContext(sockfd)->prepareIO(meha::FdContext::FdEvent::Write);
+    iom->countIOCall();
     int n = connect_f(sockfd, addr, addrlen);
     if (n == 0) {
         return 0;
@@ -212,44 +416,20 @@ int ConnectWithTimeout(int sockfd, const struct sockaddr *addr,
      * 调用 connect，非阻塞形式下会返回-1，但是 errno 被设为 EINPROGRESS，表明
      * connect 仍旧在进行还没有完成。下一步就需要为其添加写就绪监听。
      */
-    meha::Timer::sptr timer;
-    auto timer_info = std::make_shared<TimerInfo>();
-    std::weak_ptr<TimerInfo> weak_timer_info(timer_info);
-
-    if (timeout_ms != static_cast<uint64_t>(-1)) {
-        timer = iom->addConditionalTimer(
-            timeout_ms,
-            [weak_timer_info, sockfd, iom]() {
-                auto t = weak_timer_info.lock();
-                if (!t || t->timeouted) {
-                    return;
-                }
-                t->timeouted = ETIMEDOUT;
-                iom->triggerEvent(sockfd, meha::FdContext::FdEvent::Write);
-            },
-            weak_timer_info);
-    }
     // TODO 下面的逻辑要看一下
-    int rt = iom->subscribeEvent(sockfd, meha::FdContext::FdEvent::Write);
-    if (rt == 0) {
-        meha::Fiber::Yield();
-        if (timer) {
-            timer->cancel();
-        }
-        if (timer_info->timeouted) {
-            errno = timer_info->timeouted;
+    const int result = WaitEventFor(iom, sockfd, meha::FdContext::FdEvent::Write, timeout_ms);
+    if (result != -1) {
+        if (result == ETIMEDOUT) {
+            errno = ETIMEDOUT;
             return -1;
         }
-    }
-    if (rt == -1) {
-        if (timer) {
-            timer->cancel();
-        }
+    } else {
         LOG_FMT_ERROR(core, "ConnectWithTimeout addEventListen(%d, WRITE) error", sockfd);
     }
     // 处理错误
     int error = 0;
     socklen_t len = sizeof(int);
+    iom->countIOCall();
     if (getsockopt(sockfd, SOL_SOCKET, SO_ERROR, &error, &len) == -1) {
         return -1;
     }
@@ -285,15 +465,12 @@ unsigned int sleep(unsigned int seconds)
 {
     auto iom = meha::IOManager::GetCurrent();
     if (!meha::hook::t_hook_enabled || !iom) {
+        if (meha::Scheduler::IsRunningInline()) {
+            meha::hook::ReportInlineBlocking("sleep");
+        }
         return sleep_f(seconds);
     }
-    meha::Fiber::sptr fiber = meha::Fiber::GetCurrent();
-    ASSERT(iom);
-    // 设置超时
-    iom->addTimer(seconds * 1000, [iom, fiber]() {
-        iom->schedule(fiber);
-    });
-    fiber->yield();
+    meha::hook::SleepFor(iom, std::chrono::seconds(seconds));
     return 0;
 }
 
@@ -304,14 +481,12 @@ int usleep(useconds_t usec)
 {
     auto iom = meha::IOManager::GetCurrent();
     if (!meha::hook::t_hook_enabled || !iom) {
+        if (meha::Scheduler::IsRunningInline()) {
+            meha::hook::ReportInlineBlocking("usleep");
+        }
         return usleep_f(usec);
     }
-    meha::Fiber::sptr fiber = meha::Fiber::GetCurrent();
-    // 设置超时
-    iom->addTimer(usec / 1000, [iom, fiber]() {
-        iom->schedule(fiber);
-    });
-    fiber->yield();
+    meha::hook::SleepFor(iom, std::chrono::microseconds(usec));
     return 0;
 }
 
@@ -319,16 +494,14 @@ int nanosleep(const struct timespec *req, struct timespec *rem)
 {
     auto iom = meha::IOManager::GetCurrent();
     if (!meha::hook::t_hook_enabled || !iom) {
+        if (meha::Scheduler::IsRunningInline()) {
+            meha::hook::ReportInlineBlocking("nanosleep");
+        }
         return nanosleep_f(req, rem);
     }
-    int timeout_ms = req->tv_sec * 1000 + req->tv_nsec / 1000 / 1000;
-    meha::Fiber::sptr fiber = meha::Fiber::GetCurrent();
-    ASSERT(iom);
-    // 设置超时
-    iom->addTimer(timeout_ms, [iom, fiber]() {
-        iom->schedule(fiber);
-    });
-    fiber->yield();
+    // 定时器精确到微秒，不足1us的部分向上取整
+    const auto duration = std::chrono::seconds(req->tv_sec) + std::chrono::ceil<std::chrono::microseconds>(std::chrono::nanoseconds(req->tv_nsec));
+    meha::hook::SleepFor(iom, duration);
     return 0;
 }
 
@@ -340,27 +513,47 @@ int socket(int domain, int type, int protocol)
         return socket_f(domain, type, protocol);
     }
     int fd = socket_f(domain, type, protocol);
-    meha::FileDescriptorManager::Instance()->fetch(fd, false);
+    meha::FileDescriptorManager::Instance()->create(fd);
     return fd;
 }
 
 int connect(int sockfd, const struct sockaddr *addr, socklen_t addrlen)
 {
+    meha::FileDescriptor::sptr fdp;
+    if (auto iom = meha::hook::UringTarget(sockfd, fdp)) {
+        return iom->uringConnect(sockfd, addr, addrlen, meha::hook::s_connect_timeout);
+    }
     return meha::hook::ConnectWithTimeout(sockfd, addr, addrlen, meha::hook::s_connect_timeout);
 }
 
 int accept(int sockfd, struct sockaddr *addr, socklen_t *addrlen)
 {
-    int fd = meha::hook::doIO(sockfd, accept_f, "accept",
+    int fd = -1;
+    meha::FileDescriptor::sptr fdp;
+    if (auto iom = meha::hook::UringTarget(sockfd, fdp)) {
+        fd = iom->uringAccept(sockfd, addr, addrlen, fdp->timeout(meha::FileDescriptor::RecvTimeout));
+    } else {
+        fd = meha::hook::doIO(sockfd, accept_f, "accept",
                               meha::FdContext::FdEvent::Read,
                               meha::FileDescriptor::RecvTimeout, // REVIEW 这里的recvtimout和sendtimeout是怎么确定的？
                               addr, addrlen);
-    meha::FileDescriptorManager::Instance()->fetch(fd, true);
+    }
+    // 新连接也要纳入管理（设置为非阻塞），此后它上面的IO才会被hook
+    meha::FileDescriptorManager::Instance()->create(fd);
+    if (fd >= 0) {
+        if (auto iom = meha::IOManager::GetCurrent()) {
+            iom->setupAcceptedSocket(fd);
+        }
+    }
     return fd;
 }
 
 ssize_t read(int fd, void *buf, size_t count)
 {
+    meha::FileDescriptor::sptr fdp;
+    if (auto iom = meha::hook::UringTarget(fd, fdp)) {
+        return iom->uringRecv(fd, buf, count, 0, fdp->timeout(meha::FileDescriptor::RecvTimeout));
+    }
     return meha::hook::doIO(fd, read_f, "read", meha::FdContext::FdEvent::Read, meha::FileDescriptor::RecvTimeout, buf, count);
 }
 
@@ -371,6 +564,10 @@ ssize_t readv(int fd, const struct iovec *iov, int iovcnt)
 
 ssize_t recv(int sockfd, void *buf, size_t len, int flags)
 {
+    meha::FileDescriptor::sptr fdp;
+    if (auto iom = meha::hook::UringTarget(sockfd, fdp)) {
+        return iom->uringRecv(sockfd, buf, len, flags, fdp->timeout(meha::FileDescriptor::RecvTimeout));
+    }
     return meha::hook::doIO(sockfd, recv_f, "recv", meha::FdContext::FdEvent::Read, meha::FileDescriptor::RecvTimeout, buf,
                             len, flags);
 }
@@ -390,6 +587,10 @@ ssize_t recvmsg(int sockfd, struct msghdr *msg, int flags)
 
 ssize_t write(int fd, const void *buf, size_t count)
 {
+    meha::FileDescriptor::sptr fdp;
+    if (auto iom = meha::hook::UringTarget(fd, fdp)) {
+        return iom->uringSend(fd, buf, count, 0, fdp->timeout(meha::FileDescriptor::SendTimeout));
+    }
     return meha::hook::doIO(fd, write_f, "write", meha::FdContext::FdEvent::Write, meha::FileDescriptor::SendTimeout, buf,
                             count);
 }
@@ -402,6 +603,10 @@ ssize_t writev(int fd, const struct iovec *iov, int iovcnt)
 
 ssize_t send(int sockfd, const void *buf, size_t len, int flags)
 {
+    meha::FileDescriptor::sptr fdp;
+    if (auto iom = meha::hook::UringTarget(sockfd, fdp)) {
+        return iom->uringSend(sockfd, buf, len, flags, fdp->timeout(meha::FileDescriptor::SendTimeout));
+    }
     return meha::hook::doIO(sockfd, send_f, "send", meha::FdContext::FdEvent::Write, meha::FileDescriptor::SendTimeout, buf,
                             len, flags);
 }
@@ -421,17 +626,10 @@ ssize_t sendmsg(int sockfd, const struct msghdr *msg, int flags)
 
 int close(int fd)
 {
-    if (!meha::hook::t_hook_enabled) {
-        return close_f(fd);
-    }
-
-    meha::FileDescriptor::sptr fdp = meha::FileDescriptorManager::Instance()->fetch(fd);
-    if (fdp) {
-        auto iom = meha::IOManager::GetCurrent();
-        if (iom) {
-            iom->triggerAllEvents(fd);
-        }
-        meha::FileDescriptorManager::Instance()->remove(fd);
+    // 不论是否开启hook、在哪个线程上关闭，都要让监听该fd的IOManager释放它，否则fd号被复用后新的fd不会加入epoll
+    // 没有IOManager持有状态的fd（普通文件、管道、没有监听过事件的套接字）不必访问所有的IOManager
+    if (meha::FileDescriptorManager::Instance()->remove(fd)) {
+        meha::IOManager::ReleaseFd(fd);
     }
     return close_f(fd);
 }
@@ -440,29 +638,31 @@ int close(int fd)
 
 int open(const char *pathname, int flags, ...)
 {
-    if (!meha::hook::t_hook_enabled) {
+    // 只有创建文件时才有第三个参数mode
+    mode_t mode = 0;
+    if ((flags & O_CREAT) || (flags & O_TMPFILE) == O_TMPFILE) {
         va_list args;
         va_start(args, flags);
-        int fd = open_f(pathname, flags, args);
+        mode = static_cast<mode_t>(va_arg(args, int));
         va_end(args);
-        return fd;
     }
-    va_list args;
-    va_start(args, flags);
-    int fd = open_f(pathname, flags, args);
-    va_end(args);
-    meha::FileDescriptorManager::Instance()->fetch(fd, false);
+    if (!meha::hook::t_hook_enabled) {
+        return open_f(pathname, flags, mode);
+    }
+    int fd = meha::hook::doFileIO(open_f, pathname, flags, mode);
+    meha::FileDescriptorManager::Instance()->create(fd);
     return fd;
 }
 
 int fcntl(int fd, int cmd, ... /* arg */)
 {
     if (!meha::hook::t_hook_enabled) {
+        // 不能把 va_list 本身当作参数透传，按指针宽度取出第三个参数（与 glibc 的 fcntl 实现一致）
         va_list args;
         va_start(args, cmd);
-        int res = fcntl_f(fd, cmd, args);
+        void *arg = va_arg(args, void *);
         va_end(args);
-        return res;
+        return fcntl_f(fd, cmd, arg);
     }
 
     va_list va;
@@ -570,10 +770,7 @@ int getsockopt(int sockfd, int level, int optname, void *optval,
 int setsockopt(int sockfd, int level, int optname, const void *optval,
                socklen_t optlen)
 {
-    if (!meha::hook::t_hook_enabled) {
-        return setsockopt_f(sockfd, level, optname, optval, optlen);
-    }
-
+    // hook关闭时（例如内联任务中）也要记录超时，等待套接字就绪时仍然要遵守
     if (level == SOL_SOCKET) {
         if (optname == SO_RCVTIMEO || optname == SO_SNDTIMEO) {
             auto fdp = meha::FileDescriptorManager::Instance()->fetch(sockfd);
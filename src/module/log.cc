@@ -147,7 +147,7 @@ struct ElapseFormatItem : public LogFormatter::FormatItemBase
 {
     void format(std::ostream &out, const LogMessage::sptr msg) const override
     {
-        out << utils::GetCurrentMS().count();
+        out << std::chrono::duration_cast<std::chrono::milliseconds>(msg->timestamp.time_since_epoch()).count();
     }
 };
 
@@ -13,6 +13,7 @@
 
 #include "module/private/modules.h"
 #include "utils/mutex.h"
+#include "utils/clock.h"
 #include "utils/singleton.h"
 #include "utils/utils.h" // 为了引入 utils namespace
 
@@ -45,14 +46,17 @@
 #define LOG_FATAL(category, message) LOG_LEVEL(category, FATAL, message)
 
 // 使用C-style API的可设置格式打印日志的宏（这里额外加了一个大括号来增加作用域，放置内部定义的变量和外部冲突）
-#define LOG_FMT_LEVEL(category, level, format, argv...)    \
-    {                                                      \
-        char *b = nullptr;                                 \
-        int l = asprintf(&b, format, argv);                \
-        if (l != -1) {                                     \
-            LOG_LEVEL(category, level, std::string(b, l)); \
-            free(b);                                       \
-        }                                                  \
+// 先检查日志等级，被过滤掉的日志不做格式化，也不分配内存
+#define LOG_FMT_LEVEL(category, level, format, argv...)                                 \
+    {                                                                                   \
+        if (GET_LOGGER(#category)->getLevel() <= meha::LogMessage::LogLevel::level) {   \
+            char *b = nullptr;                                                          \
+            int l = asprintf(&b, format, argv);                                         \
+            if (l != -1) {                                                              \
+                LOG_LEVEL(category, level, std::string(b, l));                          \
+                free(b);                                                                \
+            }                                                                           \
+        }                                                                               \
     }
 
 #define LOG_FMT_TRACE(category, format, argv...) \
@@ -110,7 +114,7 @@ struct LogMessage
         , function(func)
         , tid(tid)
         , fid(fid)
-        , timestamp(std::chrono::system_clock::now())
+        , timestamp(utils::PreciseSystemTime())
         , ss(content)
     {
     }
@@ -127,7 +131,7 @@ struct LogMessage
     const uint32_t line; // 行号
     const int32_t tid; // 线程ID
     const int32_t fid; // 协程ID
-    const std::chrono::system_clock::time_point timestamp; // 当前时间戳
+    const std::chrono::system_clock::time_point timestamp; // 当前时间戳（精确时间，不使用事件循环缓存的时间）
     std::stringstream ss; // 日志流
 };
 
@@ -1,11 +1,18 @@
+#include <algorithm>
+#include <cerrno>
 #include <fmt/format.h>
+#include <linux/futex.h>
+#include <sched.h>
+#include <sys/syscall.h>
 
 #include "config.h"
 #include "fiber.h"
+#include "fiber_stack.h"
 #include "module/hook.h"
 #include "module/log.h"
 
 #include "scheduler.h"
+#include "utils/clock.h"
 #include "utils/exception.h"
 #include "utils/utils.h"
 
@@ -17,8 +24,199 @@ static thread_local Scheduler *t_scheduler{nullptr};
 // 新增：当前线程的调度协程（用于切到调度协程）。加上Fiber模块中记录的当前协程和主协程，现在记录了3个协程
 static thread_local Fiber::sptr t_scheduler_fiber{nullptr};
 
-// 调度器tickle频率配置项（默认1s一次）
-static ConfigItem<uint64_t>::sptr g_scheduler_tickle_time{Config::Lookup<uint64_t>("scheduler.tickle_time", 1, "单位:us")};
+// 工作线程的放置
+static ConfigItem<std::vector<int>>::sptr g_scheduler_cpu_set{Config::Lookup<std::vector<int>>("scheduler.cpu_set", {}, "工作线程绑定的CPU列表，每个工作线程依次绑定到其中的一个CPU上，为空表示不绑定，仅在创建调度器时读取")};
+static ConfigItem<int>::sptr g_scheduler_numa_node{Config::Lookup<int>("scheduler.numa_node", -1, "工作线程所在的NUMA节点：只在该节点的CPU上运行（cpu_set不为空时取两者的交集），并优先在该节点上分配内存；-1表示不限制，仅在创建调度器时读取")};
+static ConfigItem<bool>::sptr g_scheduler_numa_spread{Config::Lookup<bool>("scheduler.numa_spread", false, "numa_node为-1时，是否把先后创建的调度器轮流分配到各个在线并且有CPU的NUMA节点上")};
+
+// 空闲的工作线程休眠前最多自旋的轮数
+static ConfigItem<uint64_t>::sptr g_scheduler_idle_spin{Config::Lookup<uint64_t>("scheduler.idle_spin", 64, "空闲的工作线程休眠前最多自旋等待新任务的轮数（实际轮数会根据最近自旋是否等到任务自适应调整），0表示不自旋直接休眠")};
+// 每个工作线程缓存的已结束协程数量上限
+static ConfigItem<uint64_t>::sptr g_scheduler_fiber_cache{Config::Lookup<uint64_t>("scheduler.fiber_cache", 64, "每个工作线程缓存的已结束协程数量上限，0表示不缓存")};
+
+// PSA的优先级级别数量与老化间隔
+static ConfigItem<uint64_t>::sptr g_scheduler_psa_levels{Config::Lookup<uint64_t>("scheduler.psa.levels", 4, "PSA调度策略的优先级级别数量，仅在创建调度器时读取")};
+static ConfigItem<uint64_t>::sptr g_scheduler_psa_aging{Config::Lookup<uint64_t>("scheduler.psa.aging", 100, "PSA调度策略中任务每等待多久提升一个优先级，单位:ms，0表示不老化")};
+
+// 弹性线程池
+static ConfigItem<uint64_t>::sptr g_scheduler_elastic_min_threads{Config::Lookup<uint64_t>("scheduler.elastic.min_threads", 0, "线程池最少保留的工作线程数量（不含caller线程），0表示与创建调度器时指定的线程池大小相同，仅在创建调度器时读取")};
+static ConfigItem<uint64_t>::sptr g_scheduler_elastic_max_threads{Config::Lookup<uint64_t>("scheduler.elastic.max_threads", 0, "线程池最多扩容到的工作线程数量（不含caller线程），不大于线程池大小时表示不扩容，仅在创建调度器时读取")};
+static ConfigItem<uint64_t>::sptr g_scheduler_elastic_queue_delay{Config::Lookup<uint64_t>("scheduler.elastic.queue_delay", 5, "任务排队超过多久且没有空闲的工作线程时扩容一个工作线程，同时也是两次扩容的最小间隔，单位:ms，仅在创建调度器时读取")};
+static ConfigItem<uint64_t>::sptr g_scheduler_elastic_idle_timeout{Config::Lookup<uint64_t>("scheduler.elastic.idle_timeout", 30000, "工作线程空闲超过多久后退出（线程数量不少于min_threads），单位:ms，0表示不退出，仅在创建调度器时读取")};
+
+// 阻塞调用线程池
+static ConfigItem<uint64_t>::sptr g_scheduler_offload_threads{Config::Lookup<uint64_t>("scheduler.offload.threads", 16, "阻塞调用线程池的线程数量上限（线程按需创建，所有调度器共用）")};
+
+// 热路径上不走 ConfigItem::getValue（会加读锁），而是读取由变更回调同步过来的副本
+static std::atomic_uint64_t s_fiber_cache_limit{g_scheduler_fiber_cache->getValue()};
+static std::atomic_uint64_t s_psa_aging{g_scheduler_psa_aging->getValue()};
+static std::atomic_uint64_t s_idle_spin{g_scheduler_idle_spin->getValue()};
+
+struct _SchedulerIniter
+{
+    _SchedulerIniter()
+    {
+        g_scheduler_fiber_cache->addListener([](const uint64_t &, const uint64_t &new_value) {
+            s_fiber_cache_limit = new_value;
+        });
+        g_scheduler_psa_aging->addListener([](const uint64_t &, const uint64_t &new_value) {
+            s_psa_aging = new_value;
+        });
+        g_scheduler_idle_spin->addListener([](const uint64_t &, const uint64_t &new_value) {
+            s_idle_spin = new_value;
+        });
+    }
+};
+static _SchedulerIniter s_scheduler_initer;
+
+// 当前工作线程缓存的已结束协程（用于复用执行可调用对象任务）
+static thread_local std::vector<Fiber::sptr> t_fiber_cache;
+// 当前线程是否正在调度协程上执行内联任务
+static thread_local bool t_running_inline{false};
+// 当前工作线程在调度器中的序号（对应本地任务队列的下标），不是工作线程时为-1
+static thread_local int t_worker_index{-1};
+// 选择窃取对象用的随机数状态（xorshift）
+static thread_local uint32_t t_steal_seed{0};
+
+// 当前协程完全换出后由调度协程执行的动作（见Scheduler::suspend）
+static thread_local std::function<void(Scheduler::ResumeFunc)> t_suspend_action{nullptr};
+
+// 当前工作线程下次空闲时自旋的轮数（自适应：自旋等到了任务就加倍，没等到就减半）
+static thread_local uint64_t t_spin_rounds{0};
+
+// numa_spread：下一个调度器分配到的NUMA节点在 Thread::GetNumaNodes() 中的序号
+static std::atomic_int s_next_numa_node{0};
+
+// WorkStealing：一次从全局注入队列中最多取出的任务数量
+static constexpr size_t kGlobalBatch = 32;
+// 调度器停止过程中，休眠的工作线程每隔多久醒来检查一次是否可以退出（其他工作线程执行完最后的任务时不会唤醒它们）
+static constexpr long kStoppingParkNS = 1000 * 1000;
+
+static void CPURelax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    asm volatile("yield" ::: "memory");
+#endif
+}
+
+// 返回是否是因为超时返回的
+static bool FutexWait(std::atomic_uint32_t *addr, uint32_t expected, const timespec *timeout)
+{
+    return ::syscall(SYS_futex, reinterpret_cast<uint32_t *>(addr), FUTEX_WAIT_PRIVATE, expected, timeout, nullptr, 0) == -1 && errno == ETIMEDOUT;
+}
+
+static void FutexWake(std::atomic_uint32_t *addr)
+{
+    ::syscall(SYS_futex, reinterpret_cast<uint32_t *>(addr), FUTEX_WAKE_PRIVATE, 1, nullptr, nullptr, 0);
+}
+
+/**
+ * @brief 阻塞调用线程池
+ * @details 所有调度器共用，有调用排队且没有空闲线程时才创建新线程，线程数量不超过 scheduler.offload.threads，线程创建后不退出
+ */
+class OffloadPool
+{
+public:
+    static OffloadPool *Instance()
+    {
+        // 线程不会退出，故意不析构，避免进程退出时线程访问已经析构的队列
+        static OffloadPool *pool = new OffloadPool();
+        return pool;
+    }
+
+    void submit(Fiber::FiberFunc &&job)
+    {
+        Thread::sptr thread;
+        {
+            ScopedLock lock(&m_mutex);
+            m_jobs.push_back(std::move(job));
+            const size_t limit = std::max<uint64_t>(g_scheduler_offload_threads->getValue(), 1);
+            if (m_jobs.size() > m_idle && m_threads.size() < limit) {
+                thread = std::make_shared<Thread>(std::bind(&OffloadPool::work, this));
+                m_threads.push_back(thread);
+            }
+            m_cv.signal();
+        }
+        if (thread) {
+            thread->start();
+        }
+    }
+
+private:
+    void work()
+    {
+        // 阻塞调用就是要阻塞执行的，不走hook
+        hook::SetHookEnable(false);
+        while (true) {
+            Fiber::FiberFunc job;
+            {
+                ScopedLock lock(&m_mutex);
+                ++m_idle;
+                m_cv.wait(m_mutex, [this]() {
+                    return !m_jobs.empty();
+                });
+                --m_idle;
+                job = std::move(m_jobs.front());
+                m_jobs.pop_front();
+            }
+            job();
+        }
+    }
+
+    Mutex m_mutex;
+    ConditionVariable m_cv;
+    std::deque<Fiber::FiberFunc> m_jobs;
+    std::vector<Thread::sptr> m_threads;
+    size_t m_idle = 0;
+};
+
+static uint32_t NextRandom()
+{
+    if (t_steal_seed == 0) {
+        t_steal_seed = static_cast<uint32_t>(utils::GetThreadID()) * 2654435761u | 1;
+    }
+    t_steal_seed ^= t_steal_seed << 13;
+    t_steal_seed ^= t_steal_seed >> 17;
+    t_steal_seed ^= t_steal_seed << 5;
+    return t_steal_seed;
+}
+
+// 单调时钟上的当前时间（ms），用于任务的入队时间，不受系统时间修改的影响
+// 入队的任务可能执行了任意长时间，读取缓存的时间会把执行时间算成排队时间，造成误老化和误扩容
+static uint64_t NowMS()
+{
+    return std::chrono::duration_cast<std::chrono::milliseconds>(utils::PreciseMonotonicUS()).count();
+}
+
+Scheduler::TaskBatch::TaskBatch(TaskBatch &&rhs) noexcept
+    : m_head(rhs.m_head)
+    , m_tail(rhs.m_tail)
+    , m_size(rhs.m_size)
+{
+    rhs.m_head = rhs.m_tail = nullptr;
+    rhs.m_size = 0;
+}
+
+Scheduler::TaskBatch &Scheduler::TaskBatch::operator=(TaskBatch &&rhs) noexcept
+{
+    if (this != &rhs) {
+        std::swap(m_head, rhs.m_head);
+        std::swap(m_tail, rhs.m_tail);
+        std::swap(m_size, rhs.m_size);
+    }
+    return *this;
+}
+
+Scheduler::TaskBatch::~TaskBatch()
+{
+    while (m_head) {
+        TaskNode *next = m_head->next;
+        delete m_head;
+        m_head = next;
+    }
+}
 
 Scheduler *Scheduler::GetCurrent()
 {
@@ -33,7 +231,13 @@ Fiber::sptr Scheduler::GetSchedulerFiber()
     return t_scheduler_fiber;
 }
 
-Scheduler::Scheduler(size_t pool_size, bool use_caller)
+bool Scheduler::IsRunningInline()
+{
+    return t_running_inline;
+}
+
+Scheduler::Scheduler(size_t pool_size, bool use_caller, Strategy strategy)
+    : m_strategy(strategy)
 {
     ASSERT_FMT(pool_size > 0, "线程池大小不能为空");
     ASSERT_FMT(t_scheduler == nullptr, "每个线程只能有一个调度器");
@@ -53,7 +257,53 @@ Scheduler::Scheduler(size_t pool_size, bool use_caller)
         t_scheduler_fiber = nullptr;
     }
     m_threadPoolSize = pool_size;
-    m_threadPool.reserve(m_threadPoolSize);
+    // 弹性线程池：线程数量在[m_minThreads, m_maxThreads]之间变化，本地队列按上限预先分配好，工作线程进出时只是绑定和解绑
+    m_minThreads = g_scheduler_elastic_min_threads->getValue();
+    m_minThreads = m_minThreads == 0 ? m_threadPoolSize : std::min<size_t>(m_minThreads, m_threadPoolSize);
+    if (!use_caller) {
+        m_minThreads = std::max<size_t>(m_minThreads, 1); // 没有caller线程时至少要保留一个工作线程
+    }
+    m_maxThreads = std::max<size_t>(g_scheduler_elastic_max_threads->getValue(), m_threadPoolSize);
+    m_queueDelay = std::max<uint64_t>(g_scheduler_elastic_queue_delay->getValue(), 1);
+    if (m_maxThreads > m_minThreads) {
+        m_idleTimeout = g_scheduler_elastic_idle_timeout->getValue();
+    }
+    m_stampEnqueueTime = m_strategy == PSA || m_maxThreads > m_minThreads;
+    m_threadPool.reserve(m_maxThreads);
+    const size_t workers = m_maxThreads + (use_caller ? 1 : 0);
+    m_localQueues.reserve(workers);
+    for (size_t i = 0; i < workers; i++) {
+        m_localQueues.emplace_back(std::make_unique<LocalQueue>());
+    }
+    if (m_strategy == PSA) {
+        m_priorityLists.resize(std::max<uint64_t>(g_scheduler_psa_levels->getValue(), 1));
+    }
+    // 工作线程的放置：NUMA节点和CPU
+    m_numaNode = g_scheduler_numa_node->getValue();
+    if (m_numaNode < 0 && g_scheduler_numa_spread->getValue()) {
+        const auto nodes = Thread::GetNumaNodes();
+        if (!nodes.empty()) {
+            m_numaNode = nodes[s_next_numa_node++ % nodes.size()];
+        }
+    }
+    m_cpuSet = g_scheduler_cpu_set->getValue();
+    if (m_numaNode >= 0 && !m_cpuSet.empty()) {
+        const auto node_cpus = Thread::GetNumaNodeCPUs(m_numaNode);
+        m_cpuSet.erase(std::remove_if(m_cpuSet.begin(), m_cpuSet.end(), [&node_cpus](int cpu) {
+                           return std::find(node_cpus.begin(), node_cpus.end(), cpu) == node_cpus.end();
+                       }),
+                       m_cpuSet.end());
+        if (m_cpuSet.empty()) {
+            LOG_FMT_WARN(core, "scheduler.cpu_set 中没有属于NUMA节点%d的CPU，工作线程绑定到该节点的所有CPU上", m_numaNode);
+        }
+    }
+    if (use_caller) {
+        m_callerThread = utils::GetThreadID();
+    }
+    // caller线程要到stop时才开始调度，提前绑定本地队列，让绑定到caller线程的任务直接进入它的邮箱
+    if (use_caller) {
+        bindLocalQueue(utils::GetThreadID());
+    }
 }
 
 Scheduler::~Scheduler()
@@ -75,13 +325,18 @@ void Scheduler::start()
         return;
     }
     m_started = true;
+    m_activeThreads = m_threadPoolSize;
     for (size_t i = 0; i < m_threadPoolSize; i++) {
         m_threadPool.emplace_back(std::make_shared<Thread>(std::bind(&Scheduler::run, this)));
         m_threadPool.back()->start();
+        // start返回时线程id已经确定，此后绑定到该线程的任务都会直接进入它的邮箱
+        bindLocalQueue(m_threadPool.back()->tid());
     }
     if (m_cv) {
-        m_cv->wait([this]() {
-            return m_syncCount > 0;
+        // 等待所有工作线程完成t_scheduler的初始化
+        ScopedLock lock(&m_mutex);
+        m_cv->wait(m_mutex, [this]() {
+            return m_syncCount == 0;
         });
         LOG_FMT_DEBUG(root, "WAIT: m_syncCount = %lu", m_syncCount);
     }
@@ -95,7 +350,13 @@ void Scheduler::stop()
     m_stopped = true;
     // 必然是调度协程来调用stop
 
-    for (auto &&t : m_threadPool) {
+    // 线程池会扩容，复制一份再遍历（设置了m_stopped之后就不会再扩容了）
+    std::vector<Thread::sptr> threads;
+    {
+        ScopedLock lock(&m_mutex);
+        threads = m_threadPool;
+    }
+    for (auto &&t : threads) {
         tickle(); // REVIEW 这里tickle这么多次有用吗？
     }
 
@@ -106,31 +367,718 @@ void Scheduler::stop()
     }
 
     // 等待所有调度线程执行完各自的调度任务
-    for (auto &t : m_threadPool) {
+    for (auto &t : threads) {
         t->join();
     }
 }
 
 bool Scheduler::isStoped() const
 {
-    ScopedLock lock(&m_mutex);
-    // 调用过stop、任务列表没有新任务，也没有正在执行的任务，说明调度器已经彻底停止
-    return m_stopped && m_taskList.empty() && m_workers == 0;
+    // 调用过stop、任务队列中没有新任务，也没有正在执行的任务，说明调度器已经彻底停止
+    return m_stopped && m_pendingTasks == 0 && m_workers == 0 && m_suspendedTasks == 0;
+}
+
+Scheduler::Stats Scheduler::getStats() const
+{
+    Stats stats;
+    stats.threads = m_activeThreads;
+    stats.minThreads = m_minThreads;
+    stats.maxThreads = m_maxThreads;
+    stats.busy = m_workers;
+    stats.idle = m_idlers;
+    stats.pending = m_pendingTasks;
+    stats.grown = m_grownCount;
+    stats.retired = m_retiredCount;
+    stats.lastQueueDelay = m_lastQueueDelay;
+    stats.suspended = m_suspendedTasks;
+    return stats;
 }
 
 void Scheduler::tickle()
 {
-    LOG_INFO(core, "tickle!");
+    if (m_parkedWorkers == 0) {
+        return;
+    }
+    // 唤醒一个休眠的工作线程，从随机的位置开始找，避免总是唤醒同一个
+    const size_t workers = m_localQueues.size();
+    const size_t start = NextRandom() % workers;
+    for (size_t i = 0; i < workers; i++) {
+        LocalQueue &local = *m_localQueues[(start + i) % workers];
+        uint32_t parked = 1;
+        if (local.parked.compare_exchange_strong(parked, 0)) {
+            FutexWake(&local.parked);
+            return;
+        }
+    }
+}
+
+void Scheduler::tickleThread(pid_t thread_id)
+{
+    for (auto &local : m_localQueues) {
+        if (local->tid == thread_id) {
+            uint32_t parked = 1;
+            if (local->parked.compare_exchange_strong(parked, 0)) {
+                FutexWake(&local->parked);
+            }
+            return;
+        }
+    }
+}
+
+void Scheduler::placeCurrentWorker()
+{
+    // caller线程是用户自己的线程，不改变它的绑定
+    if (static_cast<pid_t>(utils::GetThreadID()) == m_callerThread) {
+        return;
+    }
+    if (!m_cpuSet.empty()) {
+        // caller线程占用了0号本地队列，线程池的工作线程从第一个CPU开始依次绑定
+        const size_t index = t_worker_index - (m_callerThread != -1 ? 1 : 0);
+        const int cpu = m_cpuSet[index % m_cpuSet.size()];
+        if (Thread::SetCurrentAffinity({cpu})) {
+            LOG_FMT_DEBUG(core, "工作线程[TID:%d] 绑定到CPU%d", utils::GetThreadID(), cpu);
+        }
+    } else if (m_numaNode >= 0) {
+        Thread::SetCurrentAffinity(Thread::GetNumaNodeCPUs(m_numaNode));
+    }
+    if (m_numaNode >= 0) {
+        Thread::SetCurrentMemoryNode(m_numaNode);
+    }
+}
+
+bool Scheduler::hasRunnableTask() const
+{
+    if (m_localQueues[t_worker_index]->mailboxSize > 0) {
+        return true;
+    }
+    return m_pendingTasks > m_mailboxTasks;
+}
+
+void Scheduler::growIfDelayed(const Task &task)
+{
+    // 有空闲的工作线程说明任务积压只是暂时的，它们很快就会来取
+    if (m_activeThreads >= m_maxThreads || m_stopped || hasIdler()) {
+        return;
+    }
+    const uint64_t now = NowMS();
+    const uint64_t delay = now > task.enqueueTime ? now - task.enqueueTime : 0;
+    if (task.enqueueTime == 0 || delay < m_queueDelay) {
+        return;
+    }
+    // 每个 queue_delay 间隔内最多扩容一次，给新线程取走积压任务的时间
+    uint64_t last = m_lastGrowTime;
+    if (now < last + m_queueDelay || !m_lastGrowTime.compare_exchange_strong(last, now)) {
+        return;
+    }
+    ScopedLock lock(&m_mutex);
+    if (m_stopped || m_activeThreads >= m_maxThreads) {
+        return;
+    }
+    // 顺便回收已经退出的工作线程
+    if (!m_retiredThreads.empty()) {
+        for (auto it = m_threadPool.begin(); it != m_threadPool.end();) {
+            if (std::find(m_retiredThreads.begin(), m_retiredThreads.end(), (*it)->tid()) != m_retiredThreads.end()) {
+                (*it)->join();
+                it = m_threadPool.erase(it);
+            } else {
+                ++it;
+            }
+        }
+        m_retiredThreads.clear();
+    }
+    if (m_cv) {
+        ++m_syncCount; // 新线程在sync中会减回去，这里不需要等待
+    }
+    auto thread = std::make_shared<Thread>(std::bind(&Scheduler::run, this));
+    thread->start();
+    // 已经持有m_mutex，直接绑定本地队列（bindLocalQueue会加锁）
+    for (auto &local : m_localQueues) {
+        if (local->tid == -1) {
+            local->tid = thread->tid();
+            break;
+        }
+    }
+    m_threadPool.push_back(thread);
+    ++m_activeThreads;
+    ++m_grownCount;
+    m_lastQueueDelay = delay;
+    LOG_FMT_INFO(core, "任务排队了%lums，线程池扩容工作线程[TID:%d]，当前%lu个工作线程", delay, thread->tid(), m_activeThreads.load());
+}
+
+bool Scheduler::tryRetireWorker()
+{
+    // caller线程不属于线程池；共享栈上还有协程时线程退出会让它们再也无法恢复
+    if (m_idleTimeout == 0 || m_stopped || t_worker_index < 0 || static_cast<pid_t>(utils::GetThreadID()) == m_callerThread || SharedStack::HasBoundFibers()) {
+        return false;
+    }
+    ScopedLock lock(&m_mutex);
+    if (m_stopped || m_activeThreads <= m_minThreads) {
+        return false;
+    }
+    LocalQueue &local = *m_localQueues[t_worker_index];
+    {
+        // 解绑本地队列之后，不会再有任务进入它的邮箱和本地队列
+        SpinScopedLock task_lock(&local.mutex);
+        SpinScopedLock mailbox_lock(&local.mailboxMutex);
+        // 挂起中的绑定任务恢复后要回到这个线程的邮箱（只有本线程会挂起绑定到自己的任务，这里的检查不会与之竞争）
+        if (!local.tasks.empty() || !local.mailbox.empty() || local.suspendedPinned > 0) {
+            return false;
+        }
+        local.tid = -1;
+    }
+    --m_activeThreads;
+    ++m_retiredCount;
+    m_retiredThreads.push_back(utils::GetThreadID());
+    LOG_FMT_INFO(core, "工作线程[TID:%d]空闲超过%lums，退出线程池，当前%lu个工作线程", utils::GetThreadID(), m_idleTimeout, m_activeThreads.load());
+    return true;
+}
+
+bool Scheduler::park(uint64_t timeout_ms)
+{
+    // 自旋：每轮的等待时间指数增长，最后几轮让出CPU
+    const uint64_t max_rounds = s_idle_spin;
+    uint64_t rounds = std::min(t_spin_rounds ? t_spin_rounds : max_rounds, max_rounds);
+    for (uint64_t i = 0; i < rounds; i++) {
+        if (hasRunnableTask() || m_stopped) {
+            t_spin_rounds = std::min(rounds * 2, max_rounds);
+            return false;
+        }
+        if (i + 4 >= rounds) {
+            ::sched_yield();
+        } else {
+            for (uint64_t n = 1u << std::min<uint64_t>(i, 6); n > 0; n--) {
+                CPURelax();
+            }
+        }
+    }
+    t_spin_rounds = std::max<uint64_t>(rounds / 2, 1);
+
+    // 休眠：先声明自己要休眠，再检查一次有没有任务，与入队后tickle的顺序相反，保证不会错过唤醒
+    LocalQueue &local = *m_localQueues[t_worker_index];
+    ++m_parkedWorkers;
+    local.parked = 1;
+    bool timed_out = false;
+    if (!hasRunnableTask()) {
+        if (m_stopped) {
+            timespec timeout{0, kStoppingParkNS};
+            FutexWait(&local.parked, 1, &timeout);
+        } else if (timeout_ms > 0) {
+            timespec timeout{static_cast<time_t>(timeout_ms / 1000), static_cast<long>(timeout_ms % 1000 * 1000 * 1000)};
+            timed_out = FutexWait(&local.parked, 1, &timeout);
+        } else {
+            FutexWait(&local.parked, 1, nullptr);
+        }
+    }
+    local.parked = 0;
+    --m_parkedWorkers;
+    return timed_out;
 }
 
 void Scheduler::idle()
 {
-    // Idle协程啥也不用做，只是会获取CPU，作用是保持调度器运行，这样才能响应用户的schedule添加调度任务的请求
+    // 没有任务时休眠，有新任务（或者被tickle唤醒）时yield回调度协程去取任务
     LOG(core, TRACE) << "idle协程[" << Fiber::GetCurrentID() << "] on scheduler " << this;
     while (!isStoped()) {
-        ::usleep(g_scheduler_tickle_time->getValue());
-        Fiber::Yield(); // 啥也没做直接yield
+        // 空闲太久的工作线程退出线程池
+        if (park(m_idleTimeout) && tryRetireWorker()) {
+            break;
+        }
+        Fiber::Yield();
+    }
+}
+
+void Scheduler::RunInline(Fiber::FiberFunc &&callback)
+{
+    // 内联任务不能让出调度协程，因此关闭hook，本来会挂起协程的sleep和套接字IO改为阻塞工作线程（见 hook.cc）
+    const bool hook_enabled = hook::IsHookEnabled();
+    hook::SetHookEnable(false);
+    t_running_inline = true;
+    auto cleanup = utils::GenScopeGuard([hook_enabled]() {
+        t_running_inline = false;
+        hook::SetHookEnable(hook_enabled);
+    });
+    callback();
+}
+
+Fiber::sptr Scheduler::AcquireFiber(Fiber::FiberFunc &&callback)
+{
+    if (t_fiber_cache.empty()) {
+        return std::make_shared<Fiber>(std::move(callback), true);
+    }
+    Fiber::sptr fiber = std::move(t_fiber_cache.back());
+    t_fiber_cache.pop_back();
+    fiber->reset(std::move(callback));
+    return fiber;
+}
+
+void Scheduler::RecycleFiber(Fiber::sptr &&fiber)
+{
+    // 还被其他地方引用的协程不能复用，否则对方会看到协程被绑定到了别的任务上
+    if (fiber.use_count() != 1 || t_fiber_cache.size() >= s_fiber_cache_limit) {
+        fiber.reset();
+        return;
     }
+    t_fiber_cache.push_back(std::move(fiber));
+}
+
+void Scheduler::ClearFiberCache()
+{
+    t_fiber_cache.clear();
+}
+
+bool Scheduler::pushTask(Task &&task, bool instantly)
+{
+    ++m_pendingTasks;
+    // 记录入队时间，用于PSA的老化和线程池扩容
+    if (m_stampEnqueueTime) {
+        task.enqueueTime = NowMS();
+    }
+    if (task.tid != -1) {
+        // 绑定了线程的任务直接放入该线程的邮箱，只唤醒该线程（找不到该线程时解除绑定，放入全局队列）
+        if (pushMailboxTask(std::move(task), instantly)) {
+            return false;
+        }
+    } else if (m_strategy == WorkStealing && t_scheduler == this && t_worker_index >= 0) {
+        // 工作线程自己提交的任务放入自己的本地队列
+        LocalQueue &local = *m_localQueues[t_worker_index];
+        SpinScopedLock lock(&local.mutex);
+        if (instantly)
+            local.tasks.push_front(std::move(task));
+        else
+            local.tasks.push_back(std::move(task));
+        // 有空闲的工作线程就唤醒它来窃取
+        return hasIdler();
+    }
+    ScopedLock lock(&m_mutex);
+    if (m_strategy == PSA) {
+        // 之前所有队列都是空的，说明工作线程可能都空闲了
+        bool need_tickle = true;
+        for (auto &list : m_priorityLists) {
+            need_tickle = need_tickle && list.empty();
+        }
+        pushPriorityTask(std::move(task), instantly);
+        // 有空闲的工作线程时也要唤醒，否则在其他工作线程忙碌时新任务要等到它们取完前面的任务才会被执行
+        return need_tickle || hasIdler();
+    }
+    bool need_tickle = m_taskList.empty();
+    // 优先调度的任务放在队首
+    if (instantly)
+        m_taskList.push_front(std::move(task));
+    else
+        m_taskList.push_back(std::move(task));
+    return need_tickle || hasIdler();
+}
+
+void Scheduler::offloadCall(Fiber::FiberFunc &&job)
+{
+    // 协程还没有换出时不能交给其他线程，否则job执行完时协程可能还在当前线程的栈上
+    const bool suspended = suspend([&job](ResumeFunc resume) {
+        OffloadPool::Instance()->submit([job = std::move(job), resume = std::move(resume)]() {
+            job();
+            resume();
+        });
+    });
+    if (!suspended) {
+        job();
+    }
+}
+
+bool Scheduler::suspend(std::function<void(ResumeFunc)> on_suspended)
+{
+    Fiber::sptr fiber = Fiber::GetCurrent();
+    if (t_scheduler != this || t_running_inline || !fiber || !fiber->isScheduled()) {
+        return false;
+    }
+    fiber.reset();
+    t_suspend_action = std::move(on_suspended);
+    Fiber::Yield();
+    return true;
+}
+
+bool Scheduler::pushMailboxTask(Task &&task, bool instantly)
+{
+    // 不再绑定线程；已经开始运行的共享栈协程不会走到这里，它们所在的线程不会退出线程池（见tryRetireWorker）
+    auto unpin = [&task]() {
+        LOG_FMT_DEBUG(core, "任务绑定的线程[TID:%d]不是工作线程，改由任意工作线程执行", task.tid);
+        ASSERT(!task.handle || task.handle->boundThread() == -1);
+        task.tid = -1;
+        return false;
+    };
+    for (auto &local : m_localQueues) {
+        if (local->tid != task.tid) {
+            continue;
+        }
+        const pid_t thread_id = task.tid;
+        {
+            SpinScopedLock lock(&local->mailboxMutex);
+            // 该线程可能刚刚退出了线程池
+            if (local->tid != thread_id) {
+                return unpin();
+            }
+            if (instantly)
+                local->mailbox.push_front(std::move(task));
+            else
+                local->mailbox.push_back(std::move(task));
+            ++local->mailboxSize;
+            ++m_mailboxTasks;
+        }
+        if (thread_id != static_cast<pid_t>(utils::GetThreadID())) {
+            tickleThread(thread_id);
+        }
+        return true;
+    }
+    return unpin();
+}
+
+void Scheduler::pushPriorityTask(Task &&task, bool instantly)
+{
+    const uint32_t levels = static_cast<uint32_t>(m_priorityLists.size());
+    uint32_t &priority = task.priority;
+    priority = priority == kDefaultPriority ? levels / 2 : std::min(priority, levels - 1);
+    auto &list = m_priorityLists[priority];
+    if (instantly)
+        list.push_front(std::move(task));
+    else
+        list.push_back(std::move(task));
+}
+
+void Scheduler::schedule(TaskBatch &&batch)
+{
+    if (batch.empty()) {
+        return;
+    }
+    // 先计入等待中的任务，保证工作线程休眠前能看到这批任务
+    m_pendingTasks += batch.m_size;
+    stampEnqueueTime(batch.m_head);
+    TaskNode *head = m_batchHead.load(std::memory_order_relaxed);
+    do {
+        batch.m_tail->next = head;
+    } while (!m_batchHead.compare_exchange_weak(head, batch.m_head, std::memory_order_release, std::memory_order_relaxed));
+    batch.m_head = batch.m_tail = nullptr;
+    batch.m_size = 0;
+    tickle();
+}
+
+void Scheduler::drainTaskBatches()
+{
+    if (m_batchHead.load(std::memory_order_relaxed) == nullptr) {
+        return;
+    }
+    TaskNode *node = m_batchHead.exchange(nullptr, std::memory_order_acquire);
+    const size_t count = pushTaskNodes(node);
+    // 提交时只唤醒了一个工作线程，这里按任务数量再唤醒其他空闲的工作线程来分担
+    const size_t wake = std::min(count, m_localQueues.size()) - (count > 0 ? 1 : 0);
+    for (size_t i = 0; i < wake; i++) {
+        tickle();
+    }
+}
+
+void Scheduler::scheduleLocal(TaskBatch &&batch)
+{
+    if (t_scheduler != this || t_worker_index < 0) {
+        schedule(std::move(batch));
+        return;
+    }
+    if (batch.empty()) {
+        return;
+    }
+    m_pendingTasks += batch.m_size;
+    stampEnqueueTime(batch.m_head);
+    // 当前工作线程接下来就会取这些任务，不唤醒其他工作线程
+    pushTaskNodes(batch.m_head);
+    batch.m_head = batch.m_tail = nullptr;
+    batch.m_size = 0;
+}
+
+int Scheduler::GetWorkerIndex()
+{
+    return t_worker_index;
+}
+
+void Scheduler::stampEnqueueTime(TaskNode *node)
+{
+    if (!m_stampEnqueueTime) {
+        return;
+    }
+    const uint64_t now = NowMS();
+    for (; node; node = node->next) {
+        node->task.enqueueTime = now;
+    }
+}
+
+size_t Scheduler::pushTaskNodes(TaskNode *node)
+{
+    // 链表是逆序的，反转回提交顺序，同时把绑定了线程的任务（共享栈协程）挑出来
+    TaskNode *head = nullptr;
+    TaskNode *pinned = nullptr;
+    size_t count = 0;
+    while (node) {
+        TaskNode *next = node->next;
+        if (node->task.tid != -1) {
+            node->next = pinned;
+            pinned = node;
+        } else {
+            node->next = head;
+            head = node;
+            ++count;
+        }
+        node = next;
+    }
+    auto take = [](TaskNode *&list) {
+        std::unique_ptr<TaskNode> node(list);
+        list = list->next;
+        return std::move(node->task);
+    };
+    // 所有任务放入同一个队列，只加一次锁
+    if (m_strategy == WorkStealing) {
+        LocalQueue &local = *m_localQueues[t_worker_index];
+        SpinScopedLock lock(&local.mutex);
+        while (head) {
+            local.tasks.push_back(take(head));
+        }
+    } else {
+        ScopedLock lock(&m_mutex);
+        while (head) {
+            if (m_strategy == PSA) {
+                pushPriorityTask(take(head), false);
+            } else {
+                m_taskList.push_back(take(head));
+            }
+        }
+    }
+    while (pinned) {
+        Task task = take(pinned);
+        if (!pushMailboxTask(std::move(task), false)) {
+            ScopedLock lock(&m_mutex);
+            if (m_strategy == PSA) {
+                pushPriorityTask(std::move(task), false);
+            } else {
+                m_taskList.push_back(std::move(task));
+            }
+        }
+    }
+    return count;
+}
+
+bool Scheduler::popTask(Task &task, bool &need_tickle)
+{
+    // 优先执行绑定到本线程的任务
+    if (t_worker_index >= 0 && popMailboxTask(task)) {
+        return true;
+    }
+    if (t_worker_index >= 0) {
+        drainTaskBatches();
+    }
+    if (m_strategy == PSA) {
+        return popPriorityTask(task, need_tickle);
+    }
+    if (m_strategy != WorkStealing || t_worker_index < 0) {
+        return popGlobalTask(task, need_tickle);
+    }
+    return popLocalTask(task) || grabGlobalTasks(task, need_tickle) || stealTasks(task);
+}
+
+bool Scheduler::popMailboxTask(Task &task)
+{
+    LocalQueue &local = *m_localQueues[t_worker_index];
+    if (local.mailboxSize == 0) {
+        return false;
+    }
+    SpinScopedLock lock(&local.mailboxMutex);
+    if (local.mailbox.empty()) {
+        return false;
+    }
+    task = std::move(local.mailbox.front());
+    local.mailbox.pop_front();
+    --local.mailboxSize;
+    --m_mailboxTasks;
+    return true;
+}
+
+int Scheduler::bindLocalQueue(pid_t thread_id)
+{
+    ScopedLock lock(&m_mutex);
+    int free_index = -1;
+    for (size_t i = 0; i < m_localQueues.size(); i++) {
+        const pid_t tid = m_localQueues[i]->tid;
+        if (tid == thread_id) {
+            return static_cast<int>(i);
+        }
+        if (tid == -1 && free_index == -1) {
+            free_index = static_cast<int>(i);
+        }
+    }
+    ASSERT_FMT(free_index != -1, "工作线程数量超出了本地队列数量");
+    m_localQueues[free_index]->tid = thread_id;
+    return free_index;
+}
+
+bool Scheduler::popGlobalTask(Task &task, bool &need_tickle)
+{
+    // 查找等待调度的任务
+    ScopedLock lock(&m_mutex);
+    auto it = m_taskList.begin();
+    while (it != m_taskList.end()) {
+        ASSERT(it->valid());
+        // 如果任务指定了要在特定线程执行，但当前线程不是指定线程，通知其他线程处理
+        if (it->tid != -1 && it->tid != static_cast<pid_t>(utils::GetThreadID())) {
+            need_tickle = true;
+            ++it;
+            continue;
+        }
+        // 跳过正在执行的任务
+        if (it->handle && it->handle->isRunning()) {
+            ++it;
+            continue;
+        }
+        // 找到可以执行的任务（且和指定的tid匹配）
+        task = std::move(*it);
+        m_taskList.erase(it); // 这里要用erase,导致我m_mutex用不了读写锁（否则就会出现读锁里加写锁）
+        return true; // 直接返回了，所以不会迭代器失效（虽然这里是std::list本来也不会失效）
+    }
+    return false;
+}
+
+bool Scheduler::popPriorityTask(Task &task, bool &need_tickle)
+{
+    ScopedLock lock(&m_mutex);
+    const uint64_t aging = s_psa_aging;
+    const uint64_t now = NowMS();
+    TaskDeque *best_list = nullptr;
+    TaskDeque::iterator best;
+    int64_t best_priority = 0;
+    for (size_t level = 0; level < m_priorityLists.size(); level++) {
+        auto &list = m_priorityLists[level];
+        // 同一级别中先入队的任务等待得最久，因此每个级别只需要看第一个可以执行的任务
+        for (auto it = list.begin(); it != list.end(); ++it) {
+            if (it->tid != -1 && it->tid != static_cast<pid_t>(utils::GetThreadID())) {
+                need_tickle = true;
+                continue;
+            }
+            if (it->handle && it->handle->isRunning()) {
+                continue;
+            }
+            // 老化：每等待 aging 毫秒提升一个优先级，相同的有效优先级下原本优先级高的任务优先
+            int64_t priority = static_cast<int64_t>(level);
+            if (aging > 0 && now > it->enqueueTime) {
+                priority -= static_cast<int64_t>((now - it->enqueueTime) / aging);
+            }
+            if (!best_list || priority < best_priority) {
+                best_list = &list;
+                best = it;
+                best_priority = priority;
+            }
+            break;
+        }
+    }
+    if (!best_list) {
+        return false;
+    }
+    task = std::move(*best);
+    best_list->erase(best);
+    return true;
+}
+
+bool Scheduler::popLocalTask(Task &task)
+{
+    LocalQueue &local = *m_localQueues[t_worker_index];
+    SpinScopedLock lock(&local.mutex);
+    // 队首的协程可能还没有在别的线程上换出，此时把它挪到队尾，每个任务最多检查一次
+    for (size_t n = local.tasks.size(); n > 0; n--) {
+        Task &front = local.tasks.front();
+        if (front.handle && front.handle->isRunning()) {
+            local.tasks.push_back(std::move(front));
+            local.tasks.pop_front();
+            continue;
+        }
+        task = std::move(front);
+        local.tasks.pop_front();
+        return true;
+    }
+    return false;
+}
+
+bool Scheduler::grabGlobalTasks(Task &task, bool &need_tickle)
+{
+    // 先无锁地看一眼，避免空闲的工作线程反复争抢全局锁
+    if (m_pendingTasks == 0) {
+        return false;
+    }
+    std::vector<Task> batch;
+    {
+        ScopedLock lock(&m_mutex);
+        if (m_taskList.empty()) {
+            return false;
+        }
+        // 每个工作线程只取自己的一份，剩下的留给其他工作线程
+        const size_t limit = std::min(m_taskList.size() / m_localQueues.size() + 1, kGlobalBatch);
+        const pid_t tid = utils::GetThreadID();
+        auto it = m_taskList.begin();
+        while (it != m_taskList.end() && batch.size() < limit) {
+            if ((it->tid != -1 && it->tid != tid) || (it->handle && it->handle->isRunning())) {
+                need_tickle = need_tickle || it->tid != -1;
+                ++it;
+                continue;
+            }
+            batch.push_back(std::move(*it));
+            it = m_taskList.erase(it);
+        }
+    }
+    if (batch.empty()) {
+        return false;
+    }
+    task = std::move(batch.front());
+    if (batch.size() > 1) {
+        LocalQueue &local = *m_localQueues[t_worker_index];
+        SpinScopedLock lock(&local.mutex);
+        for (size_t i = 1; i < batch.size(); i++) {
+            local.tasks.push_back(std::move(batch[i]));
+        }
+    }
+    return true;
+}
+
+bool Scheduler::stealTasks(Task &task)
+{
+    const size_t workers = m_localQueues.size();
+    if (workers <= 1 || m_pendingTasks == 0) {
+        return false;
+    }
+    // 从随机的工作线程开始依次尝试，避免所有窃取者都盯着同一个工作线程
+    const size_t start = NextRandom() % workers;
+    std::vector<Task> stolen;
+    for (size_t i = 0; i < workers && stolen.empty(); i++) {
+        const size_t victim = (start + i) % workers;
+        if (static_cast<int>(victim) == t_worker_index) {
+            continue;
+        }
+        LocalQueue &queue = *m_localQueues[victim];
+        SpinScopedLock lock(&queue.mutex);
+        // 从队尾窃取一半（至少一个），绑定了线程的任务不能被窃取
+        size_t want = (queue.tasks.size() + 1) / 2;
+        for (auto it = queue.tasks.end(); it != queue.tasks.begin() && want > 0;) {
+            --it;
+            if (it->tid != -1) {
+                continue;
+            }
+            stolen.push_back(std::move(*it));
+            it = queue.tasks.erase(it);
+            --want;
+        }
+    }
+    if (stolen.empty()) {
+        return false;
+    }
+    // 窃取时是倒序取出的，这里恢复原来的顺序
+    task = std::move(stolen.back());
+    if (stolen.size() > 1) {
+        LocalQueue &local = *m_localQueues[t_worker_index];
+        SpinScopedLock lock(&local.mutex);
+        for (size_t i = stolen.size() - 1; i > 0; i--) {
+            local.tasks.push_back(std::move(stolen[i - 1]));
+        }
+    }
+    return true;
 }
 
 void Scheduler::sync()
@@ -141,6 +1089,7 @@ void Scheduler::sync()
     }
     if (m_cv && !t_scheduler) {
         t_scheduler = this;
+        ScopedLock lock(&m_mutex);
         m_syncCount--;
         if (m_syncCount == 0)
             m_cv->signal();
@@ -152,9 +1101,16 @@ void Scheduler::run()
     sync();
     // 开启Hook
     hook::SetHookEnable(true); // FIXME 临时
+    // 找到当前工作线程的本地队列（可能已经在构造函数或start中绑定过）
+    t_worker_index = bindLocalQueue(utils::GetThreadID());
+    // 在分配idle协程、协程栈等工作线程自己的数据之前完成绑定，这些内存才会在本地NUMA节点上分配
+    placeCurrentWorker();
     auto cleanup = utils::GenScopeGuard([]() {
         // 关闭Hook
         hook::SetHookEnable(false);
+        // 调度结束后不再需要缓存的协程
+        ClearFiberCache();
+        t_worker_index = -1;
     });
 
     // 该线程空闲时执行的协程（每个执行Scheduler::run方法的线程都有一个idle协程）
@@ -164,47 +1120,81 @@ void Scheduler::run()
     while (true) {
         task.reset();
         bool need_tickle = false;
-        {
-            // 查找等待调度的任务
-            ScopedLock lock(&m_mutex);
-            auto it = m_taskList.begin();
-            while (it != m_taskList.end()) {
-                ASSERT(it->handle);
-                // 如果任务指定了要在特定线程执行，但当前线程不是指定线程，通知其他线程处理
-                if (it->tid != -1 && it->tid != utils::GetThreadID()) {
-                    need_tickle = true;
-                    ++it;
-                    continue;
-                }
-                // 跳过正在执行的任务
-                if (it->handle->isRunning()) {
-                    ++it;
-                    continue;
-                }
-                // 找到可以执行的任务（且和指定的tid匹配）
-                task = *it; // 拷贝一份
-                m_taskList.erase(it); // 这里要用erase,导致我m_mutex用不了读写锁（否则就会出现读锁里加写锁）
-                break; // 直接break了，所以不会迭代器失效（虽然这里是std::list本来也不会失效）
-            }
+        // 先计入正在执行的任务再减少等待中的任务，保证isStoped不会在两者之间误判
+        if (popTask(task, need_tickle)) {
+            ++m_workers;
+            --m_pendingTasks;
+            growIfDelayed(task);
         }
         if (need_tickle) { // 通知其他线程处理
             tickle();
         }
+        // 内联任务直接在调度协程上执行
+        if (task.inlined) {
+            RunInline(std::move(task.callback));
+            --m_workers;
+            continue;
+        }
+        // 可调用对象任务在这里才绑定协程
+        if (!task.handle && task.callback) {
+            task.handle = AcquireFiber(std::move(task.callback));
+            task.recyclable = true;
+        }
         // 换入该协程来执行任务
         if (task.handle) {
             // 换入执行该任务协程
             if (!task.handle->isTerminated()) {
-                ++m_workers;
                 task.handle->resume();
+            }
+            // 协程挂起等待外部事件，此时它已经完全换出，由挂起动作登记唤醒方式，唤醒后再放回任务队列
+            if (t_suspend_action) {
+                // 恢复时重新入队的任务放在（复用的）任务结点中，恢复回调只捕获两个指针，放得进std::function内部的缓冲区，挂起恢复都不分配内存
+                auto again = new TaskNode{Task(task.handle, task.tid)};
+                again->task.recyclable = task.recyclable;
+                again->task.priority = task.priority;
+                ++m_suspendedTasks;
+                // 绑定到本线程的任务挂起期间，本线程不能退出线程池，否则恢复后找不到邮箱
+                if (again->task.tid != -1) {
+                    ++m_localQueues[t_worker_index]->suspendedPinned;
+                }
+                auto action = std::move(t_suspend_action);
+                t_suspend_action = nullptr;
+                action([this, again]() {
+                    std::unique_ptr<TaskNode> node(again);
+                    const pid_t pinned = node->task.tid;
+                    // 先计入等待中的任务再减少，保证isStoped不会在两者之间误判
+                    if (pushTask(std::move(node->task))) {
+                        tickle();
+                    }
+                    // 任务已经进入了邮箱，线程仍然不能退出
+                    if (pinned != -1) {
+                        for (auto &local : m_localQueues) {
+                            if (local->tid == pinned) {
+                                --local->suspendedPinned;
+                                break;
+                            }
+                        }
+                    }
+                    --m_suspendedTasks;
+                });
                 --m_workers;
+                continue;
             }
             // 此时该任务协程已被换出，回到了调度协程
             switch (task.handle->status()) {
             case Fiber::Initialized:
             case Fiber::Ready:
                 LOG_FMT_TRACE(core, "工作协程[%ld]调度执行", task.handle->fid());
-                // 这种情况要重新塞入队列调度执行
-                schedule(task.handle, task.tid);
+                // 这种情况要重新塞入队列调度执行（保留协程可回收的标记，因此不走schedule）
+                {
+                    Task again(task.handle, task.tid);
+                    again.recyclable = task.recyclable;
+                    again.priority = task.priority;
+                    if (pushTask(std::move(again))) {
+                        tickle();
+                    }
+                }
+                --m_workers;
                 break;
             case Fiber::Terminated:
                 // 从任务列表里移除该任务
@@ -213,6 +1203,10 @@ void Scheduler::run()
                     ScopedLock lock(&m_mutex);
                     m_taskList.erase(*task.iter);
                 }
+                if (task.recyclable) {
+                    RecycleFiber(std::move(task.handle));
+                }
+                --m_workers;
                 break;
             case Fiber::Running:
                 // 如果换出时还是执行状态就抛异常
@@ -230,6 +1224,11 @@ void Scheduler::run()
                 ++m_idlers;
                 idle_fiber->resume();
                 --m_idlers;
+                // idle协程结束：调度器停止了，或者当前工作线程空闲太久退出了线程池（此时本地队列已经解绑，不能再取任务）
+                if (idle_fiber->isTerminated()) {
+                    LOG_FMT_TRACE(core, "idle协程[%ld]运行结束", idle_fiber->fid());
+                    return;
+                }
                 break;
             case Fiber::Terminated:
                 // 当idle协程停止时说明调度器需要结束了
@@ -2,11 +2,14 @@
 
 #include "fiber.h"
 #include "macro.h"
+#include "utils/cached_allocator.h"
 #include "utils/cond.h"
 #include "utils/mutex.h"
 #include "utils/thread.h"
 #include <atomic>
 #include <ctime>
+#include <deque>
+#include <exception>
 #include <list>
 #include <memory>
 #include <type_traits>
@@ -54,15 +57,28 @@ struct is_valid_task<std::variant<Types...>>
 class Scheduler : public utils::NonCopyable, public std::enable_shared_from_this<Scheduler>
 {
 private:
+    // 未指定优先级的任务（PSA下处于中间级别）
+    static constexpr uint32_t kDefaultPriority = ~0u;
+
+    struct Task;
+    // 任务队列：结点、块在入队出队时反复申请释放，由线程缓存复用（见 utils::CachedAllocator），稳定状态下入队出队不分配内存
+    using TaskList = std::list<Task, utils::CachedAllocator<Task>>;
+    using TaskDeque = std::deque<Task, utils::CachedAllocator<Task>>;
+
     /**
      * @brief 任务包装类
      * @note 任务可以是协程对象，也可以是可调用对象，会自动构造为协程
      * */
     struct Task
     {
-        std::optional<std::list<Task>::iterator> iter{std::nullopt}; // list迭代器，用于快速删除
+        std::optional<TaskList::iterator> iter{std::nullopt}; // list迭代器，用于快速删除
         Fiber::sptr handle{nullptr};
+        Fiber::FiberFunc callback{nullptr}; // 可调用对象任务，由执行它的工作线程绑定到协程上（见Scheduler::AcquireFiber）
         pid_t tid{-1}; // 可选的: 指定执行该任务的线程的id
+        bool recyclable{false}; // 协程是否由调度器创建，结束后可以放回工作线程的协程缓存复用
+        bool inlined{false}; // 是否是内联任务（直接在调度协程上执行callback）
+        uint32_t priority{kDefaultPriority}; // PSA：优先级，数值越小优先级越高
+        uint64_t enqueueTime{0}; // 入队时间（单调时钟，ms），用于PSA的老化和弹性线程池的扩容，不需要时不记录（为0）
 
         explicit Task()
             : handle(nullptr)
@@ -70,57 +86,206 @@ private:
             , iter(std::nullopt)
         {
         }
-        Task(Fiber::sptr f, pid_t tid, std::optional<std::list<Task>::iterator> iter = std::nullopt)
+        Task(Fiber::sptr f, pid_t tid, std::optional<TaskList::iterator> iter = std::nullopt)
             : handle(f)
             , tid(tid)
             , iter(iter)
         {
             ASSERT_FMT(f && f->isScheduled(), "协程必须参与调度器调度");
+            // 已经开始运行的共享栈协程只能在绑定的线程上恢复执行
+            if (f->boundThread() != -1) {
+                ASSERT_FMT(tid == -1 || tid == f->boundThread(), "共享栈协程[%lu]绑定在线程[%d]上", f->fid(), f->boundThread());
+                this->tid = f->boundThread();
+            }
         }
-        Task(const Fiber::FiberFunc &cb, pid_t tid, std::optional<std::list<Task>::iterator> iter = std::nullopt)
-            : handle(std::make_shared<Fiber>(cb, true))
+        // NOTE 这里不直接创建协程，而是推迟到工作线程取出任务时再从其协程缓存中取一个已结束的协程来绑定，省去每个任务一次协程的创建
+        Task(Fiber::FiberFunc cb, pid_t tid, std::optional<TaskList::iterator> iter = std::nullopt)
+            : callback(std::move(cb))
             , tid(tid)
             , iter(iter)
         {
         }
+        Task(const Task &rhs) = default;
+        Task(Task &&rhs) = default;
         Task &operator=(const Task &rhs)
         {
             if (this != &rhs) {
                 iter = rhs.iter;
                 handle = rhs.handle;
+                callback = rhs.callback;
                 tid = rhs.tid;
+                recyclable = rhs.recyclable;
+                inlined = rhs.inlined;
+                priority = rhs.priority;
+                enqueueTime = rhs.enqueueTime;
             }
             return *this;
         }
+        Task &operator=(Task &&rhs)
+        {
+            if (this != &rhs) {
+                iter = std::move(rhs.iter);
+                handle = std::move(rhs.handle);
+                callback = std::move(rhs.callback);
+                tid = rhs.tid;
+                recyclable = rhs.recyclable;
+                inlined = rhs.inlined;
+                priority = rhs.priority;
+                enqueueTime = rhs.enqueueTime;
+            }
+            return *this;
+        }
+        bool valid() const
+        {
+            return handle || callback;
+        }
         void reset(const Task &rhs = Task())
         {
             *this = rhs;
         }
     };
 
+    // 批量提交（以及挂起等待恢复）的任务链表结点，由线程缓存复用
+    struct TaskNode
+    {
+        Task task;
+        TaskNode *next{nullptr};
+
+        static void *operator new(size_t size)
+        {
+            ASSERT(size == sizeof(TaskNode));
+            return utils::CachedAllocator<TaskNode>().allocate(1);
+        }
+        static void operator delete(void *p)
+        {
+            utils::CachedAllocator<TaskNode>().deallocate(static_cast<TaskNode *>(p), 1);
+        }
+    };
+
 public:
     using sptr = std::shared_ptr<Scheduler>;
 
     /**
-     * @brief 调度策略 //TODO 还没实现，可以参考一下STL中的适配器
+     * @brief 调度策略
      * @note 由于估计任务运行时间不知道怎么做，所以只设想了这几种
      */
     enum Strategy {
-        FCFS, // 先来先服务（默认）
-        PSA, // 优先级调度
+        FCFS, // 先来先服务（默认）：所有工作线程共用一个全局任务队列
+        PSA, // 优先级调度：多级优先级队列，高优先级的任务先执行，等待过久的低优先级任务会被老化提升，避免饿死
+        WorkStealing, // 工作窃取：每个工作线程有自己的本地队列，外部提交的任务进入全局注入队列，本地与全局都没有任务时从其他工作线程窃取
+    };
+
+    /**
+     * @brief 任务类型
+     */
+    enum TaskKind {
+        Coroutine, // 在协程中执行（默认）
+        Inline, // 内联任务：直接在工作线程的调度协程上执行，省去协程的创建与一对上下文切换。
+                // 仅适用于不会yield的短小回调，执行期间hook被关闭，显式yield会被断言拒绝，本来会挂起协程的sleep、套接字IO会阻塞工作线程直到完成
+    };
+
+    /**
+     * @brief 任务优先级（仅PSA），数值越小优先级越高
+     * @details 级别数量由配置项 scheduler.psa.levels 决定，超出的级别按最低优先级处理；
+     * 不指定优先级的任务处于中间级别（levels / 2）
+     */
+    struct Priority
+    {
+        uint32_t level;
+    };
+
+    /**
+     * @brief 预先链接好的一批任务
+     * @details 生产者在不持有任何锁的情况下把任务逐个加入链表，再通过 schedule(TaskBatch &&) 用一次CAS整体提交、只唤醒一次调度器；
+     * 工作线程取任务时用一次原子交换取走所有已提交的批量任务，放入自己的队列后再按需唤醒其他空闲的工作线程来分担
+     * @note 批量任务不能绑定线程（共享栈协程除外，它们会被转交到所绑定线程的邮箱中）
+     */
+    class TaskBatch
+    {
+        friend class Scheduler;
+
+    public:
+        TaskBatch() = default;
+        TaskBatch(TaskBatch &&rhs) noexcept;
+        TaskBatch &operator=(TaskBatch &&rhs) noexcept;
+        TaskBatch(const TaskBatch &) = delete;
+        TaskBatch &operator=(const TaskBatch &) = delete;
+        // 释放没有提交的任务
+        ~TaskBatch();
+
+        /**
+         * @brief 向批量任务中添加一个任务 non-thread-safe
+         * @param exec 协程对象或可调用对象
+         * @param kind 任务类型
+         * @param priority 任务优先级（仅PSA）
+         */
+        template<typename Executable>
+        void add(Executable &&exec, TaskKind kind = Coroutine, uint32_t priority = kDefaultPriority)
+        {
+            static_assert(utils::is_valid_task<Executable>::value, "任务类型必须是std::shared_ptr<meha::Fiber>或std::function<void()>或与之匹配的lambda");
+            auto node = new TaskNode{Task(std::forward<Executable>(exec), -1)};
+            if (!node->task.valid()) {
+                delete node;
+                return;
+            }
+            node->task.inlined = kind == Inline;
+            node->task.priority = priority;
+            // 新任务放在表头，链表是逆序的，工作线程取出时会整体反转回提交顺序
+            node->next = m_head;
+            m_head = node;
+            if (!m_tail) {
+                m_tail = node;
+            }
+            ++m_size;
+        }
+        size_t size() const
+        {
+            return m_size;
+        }
+        bool empty() const
+        {
+            return m_size == 0;
+        }
+
+    private:
+        TaskNode *m_head = nullptr; // 最后添加的任务
+        TaskNode *m_tail = nullptr; // 最先添加的任务
+        size_t m_size = 0;
+    };
+
+    /**
+     * @brief 调度器的运行统计
+     * @details 线程池是弹性的：任务排队时间超过 scheduler.elastic.queue_delay 且没有空闲的工作线程时扩容一个工作线程，
+     * 工作线程空闲超过 scheduler.elastic.idle_timeout 后退出，线程数量保持在 [minThreads, maxThreads] 之间（不含caller线程）
+     */
+    struct Stats
+    {
+        uint64_t threads = 0; // 线程池中当前的工作线程数量
+        uint64_t minThreads = 0; // 线程池的最少工作线程数量
+        uint64_t maxThreads = 0; // 线程池的最多工作线程数量
+        uint64_t busy = 0; // 正在执行任务的工作线程数量
+        uint64_t idle = 0; // 空闲的工作线程数量
+        uint64_t pending = 0; // 等待执行的任务数量
+        uint64_t grown = 0; // 扩容的次数
+        uint64_t retired = 0; // 空闲退出的工作线程数量
+        uint64_t lastQueueDelay = 0; // 最近一次扩容时任务的排队时间（ms）
+        uint64_t suspended = 0; // 挂起等待外部事件的协程数量（阻塞调用、io_uring完成事件等，见suspend）
     };
 
     // 获取当前的调度器
     static Scheduler *GetCurrent();
     // 获取当前调度器的调度协程
     static Fiber::sptr GetSchedulerFiber();
+    // 当前线程是否正在执行内联任务
+    static bool IsRunningInline();
 
     /**
      * @brief 构造函数
      * @param pool_size 线程池线程数量
      * @param use_caller 是否将 Scheduler 所在的线程作为 master fiber
+     * @param strategy 调度策略
      * */
-    explicit Scheduler(size_t pool_size = 1, bool use_caller = true);
+    explicit Scheduler(size_t pool_size = 1, bool use_caller = true, Strategy strategy = FCFS);
     virtual ~Scheduler();
     /**
      * @brief 开始调度（初始化线程池并启动所有工作线程，等待添加调度任务）
@@ -137,6 +302,32 @@ public:
     {
         return m_idlers > 0;
     }
+    Strategy strategy() const
+    {
+        return m_strategy;
+    }
+    // 工作线程绑定的CPU列表（为空时只按NUMA节点绑定或者不绑定）
+    const std::vector<int> &cpuSet() const
+    {
+        return m_cpuSet;
+    }
+    // 工作线程所在的NUMA节点，-1表示不限制
+    int numaNode() const
+    {
+        return m_numaNode;
+    }
+    // caller线程的id，不使用caller线程时为-1
+    pid_t callerThread() const
+    {
+        return m_callerThread;
+    }
+    // 获取运行统计 thread-safe
+    Stats getStats() const;
+    // PSA 的优先级级别数量，其他策略返回0
+    size_t priorityLevels() const
+    {
+        return m_priorityLists.size();
+    }
 
     /**
      * @brief 添加任务 thread-safe
@@ -148,13 +339,38 @@ public:
     template<typename Executable>
     void schedule(Executable &&exec, pid_t thread_id = -1, bool instantly = false)
     {
-        bool need_tickle = false;
-        {
-            ScopedLock lock(&m_mutex);
-            need_tickle = addTask(std::forward<Executable>(exec), thread_id, instantly);
-        }
         // 通知调度器开始新的任务分发调度
-        if (need_tickle) {
+        if (addTask(std::forward<Executable>(exec), thread_id, instantly)) {
+            tickle();
+        }
+    }
+
+    /**
+     * @brief 添加指定优先级的任务 thread-safe
+     * @param exec Executable 的实例
+     * @param priority 任务优先级，仅PSA策略下生效，其他策略下忽略
+     * @param thread_id 任务要绑定执行线程的id，-1表示任务不绑定线程（即任意线程均可）
+     * @param instantly 是否在同一优先级中优先调度
+     */
+    template<typename Executable>
+    void schedule(Executable &&exec, Priority priority, pid_t thread_id = -1, bool instantly = false)
+    {
+        if (addTask(std::forward<Executable>(exec), thread_id, instantly, Coroutine, priority.level)) {
+            tickle();
+        }
+    }
+
+    /**
+     * @brief 添加指定类型的任务 thread-safe
+     * @param exec 可调用对象（内联任务不能是协程对象）
+     * @param kind 任务类型
+     * @param thread_id 任务要绑定执行线程的id，-1表示任务不绑定线程（即任意线程均可）
+     */
+    template<typename Executable>
+    void schedule(Executable &&exec, TaskKind kind, pid_t thread_id = -1)
+    {
+        static_assert(!std::is_same_v<std::decay_t<Executable>, Fiber::sptr>, "协程对象不能作为内联任务");
+        if (addTask(std::forward<Executable>(exec), thread_id, false, kind)) {
             tickle();
         }
     }
@@ -163,50 +379,159 @@ public:
      * @brief 添加多个任务 thread-safe
      * @param begin 顺序迭代器
      * @param end 顺序迭代器
+     * @param kind 任务类型
      */
     template<typename InputIterator>
-    void schedule(InputIterator begin, InputIterator end)
+    void schedule(InputIterator begin, InputIterator end, TaskKind kind = Coroutine)
     {
         static_assert(std::is_base_of_v<std::input_iterator_tag, typename std::iterator_traits<InputIterator>::iterator_category>,
                       "InputIterator must be an input iterator");
-        bool need_tickle = false;
+        TaskBatch batch;
+        while (begin != end) {
+            batch.add(std::move(*begin), kind);
+            ++begin;
+        }
+        schedule(std::move(batch));
+    }
+
+    /**
+     * @brief 批量提交任务 thread-safe lock-free
+     * @details 无论有多少任务，都只有一次CAS和一次唤醒
+     */
+    void schedule(TaskBatch &&batch);
+
+    /**
+     * @brief 在阻塞调用线程池中执行func，当前协程挂起等待结果 thread-safe
+     * @details hook只能让套接字IO异步化，普通文件IO、getaddrinfo、fsync、重CPU计算等会阻塞整个工作线程以及排在它后面的协程。
+     * 交给阻塞调用线程池（所有调度器共用，线程数量上限由 scheduler.offload.threads 配置）执行期间，工作线程继续执行其他协程，
+     * func执行完后协程回到本调度器上恢复执行，返回func的结果（func抛出的异常在协程中重新抛出）
+     * @note 不是在本调度器的协程中调用时（包括内联任务）直接执行func；func在其他线程执行，不能依赖线程局部变量（包括errno）
+     * @note 共享栈协程挂起后栈内容会被换出，此时func不能读写该协程栈上的数据
+     */
+    template<typename Func>
+    auto offload(Func &&func) -> std::invoke_result_t<Func>
+    {
+        using Result = std::invoke_result_t<Func>;
+        // 结果放在堆上，阻塞调用线程池不往协程栈上写
+        struct State
         {
-            ScopedLock lock(&m_mutex);
-            while (begin != end) {
-                need_tickle = addTask(std::move(*begin)) || need_tickle;
-                ++begin;
+            std::optional<std::conditional_t<std::is_void_v<Result>, bool, Result>> value;
+            std::exception_ptr error;
+        };
+        auto state = std::make_shared<State>();
+        offloadCall([state, func = std::forward<Func>(func)]() mutable {
+            try {
+                if constexpr (std::is_void_v<Result>) {
+                    func();
+                } else {
+                    state->value.emplace(func());
+                }
+            } catch (...) {
+                state->error = std::current_exception();
             }
+        });
+        if (state->error) {
+            std::rethrow_exception(state->error);
         }
-        if (need_tickle) {
-            tickle();
+        if constexpr (!std::is_void_v<Result>) {
+            return std::move(*state->value);
         }
     }
 
+    // 把被挂起的协程放回调度器（必须调用且只能调用一次，可以在任意线程调用）。拷贝、调用都不分配内存
+    using ResumeFunc = std::function<void()>;
+    /**
+     * @brief 挂起当前协程，等它完全换出到调度协程之后再调用 on_suspended(resume) thread-safe
+     * @details 协程还没有换出时不能让其他线程恢复它，因此提交异步操作、登记唤醒方式都要放在 on_suspended 中做，
+     * 外部事件发生后调用 resume 让协程回到本调度器上恢复执行。挂起期间调度器不会停止
+     * @note on_suspended 在调度协程上执行，此时挂起的协程栈仍然有效（共享栈协程也还没有被换出）
+     * @return 不是在本调度器的协程中调用时（包括内联任务）不挂起，返回false
+     */
+    bool suspend(std::function<void(ResumeFunc)> on_suspended);
+
 private:
     /**
-     * @brief 添加任务 non-thread-safe
+     * @brief 添加任务 thread-safe
      * @param Executable 可调用对象
      * @param exec Executable 的实例
      * @param thread_id 任务要绑定执行线程的 id
      * @param instantly 是否优先调度
+     * @param kind 任务类型
+     * @param priority 任务优先级（仅PSA）
      * @return 是否是空闲状态下的第一个新任务（此时需要唤醒调度器来调度执行任务）
      * */
     template<typename Executable>
-    bool addTask(Executable &&exec, pid_t thread_id = -1, bool instantly = false)
+    bool addTask(Executable &&exec, pid_t thread_id = -1, bool instantly = false, TaskKind kind = Coroutine, uint32_t priority = kDefaultPriority)
     {
         static_assert(utils::is_valid_task<Executable>::value, "任务类型必须是std::shared_ptr<meha::Fiber>或std::function<void()>或与之匹配的lambda");
-        bool need_tickle = m_taskList.empty();
         auto task = Task(std::forward<Executable>(exec), thread_id);
-        // 优先调度的任务放在队首
-        if (task.handle) {
-            if (instantly)
-                m_taskList.push_front(std::move(task));
-            else
-                m_taskList.push_back(std::move(task));
-        }
-        return need_tickle;
+        task.inlined = kind == Inline;
+        task.priority = priority;
+        if (!task.valid()) {
+            return false;
+        }
+        return pushTask(std::move(task), instantly);
     }
 
+    /**
+     * @brief 任务入队 thread-safe
+     * @details 绑定了线程的任务进入该工作线程的邮箱，并且只唤醒该工作线程；
+     * 其余任务 FCFS：进入全局队列；WorkStealing：工作线程自己提交的任务进入自己的本地队列，其他情况进入全局注入队列
+     * @param instantly 是否优先调度（放在队首）
+     * @return 是否需要唤醒调度器来调度执行任务
+     */
+    bool pushTask(Task &&task, bool instantly = false);
+    // 挂起当前协程，协程换出后把job交给阻塞调用线程池，job执行完后协程重新入队（不在本调度器的协程中时直接执行job）
+    void offloadCall(Fiber::FiberFunc &&job);
+    /**
+     * @brief 取出当前线程可以执行的任务 thread-safe
+     * @param[out] task 取出的任务
+     * @param[out] need_tickle 是否有需要由其他线程执行的任务
+     * @return 是否取到了任务
+     */
+    bool popTask(Task &task, bool &need_tickle);
+    /**
+     * @brief 把绑定了线程的任务放入该线程的邮箱并唤醒该线程
+     * @return 找不到该线程（已经退出了线程池，或者不是工作线程）时返回false，此时任务不再绑定线程（清除tid），调用者把它放入全局队列由任意工作线程执行
+     */
+    bool pushMailboxTask(Task &&task, bool instantly);
+    // PSA：按优先级放入优先级队列 non-thread-safe（需要持有m_mutex）
+    void pushPriorityTask(Task &&task, bool instantly);
+    // 从当前工作线程的邮箱中取出绑定到本线程的任务
+    bool popMailboxTask(Task &task);
+    // 取走所有已提交的批量任务，放入当前工作线程可以取到的队列，并唤醒其他空闲的工作线程来分担
+    void drainTaskBatches();
+    /**
+     * @brief 把一条逆序的任务链表放入当前工作线程可以取到的队列 thread-safe
+     * @details WorkStealing下放入当前工作线程的本地队列，其他策略放入全局队列，绑定了线程的任务放入该线程的邮箱
+     * @return 放入本地队列或全局队列的任务数量（不含绑定了线程的任务）
+     */
+    size_t pushTaskNodes(TaskNode *node);
+    // 需要时（见 m_stampEnqueueTime）给任务链表中的任务记录入队时间
+    void stampEnqueueTime(TaskNode *node);
+    // 按FCFS从全局队列中取出当前线程可以执行的任务
+    bool popGlobalTask(Task &task, bool &need_tickle);
+    // WorkStealing：从本地队列中取出任务
+    bool popLocalTask(Task &task);
+    // PSA：按老化后的优先级从优先级队列中取出当前线程可以执行的任务
+    bool popPriorityTask(Task &task, bool &need_tickle);
+    // WorkStealing：从全局注入队列中批量取出任务放入本地队列
+    bool grabGlobalTasks(Task &task, bool &need_tickle);
+    // WorkStealing：从其他工作线程的本地队列中窃取任务
+    bool stealTasks(Task &task);
+    // 将线程绑定到一个本地队列上（已经绑定过则直接返回），返回本地队列的下标
+    int bindLocalQueue(pid_t thread_id);
+    // 按配置把当前工作线程绑定到CPU和NUMA节点上（caller线程不绑定）
+    void placeCurrentWorker();
+    // 任务排队时间超过阈值且没有空闲的工作线程时扩容一个工作线程
+    void growIfDelayed(const Task &task);
+    /**
+     * @brief 当前工作线程先自旋等待新任务，等不到再休眠在本地队列的futex上，直到被tickle唤醒或者超时
+     * @param timeout_ms 休眠的超时时间，0表示不超时
+     * @return 是否是因为超时返回的
+     */
+    bool park(uint64_t timeout_ms);
+
 protected:
     // 让Scheduler::run完成t_scheduler的初始化
     void sync();
@@ -214,8 +539,44 @@ protected:
     void run();
     // 调度器idle协程的执行函数
     virtual void idle();
-    // 通知调度器有新任务
+    // 通知调度器有新任务（唤醒一个休眠的工作线程）
     virtual void tickle();
+    // 通知指定的工作线程有新任务（只唤醒该线程）
+    virtual void tickleThread(pid_t thread_id);
+    /**
+     * @brief 空闲的工作线程尝试退出（线程池缩容）
+     * @details 线程数量已经是下限、当前线程是caller线程、共享栈上还绑定着协程、或者还有绑定到该线程的任务（包括挂起中的）时不能退出
+     * @return 是否可以退出，可以退出时当前线程已经不再属于线程池，idle协程应当直接结束
+     */
+    bool tryRetireWorker();
+    // 当前工作线程是否有可能取到任务（绑定到其他线程的任务不算）
+    bool hasRunnableTask() const;
+    /**
+     * @brief 在当前工作线程上批量提交任务 thread-safe
+     * @details 与 schedule(TaskBatch &&) 不同，任务直接放入当前工作线程的本地队列（WorkStealing），由它自己执行，忙不过来时才会被其他工作线程窃取；
+     * 不是本调度器的工作线程时等同于 schedule(TaskBatch &&)
+     */
+    void scheduleLocal(TaskBatch &&batch);
+    // 当前工作线程的序号（即本地队列的下标），不是工作线程时返回-1
+    static int GetWorkerIndex();
+    // 工作线程槽位的数量（本地队列的数量，含caller线程以及弹性线程池扩容的上限）
+    size_t workerSlots() const
+    {
+        return m_localQueues.size();
+    }
+    // 绑定在指定槽位上的工作线程id，没有绑定时返回-1
+    pid_t workerThread(size_t index) const
+    {
+        return m_localQueues[index]->tid;
+    }
+    // 在调度协程上直接执行内联任务
+    static void RunInline(Fiber::FiberFunc &&callback);
+    // 为可调用对象任务绑定协程：优先复用当前工作线程缓存的已结束协程，没有才创建新协程
+    static Fiber::sptr AcquireFiber(Fiber::FiberFunc &&callback);
+    // 将已结束的协程放回当前工作线程的协程缓存，缓存已满或协程仍被其他地方引用时直接丢弃
+    static void RecycleFiber(Fiber::sptr &&fiber);
+    // 清空当前工作线程的协程缓存
+    static void ClearFiberCache();
 
 protected:
     // 线程池大小
@@ -224,6 +585,8 @@ protected:
     std::atomic_uint64_t m_workers{0};
     // 正空闲的线程数量
     std::atomic_uint64_t m_idlers{0};
+    // 工作线程空闲多久后退出（ms），0表示线程池不会缩容
+    uint64_t m_idleTimeout = 0;
     // 是否启动
     bool m_started = false;
     // 是否停止
@@ -234,8 +597,64 @@ private:
     Fiber::sptr m_callerFiber;
     // 工作线程池
     std::vector<Thread::sptr> m_threadPool;
-    // 任务队列（任务由任务协程执行，而任务协程由工作线程中的调度者协程调度），是临界资源
-    std::list<Task> m_taskList;
+    /**
+     * @brief 工作线程的本地任务队列
+     * @details tasks（仅WorkStealing）：队列的所有者从队首取任务、在队尾放任务，窃取者从队尾窃取，两端的竞争只在队列很短时才会发生；
+     * mailbox：绑定到该线程的任务，只有所有者会取出，工作线程优先执行其中的任务
+     */
+    struct LocalQueue
+    {
+        SpinLock mutex;
+        TaskDeque tasks;
+        SpinLock mailboxMutex;
+        TaskDeque mailbox;
+        std::atomic_size_t mailboxSize{0}; // 邮箱为空时所有者不必加锁
+        std::atomic_size_t suspendedPinned{0}; // 绑定到该线程、正挂起等待恢复的任务数量，不为0时该线程不能退出线程池
+        std::atomic<pid_t> tid{-1}; // 所属工作线程的id，线程启动后才确定
+        std::atomic_uint32_t parked{0}; // 所属工作线程是否在休眠（futex字，唤醒者将其置0后再FUTEX_WAKE）
+    };
+
+    // 调度策略
+    Strategy m_strategy = FCFS;
+    // caller线程的id，仅在类实例化参数中 use_caller 为 true 时有效
+    pid_t m_callerThread = -1;
+    // 工作线程绑定的CPU列表，第i个工作线程绑定到第 i % size 个CPU上
+    std::vector<int> m_cpuSet;
+    // 工作线程所在的NUMA节点
+    int m_numaNode = -1;
+    // 弹性线程池的上下限（不含caller线程）
+    size_t m_minThreads = 0;
+    size_t m_maxThreads = 0;
+    // 任务排队多久后扩容（ms）
+    uint64_t m_queueDelay = 0;
+    // 是否记录任务的入队时间：只有PSA的老化和弹性线程池的扩容会用到，其他情况下入队时不读时钟
+    bool m_stampEnqueueTime = false;
+    // 线程池中当前的工作线程数量
+    std::atomic_size_t m_activeThreads{0};
+    // 最近一次扩容的时间（ms），用于限制扩容频率
+    std::atomic_uint64_t m_lastGrowTime{0};
+    // 扩容次数、空闲退出的线程数、最近一次扩容时的排队时间
+    std::atomic_uint64_t m_grownCount{0};
+    std::atomic_uint64_t m_retiredCount{0};
+    std::atomic_uint64_t m_lastQueueDelay{0};
+    // 挂起等待外部事件的协程数量（见suspend），不为0时调度器不能停止
+    std::atomic_uint64_t m_suspendedTasks{0};
+    // 已经退出但还没有join的工作线程，由m_mutex保护
+    std::vector<pid_t> m_retiredThreads;
+    // 各工作线程的本地任务队列，下标即工作线程的序号
+    std::vector<std::unique_ptr<LocalQueue>> m_localQueues;
+    // PSA：各优先级的任务队列（下标即优先级），由m_mutex保护
+    std::vector<TaskDeque> m_priorityLists;
+    // 所有队列中等待执行的任务总数
+    std::atomic_uint64_t m_pendingTasks{0};
+    // 其中在各工作线程邮箱中的任务数量
+    std::atomic_uint64_t m_mailboxTasks{0};
+    // 已提交但还没有被工作线程取走的批量任务（逆序的链表，见TaskBatch）
+    std::atomic<TaskNode *> m_batchHead{nullptr};
+    // 休眠中的工作线程数量
+    std::atomic_size_t m_parkedWorkers{0};
+    // 任务队列（任务由任务协程执行，而任务协程由工作线程中的调度者协程调度），是临界资源。WorkStealing 策略下作为全局注入队列
+    TaskList m_taskList;
     // 用于保护任务队列的读写锁
     mutable Mutex m_mutex;
     // 用于保证t_scheduler初始化的信号量
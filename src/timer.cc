@@ -1,116 +1,347 @@
+#include <algorithm>
+#include <thread>
+
 #include "timer.h"
-#include "utils/utils.h"
+#include "utils/clock.h"
 
 namespace meha
 {
 
-bool Timer::Comparator::operator()(const Timer::sptr &lhs, const Timer::sptr &rhs) const
+// steady_clock上的当前时间（us），用于计算定时器的到期时间
+// 调用者可能是执行了任意长时间的任务，不能读取缓存的时间，否则到期时间会提前；
+// 向上取整到微秒，否则到期时间最多会比调用时刻加上定时时长早1us
+static uint64_t NowUS()
 {
-    // 判断指针的有效性
-    if (!lhs && !rhs)
-        return false;
-    else if (!lhs)
-        return true;
-    else if (!rhs)
-        return false;
-    // 按绝对时间戳排序
-    if (lhs->m_nexttime_absolute != rhs->m_nexttime_absolute)
-        return lhs->m_nexttime_absolute < rhs->m_nexttime_absolute;
-    else // 时间戳相同就按指针排序
-        return lhs.get() < rhs.get();
+    return std::chrono::ceil<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
 }
 
-Timer::Timer(uint64_t elapse, TimeOutFunc cb, bool cyclic, TimerManager *manager)
-    : m_cyclic(cyclic)
-    , m_elapsetime_relative(elapse)
-    , m_callback(cb)
-    , m_manager(manager)
+// 事件循环内部判断到期用的当前时间（us），IO工作线程上是本轮事件循环缓存的时间
+static uint64_t LoopNowUS()
+{
+    return utils::CoarseMonotonicUS().count();
+}
+
+static uint64_t RotateLeft(uint64_t v, int c)
+{
+    c &= 63;
+    return c ? (v << c) | (v >> (64 - c)) : v;
+}
+
+static uint64_t RotateRight(uint64_t v, int c)
 {
-    m_nexttime_absolute = utils::GetCurrentMS().count() + m_elapsetime_relative;
+    c &= 63;
+    return c ? (v >> c) | (v << (64 - c)) : v;
 }
 
-Timer::Timer(uint64_t next)
-    : m_nexttime_absolute(next)
+Timer::Timer(std::chrono::microseconds elapse, TimeOutFunc cb, bool cyclic, TimerManager *manager)
+    : TimerNode(false)
+    , m_cyclic(cyclic)
+    , m_elapsetime_relative(std::max<int64_t>(elapse.count(), 0))
+    , m_callback(cb)
+    , m_manager(manager)
 {
+    m_nexttime_absolute = NowUS() + m_elapsetime_relative;
 }
 
 void Timer::cancel()
 {
-    WriteScopedLock lock(&m_manager->m_lock);
+    TimerManager::TimerQueue &queue = *m_manager->m_queues[m_queue];
+    SpinScopedLock lock(&queue.lock);
     if (m_callback) {
         m_callback = nullptr;
         m_manager->delTimer(shared_from_this());
     }
 }
 
-bool Timer::reset(uint64_t elapse, bool from_now)
+bool Timer::reset(std::chrono::microseconds elapse, bool from_now)
 {
-    if (elapse == m_elapsetime_relative && !from_now) {
+    const uint64_t elapse_us = std::max<int64_t>(elapse.count(), 0);
+    if (elapse_us == m_elapsetime_relative && !from_now) {
         return true;
     }
     if (!m_callback) {
         return false;
     }
-    WriteScopedLock lock(&m_manager->m_lock);
-    m_manager->delTimer(shared_from_this());
+    // 从时间轮中移除时会释放时间轮持有的引用
+    Timer::sptr self = shared_from_this();
+    SpinScopedLock lock(&m_manager->m_queues[m_queue]->lock);
+    m_manager->delTimer(self);
     uint64_t start = 0;
     // 重新计时
     if (from_now) {
-        start = utils::GetCurrentMS().count();
+        start = NowUS();
     } else {
         start = m_nexttime_absolute - m_elapsetime_relative;
     }
-    m_elapsetime_relative = elapse;
-    m_nexttime_absolute = start + elapse;
-    m_manager->addTimer(shared_from_this(), lock); // FIXME 这里这样加速安全吗？RWMutex是递归锁？
+    m_elapsetime_relative = elapse_us;
+    m_nexttime_absolute = start + elapse_us;
+    m_manager->addTimer(self, lock);
     return true;
 }
 
+Timeout::~Timeout()
+{
+    ASSERT_FMT(m_state == Idle, "超时析构之前必须调用 TimerManager::cancelTimeout");
+}
+
 bool Timer::restart()
 {
     if (!m_callback) {
         return false;
     }
-    WriteScopedLock lock(&m_manager->m_lock);
-    m_manager->delTimer(shared_from_this());
-    m_nexttime_absolute = utils::GetCurrentMS().count() + m_elapsetime_relative;
-    m_manager->addTimer(shared_from_this(), lock);
+    Timer::sptr self = shared_from_this();
+    SpinScopedLock lock(&m_manager->m_queues[m_queue]->lock);
+    m_manager->delTimer(self);
+    m_nexttime_absolute = NowUS() + m_elapsetime_relative;
+    m_manager->addTimer(self, lock);
     return true;
 }
 
-TimerManager::TimerManager()
+TimerManager::TimerManager(size_t queues)
 {
-    m_previous_time = utils::GetCurrentMS().count();
+    const uint64_t now = NowUS();
+    for (size_t i = 0; i < std::max<size_t>(queues, 1); i++) {
+        auto queue = std::make_unique<TimerQueue>();
+        queue->now = now;
+        m_queues.push_back(std::move(queue));
+    }
 }
 
-Timer::sptr TimerManager::addTimer(uint64_t ms, Timer::TimeOutFunc fn, bool cyclic)
+TimerManager::~TimerManager()
 {
-    Timer::sptr timer(new Timer(ms, fn, cyclic, this));
-    WriteScopedLock lock(&m_lock);
+    // 释放时间轮持有的引用
+    auto release = [](TimerNode *head) {
+        while (head) {
+            TimerNode *next = head->m_next;
+            head->m_prev = head->m_next = nullptr;
+            head->m_slot = nullptr;
+            if (head->m_isTimeout) {
+                static_cast<Timeout *>(head)->m_state = Timeout::Idle;
+            } else {
+                static_cast<Timer *>(head)->m_self.reset();
+            }
+            head = next;
+        }
+    };
+    for (auto &queue : m_queues) {
+        for (auto &wheel : queue->wheels) {
+            for (TimerNode *head : wheel) {
+                release(head);
+            }
+        }
+        release(queue->expired);
+    }
+}
+
+Timer::sptr TimerManager::addTimer(std::chrono::microseconds delay, Timer::TimeOutFunc fn, bool cyclic, std::chrono::microseconds slack, bool inlined)
+{
+    Timer::sptr timer(new Timer(delay, fn, cyclic, this));
+    timer->m_inlined = inlined;
+    timer->m_slack = slackOf(slack);
+    timer->m_queue = currentTimerQueue();
+    SpinScopedLock lock(&m_queues[timer->m_queue]->lock);
     addTimer(timer, lock);
     return timer;
 }
 
-void TimerManager::addTimer(Timer::sptr timer, WriteScopedLock &lock)
+void TimerManager::addTimer(Timer::sptr timer, SpinScopedLock &lock)
+{
+    Timer *raw = timer.get();
+    raw->m_self = std::move(timer);
+    arm(raw, lock);
+}
+
+void TimerManager::addTimeout(Timeout &timeout, std::chrono::microseconds delay, std::chrono::microseconds slack)
 {
-    auto it = m_timers.insert(timer).first;
-    bool at_front = (it == m_timers.begin());
+    ASSERT_FMT(timeout.m_state == Timeout::Idle, "超时已经在时间轮中");
+    timeout.m_nexttime_absolute = NowUS() + std::max<int64_t>(delay.count(), 0);
+    timeout.m_slack = slackOf(slack);
+    timeout.m_queue = currentTimerQueue();
+    timeout.m_state.store(Timeout::Armed, std::memory_order_relaxed);
+    SpinScopedLock lock(&m_queues[timeout.m_queue]->lock);
+    arm(&timeout, lock);
+}
+
+bool TimerManager::cancelTimeout(Timeout &timeout)
+{
+    // 只有加入超时的一方会取消它，Idle不会再变化
+    if (timeout.m_state.load(std::memory_order_acquire) == Timeout::Idle) {
+        return false;
+    }
+    {
+        TimerQueue &queue = *m_queues[timeout.m_queue];
+        SpinScopedLock lock(&queue.lock);
+        if (timeout.m_slot) {
+            unlink(queue, &timeout);
+            --queue.count;
+            --m_timers;
+            timeout.m_state.store(Timeout::Idle, std::memory_order_relaxed);
+            return true;
+        }
+    }
+    // 已经到期，回调正在其他线程上执行，等它执行完才能释放超时
+    while (timeout.m_state.load(std::memory_order_acquire) != Timeout::Idle) {
+        std::this_thread::yield();
+    }
+    return false;
+}
+
+void TimerManager::arm(TimerNode *timer, SpinScopedLock &lock)
+{
+    TimerQueue &queue = *m_queues[timer->m_queue];
+    // 比之前最早可能到期的时间还早，等待定时器的一方需要重新计算等待时间
+    const bool at_front = expiresOf(timer) < nextDeadline(queue);
+    const size_t index = timer->m_queue;
+    place(queue, timer);
+    ++queue.count;
+    ++m_timers;
     lock.unLock();
     if (at_front) {
-        onTimerInsertedAtFront();
+        onTimerInsertedAtFront(index);
     }
 }
 
 bool TimerManager::delTimer(Timer::sptr timer)
 {
-    auto it = m_timers.find(timer);
-    if (it == m_timers.end()) {
+    if (!timer->m_slot) {
         return false;
     }
-    m_timers.erase(it);
+    unlink(*m_queues[timer->m_queue], timer.get());
+    --m_queues[timer->m_queue]->count;
+    --m_timers;
+    // 调用者持有timer，这里释放不会析构定时器
+    timer->m_self.reset();
     return true;
 }
 
+uint64_t TimerManager::expiresOf(const TimerNode *timer)
+{
+    const uint64_t deadline = timer->m_nexttime_absolute;
+    if (timer->m_slack == 0) {
+        return deadline;
+    }
+    // 区间 [deadline, latest] 中末尾0最多的时刻：两端最高的不同位以下清零（latest 在该位上是1，结果仍不早于 deadline）
+    const uint64_t latest = deadline + timer->m_slack;
+    const uint64_t mask = (1ull << (63 - __builtin_clzll(deadline ^ latest))) - 1;
+    return latest & ~mask;
+}
+
+void TimerManager::place(TimerQueue &queue, TimerNode *timer)
+{
+    // 剩余时间超过时间轮能表示的范围时放在最高层，轮到时再重新放置
+    static constexpr uint64_t kMaxTimeout = (1ull << (kWheelBits * kWheels)) - 1;
+    const uint64_t expires = expiresOf(timer);
+    TimerNode **slot = &queue.expired;
+    if (expires > queue.now) {
+        // 剩余时间的最高位决定放在哪一层
+        const uint64_t remain = std::min(expires - queue.now, kMaxTimeout);
+        const int wheel = (63 - __builtin_clzll(remain)) / kWheelBits;
+        // 第0层按到期时间放入槽位；更高层放入“前一个”槽位，这个槽位轮到时剩余时间已经不足该层的一个槽位，定时器下沉到低层
+        const int index = ((expires >> (wheel * kWheelBits)) - (wheel ? 1 : 0)) & kWheelMask;
+        slot = &queue.wheels[wheel][index];
+        queue.pending[wheel] |= 1ull << index;
+    }
+    timer->m_prev = nullptr;
+    timer->m_next = *slot;
+    if (*slot) {
+        (*slot)->m_prev = timer;
+    }
+    *slot = timer;
+    timer->m_slot = slot;
+}
+
+void TimerManager::unlink(TimerQueue &queue, TimerNode *timer)
+{
+    TimerNode **slot = timer->m_slot;
+    if (timer->m_prev) {
+        timer->m_prev->m_next = timer->m_next;
+    } else {
+        *slot = timer->m_next;
+    }
+    if (timer->m_next) {
+        timer->m_next->m_prev = timer->m_prev;
+    }
+    // 槽位空了就清掉位图中对应的位
+    if (!*slot && slot != &queue.expired) {
+        const size_t offset = slot - &queue.wheels[0][0];
+        queue.pending[offset / kWheelSlots] &= ~(1ull << (offset % kWheelSlots));
+    }
+    timer->m_prev = timer->m_next = nullptr;
+    timer->m_slot = nullptr;
+}
+
+void TimerManager::advance(TimerQueue &queue, uint64_t now)
+{
+    if (now <= queue.now) {
+        return;
+    }
+    uint64_t elapsed = now - queue.now;
+    // 走过的槽位中的定时器，时间更新之后再重新放置
+    TimerNode *todo = nullptr;
+    for (int wheel = 0; wheel < kWheels; wheel++) {
+        const int shift = wheel * kWheelBits;
+        uint64_t passed;
+        if ((elapsed >> shift) > kWheelMask) {
+            // 走过了一整圈
+            passed = ~0ull;
+        } else {
+            // 从原来的槽位走到现在的槽位（首尾都包括在内）
+            const int steps = static_cast<int>((elapsed >> shift) & kWheelMask);
+            const int old_slot = static_cast<int>((queue.now >> shift) & kWheelMask);
+            const int new_slot = static_cast<int>((now >> shift) & kWheelMask);
+            passed = RotateLeft((1ull << steps) - 1, old_slot);
+            passed |= RotateRight(RotateLeft((1ull << steps) - 1, new_slot), steps);
+            passed |= 1ull << new_slot;
+        }
+        uint64_t hit = passed & queue.pending[wheel];
+        while (hit) {
+            const int index = __builtin_ctzll(hit);
+            hit &= hit - 1;
+            for (TimerNode *timer = queue.wheels[wheel][index]; timer;) {
+                TimerNode *next = timer->m_next;
+                timer->m_next = todo;
+                todo = timer;
+                timer = next;
+            }
+            queue.wheels[wheel][index] = nullptr;
+            queue.pending[wheel] &= ~(1ull << index);
+        }
+        // 没有越过这一层的末尾，更高层的槽位都还没有轮到
+        if (!(passed & 1)) {
+            break;
+        }
+        // 越过了末尾，更高的一层至少走过了一个槽位
+        elapsed = std::max(elapsed, static_cast<uint64_t>(kWheelSlots) << shift);
+    }
+    queue.now = now;
+    while (todo) {
+        TimerNode *next = todo->m_next;
+        place(queue, todo);
+        todo = next;
+    }
+}
+
+uint64_t TimerManager::nextDeadline(const TimerQueue &queue)
+{
+    if (queue.expired) {
+        return queue.now;
+    }
+    uint64_t deadline = UINT64_MAX;
+    uint64_t lower_mask = 0; // 更低的各层已经走过的部分
+    for (int wheel = 0; wheel < kWheels; wheel++) {
+        if (queue.pending[wheel]) {
+            const int shift = wheel * kWheelBits;
+            const int slot = static_cast<int>((queue.now >> shift) & kWheelMask);
+            // 从当前槽位往后第一个非空的槽位；更高层的槽位中的定时器要等到下一个槽位开始时才会下沉
+            uint64_t timeout = (static_cast<uint64_t>(__builtin_ctzll(RotateRight(queue.pending[wheel], slot))) + (wheel ? 1 : 0)) << shift;
+            timeout -= queue.now & lower_mask;
+            deadline = std::min(deadline, queue.now + timeout);
+        }
+        lower_mask = (lower_mask << kWheelBits) | kWheelMask;
+    }
+    return deadline;
+}
+
 static void OnTimer(std::weak_ptr<void> weak_cond, Timer::TimeOutFunc fn)
 {
     auto tmp = weak_cond.lock();
@@ -119,83 +350,101 @@ static void OnTimer(std::weak_ptr<void> weak_cond, Timer::TimeOutFunc fn)
     }
 }
 
-Timer::sptr TimerManager::addConditionalTimer(uint64_t ms, Timer::TimeOutFunc fn, std::weak_ptr<void> weak_cond, bool cyclic)
+Timer::sptr TimerManager::addConditionalTimer(std::chrono::microseconds delay, Timer::TimeOutFunc fn, std::weak_ptr<void> weak_cond, bool cyclic, std::chrono::microseconds slack)
 {
-    return addTimer(ms, std::bind(&OnTimer, weak_cond, fn), cyclic);
+    return addTimer(delay, std::bind(&OnTimer, weak_cond, fn), cyclic, slack);
 }
 
-uint64_t TimerManager::getNextTimer() const
+std::chrono::microseconds TimerManager::getNextTimer() const
 {
-    ReadScopedLock lock(&m_lock);
-    if (m_timers.empty()) {
+    const size_t current = currentTimerQueue();
+    const size_t shared = sharedTimerQueue();
+    uint64_t deadline = UINT64_MAX;
+    // 空的队列不必加锁
+    for (size_t index : {current, shared}) {
+        TimerQueue &queue = *m_queues[index];
+        if (queue.count > 0) {
+            SpinScopedLock lock(&queue.lock);
+            deadline = std::min(deadline, nextDeadline(queue));
+        }
+        if (current == shared) {
+            break;
+        }
+    }
+    if (deadline == UINT64_MAX) {
         // 没有定时器
-        return ~0ull;
+        return kNoTimer;
     }
-    const Timer::sptr &next = *m_timers.begin();
-    uint64_t now_ms = utils::GetCurrentMS().count();
-    if (now_ms >= next->m_nexttime_absolute) {
+    const uint64_t now = LoopNowUS();
+    if (now >= deadline) {
         // 等待超时
-        return 0;
+        return std::chrono::microseconds(0);
     } else {
         // 返回剩余的等待时间
-        return next->m_nexttime_absolute - now_ms;
+        return std::chrono::microseconds(deadline - now);
     }
 }
 
-void TimerManager::listExpiredCallback(std::vector<Timer::TimeOutFunc> &fns)
+void TimerManager::listExpiredCallback(std::vector<Timer::TimeOutFunc> &fns, std::vector<Timer::TimeOutFunc> *inline_fns)
 {
-    uint64_t now_ms = utils::GetCurrentMS().count();
-    if (!hasTimer()) {
-        return;
+    const uint64_t now = LoopNowUS();
+    const size_t current = currentTimerQueue();
+    const size_t shared = sharedTimerQueue();
+    listExpired(*m_queues[current], now, fns, inline_fns);
+    if (current != shared) {
+        listExpired(*m_queues[shared], now, fns, inline_fns);
     }
-    WriteScopedLock lock(&m_lock);
-    // 检查系统时间是否被修改
-    const bool rollover = detectClockRollover(now_ms);
-    // 系统时间未被回拨，并且无定时器等待超时
-    if (!rollover && (*m_timers.begin())->m_nexttime_absolute > now_ms) {
+}
+
+void TimerManager::listExpired(TimerQueue &queue, uint64_t now, std::vector<Timer::TimeOutFunc> &fns, std::vector<Timer::TimeOutFunc> *inline_fns)
+{
+    if (queue.count == 0) {
         return;
     }
-    Timer::sptr now_timer(new Timer(now_ms)); // 插入一个用于二分查找的临时定时器
-    // 获取第一个 m_next 大于或等于 now_timer->m_next 的定时器的迭代器
-    // 就是已经等待到达或超时的定时器。
-    // ** 如果系统时间被修改过，直接认定所有定时器均超时 **
-    auto it = rollover ? m_timers.end() : m_timers.lower_bound(now_timer);
-    // 包括上到达指定时间的定时器
-    while (it != m_timers.end() && (*it)->m_nexttime_absolute == now_timer->m_nexttime_absolute) {
-        ++it;
-    }
-    std::vector<Timer::sptr> expired;
-    // 取出超时的定时器
-    expired.insert(expired.begin(), m_timers.begin(), it);
-    m_timers.erase(m_timers.begin(), it);
-    fns.reserve(expired.size());
-    for (auto &timer : expired) {
-        fns.push_back(timer->m_callback);
+    SpinScopedLock lock(&queue.lock);
+    advance(queue, now);
+    // 整条到期链表一次取出，周期定时器重新放回时（间隔为0时会再次放入到期链表）不会被这一轮再次取出
+    TimerNode *expired = queue.expired;
+    queue.expired = nullptr;
+    Timeout *firing = nullptr; // 到期的超时，释放锁之后再执行回调
+    while (expired) {
+        TimerNode *node = expired;
+        expired = node->m_next;
+        node->m_prev = node->m_next = nullptr;
+        node->m_slot = nullptr;
+        if (node->m_isTimeout) {
+            auto timeout = static_cast<Timeout *>(node);
+            timeout->m_state.store(Timeout::Firing, std::memory_order_relaxed);
+            timeout->m_next = firing;
+            firing = timeout;
+            --queue.count;
+            --m_timers;
+            continue;
+        }
+        Timer *timer = static_cast<Timer *>(node);
+        std::vector<Timer::TimeOutFunc> &out = timer->m_inlined && inline_fns ? *inline_fns : fns;
         // 处理周期定时器
         if (timer->m_cyclic) {
-            timer->m_nexttime_absolute = now_ms + timer->m_elapsetime_relative;
-            m_timers.insert(timer);
+            out.push_back(timer->m_callback);
+            timer->m_nexttime_absolute = now + timer->m_elapsetime_relative;
+            place(queue, timer);
         } else {
+            out.push_back(std::move(timer->m_callback));
             timer->m_callback = nullptr;
+            --queue.count;
+            --m_timers;
+            timer->m_self.reset();
         }
     }
-}
-
-bool TimerManager::hasTimer()
-{
-    ReadScopedLock lock(&m_lock);
-    return !m_timers.empty();
-}
-
-bool TimerManager::detectClockRollover(uint64_t now_ms)
-{
-    bool rollover = false;
-    // 系统时间被回拨超过一个小时
-    if (now_ms < (m_previous_time - 60 * 60 * 1000)) {
-        rollover = true;
+    lock.unLock();
+    while (firing) {
+        Timeout *timeout = firing;
+        firing = static_cast<Timeout *>(timeout->m_next);
+        timeout->m_next = nullptr;
+        timeout->m_callback(timeout->m_arg);
+        // 此后超时随时可能被释放，不能再访问
+        timeout->m_state.store(Timeout::Idle, std::memory_order_release);
     }
-    m_previous_time = now_ms;
-    return rollover;
 }
 
 } // namespace meha
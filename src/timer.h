@@ -1,27 +1,59 @@
 #pragma once
 
+#include <atomic>
+#include <chrono>
+#include <cstdint>
 #include <functional>
 #include <memory>
-#include <set>
+#include <vector>
 
 #include "macro.h"
 #include "utils/mutex.h"
+#include "utils/noncopyable.h"
 
 namespace meha
 {
 
 class TimerManager;
 
+/**
+ * @brief 时间轮槽位链表的节点（侵入式），Timer 与 Timeout 的公共部分
+ */
+class TimerNode
+{
+    friend class TimerManager;
+
+protected:
+    explicit TimerNode(bool is_timeout)
+        : m_isTimeout(is_timeout)
+    {
+    }
+    ~TimerNode() = default;
+
+    uint64_t m_nexttime_absolute = 0; // 绝对超时时间（steady_clock上的us）
+    uint64_t m_slack = 0; // 允许推迟到期的时间（us），见 TimerManager::setTimerSlack
+    size_t m_queue = 0; // 所属的定时器队列（见 TimerManager::currentTimerQueue）
+    // 所在槽位链表的前后节点，以及所在的槽位，不在时间轮中时为nullptr
+    TimerNode *m_prev = nullptr;
+    TimerNode *m_next = nullptr;
+    TimerNode **m_slot = nullptr;
+    const bool m_isTimeout; // 是Timeout还是Timer
+};
+
 /**
  * @brief 定时器类
+ * @details 基于单调时钟 std::chrono::steady_clock，精度为微秒，不受系统时间修改的影响。
+ * 计时的起点读取的是缓存的时间（见 utils/clock.h），在IO工作线程上是本轮事件循环开始的时间，需要精确起点时先刷新缓存。
+ * 定时器本身就是时间轮槽位链表的节点（侵入式），加入、取消都不需要额外分配内存
  */
-class Timer : public std::enable_shared_from_this<Timer>
+class Timer : public TimerNode, public std::enable_shared_from_this<Timer>
 {
     friend class TimerManager;
 
 public:
     MEHA_PTR_INSIDE_CLASS(Timer)
     using TimeOutFunc = std::function<void()>;
+    using Clock = std::chrono::steady_clock;
 
     /**
      * @brief 取消定时器
@@ -30,10 +62,15 @@ public:
 
     /**
      * @brief 重设超时间隔
-     * @param elapse 新的ms超时
+     * @param elapse 新的超时间隔
      * @param from_now 是否立即开始倒计时
      */
-    bool reset(uint64_t elapse, bool from_now);
+    bool reset(std::chrono::microseconds elapse, bool from_now);
+    // 同上，超时间隔的单位为ms
+    bool reset(uint64_t elapse, bool from_now)
+    {
+        return reset(std::chrono::milliseconds(elapse), from_now);
+    }
 
     /**
      * @brief 重新计时
@@ -43,90 +80,199 @@ public:
 private:
     /**
      * @brief Constructor
-     * @param elapse 延迟时间(ms)
+     * @param elapse 延迟时间
      * @param fn 回调函数
      * @param cyclic 是否重复执行
      * @param manager 执行环境
      */
-    Timer(uint64_t elapse, TimeOutFunc cb, bool cyclic, TimerManager *manager);
-
-    /**
-     * @brief 用于创建只有时间信息的定时器，基本是用于查找超时的定时器，无其他作用
-     */
-    explicit Timer(uint64_t next);
+    Timer(std::chrono::microseconds elapse, TimeOutFunc cb, bool cyclic, TimerManager *manager);
 
 private:
     bool m_cyclic = false; // 是否重复
-    uint64_t m_elapsetime_relative = 0; // 相对超时时间（ms）
-    uint64_t m_nexttime_absolute = 0; // 绝对超时时间戳（ms）
+    bool m_inlined = false; // 到期后是否作为内联任务执行
+    uint64_t m_elapsetime_relative = 0; // 相对超时时间（us）
     TimeOutFunc m_callback{nullptr}; // 定时任务回调
     TimerManager *m_manager = nullptr;
+    sptr m_self; // 在时间轮中时持有自己，调用者不保留定时器也不会被提前释放
+};
 
-private:
-    // 比较两个Timer对象，比较的依据是绝对超时时间。这里也可以直接重写operator<
-    struct Comparator
+/**
+ * @brief 一次性超时
+ * @details 由调用者分配（比如随FdContext一起分配，见 FdContext::EventTimeout），加入、取消、到期都不分配内存，也没有 shared_ptr 和 std::function。
+ * 挂起期间仍在时间轮中的超时不能放在共享栈协程的栈上（挂起后栈会被换出）。
+ * 到期时在处理该定时器队列的线程上直接调用 callback(arg)（在 TimerManager::listExpiredCallback 中），回调应当短小、不能yield。
+ * 析构之前必须调用 TimerManager::cancelTimeout（到期之后也要），它返回之后回调不会再执行，也不会再访问这个对象
+ */
+class Timeout : public TimerNode
+{
+    friend class TimerManager;
+    DISABLE_COPY_MOVE(Timeout)
+
+public:
+    using Callback = void (*)(void *arg);
+
+    Timeout(Callback callback, void *arg)
+        : TimerNode(true)
+        , m_callback(callback)
+        , m_arg(arg)
     {
-        bool operator()(const Timer::sptr &lhs, const Timer::sptr &rhs) const;
+    }
+    ~Timeout();
+
+private:
+    enum State : uint8_t {
+        Idle, // 不在时间轮中，回调也没有在执行
+        Armed, // 在时间轮中
+        Firing, // 已经到期，回调正在执行
     };
+
+    Callback m_callback;
+    void *m_arg;
+    std::atomic_uint8_t m_state{Idle};
 };
 
 /**
  * @brief 定时器调度类
- * @details 基于小根堆实现
+ * @details 基于分层时间轮实现：每层64个槽位，第 n 层一个槽位跨 64^n us，共10层（约36年）。
+ * 定时器按剩余时间放入对应的层，加入和取消都是O(1)的链表操作；时间前进时只检查走过的槽位，
+ * 高层槽位中的定时器逐层下沉，到期的定时器批量取出。每层用一个64位的位图记录哪些槽位非空。
+ * 可以有多个定时器队列（各自一个时间轮和一把锁），定时器加入创建它的线程的队列，此后也只在这个队列中到期；
+ * 最后一个队列是共享队列，不属于任何线程的定时器放在这里，所有线程都会处理它
  */
 class TimerManager
 {
     friend class Timer;
 
 public:
-    TimerManager();
-    virtual ~TimerManager() = default;
+    // getNextTimer() 在没有定时器时的返回值
+    static constexpr std::chrono::microseconds kNoTimer = std::chrono::microseconds::max();
+    // 使用 timerSlack() 作为定时器的宽限
+    static constexpr std::chrono::microseconds kDefaultSlack = std::chrono::microseconds(-1);
+
+    /**
+     * @param queues 定时器队列的数量（包括共享队列）
+     */
+    explicit TimerManager(size_t queues = 1);
+    virtual ~TimerManager();
 
     /**
      * @brief 新增一个普通定时器
-     * @param ms 延迟毫秒数
+     * @param delay 延迟时间（微秒精度）
      * @param fn 回调函数
-     * @param weak_cond 执行条件
      * @param cyclic 是否重复执行
+     * @param slack 允许推迟到期的时间，kDefaultSlack 表示使用 timerSlack()
+     * @param inlined 回调短小且不会yield（比如只是重新调度某个协程），到期后可以作为内联任务直接在调度协程上执行（见 Scheduler::Inline）；
+     *                默认在协程中执行，回调中可以做IO、挂起
      */
-    Timer::sptr addTimer(uint64_t ms, Timer::TimeOutFunc fn, bool cyclic = false);
+    Timer::sptr addTimer(std::chrono::microseconds delay, Timer::TimeOutFunc fn, bool cyclic = false, std::chrono::microseconds slack = kDefaultSlack, bool inlined = false);
+    // 同上，延迟的单位为ms
+    Timer::sptr addTimer(uint64_t ms, Timer::TimeOutFunc fn, bool cyclic = false)
+    {
+        return addTimer(std::chrono::milliseconds(ms), std::move(fn), cyclic);
+    }
 
     /**
      * @brief 新增一个条件定时器。当到达执行时间时，若提供的条件变量依旧有效则执行回调，否则不执行回调
-     * @param ms 延迟毫秒数
+     * @param delay 延迟时间（微秒精度）
      * @param fn 回调函数
      * @param weak_cond 条件变量，利用智能指针是否有效作为判断条件
      * @param cyclic 是否重复执行
+     * @param slack 允许推迟到期的时间，kDefaultSlack 表示使用 timerSlack()
+     */
+    Timer::sptr addConditionalTimer(std::chrono::microseconds delay, Timer::TimeOutFunc fn, std::weak_ptr<void> weak_cond, bool cyclic = false, std::chrono::microseconds slack = kDefaultSlack);
+    // 同上，延迟的单位为ms
+    Timer::sptr addConditionalTimer(uint64_t ms, Timer::TimeOutFunc fn, std::weak_ptr<void> weak_cond, bool cyclic = false)
+    {
+        return addConditionalTimer(std::chrono::milliseconds(ms), std::move(fn), std::move(weak_cond), cyclic);
+    }
+
+    /**
+     * @brief 加入一次性超时，delay 之后调用它的回调
+     * @param slack 允许推迟到期的时间，kDefaultSlack 表示使用 timerSlack()
+     * @note 超时不能已经在时间轮中
+     */
+    void addTimeout(Timeout &timeout, std::chrono::microseconds delay, std::chrono::microseconds slack = kDefaultSlack);
+    /**
+     * @brief 取消一次性超时，返回之后超时可以析构或者再次加入
+     * @return 是否在到期之前取消；为false时回调已经执行过或者正在其他线程上执行，后者会等它执行完再返回
      */
-    Timer::sptr addConditionalTimer(uint64_t ms, Timer::TimeOutFunc fn, std::weak_ptr<void> weak_cond, bool cyclic = false);
+    bool cancelTimeout(Timeout &timeout);
 
     /**
-     * @brief 获取下一个定时器的等待时间
-     * @return 返回结果分为三种：无定时器等待执行返回 ~0ull，存在超时未执行的定时器返回 0，存在等待执行的定时器返回剩余的等待时间
+     * @brief 设置定时器默认的宽限（timer slack） thread-safe
+     * @details 宽限为 s 的定时器在 [到期时间, 到期时间 + s] 中末尾0最多的时刻（最“整”的时刻）到期，
+     * 区间有重叠的定时器大多落在同一个时刻，一次唤醒就能处理一批，代价是最多推迟 s。
+     * 只影响之后加入（以及重设、周期定时器重新放回）的定时器，默认为0（准时到期）
      */
-    uint64_t getNextTimer() const;
+    void setTimerSlack(std::chrono::microseconds slack)
+    {
+        m_slack = std::max<int64_t>(slack.count(), 0);
+    }
+    std::chrono::microseconds timerSlack() const
+    {
+        return std::chrono::microseconds(m_slack.load(std::memory_order_relaxed));
+    }
 
     /**
-     * @brief 获取所有等待超时的定时器的回调函数对象，并将定时器从队列中移除，这个函数会自动将周期调用的定时器存回队列
+     * @brief 获取当前线程下一个定时器的等待时间（当前线程的队列以及共享队列）
+     * @return 返回结果分为三种：无定时器等待执行返回 kNoTimer，存在超时未执行的定时器返回 0，存在等待执行的定时器返回剩余的等待时间
+     * @note 高层槽位中的定时器只能知道它所在槽位什么时候轮到，返回的可能早于实际的到期时间（此时 listExpiredCallback 让它下沉，不会取出任何定时器）
      */
-    void listExpiredCallback(std::vector<Timer::TimeOutFunc> &fns);
+    std::chrono::microseconds getNextTimer() const;
 
     /**
-     * @brief 检查是否有等待执行的定时器
+     * @brief 获取当前线程的队列以及共享队列中所有等待超时的定时器的回调函数对象，并将定时器从时间轮中移除，这个函数会自动将周期调用的定时器存回时间轮
+     * @param inline_fns 不为空时，以 inlined 方式添加的定时器的回调放入这里而不是 fns
+     * @note 到期的 Timeout 不放入 fns，它们的回调在这里直接执行
      */
-    bool hasTimer();
+    void listExpiredCallback(std::vector<Timer::TimeOutFunc> &fns, std::vector<Timer::TimeOutFunc> *inline_fns = nullptr);
+
+    /**
+     * @brief 检查是否有等待执行的定时器（所有队列）lock-free
+     */
+    bool hasTimer() const
+    {
+        return m_timers.load(std::memory_order_acquire) > 0;
+    }
 
 protected:
     /**
      * @brief 当创建了延迟时间最短的定时任务时，会调用此函数
      * TimerManager通过该方法来通知IOManager立刻更新当前的epoll_wait超时
+     * @param queue 定时器所在的队列，只有处理这个队列的线程需要更新超时
      */
-    virtual void onTimerInsertedAtFront() = 0;
+    virtual void onTimerInsertedAtFront(size_t queue) = 0;
+
+    /**
+     * @brief 当前线程新建的定时器加入哪个队列，默认都加入共享队列
+     * @note 返回的队列只能由当前线程处理（getNextTimer、listExpiredCallback），否则其中的定时器不会到期
+     */
+    virtual size_t currentTimerQueue() const
+    {
+        return sharedTimerQueue();
+    }
+
+    // 定时器队列的数量（包括共享队列）
+    size_t timerQueueCount() const
+    {
+        return m_queues.size();
+    }
+    // 共享队列的下标
+    size_t sharedTimerQueue() const
+    {
+        return m_queues.size() - 1;
+    }
+    // 指定队列中的定时器数量 lock-free
+    size_t timerCount(size_t queue) const
+    {
+        return m_queues[queue]->count.load(std::memory_order_acquire);
+    }
 
     /**
      * @brief 添加已有的定时器对象，该函数只是为了代码复用
+     * @param lock 定时器所在队列的锁
      */
-    void addTimer(Timer::sptr timer, WriteScopedLock &lock);
+    void addTimer(Timer::sptr timer, SpinScopedLock &lock);
 
     /**
      * @brief 删除指定的定时器
@@ -135,15 +281,49 @@ protected:
     bool delTimer(Timer::sptr timer);
 
 private:
+    static constexpr int kWheelBits = 6;
+    static constexpr int kWheelSlots = 1 << kWheelBits;
+    static constexpr uint64_t kWheelMask = kWheelSlots - 1;
+    static constexpr int kWheels = 10;
+
     /**
-     * @brief 检查系统时间是否被修改成更早的时间
+     * @brief 定时器队列：一个分层时间轮
+     * @details 只有创建定时器的线程会频繁访问自己的队列，其他线程只在取消、重设这个队列中的定时器时才会加锁，自旋锁几乎没有竞争
      */
-    bool detectClockRollover(uint64_t now_ms);
+    struct TimerQueue
+    {
+        SpinLock lock;
+        TimerNode *wheels[kWheels][kWheelSlots]{}; // 各层各槽位的链表头
+        uint64_t pending[kWheels]{}; // 各层非空槽位的位图
+        TimerNode *expired = nullptr; // 已到期、还没有取出的定时器
+        uint64_t now = 0; // 时间轮当前的时间（us）
+        std::atomic_size_t count{0}; // 时间轮中的定时器数量，修改时持有锁
+    };
+
+    // 把定时器加入它所属的队列，然后释放队列的锁，需要时通知等待定时器的一方
+    void arm(TimerNode *timer, SpinScopedLock &lock);
+    // 解析加入定时器时传入的宽限
+    uint64_t slackOf(std::chrono::microseconds slack) const
+    {
+        return slack == kDefaultSlack ? m_slack.load(std::memory_order_relaxed) : std::max<int64_t>(slack.count(), 0);
+    }
+    // 定时器实际到期的时间（us）：按宽限合并之后的到期时间
+    static uint64_t expiresOf(const TimerNode *timer);
+    // 按到期时间把定时器放入时间轮（或者已到期链表），需要持有队列的锁
+    static void place(TimerQueue &queue, TimerNode *timer);
+    // 把定时器从所在的链表中摘下，需要持有队列的锁
+    static void unlink(TimerQueue &queue, TimerNode *timer);
+    // 时间前进到 now，走过的槽位中的定时器重新放置（下沉或者到期），需要持有队列的锁
+    static void advance(TimerQueue &queue, uint64_t now);
+    // 最早可能有定时器到期的时间（us），没有定时器时为UINT64_MAX，需要持有队列的锁
+    static uint64_t nextDeadline(const TimerQueue &queue);
+    // 取出队列中到期的定时器
+    void listExpired(TimerQueue &queue, uint64_t now, std::vector<Timer::TimeOutFunc> &fns, std::vector<Timer::TimeOutFunc> *inline_fns);
 
 private:
-    mutable RWMutex m_lock;
-    std::set<Timer::sptr, Timer::Comparator> m_timers; // 这里没有用std::priority_queue，因为其无法遍历(堆本身就不是查找数据的结构)
-    uint64_t m_previous_time = 0; // 当前系统时间戳
+    std::vector<std::unique_ptr<TimerQueue>> m_queues; // 最后一个是共享队列
+    std::atomic_size_t m_timers{0}; // 所有队列中的定时器数量
+    std::atomic_uint64_t m_slack{0}; // 定时器默认的宽限（us）
 };
 
 } // end namespace meha
@@ -0,0 +1,106 @@
+#pragma once
+
+#include <cstddef>
+#include <new>
+
+namespace meha::utils
+{
+
+/**
+ * @brief 带线程缓存的分配器
+ * @details 释放的内存块放入当前线程的空闲链表（每种类型一条，最多 kMaxCached 块），此后同样大小的分配直接从链表中取，
+ * 适用于稳定状态下反复申请、释放同样大小内存块的容器，比如任务队列（std::list 的结点、std::deque 的块）。
+ * 在一个线程上分配、在另一个线程上释放的内存块进入释放线程的缓存；大小与缓存中不同的分配（比如 std::deque 的 map）直接走 operator new
+ */
+template<typename T>
+class CachedAllocator
+{
+public:
+    using value_type = T;
+    // 每个线程每种类型最多缓存的内存块数量
+    static constexpr size_t kMaxCached = 256;
+
+    CachedAllocator() noexcept = default;
+    template<typename U>
+    CachedAllocator(const CachedAllocator<U> &) noexcept
+    {
+    }
+
+    T *allocate(size_t n)
+    {
+        FreeList &list = Local();
+        if (list.head && list.blocks == n) {
+            Block *block = list.head;
+            list.head = block->next;
+            --list.count;
+            return reinterpret_cast<T *>(block);
+        }
+        return static_cast<T *>(::operator new(n * sizeof(T)));
+    }
+
+    void deallocate(T *p, size_t n) noexcept
+    {
+        FreeList &list = Local();
+        if (n * sizeof(T) >= sizeof(Block) && !list.closed && list.count < kMaxCached && (list.count == 0 || list.blocks == n)) {
+            Block *block = reinterpret_cast<Block *>(p);
+            block->next = list.head;
+            list.head = block;
+            list.blocks = n;
+            ++list.count;
+            return;
+        }
+        ::operator delete(p);
+    }
+
+    template<typename U>
+    bool operator==(const CachedAllocator<U> &) const noexcept
+    {
+        return true;
+    }
+    template<typename U>
+    bool operator!=(const CachedAllocator<U> &) const noexcept
+    {
+        return false;
+    }
+
+private:
+    struct Block
+    {
+        Block *next;
+    };
+
+    // 平凡析构，线程退出时在其他线程局部变量的析构函数中（比如释放线程局部的容器）仍然可以访问
+    struct FreeList
+    {
+        Block *head;
+        size_t count;
+        size_t blocks; // 缓存的内存块能放下几个T
+        bool closed; // 线程正在退出，不再缓存
+    };
+
+    // 线程退出时释放缓存的内存块
+    struct Reclaimer
+    {
+        FreeList *list;
+        ~Reclaimer()
+        {
+            list->closed = true;
+            while (list->head) {
+                Block *block = list->head;
+                list->head = block->next;
+                ::operator delete(block);
+            }
+            list->count = 0;
+        }
+    };
+
+    static FreeList &Local()
+    {
+        static thread_local FreeList t_list{};
+        static thread_local Reclaimer t_reclaimer{&t_list};
+        (void)t_reclaimer;
+        return t_list;
+    }
+};
+
+} // namespace meha::utils
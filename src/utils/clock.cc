@@ -0,0 +1,57 @@
+#include "utils/clock.h"
+
+namespace meha::utils
+{
+
+// 当前线程缓存的时间
+struct CachedClock
+{
+    bool valid = false; // 当前线程是否缓存时间
+    std::chrono::microseconds monotonic{0};
+    std::chrono::system_clock::time_point system{};
+};
+
+static thread_local CachedClock t_clock;
+
+void StartCoarseClock()
+{
+    t_clock.valid = true;
+    RefreshCoarseClock();
+}
+
+void StopCoarseClock()
+{
+    t_clock.valid = false;
+}
+
+std::chrono::microseconds RefreshCoarseClock()
+{
+    const std::chrono::microseconds monotonic = PreciseMonotonicUS();
+    if (t_clock.valid) {
+        t_clock.monotonic = monotonic;
+        t_clock.system = PreciseSystemTime();
+    }
+    return monotonic;
+}
+
+std::chrono::microseconds CoarseMonotonicUS()
+{
+    return t_clock.valid ? t_clock.monotonic : PreciseMonotonicUS();
+}
+
+std::chrono::system_clock::time_point CoarseSystemTime()
+{
+    return t_clock.valid ? t_clock.system : PreciseSystemTime();
+}
+
+std::chrono::microseconds PreciseMonotonicUS()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch());
+}
+
+std::chrono::system_clock::time_point PreciseSystemTime()
+{
+    return std::chrono::system_clock::now();
+}
+
+} // namespace meha::utils
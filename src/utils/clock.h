@@ -0,0 +1,41 @@
+#pragma once
+
+#include <chrono>
+
+namespace meha::utils
+{
+
+/**
+ * 框架时钟
+ *
+ * 事件循环的热路径上（计算epoll_wait超时、收集到期定时器、忙轮询）每轮都要读多次时钟，即使是vDSO也要几十ns。
+ * IO工作线程进入事件循环时开始缓存时间（StartCoarseClock），每轮事件循环刷新一次（RefreshCoarseClock），
+ * 这些地方读取缓存的时间（Coarse*）只是一次线程局部变量的读取。
+ *
+ * 执行任务期间缓存不刷新，落后的时间等于任务已经执行的时间，没有上限。因此只有事件循环本身可以读取缓存的时间；
+ * 任务中可能调用的入口（创建定时器、创建日志、任务入队）使用 Precise*。
+ * 当前线程没有缓存时间时（不是IO工作线程），Coarse* 读取精确时间。
+ */
+
+// 当前线程开始缓存时间（进入事件循环时调用）
+void StartCoarseClock();
+
+// 当前线程不再缓存时间（退出事件循环时调用），此后 Coarse* 读取精确时间
+void StopCoarseClock();
+
+// 当前线程缓存时间时刷新缓存，返回精确的单调时间
+std::chrono::microseconds RefreshCoarseClock();
+
+// 缓存的单调时间（steady_clock）
+std::chrono::microseconds CoarseMonotonicUS();
+
+// 缓存的系统时间（system_clock）
+std::chrono::system_clock::time_point CoarseSystemTime();
+
+// 精确的单调时间（steady_clock）
+std::chrono::microseconds PreciseMonotonicUS();
+
+// 精确的系统时间（system_clock）
+std::chrono::system_clock::time_point PreciseSystemTime();
+
+} // namespace meha::utils
@@ -76,9 +76,11 @@ bool FiberConditionVariable::timeWait(SpinLock &mutex, uint32_t sec)
         auto fiber = Fiber::GetCurrent();
         auto iom = IOManager::GetCurrent();
         ASSERT(iom);
-        iom->addTimer(sec * 1000, [iom, fiber] {
-            iom->schedule(fiber);
-        });
+        iom->addTimer(
+            std::chrono::seconds(sec), [iom, fiber] {
+                iom->schedule(fiber);
+            },
+            false, TimerManager::kDefaultSlack, true);
         fiber->yield();
         return false;
     }
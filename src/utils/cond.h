@@ -34,6 +34,17 @@ public:
         }
         pthread_mutex_unlock(&m_mutex);
     }
+    /**
+     * @brief 在调用者已经持有的互斥锁上等待
+     * @param mutex 已经加锁的互斥锁，保护谓词中访问的数据
+     */
+    template<typename Predicate>
+    void wait(Mutex &mutex, Predicate p)
+    {
+        while (!p()) {
+            pthread_cond_wait(&m_cond, mutex.native());
+        }
+    }
     /**
      * @return true 条件变量触发了
      * @return false 条件变量没有触发
@@ -55,6 +66,20 @@ public:
         pthread_mutex_unlock(&m_mutex);
         return ret == 0;
     }
+    // 在调用者已经持有的互斥锁上限时等待
+    template<typename Predicate>
+    bool timeWait(Mutex &mutex, time_t sec, Predicate p)
+    {
+        struct timespec absts;
+        clock_gettime(CLOCK_REALTIME, &absts); // 需要是绝对时间
+        absts.tv_sec += sec;
+        while (!p()) {
+            if (pthread_cond_timedwait(&m_cond, mutex.native(), &absts) == ETIMEDOUT) {
+                return p();
+            }
+        }
+        return true;
+    }
 
     void signal();
     void broadcast();
@@ -23,7 +23,7 @@ public:
     void push(Data data, bool instantly = false)
     {
         ScopedLock lock(&m_mutex);
-        m_condEmpty.wait([this]() {
+        m_condEmpty.wait(m_mutex, [this]() {
             return m_queue.size() < m_capacity;
         });
         if (instantly)
@@ -49,7 +49,7 @@ public:
     bool tryPushTimeWait(Data data, time_t sec, bool instantly = false)
     {
         ScopedLock lock(&m_mutex);
-        if (!m_condFull.timeWait(sec, [this] {
+        if (!m_condFull.timeWait(m_mutex, sec, [this] {
                 return m_queue.size() < m_capacity;
             })) {
             return false;
@@ -65,7 +65,7 @@ public:
     Data pop()
     {
         ScopedLock lock(&m_mutex);
-        m_condFull.wait([this] {
+        m_condFull.wait(m_mutex, [this] {
             return !m_queue.empty();
         });
         Data data = std::move(m_queue.front());
@@ -88,7 +88,7 @@ public:
     std::optional<Data> tryPopTimeWait(time_t sec)
     {
         ScopedLock lock(&m_mutex);
-        if (!m_condFull.timeWait(sec, [this] {
+        if (!m_condFull.timeWait(m_mutex, sec, [this] {
                 return !m_queue.empty();
             })) {
             return std::nullopt;
@@ -22,6 +22,11 @@ public:
 
     int lock() noexcept;
     int unLock() noexcept;
+    // 底层的 pthread 互斥锁，用于配合条件变量等待
+    pthread_mutex_t *native() noexcept
+    {
+        return &m_mutex;
+    }
 
 private:
     pthread_mutex_t m_mutex{};
@@ -60,7 +65,7 @@ class ScopedLockImpl
 public:
     explicit ScopedLockImpl(Mutex *mutex)
         : m_mutex(mutex)
-        , m_locked(true)
+        , m_locked(false)
     {
         lock();
     }
@@ -104,7 +109,7 @@ class ReadScopedLockImpl
 public:
     explicit ReadScopedLockImpl(RWMutex *mutex)
         : m_mutex(mutex)
-        , m_locked(true)
+        , m_locked(false)
     {
         lock();
     }
@@ -146,7 +151,7 @@ class WriteScopedLockImpl
 public:
     explicit WriteScopedLockImpl(RWMutex *mutex)
         : m_mutex(mutex)
-        , m_locked(true)
+        , m_locked(false)
     {
         lock();
     }
@@ -1,4 +1,10 @@
+#include <algorithm>
 #include <fmt/format.h>
+#include <fstream>
+#include <linux/mempolicy.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
 
 #include "module/log.h"
 
@@ -125,4 +131,76 @@ Thread::sptr Thread::GetCurrent()
     return t_this_thread;
 }
 
+bool Thread::SetCurrentAffinity(const std::vector<int> &cpus)
+{
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int cpu : cpus) {
+        if (cpu >= 0 && cpu < CPU_SETSIZE) {
+            CPU_SET(cpu, &set);
+        }
+    }
+    if (CPU_COUNT(&set) == 0) {
+        return false;
+    }
+    int ret = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    if (ret) {
+        LOG_FMT_WARN(core, "线程[TID:%d] 绑定CPU失败: %s", utils::GetThreadID(), ::strerror(ret));
+        return false;
+    }
+    return true;
+}
+
+bool Thread::SetCurrentMemoryNode(int node)
+{
+    if (node < 0 || node >= static_cast<int>(sizeof(unsigned long) * 8)) {
+        return false;
+    }
+    // 没有依赖libnuma，直接走系统调用
+    unsigned long mask = 1ul << node;
+    if (::syscall(SYS_set_mempolicy, MPOL_PREFERRED, &mask, sizeof(mask) * 8) == -1) {
+        LOG_FMT_WARN(core, "线程[TID:%d] 设置NUMA内存策略失败: %s", utils::GetThreadID(), ::strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+// 读取sysfs中的编号列表，格式形如 "0-3,8-11"，文件不存在时返回空列表
+static std::vector<int> ReadIdList(const std::string &path)
+{
+    std::vector<int> ids;
+    std::ifstream in(path);
+    std::string range;
+    while (std::getline(in, range, ',')) {
+        int first = 0, last = 0;
+        int n = std::sscanf(range.c_str(), "%d-%d", &first, &last);
+        if (n == 1) {
+            last = first;
+        } else if (n != 2) {
+            continue;
+        }
+        for (int id = first; id <= last; id++) {
+            ids.push_back(id);
+        }
+    }
+    return ids;
+}
+
+std::vector<int> Thread::GetNumaNodes()
+{
+    // 节点编号可能有空缺，不能从node0开始逐个探测
+    std::vector<int> nodes = ReadIdList("/sys/devices/system/node/online");
+    // 只有内存的节点上不能运行线程
+    nodes.erase(std::remove_if(nodes.begin(), nodes.end(), [](int node) {
+                    return GetNumaNodeCPUs(node).empty();
+                }),
+                nodes.end());
+    return nodes;
+}
+
+std::vector<int> Thread::GetNumaNodeCPUs(int node)
+{
+    return ReadIdList(fmt::format("/sys/devices/system/node/node{}/cpulist", node));
+}
+
 } // namespace meha
\ No newline at end of file
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <functional>
+#include <vector>
 
 #include "macro.h"
 #include "utils/sem.h"
@@ -63,6 +64,25 @@ public:
     // 获取当前线程指针
     static Thread::sptr GetCurrent(); // FIXME 这里应该返回什么指针更好？
 
+    /**
+     * @brief 将当前线程绑定到指定的CPU上运行
+     * @param cpus CPU编号列表
+     * @return 是否绑定成功
+     */
+    static bool SetCurrentAffinity(const std::vector<int> &cpus);
+    /**
+     * @brief 让当前线程优先在指定的NUMA节点上分配内存
+     * @note 只影响此后第一次访问的内存页，已经分配的内存不会迁移
+     */
+    static bool SetCurrentMemoryNode(int node);
+    /**
+     * @brief 获取在线并且有CPU的NUMA节点编号列表（升序），不支持NUMA时返回空列表
+     * @note 节点编号可能不连续（离线的节点、只有内存没有CPU的节点）
+     */
+    static std::vector<int> GetNumaNodes();
+    // 获取NUMA节点上的CPU编号列表，节点不存在时返回空列表
+    static std::vector<int> GetNumaNodeCPUs(int node);
+
 private:
     // linux线程id
     pid_t m_tid;
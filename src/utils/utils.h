@@ -75,7 +75,7 @@ struct ScopeGuard
         if (m_invoke) {
             m_cb();
         }
-	m_invokde = false;
+        m_invoke = false;
     }
     void dismiss()
     {
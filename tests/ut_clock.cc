@@ -0,0 +1,57 @@
+#include <chrono>
+#include <gtest/gtest.h>
+#include <thread>
+
+#include "application.h"
+#include "utils/clock.h"
+
+using namespace meha;
+
+// 没有缓存时间的线程读取精确时间
+TEST(ClockTest, PreciseWithoutCache)
+{
+    using namespace std::chrono;
+    const auto before = utils::PreciseMonotonicUS();
+    std::this_thread::sleep_for(milliseconds(2));
+    EXPECT_GE(utils::CoarseMonotonicUS() - before, milliseconds(2));
+    EXPECT_GE(utils::CoarseSystemTime(), system_clock::now() - milliseconds(100));
+}
+
+// 缓存时间的线程只在刷新时前进，停止缓存后恢复读取精确时间
+TEST(ClockTest, CoarseFollowsRefresh)
+{
+    using namespace std::chrono;
+    utils::StartCoarseClock();
+    const auto cached = utils::CoarseMonotonicUS();
+    const auto cached_system = utils::CoarseSystemTime();
+    std::this_thread::sleep_for(milliseconds(2));
+    EXPECT_EQ(utils::CoarseMonotonicUS(), cached);
+    EXPECT_EQ(utils::CoarseSystemTime(), cached_system);
+
+    const auto refreshed = utils::RefreshCoarseClock();
+    EXPECT_GE(refreshed - cached, milliseconds(2));
+    EXPECT_EQ(utils::CoarseMonotonicUS(), refreshed);
+    EXPECT_GT(utils::CoarseSystemTime(), cached_system);
+
+    utils::StopCoarseClock();
+    std::this_thread::sleep_for(milliseconds(2));
+    EXPECT_GE(utils::CoarseMonotonicUS() - refreshed, milliseconds(2));
+    // 不缓存时间时刷新不会开始缓存
+    utils::RefreshCoarseClock();
+    const auto precise = utils::CoarseMonotonicUS();
+    std::this_thread::sleep_for(milliseconds(2));
+    EXPECT_GE(utils::CoarseMonotonicUS() - precise, milliseconds(2));
+}
+
+int main(int argc, char *argv[])
+{
+    Application app;
+    return app.boot(BootArgs{
+        .argc = argc,
+        .argv = argv,
+        .configFile = "/home/will/Workspace/Devs/projects/server-framework/misc/config.yml",
+        .mainFunc = [](int argc, char **argv) -> int {
+            ::testing::InitGoogleTest(&argc, argv);
+            return RUN_ALL_TESTS();
+        }});
+}
@@ -1,8 +1,10 @@
 #include <fmt/format.h>
+#include <fstream>
 #include <gtest/gtest.h>
 
 #include "application.h"
 #include "fiber.h"
+#include "fiber_stack.h"
 #include "module/log.h"
 #include "utils/thread.h"
 
@@ -93,6 +95,129 @@ TEST(TEST_CASE, MultiThread)
     LOG(root, INFO) << "main thread end";
 }
 
+// 上下文切换后端的测试用例：反复切换后，跨切换存活的局部变量（包括浮点寄存器中的）应保持不变
+TEST(TEST_CASE, ContextSwitch)
+{
+    Fiber::Init();
+    LOG_FMT_INFO(root, "fiber context backend: %s", FiberContext::Backend());
+    constexpr int kRounds = 10000;
+    int64_t counter = 0;
+    double acc = 0.0;
+    auto ping_pong = [&counter, &acc]() {
+        double local = 1.5;
+        for (int i = 0; i < kRounds; i++) {
+            ++counter;
+            local += 0.5;
+            Fiber::Yield();
+        }
+        acc = local;
+    };
+    Fiber::sptr fiber(new Fiber(ping_pong, false));
+    for (int i = 0; i < kRounds; i++) {
+        fiber->resume();
+        EXPECT_EQ(counter, i + 1);
+    }
+    fiber->resume();
+    EXPECT_TRUE(fiber->isTerminated());
+    EXPECT_DOUBLE_EQ(acc, 1.5 + 0.5 * kRounds);
+
+    // 复用栈重新执行
+    counter = 0;
+    fiber->reset(ping_pong);
+    EXPECT_EQ(fiber->status(), Fiber::Status::Initialized);
+    while (!fiber->isTerminated()) {
+        fiber->resume();
+    }
+    EXPECT_EQ(counter, kRounds);
+}
+
+// 协程栈池的测试用例
+TEST(TEST_CASE, StackPool)
+{
+    auto before = StackAllocator::GetStats();
+    // 同一尺寸级别的栈被释放后，下一次分配直接从线程缓存中取回
+    void *stack1 = StackAllocator::Alloc(100 * 1024);
+    StackAllocator::Dealloc(stack1, 100 * 1024);
+    void *stack2 = StackAllocator::Alloc(128 * 1024);
+    EXPECT_EQ(stack1, stack2);
+    StackAllocator::Dealloc(stack2, 128 * 1024);
+    auto after = StackAllocator::GetStats();
+    EXPECT_GE(after.hits - before.hits, 1);
+
+    // 子线程退出时，其缓存的栈归还全局池，其他线程可以取用
+    constexpr size_t kStackSize = 512 * 1024;
+    auto thread = std::make_shared<Thread>([]() {
+        std::vector<void *> stacks;
+        for (int i = 0; i < 4; i++) {
+            stacks.push_back(StackAllocator::Alloc(kStackSize));
+        }
+        for (auto stack : stacks) {
+            StackAllocator::Dealloc(stack, kStackSize);
+        }
+    });
+    thread->start();
+    thread->join();
+    before = StackAllocator::GetStats();
+    EXPECT_GE(before.cached, 4);
+    void *stack3 = StackAllocator::Alloc(kStackSize);
+    after = StackAllocator::GetStats();
+    EXPECT_EQ(after.hits - before.hits, 1);
+    EXPECT_EQ(after.misses, before.misses);
+    StackAllocator::Dealloc(stack3, kStackSize);
+
+    // 创建协程也走栈池
+    before = StackAllocator::GetStats();
+    for (int i = 0; i < 8; i++) {
+        Fiber::sptr fiber(new Fiber([]() {}, false));
+    }
+    after = StackAllocator::GetStats();
+    EXPECT_GE(after.hits - before.hits, 7);
+}
+
+// 共享栈协程的测试用例：多于共享栈数量的协程交替执行，各自栈上的数据在换入换出后保持不变
+TEST(TEST_CASE, SharedStack)
+{
+    Fiber::Init();
+    constexpr int kFibers = 16;
+    constexpr int kRounds = 100;
+    int finished = 0;
+    std::vector<Fiber::sptr> fibers;
+    for (int i = 0; i < kFibers; i++) {
+        fibers.emplace_back(new Fiber(
+            [i, &finished]() {
+                char buffer[4096];
+                memset(buffer, i, sizeof(buffer));
+                for (int round = 0; round < kRounds; round++) {
+                    Fiber::Yield();
+                    for (char c : buffer) {
+                        ASSERT_EQ(c, static_cast<char>(i));
+                    }
+                }
+                ++finished;
+            },
+            false, 0, Fiber::Shared));
+        EXPECT_EQ(fibers.back()->stackMode(), Fiber::Shared);
+        EXPECT_EQ(fibers.back()->boundThread(), -1);
+    }
+    for (int round = 0; round <= kRounds; round++) {
+        for (auto &fiber : fibers) {
+            fiber->resume();
+            if (round < kRounds) {
+                EXPECT_EQ(fiber->boundThread(), utils::GetThreadID());
+            }
+        }
+    }
+    EXPECT_EQ(finished, kFibers);
+    for (auto &fiber : fibers) {
+        EXPECT_TRUE(fiber->isTerminated());
+        // 结束后解除绑定，可以复用
+        EXPECT_EQ(fiber->boundThread(), -1);
+    }
+    fibers[0]->reset([&finished]() { ++finished; });
+    fibers[0]->resume();
+    EXPECT_EQ(finished, kFibers + 1);
+}
+
 // 协程跑飞的测试用例（非对称协程）
 TEST(TEST_CASE, AbnormalExecutionDeathTest)
 {
@@ -130,6 +255,50 @@ TEST(TEST_CASE, AbnormalExecutionDeathTest)
         "");
 }
 
+static int recurse(int depth)
+{
+    volatile char frame[1024];
+    frame[0] = static_cast<char>(depth);
+    return depth > 0 ? recurse(depth - 1) + frame[0] : 0;
+}
+
+// 协程栈溢出的测试用例：访问到保护页时报告溢出的协程并以SIGSEGV结束
+// 协程数量超过带保护页的栈能支持的数量（每个栈2个内存映射）时，退回到不带保护页的栈，而不是分配失败
+TEST(TEST_CASE, MoreFibersThanMapCount)
+{
+    uint64_t max_map_count = 0;
+    std::ifstream("/proc/sys/vm/max_map_count") >> max_map_count;
+    if (max_map_count == 0 || max_map_count > 1000000) {
+        GTEST_SKIP() << "vm.max_map_count = " << max_map_count;
+    }
+    const size_t count = max_map_count / 2 + 1000;
+    std::vector<Fiber::sptr> fibers;
+    fibers.reserve(count);
+    for (size_t i = 0; i < count; i++) {
+        fibers.emplace_back(new Fiber([]() {}, false, 8 * 1024));
+    }
+    EXPECT_EQ(fibers.size(), count);
+    // 退回到堆上的栈同样可以执行、释放
+    fibers.back()->resume();
+    EXPECT_TRUE(fibers.back()->isTerminated());
+    fibers.clear();
+}
+
+TEST(TEST_CASE, StackOverflowDeathTest)
+{
+    if (StackAllocator::GuardSize() == 0) {
+        GTEST_SKIP() << "协程栈没有保护页";
+    }
+    ASSERT_EXIT(
+        {
+            Fiber::Init();
+            Fiber::sptr fiber(new Fiber([]() { recurse(1024); }, false, 16 * 1024));
+            fiber->resume();
+        },
+        testing::KilledBySignal(SIGSEGV),
+        "栈溢出");
+}
+
 int main(int argc, char *argv[])
 {
     Application app;
@@ -1,13 +1,44 @@
 #include <arpa/inet.h>
+#include <atomic>
+#include <chrono>
+#include <fcntl.h>
 #include <gtest/gtest.h>
+#include <new>
+#include <thread>
 
 #include "application.h"
+#include "config.h"
+#include "fd_manager.h"
 #include "io_manager.h"
+#include "io_uring.h"
+#include "module/hook.h"
 #include "module/log.h"
 #include "utils/utils.h"
 
 using namespace meha;
 
+// 统计堆内存分配的次数，用于验证热路径上没有内存分配
+static std::atomic_uint64_t g_allocations{0};
+
+void *operator new(size_t size)
+{
+    g_allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void *p = std::malloc(size ? size : 1)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void *p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void *p, size_t) noexcept
+{
+    std::free(p);
+}
+
 class HookTest : public ::testing::Test
 {
 protected:
@@ -43,6 +74,102 @@ TEST_F(HookTest, HookSleep)
     LOG_FMT_INFO(root, "main() 结束 in fiber[%ld]", utils::GetFiberID());
 }
 
+// 亚毫秒的睡眠既不会被取整成0（不睡），也不会被取整成1ms，等待期间也不空转
+TEST_F(HookTest, HookSubMillisecondSleep)
+{
+    iom->schedule([this]() {
+        const int rounds = 100;
+        auto waits = iom->getIOStats().epollWaits;
+        auto begin = std::chrono::steady_clock::now();
+        for (int i = 0; i < rounds; i++) {
+            ::usleep(200);
+        }
+        auto elapsed = std::chrono::steady_clock::now() - begin;
+        EXPECT_GE(elapsed, std::chrono::microseconds(200 * rounds));
+        EXPECT_LT(elapsed, std::chrono::milliseconds(rounds));
+        EXPECT_LE(iom->getIOStats().epollWaits - waits, 3u * rounds);
+
+        const timespec req{0, 300 * 1000};
+        begin = std::chrono::steady_clock::now();
+        for (int i = 0; i < rounds; i++) {
+            ::nanosleep(&req, nullptr);
+        }
+        elapsed = std::chrono::steady_clock::now() - begin;
+        EXPECT_GE(elapsed, std::chrono::microseconds(300 * rounds));
+        EXPECT_LT(elapsed, std::chrono::milliseconds(rounds));
+    });
+}
+
+// 用户的定时器回调在协程中执行，可以做IO、挂起
+TEST(TimerHookTest, HookSleepInTimer)
+{
+    IOManager iom(1, false);
+    iom.start();
+    std::atomic_bool inlined{true};
+    std::atomic_bool done{false};
+    iom.addTimer(std::chrono::milliseconds(1), [&]() {
+        inlined = Scheduler::IsRunningInline();
+        ::usleep(1000);
+        done = true;
+    });
+    for (int i = 0; i < 2000 && !done; i++) {
+        ::usleep(1000);
+    }
+    EXPECT_TRUE(done);
+    EXPECT_FALSE(inlined);
+    iom.stop();
+}
+
+// 内联任务不能挂起协程，本来会挂起协程的sleep改为阻塞工作线程，睡眠的时长不变
+TEST(TimerHookTest, SleepInInlineTask)
+{
+    IOManager iom(1, false);
+    iom.start();
+    std::atomic<int64_t> elapsed_us{0};
+    iom.schedule(
+        [&]() {
+            const auto start = std::chrono::steady_clock::now();
+            ::usleep(20 * 1000);
+            elapsed_us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+        },
+        Scheduler::Inline);
+    iom.stop();
+    EXPECT_GE(elapsed_us, 20 * 1000);
+}
+
+// 内联任务中阻塞套接字上的IO等待就绪之后完成，而不是返回EAGAIN；超时与hook开启时相同
+TEST(EpollHookTest, SocketIOInInlineTask)
+{
+    IOManager iom(1, false);
+    iom.start();
+    int pair[2];
+    ASSERT_EQ(::socketpair(AF_UNIX, SOCK_STREAM, 0, pair), 0);
+    FileDescriptorManager::Instance()->fetch(pair[0], false);
+    std::thread writer([&]() {
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        ASSERT_EQ(::write(pair[1], "x", 1), 1);
+    });
+    ssize_t received = 0, timed_out = 0;
+    int error = 0;
+    iom.schedule(
+        [&]() {
+            char buf[8];
+            received = ::recv(pair[0], buf, sizeof(buf), 0);
+            timeval tv{0, 20 * 1000};
+            ASSERT_EQ(::setsockopt(pair[0], SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)), 0);
+            timed_out = ::recv(pair[0], buf, sizeof(buf), 0);
+            error = errno;
+        },
+        Scheduler::Inline);
+    iom.stop();
+    writer.join();
+    ::close(pair[0]);
+    ::close(pair[1]);
+    EXPECT_EQ(received, 1);
+    EXPECT_EQ(timed_out, -1);
+    EXPECT_EQ(error, ETIMEDOUT);
+}
+
 TEST_F(HookTest, HookSocket)
 {
     LOG_FMT_INFO(root, "main() 开始 in fiber[%ld]", utils::GetFiberID());
@@ -85,6 +212,519 @@ TEST_F(HookTest, HookSocket)
     LOG_FMT_INFO(root, "main() 结束 in fiber[%ld]", utils::GetFiberID());
 }
 
+// 普通文件的IO交给阻塞调用线程池执行，结果和errno都要带回协程
+TEST_F(HookTest, HookFileIO)
+{
+    auto offload_file_io = Config::Lookup<bool>("hook.offload_file_io");
+    auto max_timeout = Config::Lookup<uint64_t>("io.max_timeout");
+    const uint64_t old_timeout = max_timeout->getValue();
+    offload_file_io->setValue(true);
+    max_timeout->setValue(10);
+    auto cleanup = utils::GenScopeGuard([&]() {
+        offload_file_io->setValue(false);
+        max_timeout->setValue(old_timeout);
+    });
+
+    char path[] = "/tmp/ut_hook_XXXXXX";
+    int tmp = ::mkstemp(path);
+    ASSERT_NE(tmp, -1);
+    ::close(tmp);
+    bool done = false;
+    iom->schedule([&path, &done]() {
+        int fd = ::open(path, O_WRONLY | O_TRUNC);
+        ASSERT_NE(fd, -1);
+        EXPECT_EQ(::write(fd, "offload", 7), 7);
+        char buf[16] = {0};
+        // 只写打开的文件不能读
+        EXPECT_EQ(::read(fd, buf, sizeof(buf)), -1);
+        EXPECT_EQ(errno, EBADF);
+        ::close(fd);
+
+        fd = ::open(path, O_RDONLY);
+        ASSERT_NE(fd, -1);
+        EXPECT_EQ(::read(fd, buf, sizeof(buf)), 7);
+        EXPECT_STREQ(buf, "offload");
+        ::close(fd);
+        done = true;
+    });
+    iom->stop();
+    ::unlink(path);
+    EXPECT_TRUE(done);
+}
+
+// epoll后端下，IO返回EAGAIN之后、新的就绪通知到达之前，不再执行注定返回EAGAIN的系统调用
+TEST(EpollHookTest, SkipKnownNotReady)
+{
+    auto io_backend = Config::Lookup<std::string>("io.backend");
+    auto multi_reactor = Config::Lookup<bool>("io.multi_reactor");
+    io_backend->setValue("epoll");
+    multi_reactor->setValue(true);
+    auto cleanup = utils::GenScopeGuard([&]() {
+        io_backend->setValue("auto");
+        multi_reactor->setValue(false);
+    });
+
+    IOManager iom(1, false);
+    iom.start();
+    int pair[2];
+    ASSERT_EQ(::socketpair(AF_UNIX, SOCK_STREAM, 0, pair), 0);
+    FileDescriptorManager::Instance()->fetch(pair[0], false);
+    std::atomic_bool done{false};
+    iom.schedule([&]() {
+        timeval tv{0, 20 * 1000};
+        ASSERT_EQ(::setsockopt(pair[0], SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)), 0);
+        char buf[8];
+        uint64_t calls = iom.getIOStats().ioCalls;
+        EXPECT_EQ(::recv(pair[0], buf, sizeof(buf), 0), -1);
+        EXPECT_EQ(errno, ETIMEDOUT);
+        EXPECT_EQ(iom.getIOStats().ioCalls - calls, 1u);
+        // 已知未就绪，直接等待
+        calls = iom.getIOStats().ioCalls;
+        EXPECT_EQ(::recv(pair[0], buf, sizeof(buf), 0), -1);
+        EXPECT_EQ(errno, ETIMEDOUT);
+        EXPECT_EQ(iom.getIOStats().ioCalls - calls, 0u);
+        // 数据到达后恢复
+        ASSERT_EQ(::write(pair[1], "x", 1), 1);
+        EXPECT_EQ(::recv(pair[0], buf, sizeof(buf), 0), 1);
+        ::close(pair[0]);
+        done = true;
+    });
+    iom.stop();
+    ::close(pair[1]);
+    EXPECT_TRUE(done);
+}
+
+// 就绪通知锁存的同时IO标记了未就绪：监听时消费锁存的通知之后，IO要重新执行系统调用，而不是继续等待
+TEST(EpollHookTest, LatchedReadinessClearsNotReady)
+{
+    auto io_backend = Config::Lookup<std::string>("io.backend");
+    io_backend->setValue("epoll");
+    auto cleanup = utils::GenScopeGuard([&]() {
+        io_backend->setValue("auto");
+    });
+
+    IOManager iom(1, false);
+    iom.start();
+    int pair[2];
+    ASSERT_EQ(::socketpair(AF_UNIX, SOCK_STREAM, 0, pair), 0);
+    FileDescriptorManager::Instance()->fetch(pair[0], false);
+    std::atomic_bool done{false};
+    iom.schedule([&]() {
+        timeval tv{0, 200 * 1000};
+        ASSERT_EQ(::setsockopt(pair[0], SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)), 0);
+        char buf[8];
+        // 加入epoll，并标记为未就绪
+        EXPECT_EQ(::recv(pair[0], buf, sizeof(buf), 0), -1);
+        EXPECT_EQ(errno, ETIMEDOUT);
+        // 没有等待者时数据到达，事件循环锁存就绪通知
+        ASSERT_EQ(::write(pair[1], "x", 1), 1);
+        ::usleep(20 * 1000);
+        // 构造竞争的结果：锁存之后又有IO标记了未就绪
+        FdContext *fd_ctx = iom.fetchFdContext(pair[0]);
+        EXPECT_FALSE(fd_ctx->markNotReady(FdContext::Read));
+        // 监听时消费锁存的通知，立即触发
+        std::atomic_bool fired{false};
+        EXPECT_TRUE(iom.subscribeEvent(pair[0], FdContext::Read, [&]() {
+            fired = true;
+        }));
+        ::usleep(20 * 1000);
+        EXPECT_TRUE(fired);
+        // 数据一直在，不能因为未就绪标记而跳过系统调用
+        EXPECT_EQ(::recv(pair[0], buf, sizeof(buf), 0), 1);
+        ::close(pair[0]);
+        done = true;
+    });
+    iom.stop();
+    ::close(pair[1]);
+    EXPECT_TRUE(done);
+}
+
+// IO就绪唤醒挂起的协程时以内联任务执行唤醒回调，不会为每次唤醒创建一个新的协程
+TEST(EpollHookTest, WakeupWithoutNewFiber)
+{
+    static constexpr int kRounds = 16;
+    auto io_backend = Config::Lookup<std::string>("io.backend");
+    auto fiber_cache = Config::Lookup<uint64_t>("scheduler.fiber_cache");
+    const uint64_t old_cache = fiber_cache->getValue();
+    io_backend->setValue("epoll");
+    // 关闭协程缓存，每次创建协程都会分配新的协程id
+    fiber_cache->setValue(0);
+    auto cleanup = utils::GenScopeGuard([&]() {
+        io_backend->setValue("auto");
+        fiber_cache->setValue(old_cache);
+    });
+
+    IOManager iom(1, false);
+    iom.start();
+    int pair[2];
+    ASSERT_EQ(::socketpair(AF_UNIX, SOCK_STREAM, 0, pair), 0);
+    FileDescriptorManager::Instance()->fetch(pair[0], false);
+    std::atomic_uint64_t first_fid{0}, last_fid{0};
+    std::atomic_int received{0};
+    iom.schedule([&]() {
+        first_fid = std::make_shared<Fiber>([]() {}, false)->fid();
+        char buf[8];
+        for (int i = 0; i < kRounds; i++) {
+            if (::recv(pair[0], buf, 1, 0) == 1) {
+                received++;
+            }
+        }
+        last_fid = std::make_shared<Fiber>([]() {}, false)->fid();
+    });
+    for (int i = 0; i < kRounds; i++) {
+        // 等读者挂起之后再写入，确保每一轮都经过一次唤醒
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        ASSERT_EQ(::write(pair[1], "x", 1), 1);
+    }
+    iom.stop();
+    ::close(pair[0]);
+    ::close(pair[1]);
+    EXPECT_EQ(received, kRounds);
+    EXPECT_EQ(last_fid, first_fid + 1);
+}
+
+// fd在工作线程之外关闭、或者绕过hook关闭（close_f）之后，复用同一个fd号的新套接字也要加入epoll
+TEST(EpollHookTest, ReuseClosedFd)
+{
+    auto io_backend = Config::Lookup<std::string>("io.backend");
+    io_backend->setValue("epoll");
+    auto cleanup = utils::GenScopeGuard([&]() {
+        io_backend->setValue("auto");
+    });
+
+    IOManager iom(1, false);
+    iom.start();
+    // 在工作线程上阻塞地recv一个字节，返回recv的结果
+    auto blocking_recv = [&](int fd, int peer, bool bypass_close) {
+        std::atomic_bool done{false};
+        ssize_t n = 0;
+        iom.schedule([&]() {
+            timeval tv{1, 0};
+            EXPECT_EQ(::setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)), 0);
+            char c;
+            n = ::recv(fd, &c, 1, 0);
+            if (bypass_close) {
+                close_f(fd);
+            }
+            done = true;
+        });
+        // 等协程阻塞在recv上再写
+        ::usleep(20 * 1000);
+        EXPECT_EQ(::write(peer, "x", 1), 1);
+        while (!done) {
+            ::usleep(1000);
+        }
+        return n;
+    };
+    for (bool bypass_close : {false, true}) {
+        int pair[2];
+        ASSERT_EQ(::socketpair(AF_UNIX, SOCK_STREAM, 0, pair), 0);
+        FileDescriptorManager::Instance()->create(pair[0]);
+        EXPECT_EQ(blocking_recv(pair[0], pair[1], bypass_close), 1);
+        if (!bypass_close) {
+            ::close(pair[0]);
+        }
+        ::close(pair[1]);
+        int again[2];
+        ASSERT_EQ(::socketpair(AF_UNIX, SOCK_STREAM, 0, again), 0);
+        ASSERT_EQ(again[0], pair[0]);
+        FileDescriptorManager::Instance()->create(again[0]);
+        // 新的fd没有加入epoll时，recv要等到超时
+        EXPECT_EQ(blocking_recv(again[0], again[1], false), 1) << "bypass_close=" << bypass_close;
+        ::close(again[0]);
+        ::close(again[1]);
+    }
+    iom.stop();
+}
+
+// 只有IOManager持有状态的fd在关闭时才通知IOManager释放，其他fd（管道、普通文件）的close不访问IOManager
+TEST(EpollHookTest, CloseReleasesOnlyAttachedFds)
+{
+    IOManager iom(1, false);
+    iom.start();
+    int subscribed[2], unrelated[2];
+    ASSERT_EQ(::pipe(subscribed), 0);
+    ASSERT_EQ(::pipe(unrelated), 0);
+    std::atomic_bool subscribed_done{false}, triggered{false};
+    iom.schedule([&]() {
+        EXPECT_TRUE(iom.subscribeEvent(subscribed[0], FdContext::FdEvent::Read, [&]() {
+            triggered = true;
+        }));
+        subscribed_done = true;
+    });
+    while (!subscribed_done) {
+        ::usleep(1000);
+    }
+    // 关闭时触发等待的事件
+    ::close(subscribed[0]);
+    for (int i = 0; i < 1000 && !triggered; i++) {
+        ::usleep(1000);
+    }
+    EXPECT_TRUE(triggered);
+    // 关闭时已经取消登记
+    EXPECT_FALSE(FileDescriptorManager::Instance()->remove(subscribed[0]));
+    EXPECT_FALSE(FileDescriptorManager::Instance()->remove(unrelated[0]));
+    ::close(subscribed[1]);
+    ::close(unrelated[0]);
+    ::close(unrelated[1]);
+    iom.stop();
+}
+
+// 在新的IOManager上阻塞地recv rounds次，返回统计期间内存分配的次数
+// @param timeout 是否在套接字上设置接收超时（不会触发）
+static uint64_t CountBlockingRecvAllocations(bool timeout)
+{
+    IOManager iom(1, false);
+    iom.start();
+    int pair[2];
+    EXPECT_EQ(::socketpair(AF_UNIX, SOCK_STREAM, 0, pair), 0);
+    FileDescriptorManager::Instance()->fetch(pair[0], false);
+    const int warmup = 10, rounds = 100;
+    std::atomic_int received{0};
+    iom.schedule([&]() {
+        if (timeout) {
+            timeval tv{1, 0};
+            EXPECT_EQ(::setsockopt(pair[0], SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)), 0);
+        }
+        char c;
+        // 多等一轮：统计结束时协程阻塞在recv上，而不是在退出
+        for (int i = 0; i <= rounds; i++) {
+            if (::recv(pair[0], &c, 1, 0) != 1) {
+                break;
+            }
+            ++received;
+        }
+        ::close(pair[0]);
+    });
+    uint64_t before = 0, allocations = 0;
+    for (int i = 0; i <= rounds; i++) {
+        // 等读协程阻塞在recv上再写
+        while (received < i) {
+            ::usleep(100);
+        }
+        if (i == warmup) {
+            before = g_allocations.load();
+        }
+        if (i == rounds) {
+            ::usleep(2000);
+            allocations = g_allocations.load() - before;
+        }
+        ::usleep(1000);
+        EXPECT_EQ(::write(pair[1], "x", 1), 1);
+    }
+    iom.stop();
+    ::close(pair[1]);
+    EXPECT_EQ(received, rounds + 1);
+    return allocations;
+}
+
+// 带超时的阻塞IO：超时结点在FdContext中，添加、取消超时都不分配内存
+TEST(EpollHookTest, TimeoutWithoutAllocation)
+{
+    auto io_backend = Config::Lookup<std::string>("io.backend");
+    auto multi_reactor = Config::Lookup<bool>("io.multi_reactor");
+    io_backend->setValue("epoll");
+    multi_reactor->setValue(true);
+    // 统计的是超时机制本身的分配，关掉框架的调试日志
+    auto core_logger = GET_LOGGER("core");
+    const auto core_level = core_logger->getLevel();
+    core_logger->setLevel(LogMessage::LogLevel::INFO);
+    auto cleanup = utils::GenScopeGuard([&]() {
+        io_backend->setValue("auto");
+        multi_reactor->setValue(false);
+        core_logger->setLevel(core_level);
+    });
+
+    // 协程挂起、恢复（恢复回调、任务结点、任务队列）以及超时的加入、取消都不分配内存
+    EXPECT_EQ(CountBlockingRecvAllocations(false), 0u);
+    EXPECT_EQ(CountBlockingRecvAllocations(true), 0u);
+}
+
+// io_uring后端下阻塞IO的提交、收割以及链接超时同样不分配内存
+TEST(UringHookTest, TimeoutWithoutAllocation)
+{
+    if (!IOUring::IsSupported()) {
+        GTEST_SKIP() << "内核不支持io_uring";
+    }
+    auto io_backend = Config::Lookup<std::string>("io.backend");
+    auto multi_reactor = Config::Lookup<bool>("io.multi_reactor");
+    io_backend->setValue("io_uring");
+    multi_reactor->setValue(true);
+    auto core_logger = GET_LOGGER("core");
+    const auto core_level = core_logger->getLevel();
+    core_logger->setLevel(LogMessage::LogLevel::INFO);
+    auto cleanup = utils::GenScopeGuard([&]() {
+        io_backend->setValue("auto");
+        multi_reactor->setValue(false);
+        core_logger->setLevel(core_level);
+    });
+
+    EXPECT_EQ(CountBlockingRecvAllocations(false), 0u);
+    EXPECT_EQ(CountBlockingRecvAllocations(true), 0u);
+}
+
+// 超时的加入、取消、到期都不分配内存
+TEST(EpollHookTest, AddCancelTimeoutWithoutAllocation)
+{
+    auto core_logger = GET_LOGGER("core");
+    const auto core_level = core_logger->getLevel();
+    core_logger->setLevel(LogMessage::LogLevel::INFO);
+    auto cleanup = utils::GenScopeGuard([&]() {
+        core_logger->setLevel(core_level);
+    });
+
+    IOManager iom(1, false);
+    iom.start();
+    std::atomic_int fired{0};
+    Timeout timeout([](void *arg) { ++*static_cast<std::atomic_int *>(arg); }, &fired);
+    // 预热：工作线程第一次处理定时器
+    iom.addTimeout(timeout, std::chrono::microseconds(100));
+    while (fired < 1) {
+        ::usleep(100);
+    }
+    iom.cancelTimeout(timeout);
+
+    const uint64_t before = g_allocations.load();
+    for (int i = 0; i < 1000; i++) {
+        iom.addTimeout(timeout, std::chrono::seconds(1));
+        EXPECT_TRUE(iom.cancelTimeout(timeout));
+    }
+    iom.addTimeout(timeout, std::chrono::microseconds(100));
+    while (fired < 2) {
+        ::usleep(100);
+    }
+    EXPECT_FALSE(iom.cancelTimeout(timeout));
+    EXPECT_EQ(g_allocations.load() - before, 0u);
+    iom.stop();
+}
+
+// io_uring后端下hook的套接字IO：multishot accept、connect、send/recv、provided buffer、超时以及关闭时取消
+TEST(UringHookTest, LoopbackEcho)
+{
+    if (!IOUring::IsSupported()) {
+        GTEST_SKIP() << "内核不支持io_uring";
+    }
+    auto io_backend = Config::Lookup<std::string>("io.backend");
+    // 每个工作线程一个io_uring实例，协程在哪个线程上恢复都要能正确地完成
+    auto multi_reactor = Config::Lookup<bool>("io.multi_reactor");
+    io_backend->setValue("io_uring");
+    multi_reactor->setValue(true);
+    auto cleanup = utils::GenScopeGuard([&]() {
+        io_backend->setValue("auto");
+        multi_reactor->setValue(false);
+    });
+
+    IOManager iom(2, false);
+    iom.start();
+    ASSERT_EQ(iom.backend(), IOManager::Uring);
+
+    constexpr int kClients = 4;
+    std::atomic_int port{0};
+    std::atomic_int echoed{0};
+    std::atomic_int provided{0};
+    // 服务端：第一条消息用provided buffer接收，之后用普通的recv
+    iom.schedule([&]() {
+        int listen_fd = ::socket(AF_INET, SOCK_STREAM, 0);
+        ASSERT_NE(listen_fd, -1);
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        socklen_t len = sizeof(addr);
+        ASSERT_EQ(::bind(listen_fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)), 0);
+        ASSERT_EQ(::listen(listen_fd, kClients), 0);
+        ASSERT_EQ(::getsockname(listen_fd, reinterpret_cast<sockaddr *>(&addr), &len), 0);
+        port = ntohs(addr.sin_port);
+        for (int i = 0; i < kClients; i++) {
+            sockaddr_in peer{};
+            socklen_t peer_len = sizeof(peer);
+            int fd = ::accept(listen_fd, reinterpret_cast<sockaddr *>(&peer), &peer_len);
+            ASSERT_GE(fd, 0) << strerror(errno);
+            EXPECT_EQ(peer.sin_addr.s_addr, htonl(INADDR_LOOPBACK));
+            iom.schedule([&, fd]() {
+                IOManager::ProvidedBuffer buffer;
+                ssize_t n = iom.recvProvided(fd, buffer);
+                ASSERT_GT(n, 0) << strerror(errno);
+                EXPECT_EQ(buffer.size(), static_cast<size_t>(n));
+                EXPECT_EQ(::send(fd, buffer.data(), n, 0), n);
+                buffer.release();
+                ++provided;
+                char buf[64];
+                while ((n = ::recv(fd, buf, sizeof(buf), 0)) > 0) {
+                    EXPECT_EQ(::write(fd, buf, n), n);
+                }
+                EXPECT_EQ(n, 0);
+                ::close(fd);
+            });
+        }
+        ::close(listen_fd);
+    });
+    while (port == 0) {
+        ::usleep(1000);
+    }
+
+    for (int i = 0; i < kClients; i++) {
+        iom.schedule([&, i]() {
+            int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+            ASSERT_NE(fd, -1);
+            sockaddr_in addr{};
+            addr.sin_family = AF_INET;
+            addr.sin_port = htons(port);
+            addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+            ASSERT_EQ(::connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)), 0) << strerror(errno);
+            for (int round = 0; round < 3; round++) {
+                const std::string msg = "ping " + std::to_string(i) + "-" + std::to_string(round);
+                EXPECT_EQ(::send(fd, msg.data(), msg.size(), 0), static_cast<ssize_t>(msg.size()));
+                char buf[64] = {0};
+                EXPECT_EQ(::read(fd, buf, sizeof(buf)), static_cast<ssize_t>(msg.size()));
+                EXPECT_EQ(msg, buf);
+            }
+            ::close(fd);
+            ++echoed;
+        });
+    }
+
+    // 没有数据可读时：设置了接收超时的返回ETIMEDOUT，阻塞在recv上时关闭fd返回EBADF
+    int timeout_pair[2], cancel_pair[2];
+    ASSERT_EQ(::socketpair(AF_UNIX, SOCK_STREAM, 0, timeout_pair), 0);
+    ASSERT_EQ(::socketpair(AF_UNIX, SOCK_STREAM, 0, cancel_pair), 0);
+    FileDescriptorManager::Instance()->fetch(timeout_pair[0], false);
+    FileDescriptorManager::Instance()->fetch(cancel_pair[0], false);
+    std::atomic_bool waiting{false};
+    std::atomic_bool cancelled{false};
+    iom.schedule([&]() {
+        timeval tv{0, 20 * 1000};
+        ASSERT_EQ(::setsockopt(timeout_pair[0], SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)), 0);
+        char buf[8];
+        EXPECT_EQ(::recv(timeout_pair[0], buf, sizeof(buf), 0), -1);
+        EXPECT_EQ(errno, ETIMEDOUT);
+        ::close(timeout_pair[0]);
+    });
+    iom.schedule([&]() {
+        char buf[8];
+        waiting = true;
+        EXPECT_EQ(::recv(cancel_pair[0], buf, sizeof(buf), 0), -1);
+        EXPECT_EQ(errno, EBADF);
+        cancelled = true;
+    });
+    while (!waiting) {
+        ::usleep(1000);
+    }
+    ::usleep(10 * 1000);
+    iom.schedule([&]() {
+        ::close(cancel_pair[0]);
+    });
+
+    iom.stop();
+    ::close(timeout_pair[1]);
+    ::close(cancel_pair[1]);
+    EXPECT_EQ(echoed, kClients);
+    EXPECT_EQ(provided, kClients);
+    EXPECT_TRUE(cancelled);
+    const auto stats = iom.getIOStats();
+    EXPECT_GT(stats.uringOps, 0u);
+    EXPECT_GT(stats.uringEnters, 0u);
+}
+
 int main(int argc, char *argv[])
 {
     Application app;
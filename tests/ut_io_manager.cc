@@ -1,8 +1,12 @@
 #include <arpa/inet.h>
+#include <chrono>
 #include <fcntl.h>
 #include <gtest/gtest.h>
+#include <memory>
+#include <vector>
 
 #include "application.h"
+#include "config.h"
 #include "io_manager.h"
 #include "module/log.h"
 
@@ -75,6 +79,286 @@ TEST_F(IOManagerTest, Timer)
         true);
 }
 
+// 多reactor：fd分配给各个工作线程，事件回调在所属的工作线程上执行
+TEST(MultiReactorTest, AssignFdsToWorkers)
+{
+    auto multi_reactor = Config::Lookup<bool>("io.multi_reactor");
+    auto reactor_policy = Config::Lookup<std::string>("io.reactor_policy");
+    multi_reactor->setValue(true);
+    auto cleanup = utils::GenScopeGuard([&]() {
+        multi_reactor->setValue(false);
+        reactor_policy->setValue("round_robin");
+    });
+
+    for (auto policy : {"round_robin", "least_loaded"}) {
+        reactor_policy->setValue(policy);
+        IOManager iom(3, false);
+        iom.start();
+        ASSERT_TRUE(iom.isMultiReactor());
+        ASSERT_EQ(iom.reactorCount(), 3);
+
+        constexpr int kPipes = 6;
+        int pipes[kPipes][2];
+        for (auto &fds : pipes) {
+            ASSERT_EQ(::pipe2(fds, O_NONBLOCK), 0);
+        }
+        std::atomic_int fired{0};
+        std::atomic<pid_t> fired_on[kPipes];
+        auto subscribe = [&](int i) {
+            std::atomic_bool done{false};
+            // 回调要绑定到IOManager上，因此在IOManager的协程中监听事件
+            iom.schedule([&, i]() {
+                EXPECT_TRUE(iom.subscribeEvent(pipes[i][0], FdContext::Read, [&, i]() {
+                    fired_on[i] = utils::GetThreadID();
+                    ++fired;
+                }));
+                done = true;
+            });
+            while (!done) {
+                ::usleep(1000);
+            }
+        };
+        for (int i = 0; i < kPipes; i++) {
+            subscribe(i);
+        }
+        // 两种策略下都是均匀分配
+        for (size_t r = 0; r < iom.reactorCount(); r++) {
+            EXPECT_EQ(iom.reactorLoad(r), 2) << policy;
+        }
+        // 逐个触发，保证只有所属的工作线程被唤醒
+        for (int i = 0; i < kPipes; i++) {
+            ASSERT_EQ(::write(pipes[i][1], "x", 1), 1);
+            while (fired < i + 1) {
+                ::usleep(1000);
+            }
+            const int reactor = iom.reactorOf(pipes[i][0]);
+            ASSERT_GE(reactor, 0);
+            EXPECT_EQ(fired_on[i], iom.workerThread(reactor)) << policy;
+        }
+        // 关闭fd后释放所属的reactor，least_loaded 下新的fd分配给它
+        const int released = iom.reactorOf(pipes[0][0]);
+        EXPECT_TRUE(iom.triggerAllEvents(pipes[0][0]));
+        EXPECT_EQ(iom.reactorOf(pipes[0][0]), -1);
+        EXPECT_EQ(iom.reactorLoad(released), 1);
+        if (std::string(policy) == "least_loaded") {
+            subscribe(0);
+            EXPECT_EQ(iom.reactorOf(pipes[0][0]), released);
+        }
+        for (auto &fds : pipes) {
+            iom.triggerAllEvents(fds[0]);
+            ::close(fds[0]);
+            ::close(fds[1]);
+        }
+        iom.stop();
+    }
+}
+
+// fd只在第一次监听时加入epoll，之后的等待和唤醒都不再需要epoll_ctl；没有等待者时到达的就绪通知被锁存
+// 多reactor：工作线程创建的定时器在这个工作线程上到期，其他线程重设的定时器要唤醒它所属的工作线程
+TEST(MultiReactorTest, PerWorkerTimers)
+{
+    auto multi_reactor = Config::Lookup<bool>("io.multi_reactor");
+    auto cleanup = utils::GenScopeGuard([&]() {
+        multi_reactor->setValue(false);
+    });
+    multi_reactor->setValue(true);
+    IOManager iom(2, false);
+    iom.start();
+    const int n = 20;
+    std::atomic_int fired{0}, expired{0}, mismatched{0};
+    std::atomic_int long_fired{0};
+    Timer::sptr long_timer;
+    std::atomic_bool long_added{false};
+    // 用户定时器的回调在协程中执行，可能被其他工作线程窃取；内部超时的回调在处理该定时器队列的工作线程上直接执行，用它检查定时器留在了添加它的工作线程上
+    struct Probe
+    {
+        uint32_t creator = 0;
+        std::atomic_int *expired = nullptr;
+        std::atomic_int *mismatched = nullptr;
+    };
+    std::vector<Probe> probes(n);
+    std::vector<std::unique_ptr<Timeout>> timeouts;
+    for (auto &probe : probes) {
+        probe.expired = &expired;
+        probe.mismatched = &mismatched;
+        timeouts.push_back(std::make_unique<Timeout>(
+            [](void *arg) {
+                auto probe = static_cast<Probe *>(arg);
+                if (utils::GetThreadID() != probe->creator) {
+                    ++*probe->mismatched;
+                }
+                ++*probe->expired;
+            },
+            &probe));
+    }
+    for (int i = 0; i < n; i++) {
+        iom.schedule([&, i]() {
+            probes[i].creator = utils::GetThreadID();
+            iom.addTimeout(*timeouts[i], std::chrono::milliseconds(10 + i));
+            iom.addTimer(std::chrono::milliseconds(10 + i), [&]() { ++fired; });
+            if (i == 0) {
+                long_timer = iom.addTimer(5000, [&]() { ++long_fired; });
+                long_added = true;
+            }
+        });
+    }
+    // 共享队列中的定时器
+    std::atomic_bool shared_fired{false};
+    iom.addTimer(std::chrono::milliseconds(10), [&]() { shared_fired = true; });
+    while (!long_added) {
+        ::usleep(100);
+    }
+    // 等工作线程都回到epoll_wait（超时由5s的定时器决定），再从外部线程重设
+    ::usleep(50 * 1000);
+    auto begin = std::chrono::steady_clock::now();
+    ASSERT_TRUE(long_timer->reset(20, true));
+    while (long_fired == 0 && std::chrono::steady_clock::now() - begin < std::chrono::seconds(3)) {
+        ::usleep(100);
+    }
+    EXPECT_EQ(long_fired, 1);
+    EXPECT_LT(std::chrono::steady_clock::now() - begin, std::chrono::milliseconds(1000));
+    iom.stop();
+    EXPECT_EQ(fired, n);
+    EXPECT_EQ(expired, n);
+    EXPECT_EQ(mismatched, 0);
+    EXPECT_TRUE(shared_fired);
+    for (auto &timeout : timeouts) {
+        iom.cancelTimeout(*timeout);
+    }
+}
+
+TEST(PersistentRegistrationTest, LatchReadiness)
+{
+    // 多reactor模式下从外部调度的任务能及时唤醒工作线程
+    auto multi_reactor = Config::Lookup<bool>("io.multi_reactor");
+    multi_reactor->setValue(true);
+    auto cleanup = utils::GenScopeGuard([&]() {
+        multi_reactor->setValue(false);
+    });
+    IOManager iom(1, false);
+    iom.start();
+    int fds[2];
+    ASSERT_EQ(::pipe2(fds, O_NONBLOCK), 0);
+    std::atomic_int fired{0};
+    auto subscribe = [&]() {
+        std::atomic_bool done{false};
+        iom.schedule([&]() {
+            EXPECT_TRUE(iom.subscribeEvent(fds[0], FdContext::Read, [&]() {
+                ++fired;
+            }));
+            done = true;
+        });
+        while (!done) {
+            ::usleep(1000);
+        }
+    };
+    const auto before = iom.getIOStats();
+    char c;
+    for (int i = 0; i < 10; i++) {
+        subscribe();
+        ASSERT_EQ(::write(fds[1], "x", 1), 1);
+        while (fired < i + 1) {
+            ::usleep(1000);
+        }
+        ASSERT_EQ(::read(fds[0], &c, 1), 1);
+    }
+    EXPECT_EQ(iom.getIOStats().epollCtls - before.epollCtls, 1u);
+
+    // 就绪通知先于监听到达，监听时立即触发
+    ASSERT_EQ(::write(fds[1], "x", 1), 1);
+    ::usleep(50 * 1000);
+    subscribe();
+    while (fired < 11) {
+        ::usleep(1000);
+    }
+    ASSERT_EQ(::read(fds[0], &c, 1), 1);
+    // 锁存的通知只能消费一次
+    subscribe();
+    ::usleep(50 * 1000);
+    EXPECT_EQ(fired, 11);
+    EXPECT_TRUE(iom.unsubscribeEvent(fds[0], FdContext::Read));
+
+    // fd关闭时才从epoll中移除，不在工作线程上关闭也一样
+    ::close(fds[0]);
+    EXPECT_EQ(iom.getIOStats().epollCtls - before.epollCtls, 2u);
+    ::close(fds[1]);
+    iom.stop();
+}
+
+// 从外部调度的任务要及时唤醒阻塞在epoll_wait上的工作线程（而不是等到epoll_wait超时），且每个任务只唤醒一次
+TEST(WakeupTest, ScheduleFromOutside)
+{
+    auto multi_reactor = Config::Lookup<bool>("io.multi_reactor");
+    auto cleanup = utils::GenScopeGuard([&]() {
+        multi_reactor->setValue(false);
+    });
+    for (bool multi : {false, true}) {
+        multi_reactor->setValue(multi);
+        IOManager iom(2, false);
+        iom.start();
+        const int rounds = 10;
+        uint64_t wakeups = 0;
+        for (int i = 0; i < rounds; i++) {
+            // 等工作线程都回到epoll_wait
+            ::usleep(20 * 1000);
+            const auto before = iom.getIOStats();
+            std::atomic_bool done{false};
+            auto begin = std::chrono::steady_clock::now();
+            iom.schedule([&]() {
+                done = true;
+            });
+            while (!done) {
+                ::usleep(100);
+            }
+            EXPECT_LT(std::chrono::steady_clock::now() - begin, std::chrono::milliseconds(500)) << "multi_reactor=" << multi;
+            wakeups += iom.getIOStats().wakeups - before.wakeups;
+        }
+        // 一次唤醒是写一次、读一次eventfd
+        EXPECT_GE(wakeups, 2u);
+        EXPECT_LE(wakeups, 2u * rounds) << "multi_reactor=" << multi;
+        iom.stop();
+    }
+}
+
+// 忙轮询的工作线程在轮询期间自己发现新任务，不需要eventfd唤醒；用完轮询时间后才阻塞
+TEST(BusyPollTest, SpinBeforeBlocking)
+{
+    auto multi_reactor = Config::Lookup<bool>("io.multi_reactor");
+    multi_reactor->setValue(true);
+    auto cleanup = utils::GenScopeGuard([&]() {
+        multi_reactor->setValue(false);
+    });
+    IOManager iom(1, false);
+    IOManager::BusyPollOptions options;
+    options.budgetUs = 300 * 1000;
+    iom.setBusyPoll(options);
+    iom.start();
+    auto run_task = [&]() {
+        std::atomic_bool done{false};
+        iom.schedule([&]() {
+            done = true;
+        });
+        while (!done) {
+            ::usleep(100);
+        }
+    };
+    run_task();
+    // 轮询期间：先让出CPU，保证工作线程在新任务到来前已经空转过（单核机器上否则可能直接发现任务）
+    auto before = iom.getIOStats();
+    ::usleep(1000);
+    run_task();
+    auto after = iom.getIOStats();
+    EXPECT_EQ(after.wakeups - before.wakeups, 0u);
+    EXPECT_GT(after.epollWaits - before.epollWaits, 0u);
+    // 用完轮询时间之后
+    ::usleep(500 * 1000);
+    before = iom.getIOStats();
+    run_task();
+    after = iom.getIOStats();
+    EXPECT_EQ(after.wakeups - before.wakeups, 2u);
+    iom.stop();
+}
+
 int main(int argc, char *argv[])
 {
     Application app;
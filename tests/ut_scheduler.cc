@@ -1,6 +1,8 @@
 #include <gtest/gtest.h>
+#include <set>
 
 #include "application.h"
+#include "config.h"
 #include "scheduler.h"
 
 using namespace meha;
@@ -49,6 +51,480 @@ TEST(TEST_CASE, ScheduleTaskNotUseCaller)
     sc.stop();
 }
 
+// 可调用对象任务复用工作线程缓存的已结束协程
+TEST(TEST_CASE, RecycleTaskFiber)
+{
+    constexpr int kTasks = 100;
+    std::vector<int64_t> fids;
+    Scheduler sc(1, true);
+    sc.start();
+    for (int i = 0; i < kTasks; i++) {
+        sc.schedule([&fids]() {
+            fids.push_back(Fiber::GetCurrentID());
+        });
+    }
+    // 会yield的任务在结束后同样可以回收
+    sc.schedule([&fids]() {
+        Fiber::Yield();
+        fids.push_back(Fiber::GetCurrentID());
+    });
+    sc.stop();
+    ASSERT_EQ(fids.size(), kTasks + 1);
+    // 任务依次执行，因此始终复用同一个协程
+    for (auto fid : fids) {
+        EXPECT_EQ(fid, fids.front());
+    }
+}
+
+// 内联任务直接在调度协程上执行，不创建协程
+TEST(TEST_CASE, ScheduleInlineTask)
+{
+    constexpr int kTasks = 100;
+    int executed = 0;
+    Scheduler sc(1, true);
+    sc.start();
+    const uint64_t fibers = Fiber::TotalFibers();
+    for (int i = 0; i < kTasks; i++) {
+        sc.schedule(
+            [&executed]() {
+                EXPECT_TRUE(Scheduler::IsRunningInline());
+                EXPECT_EQ(Fiber::GetCurrentID(), Scheduler::GetSchedulerFiber()->fid());
+                ++executed;
+            },
+            Scheduler::Inline);
+    }
+    std::vector<Fiber::FiberFunc> batch(kTasks, [&executed]() { ++executed; });
+    sc.schedule(batch.begin(), batch.end(), Scheduler::Inline);
+    sc.stop();
+    EXPECT_EQ(executed, 2 * kTasks);
+    EXPECT_FALSE(Scheduler::IsRunningInline());
+    // 只多出了idle协程
+    EXPECT_LE(Fiber::TotalFibers(), fibers + 1);
+}
+
+// 内联任务yield会被拒绝
+TEST(TEST_CASE, InlineTaskYieldDeathTest)
+{
+    EXPECT_DEATH(
+        {
+            Scheduler sc(1, true);
+            sc.start();
+            sc.schedule([]() { Fiber::Yield(); }, Scheduler::Inline);
+            sc.stop();
+        },
+        "IsRunningInline");
+}
+
+// 任务在执行过程中继续派生子任务，两种调度策略下所有任务都恰好执行一次
+TEST(TEST_CASE, ScheduleFanOutTasks)
+{
+    constexpr int kRoots = 16;
+    constexpr int kChildren = 64;
+    for (auto strategy : {Scheduler::FCFS, Scheduler::WorkStealing}) {
+        std::atomic_int executed{0};
+        Scheduler sc(3, true, strategy);
+        EXPECT_EQ(sc.strategy(), strategy);
+        sc.start();
+        for (int i = 0; i < kRoots; i++) {
+            sc.schedule([&sc, &executed]() {
+                for (int j = 0; j < kChildren; j++) {
+                    sc.schedule([&executed]() { ++executed; });
+                }
+                ++executed;
+            });
+        }
+        sc.stop();
+        EXPECT_EQ(executed, kRoots * (kChildren + 1));
+    }
+}
+
+// 绑定了线程的任务进入该线程的邮箱，只在该线程上执行
+TEST(TEST_CASE, SchedulePinnedTasks)
+{
+    constexpr int kTasks = 100;
+    for (auto strategy : {Scheduler::FCFS, Scheduler::WorkStealing}) {
+        std::atomic_int executed{0};
+        std::atomic_int misplaced{0};
+        const pid_t caller = utils::GetThreadID();
+        Scheduler sc(3, true, strategy);
+        sc.start();
+        for (int i = 0; i < kTasks; i++) {
+            // 绑定到caller线程的任务要等到stop时才执行
+            sc.schedule(
+                [&, caller]() {
+                    misplaced += static_cast<pid_t>(utils::GetThreadID()) != caller;
+                    ++executed;
+                },
+                caller);
+            // 工作线程在任务中把子任务绑定到自己
+            sc.schedule([&sc, &executed, &misplaced]() {
+                const pid_t self = utils::GetThreadID();
+                sc.schedule(
+                    [&executed, &misplaced, self]() {
+                        misplaced += static_cast<pid_t>(utils::GetThreadID()) != self;
+                        ++executed;
+                    },
+                    self);
+            });
+        }
+        sc.stop();
+        EXPECT_EQ(executed, 2 * kTasks);
+        EXPECT_EQ(misplaced, 0);
+    }
+}
+
+// PSA：高优先级的任务先执行，同一优先级内先来先服务
+TEST(TEST_CASE, SchedulePriorityTasks)
+{
+    std::vector<int> order;
+    Scheduler sc(1, true, Scheduler::PSA);
+    ASSERT_EQ(sc.priorityLevels(), 4);
+    sc.start();
+    // 只使用caller线程时，所有任务都在stop之后才开始调度
+    for (uint32_t level : {3, 1, 2, 0, 3, 0}) {
+        sc.schedule([&order, level]() { order.push_back(level); }, Scheduler::Priority{level});
+    }
+    // 未指定优先级的任务处于中间级别
+    sc.schedule([&order]() { order.push_back(2); });
+    // 超出的级别按最低优先级处理
+    sc.schedule([&order]() { order.push_back(3); }, Scheduler::Priority{100});
+    sc.stop();
+    EXPECT_EQ(order, (std::vector<int>{0, 0, 1, 2, 2, 3, 3, 3}));
+}
+
+// PSA：等待过久的低优先级任务会被老化提升
+TEST(TEST_CASE, SchedulePriorityAging)
+{
+    auto aging = Config::Lookup<uint64_t>("scheduler.psa.aging");
+    const uint64_t aging_ms = aging->getValue();
+    aging->setValue(1);
+    std::vector<int> order;
+    {
+        Scheduler sc(1, true, Scheduler::PSA);
+        sc.start();
+        sc.schedule([&order]() { order.push_back(3); }, Scheduler::Priority{3});
+        ::usleep(20 * 1000);
+        sc.schedule([&order]() { order.push_back(0); }, Scheduler::Priority{0});
+        sc.stop();
+    }
+    aging->setValue(aging_ms);
+    EXPECT_EQ(order, (std::vector<int>{3, 0}));
+}
+
+// 批量提交的任务按提交顺序执行，多批任务之间也是先提交的先执行
+TEST(TEST_CASE, ScheduleTaskBatch)
+{
+    std::vector<int> order;
+    Scheduler sc(1, true);
+    sc.start();
+    for (int round = 0; round < 3; round++) {
+        Scheduler::TaskBatch batch;
+        for (int i = 0; i < 10; i++) {
+            batch.add([&order, n = round * 10 + i]() { order.push_back(n); });
+        }
+        ASSERT_EQ(batch.size(), 10);
+        sc.schedule(std::move(batch));
+        EXPECT_TRUE(batch.empty());
+    }
+    sc.stop();
+    ASSERT_EQ(order.size(), 30);
+    for (int i = 0; i < 30; i++) {
+        EXPECT_EQ(order[i], i);
+    }
+}
+
+// 多个线程同时批量提交，所有任务都恰好执行一次
+TEST(TEST_CASE, ScheduleTaskBatchConcurrently)
+{
+    constexpr int kProducers = 4;
+    constexpr int kBatches = 50;
+    constexpr int kTasks = 100;
+    for (auto strategy : {Scheduler::FCFS, Scheduler::PSA, Scheduler::WorkStealing}) {
+        std::atomic_int executed{0};
+        Scheduler sc(3, false, strategy);
+        sc.start();
+        std::vector<Thread::sptr> producers;
+        for (int p = 0; p < kProducers; p++) {
+            producers.emplace_back(std::make_shared<Thread>([&sc, &executed]() {
+                for (int b = 0; b < kBatches; b++) {
+                    Scheduler::TaskBatch batch;
+                    for (int i = 0; i < kTasks; i++) {
+                        batch.add([&executed]() { ++executed; }, i % 2 ? Scheduler::Coroutine : Scheduler::Inline);
+                    }
+                    sc.schedule(std::move(batch));
+                }
+            }));
+            producers.back()->start();
+        }
+        for (auto &producer : producers) {
+            producer->join();
+        }
+        sc.stop();
+        EXPECT_EQ(executed, kProducers * kBatches * kTasks);
+    }
+}
+
+// 按配置把工作线程绑定到CPU上
+TEST(TEST_CASE, PlaceWorkersOnCPUs)
+{
+    auto cpu_set = Config::Lookup<std::vector<int>>("scheduler.cpu_set");
+    auto numa_node = Config::Lookup<int>("scheduler.numa_node");
+    const auto node_cpus = Thread::GetNumaNodeCPUs(0);
+    if (node_cpus.empty()) {
+        GTEST_SKIP() << "系统不支持NUMA";
+    }
+    // 返回工作线程中允许运行的CPU数量与第一个CPU
+    auto run_on_workers = [](std::vector<std::pair<int, int>> &placements) {
+        Scheduler sc(2, false);
+        sc.start();
+        Mutex mutex;
+        for (int i = 0; i < 8; i++) {
+            sc.schedule([&placements, &mutex]() {
+                cpu_set_t set;
+                CPU_ZERO(&set);
+                ASSERT_EQ(::sched_getaffinity(0, sizeof(set), &set), 0);
+                int first = -1;
+                for (int cpu = 0; cpu < CPU_SETSIZE && first == -1; cpu++) {
+                    first = CPU_ISSET(cpu, &set) ? cpu : -1;
+                }
+                ScopedLock lock(&mutex);
+                placements.emplace_back(CPU_COUNT(&set), first);
+            });
+        }
+        sc.stop();
+    };
+
+    // cpu_set：每个工作线程只绑定到一个CPU上
+    cpu_set->setValue({node_cpus.front()});
+    std::vector<std::pair<int, int>> placements;
+    run_on_workers(placements);
+    cpu_set->setValue({});
+    ASSERT_EQ(placements.size(), 8);
+    for (auto &[count, first] : placements) {
+        EXPECT_EQ(count, 1);
+        EXPECT_EQ(first, node_cpus.front());
+    }
+
+    // numa_node：工作线程绑定到该节点的所有CPU上
+    numa_node->setValue(0);
+    placements.clear();
+    run_on_workers(placements);
+    numa_node->setValue(-1);
+    for (auto &[count, first] : placements) {
+        EXPECT_EQ(count, static_cast<int>(node_cpus.size()));
+        EXPECT_EQ(first, node_cpus.front());
+    }
+}
+
+// 任务积压时线程池扩容，空闲后缩回到下限
+TEST(TEST_CASE, ElasticThreadPool)
+{
+    auto max_threads = Config::Lookup<uint64_t>("scheduler.elastic.max_threads");
+    auto queue_delay = Config::Lookup<uint64_t>("scheduler.elastic.queue_delay");
+    auto idle_timeout = Config::Lookup<uint64_t>("scheduler.elastic.idle_timeout");
+    max_threads->setValue(4);
+    queue_delay->setValue(1);
+    idle_timeout->setValue(50);
+    auto cleanup = utils::GenScopeGuard([&]() {
+        max_threads->setValue(0);
+        queue_delay->setValue(5);
+        idle_timeout->setValue(30000);
+    });
+
+    Scheduler sc(2, false);
+    sc.start();
+    std::atomic_int count{0};
+    for (int i = 0; i < 32; i++) {
+        // 不让出的任务一直占着工作线程，后面的任务只能排队
+        sc.schedule([&count]() {
+            const auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(2);
+            while (std::chrono::steady_clock::now() < deadline)
+                ;
+            ++count;
+        });
+    }
+    while (count < 32) {
+        ::usleep(1000);
+    }
+    auto stats = sc.getStats();
+    EXPECT_GE(stats.grown, 1);
+    EXPECT_LE(stats.threads, 4);
+    EXPECT_EQ(stats.minThreads, 2);
+    EXPECT_EQ(stats.maxThreads, 4);
+
+    // 空闲超时后扩容的线程退出
+    for (int i = 0; i < 200 && sc.getStats().threads > 2; i++) {
+        ::usleep(10 * 1000);
+    }
+    stats = sc.getStats();
+    EXPECT_EQ(stats.threads, 2);
+    EXPECT_EQ(stats.retired, stats.grown);
+    sc.stop();
+}
+
+// 绑定到某个工作线程的任务挂起期间，该线程不会因为空闲而退出线程池；绑定到非工作线程的任务由任意工作线程执行
+TEST(TEST_CASE, RetireWithSuspendedPinnedTasks)
+{
+    auto min_threads = Config::Lookup<uint64_t>("scheduler.elastic.min_threads");
+    auto max_threads = Config::Lookup<uint64_t>("scheduler.elastic.max_threads");
+    auto idle_timeout = Config::Lookup<uint64_t>("scheduler.elastic.idle_timeout");
+    min_threads->setValue(2);
+    max_threads->setValue(4);
+    idle_timeout->setValue(50);
+    auto cleanup = utils::GenScopeGuard([&]() {
+        min_threads->setValue(0);
+        max_threads->setValue(0);
+        idle_timeout->setValue(30000);
+    });
+
+    constexpr int kWorkers = 4;
+    Scheduler sc(kWorkers, false);
+    sc.start();
+    // 让每个工作线程都执行一个任务，记下它们的线程id
+    Mutex mutex;
+    std::set<pid_t> workers;
+    for (int i = 0; i < kWorkers; i++) {
+        // 不让出的任务占着工作线程，直到所有工作线程都拿到了一个任务
+        sc.schedule([&]() {
+            const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(1);
+            ScopedLock lock(&mutex);
+            workers.insert(utils::GetThreadID());
+            while (workers.size() < kWorkers && std::chrono::steady_clock::now() < deadline) {
+                lock.unLock();
+                ::sched_yield();
+                lock.lock();
+            }
+        });
+    }
+    while (sc.getStats().pending > 0 || sc.getStats().busy > 0) {
+        ::usleep(1000);
+    }
+    ASSERT_EQ(workers.size(), kWorkers);
+
+    // 每个工作线程上挂起一个绑定到它的任务
+    std::vector<Scheduler::ResumeFunc> resumes;
+    std::atomic_int done{0};
+    for (pid_t worker : workers) {
+        sc.schedule(
+            [&]() {
+                sc.suspend([&](Scheduler::ResumeFunc resume) {
+                    ScopedLock lock(&mutex);
+                    resumes.push_back(std::move(resume));
+                });
+                ++done;
+            },
+            worker);
+    }
+    for (int i = 0; i < 1000; i++) {
+        ScopedLock lock(&mutex);
+        if (resumes.size() == kWorkers) {
+            break;
+        }
+        lock.unLock();
+        ::usleep(1000);
+    }
+    // 远超空闲超时，没有挂起的任务时会有两个工作线程退出
+    ::usleep(300 * 1000);
+    EXPECT_EQ(sc.getStats().retired, 0);
+    {
+        ScopedLock lock(&mutex);
+        ASSERT_EQ(resumes.size(), kWorkers);
+        for (auto &resume : resumes) {
+            resume();
+        }
+    }
+    for (int i = 0; i < 1000 && done < kWorkers; i++) {
+        ::usleep(1000);
+    }
+    EXPECT_EQ(done, kWorkers);
+
+    // 等空闲的工作线程退出后，绑定到已经退出的线程（以及不是工作线程的线程）的任务仍然会执行
+    for (int i = 0; i < 1000 && sc.getStats().retired == 0; i++) {
+        ::usleep(1000);
+    }
+    EXPECT_GT(sc.getStats().retired, 0);
+    std::atomic_int orphans{0};
+    for (pid_t worker : workers) {
+        sc.schedule([&]() { ++orphans; }, worker);
+    }
+    sc.schedule([&]() { ++orphans; }, static_cast<pid_t>(utils::GetThreadID()));
+    for (int i = 0; i < 1000 && orphans < kWorkers + 1; i++) {
+        ::usleep(1000);
+    }
+    EXPECT_EQ(orphans, kWorkers + 1);
+    sc.stop();
+}
+
+// 阻塞调用在阻塞调用线程池中执行，期间工作线程继续执行其他协程
+TEST(TEST_CASE, OffloadBlockingCall)
+{
+    Scheduler sc(1, false);
+    sc.start();
+    std::atomic_int result{0};
+    std::atomic_int ticks{0};
+    std::atomic_int ticks_when_done{0};
+    std::atomic<pid_t> worker{-1};
+    std::atomic<pid_t> offload_thread{-1};
+    sc.schedule([&]() {
+        worker = utils::GetThreadID();
+        result = sc.offload([&]() {
+            offload_thread = utils::GetThreadID();
+            // 阻塞调用线程池中没有开启hook，这里会阻塞线程
+            ::usleep(100 * 1000);
+            return 42;
+        });
+        ticks_when_done = ticks.load();
+        // 回到原来的调度器上恢复执行
+        EXPECT_EQ(Scheduler::GetCurrent(), &sc);
+        EXPECT_THROW(sc.offload([]() {
+            throw std::runtime_error("offload");
+        }),
+                     std::runtime_error);
+    });
+    sc.schedule([&ticks]() {
+        for (int i = 0; i < 10; i++) {
+            ++ticks;
+            Fiber::Yield();
+        }
+    });
+    // 不在协程中调用时直接执行
+    EXPECT_EQ(sc.offload([]() {
+        return utils::GetThreadID();
+    }),
+              utils::GetThreadID());
+    sc.stop();
+    EXPECT_EQ(result, 42);
+    EXPECT_NE(offload_thread, worker);
+    EXPECT_EQ(ticks_when_done, 10);
+    EXPECT_EQ(sc.getStats().suspended, 0);
+}
+
+// 共享栈协程开始运行后固定在绑定的线程上恢复执行
+TEST(TEST_CASE, ScheduleSharedStackFiber)
+{
+    constexpr int kFibers = 8;
+    std::vector<std::vector<int32_t>> tids(kFibers);
+    Scheduler sc(3, true);
+    sc.start();
+    for (int i = 0; i < kFibers; i++) {
+        sc.schedule(std::make_shared<Fiber>(
+            [&tids, i]() {
+                for (int round = 0; round < 5; round++) {
+                    tids[i].push_back(utils::GetThreadID());
+                    Fiber::Yield();
+                }
+            },
+            true, 0, Fiber::Shared));
+    }
+    sc.stop();
+    for (auto &fiber_tids : tids) {
+        ASSERT_EQ(fiber_tids.size(), 5);
+        for (auto tid : fiber_tids) {
+            EXPECT_EQ(tid, fiber_tids.front());
+        }
+    }
+}
+
 int main(int argc, char *argv[])
 {
     Application app;
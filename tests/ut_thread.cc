@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <gtest/gtest.h>
 
 #include "application.h"
@@ -66,6 +67,49 @@ TEST(TEST_CASE, ReadWriteLock)
     );
 }
 
+// 作用域锁构造时必须真正加锁，否则多个线程的累加会丢失
+TEST(TEST_CASE, ScopedLockExcludes)
+{
+    static constexpr int kThreads = 4;
+    static constexpr int kLoops = 100000;
+    static int s_count = 0;
+    s_count = 0;
+    vector<Thread::sptr> thread_list;
+    for (int i = 0; i < kThreads; i++) {
+        thread_list.push_back(make_shared<Thread>([]() {
+            for (int j = 0; j < kLoops; j++) {
+                ScopedLock lock(&s_mutex);
+                s_count = s_count + 1;
+            }
+        }));
+    }
+    for (auto &thread : thread_list) {
+        thread->start();
+    }
+    for (auto &thread : thread_list) {
+        thread->join();
+    }
+    EXPECT_EQ(s_count, kThreads * kLoops);
+}
+
+// NUMA节点按sysfs的在线列表获取，每个节点上都有CPU，节点之间的CPU不重复
+TEST(TEST_CASE, NumaNodes)
+{
+    const auto nodes = Thread::GetNumaNodes();
+    if (nodes.empty()) {
+        GTEST_SKIP() << "系统不支持NUMA";
+    }
+    EXPECT_TRUE(std::is_sorted(nodes.begin(), nodes.end()));
+    std::vector<int> all_cpus;
+    for (int node : nodes) {
+        const auto cpus = Thread::GetNumaNodeCPUs(node);
+        EXPECT_FALSE(cpus.empty()) << node;
+        all_cpus.insert(all_cpus.end(), cpus.begin(), cpus.end());
+    }
+    std::sort(all_cpus.begin(), all_cpus.end());
+    EXPECT_EQ(std::adjacent_find(all_cpus.begin(), all_cpus.end()), all_cpus.end());
+}
+
 int main(int argc, char *argv[])
 {
     Application app;
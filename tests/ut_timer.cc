@@ -0,0 +1,300 @@
+#include <atomic>
+#include <chrono>
+#include <gtest/gtest.h>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "application.h"
+#include "timer.h"
+#include "utils/clock.h"
+
+using namespace meha;
+
+class TestTimerManager : public TimerManager
+{
+public:
+    explicit TestTimerManager(size_t queues = 1)
+        : TimerManager(queues)
+    {
+    }
+
+    using TimerManager::timerCount;
+
+    int frontInserted = 0;
+    // 当前线程使用的定时器队列，-1表示共享队列
+    static thread_local int s_queue;
+
+protected:
+    void onTimerInsertedAtFront(size_t) override
+    {
+        ++frontInserted;
+    }
+    size_t currentTimerQueue() const override
+    {
+        return s_queue < 0 ? sharedTimerQueue() : s_queue;
+    }
+};
+
+thread_local int TestTimerManager::s_queue = -1;
+
+// 按 getNextTimer() 等待并取出到期的定时器，直到没有定时器
+static void RunUntilEmpty(TestTimerManager &manager)
+{
+    std::vector<Timer::TimeOutFunc> fns;
+    while (manager.hasTimer()) {
+        auto next = manager.getNextTimer();
+        if (next.count() > 0) {
+            std::this_thread::sleep_for(next);
+        }
+        fns.clear();
+        manager.listExpiredCallback(fns);
+        for (auto &fn : fns) {
+            fn();
+        }
+    }
+}
+
+// 延迟分布在时间轮的前几层（64us、4ms、262ms），每个定时器都不早于到期时间触发，也不会拖得太晚
+TEST(TimerTest, ExpireAcrossWheels)
+{
+    using namespace std::chrono;
+    TestTimerManager manager;
+    std::mt19937 rng(7);
+    const int n = 2000;
+    std::vector<steady_clock::time_point> deadlines(n), fired(n);
+    for (int i = 0; i < n; i++) {
+        const microseconds delay(rng() % 300000);
+        deadlines[i] = steady_clock::now() + delay;
+        // 不保留返回的定时器，也要能触发
+        manager.addTimer(delay, [&fired, i]() {
+            fired[i] = steady_clock::now();
+        });
+    }
+    RunUntilEmpty(manager);
+    for (int i = 0; i < n; i++) {
+        EXPECT_GE(fired[i], deadlines[i]) << i;
+        EXPECT_LT(fired[i] - deadlines[i], milliseconds(50)) << i;
+    }
+    EXPECT_EQ(manager.getNextTimer(), TimerManager::kNoTimer);
+}
+
+TEST(TimerTest, CancelAndReset)
+{
+    using namespace std::chrono;
+    TestTimerManager manager;
+    int fired = 0;
+    auto cancelled = manager.addTimer(milliseconds(5), [&]() { fired += 100; });
+    auto reset = manager.addTimer(milliseconds(500), [&]() { ++fired; });
+    auto kept = manager.addTimer(microseconds(200), [&]() { ++fired; });
+    cancelled->cancel();
+    // 已经取消的定时器不能再重设
+    EXPECT_FALSE(cancelled->reset(milliseconds(1), true));
+    EXPECT_TRUE(reset->reset(milliseconds(10), true));
+    EXPECT_LE(manager.getNextTimer(), microseconds(200));
+
+    auto begin = steady_clock::now();
+    RunUntilEmpty(manager);
+    EXPECT_EQ(fired, 2);
+    EXPECT_LT(steady_clock::now() - begin, milliseconds(400));
+    // 已经触发的定时器不能再取消
+    kept->cancel();
+    EXPECT_FALSE(manager.hasTimer());
+}
+
+TEST(TimerTest, CyclicTimer)
+{
+    using namespace std::chrono;
+    TestTimerManager manager;
+    int fired = 0;
+    Timer::sptr timer = manager.addTimer(microseconds(500), [&]() {
+        if (++fired == 5) {
+            timer->cancel();
+        }
+    }, true);
+    RunUntilEmpty(manager);
+    EXPECT_EQ(fired, 5);
+}
+
+// 新定时器比之前最早到期的还早时才通知等待的一方
+TEST(TimerTest, InsertedAtFront)
+{
+    using namespace std::chrono;
+    TestTimerManager manager;
+    auto later = manager.addTimer(seconds(10), []() {});
+    EXPECT_EQ(manager.frontInserted, 1);
+    auto latest = manager.addTimer(seconds(20), []() {});
+    EXPECT_EQ(manager.frontInserted, 1);
+    auto earlier = manager.addTimer(milliseconds(1), []() {});
+    EXPECT_EQ(manager.frontInserted, 2);
+    EXPECT_LE(manager.getNextTimer(), milliseconds(1));
+    earlier->cancel();
+    later->cancel();
+    latest->cancel();
+    EXPECT_FALSE(manager.hasTimer());
+}
+
+// 宽限内到期的定时器合并到同一个时刻：唤醒次数大大减少，每个定时器最多推迟一个宽限
+TEST(TimerTest, Slack)
+{
+    using namespace std::chrono;
+    const int n = 200;
+    const microseconds slack(8000);
+    // 每100us一个定时器（跨20ms），返回有定时器到期的轮数
+    auto run = [&](bool coalesce) {
+        TestTimerManager manager;
+        if (coalesce) {
+            manager.setTimerSlack(slack);
+        }
+        std::vector<steady_clock::time_point> deadlines(n), fired(n);
+        for (int i = 0; i < n; i++) {
+            deadlines[i] = steady_clock::now() + microseconds(100 * i);
+            manager.addTimer(microseconds(100 * i), [&fired, i]() {
+                fired[i] = steady_clock::now();
+            });
+        }
+        int batches = 0;
+        std::vector<Timer::TimeOutFunc> fns;
+        while (manager.hasTimer()) {
+            auto next = manager.getNextTimer();
+            if (next.count() > 0) {
+                std::this_thread::sleep_for(next);
+            }
+            fns.clear();
+            manager.listExpiredCallback(fns);
+            batches += !fns.empty();
+            for (auto &fn : fns) {
+                fn();
+            }
+        }
+        for (int i = 0; i < n; i++) {
+            EXPECT_GE(fired[i], deadlines[i]) << i;
+            EXPECT_LT(fired[i] - deadlines[i], (coalesce ? slack : microseconds(0)) + milliseconds(50)) << i;
+        }
+        return batches;
+    };
+    const int precise = run(false);
+    const int coalesced = run(true);
+    // 8ms的宽限下到期时刻至少按4096us对齐，全部落在28ms内，最多8个
+    EXPECT_LE(coalesced, 8);
+    EXPECT_LT(coalesced, precise);
+
+    // 单独指定宽限时不使用默认值
+    TestTimerManager manager;
+    manager.setTimerSlack(seconds(10));
+    auto begin = steady_clock::now();
+    manager.addTimer(milliseconds(1), []() {}, false, microseconds(0));
+    RunUntilEmpty(manager);
+    EXPECT_LT(steady_clock::now() - begin, milliseconds(100));
+}
+
+// 一次性超时：到期时直接执行回调，不放入回调列表；取消之后可以再次加入
+TEST(TimerTest, Timeout)
+{
+    using namespace std::chrono;
+    TestTimerManager manager;
+    int fired = 0;
+    Timeout timeout([](void *arg) { ++*static_cast<int *>(arg); }, &fired);
+    manager.addTimeout(timeout, milliseconds(500));
+    EXPECT_TRUE(manager.hasTimer());
+    EXPECT_TRUE(manager.cancelTimeout(timeout));
+    EXPECT_FALSE(manager.hasTimer());
+    // 没有加入时取消什么也不做
+    EXPECT_FALSE(manager.cancelTimeout(timeout));
+
+    manager.addTimeout(timeout, microseconds(200));
+    std::this_thread::sleep_for(milliseconds(1));
+    std::vector<Timer::TimeOutFunc> fns;
+    manager.listExpiredCallback(fns);
+    EXPECT_TRUE(fns.empty());
+    EXPECT_EQ(fired, 1);
+    EXPECT_FALSE(manager.hasTimer());
+    // 已经到期的超时取消失败，回调不会再执行
+    EXPECT_FALSE(manager.cancelTimeout(timeout));
+    EXPECT_EQ(fired, 1);
+}
+
+// 缓存时间的线程（IO工作线程）执行任务期间缓存不刷新，任务中添加的定时器仍然从真实的当前时间开始计时
+TEST(TimerTest, AddTimerWithStaleCoarseClock)
+{
+    using namespace std::chrono;
+    TestTimerManager manager;
+    utils::StartCoarseClock();
+    // 模拟任务执行了一段时间
+    std::this_thread::sleep_for(milliseconds(200));
+    bool fired = false;
+    // 定时时长远大于添加与检查之间的耗时，又小于缓存落后的时间：从缓存的时间开始计时的话，刷新之后立即到期
+    manager.addTimer(milliseconds(100), [&fired]() {
+        fired = true;
+    });
+    // 回到事件循环后刷新缓存，定时器还没有到期
+    utils::RefreshCoarseClock();
+    std::vector<Timer::TimeOutFunc> fns;
+    manager.listExpiredCallback(fns);
+    EXPECT_TRUE(fns.empty());
+    EXPECT_GT(manager.getNextTimer().count(), 0);
+    utils::StopCoarseClock();
+    RunUntilEmpty(manager);
+    for (auto &fn : fns) {
+        fn();
+    }
+    EXPECT_TRUE(fired);
+}
+
+// 定时器只在创建它的线程的队列中到期，共享队列中的定时器所有线程都能取出
+TEST(TimerTest, PerThreadQueues)
+{
+    using namespace std::chrono;
+    TestTimerManager manager(3);
+    std::atomic_int fired[2]{};
+    std::atomic_int shared_fired{0}, mismatched{0};
+    std::thread threads[2];
+    for (int i = 0; i < 2; i++) {
+        threads[i] = std::thread([&, i]() {
+            TestTimerManager::s_queue = i;
+            for (int j = 0; j < 100; j++) {
+                manager.addTimer(microseconds(100 * j), [&, i]() {
+                    if (TestTimerManager::s_queue != i) {
+                        ++mismatched;
+                    }
+                    ++fired[i];
+                });
+            }
+            EXPECT_EQ(manager.timerCount(i), 100u);
+            // 只取出自己队列中的定时器（以及共享队列中的）
+            std::vector<Timer::TimeOutFunc> fns;
+            while (fired[i] < 100) {
+                fns.clear();
+                manager.listExpiredCallback(fns);
+                for (auto &fn : fns) {
+                    fn();
+                }
+                std::this_thread::sleep_for(microseconds(100));
+            }
+        });
+    }
+    manager.addTimer(microseconds(500), [&]() { ++shared_fired; });
+    for (auto &thread : threads) {
+        thread.join();
+    }
+    EXPECT_EQ(fired[0], 100);
+    EXPECT_EQ(fired[1], 100);
+    EXPECT_EQ(mismatched, 0);
+    // 共享队列中的定时器由某个线程取出，或者在这里取出
+    RunUntilEmpty(manager);
+    EXPECT_EQ(shared_fired, 1);
+    EXPECT_FALSE(manager.hasTimer());
+}
+
+int main(int argc, char *argv[])
+{
+    Application app;
+    return app.boot(BootArgs{
+        .argc = argc,
+        .argv = argv,
+        .configFile = "/home/will/Workspace/Devs/projects/server-framework/misc/config.yml",
+        .mainFunc = [](int argc, char **argv) -> int {
+            ::testing::InitGoogleTest(&argc, argv);
+            return RUN_ALL_TESTS();
+        }});
+}